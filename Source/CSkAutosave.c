@@ -0,0 +1,285 @@
+/*
+    File:       CSkAutosave.c
+        
+    Contains:	Autosaving documents on a thread, from a snapshot of their objects
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <libkern/OSAtomic.h>
+#include "CSkAutosave.h"
+#include "CSkDocStorage.h"
+#include "CSkFileFormat.h"
+#include "CSkTrace.h"
+
+struct CSkAutosave {
+    DocStoragePtr	docStP;
+    EventLoopTimerRef	timer;
+    CSkObjectPtr*	savedObjects;	// what the document or the autosave file holds, retained
+    UInt32		savedCount;
+    CSkObjectPtr*	objects;	// the snapshot the autosave thread is writing
+    UInt32		count;
+    pthread_t		thread;
+    Boolean		threadRunning;
+    volatile Boolean	threadDone;
+    OSStatus		threadErr;
+    CFIndex		bytesWritten;
+    EventTimerInterval	writeDuration;
+    Boolean		fileExists;
+    char		path[PATH_MAX];	// empty if there is nowhere to autosave to
+    CSkAutosaveMetrics	metrics;
+};
+
+//-------------------------------------------------------------------------------------------
+// ~/Library/Application Support/CarbonSketch/Autosave/<pid>-<n>.csk
+static Boolean MakeAutosavePath(char* path, size_t size, UInt32 n)
+{
+    char    dir[PATH_MAX];
+    FSRef   folder;
+    
+    if ((FSFindFolder(kUserDomain, kApplicationSupportFolderType, kCreateFolder, &folder) != noErr)
+	    || (FSRefMakePath(&folder, (UInt8*)dir, sizeof(dir)) != noErr))
+	return false;
+    strlcat(dir, "/CarbonSketch", sizeof(dir));
+    (void)mkdir(dir, 0755);
+    strlcat(dir, "/Autosave", sizeof(dir));
+    if ((mkdir(dir, 0755) != 0) && (errno != EEXIST))
+	return false;
+    return (snprintf(path, size, "%s/%d-%u.csk", dir, (int)getpid(), (unsigned)n) < (int)size);
+}
+
+static Boolean IsSameSnapshot(const CSkObjectPtr* a, UInt32 countA, const CSkObjectPtr* b, UInt32 countB)
+{
+    return (countA == countB) && ((countA == 0) || (memcmp(a, b, countA * sizeof(CSkObjectPtr)) == 0));
+}
+
+static void DeleteAutosaveFile(CSkAutosave* autosave)
+{
+    if (autosave->fileExists)
+    {
+	(void)unlink(autosave->path);
+	autosave->fileExists = false;
+    }
+}
+
+//-------------------------------------------------------------------------------------------
+// The autosave thread. The snapshot's objects aren't changed while it holds on to them.
+static void* AutosaveThread(void* arg)
+{
+    CSkAutosave*    autosave = (CSkAutosave*)arg;
+    CFAbsoluteTime  start = CFAbsoluteTimeGetCurrent();
+    CFDataRef	    data;
+    
+    data = CSkCreateBinaryDocumentDataFromObjects(autosave->objects, autosave->count);
+    if (data != NULL)
+    {
+	autosave->bytesWritten = CFDataGetLength(data);
+	autosave->threadErr = CSkReplaceFileContents(autosave->path, data);
+	CFRelease(data);
+    }
+    else
+	autosave->threadErr = memFullErr;
+    autosave->writeDuration = CFAbsoluteTimeGetCurrent() - start;
+    
+    OSMemoryBarrier();		// the results are there before threadDone is
+    autosave->threadDone = true;
+    return NULL;
+}
+
+//-------------------------------------------------------------------------------------------
+// On the main thread, once the autosave thread is done or about to be.
+static void FinishAutosave(CSkAutosave* autosave)
+{
+    pthread_join(autosave->thread, NULL);
+    autosave->threadRunning = false;
+    
+    if (autosave->threadErr == noErr)
+    {
+	ReleaseDrawObjSnapshot(autosave->savedObjects, autosave->savedCount);
+	autosave->savedObjects = autosave->objects;
+	autosave->savedCount = autosave->count;
+	autosave->fileExists = true;
+	autosave->metrics.lastDuration = autosave->writeDuration;
+	autosave->metrics.lastBytes = autosave->bytesWritten;
+	autosave->metrics.count += 1;
+#if CSK_TRACING
+	fprintf(stderr, "autosave: %u objects, %lu bytes, snapshot %.2f ms, write %.2f ms\n", 
+			(unsigned)autosave->count, (unsigned long)autosave->bytesWritten,
+			1000.0 * autosave->metrics.lastSnapshotDuration, 1000.0 * autosave->writeDuration);
+#endif
+    }
+    else
+    {
+	fprintf(stderr, "FinishAutosave: can't autosave to %s (%d)\n", autosave->path, (int)autosave->threadErr);
+	ReleaseDrawObjSnapshot(autosave->objects, autosave->count);	// try again next time
+    }
+    autosave->objects = NULL;
+    autosave->count = 0;
+}
+
+//-------------------------------------------------------------------------------------------
+static pascal void AutosaveTimerProc(EventLoopTimerRef timer, void* userData)
+{
+#pragma unused(timer)
+    (void)CSkAutosaveNow((CSkAutosave*)userData);
+}
+
+//-------------------------------------------------------------------------------------------
+// With an interval of 0, there is no timer; call CSkAutosaveNow instead.
+CSkAutosavePtr CSkAutosaveCreate(struct DocStorage* docStP, EventTimerInterval interval)
+{
+    static EventLoopTimerUPP	sTimerUPP = NULL;
+    static UInt32		sAutosaveNumber = 0;
+    CSkAutosave*		autosave = (CSkAutosave*)calloc(1, sizeof(CSkAutosave));
+    
+    if (autosave == NULL)
+	return NULL;
+    autosave->docStP = docStP;
+    autosave->metrics.interval = interval;
+    if (!MakeAutosavePath(autosave->path, sizeof(autosave->path), ++sAutosaveNumber))
+    {
+	fprintf(stderr, "CSkAutosaveCreate: no folder to autosave to\n");
+	autosave->path[0] = 0;
+    }
+    
+    if (interval > 0)
+    {
+	if (sTimerUPP == NULL)
+	    sTimerUPP = NewEventLoopTimerUPP(AutosaveTimerProc);
+	if (InstallEventLoopTimer(GetMainEventLoop(), interval, interval, sTimerUPP, autosave, &autosave->timer) != noErr)
+	    autosave->timer = NULL;
+    }
+    return autosave;
+}
+
+//-------------------------------------------------------------------------------------------
+void CSkAutosaveRelease(CSkAutosavePtr autosave)
+{
+    if (autosave == NULL)
+	return;
+    if (autosave->timer != NULL)
+	RemoveEventLoopTimer(autosave->timer);
+    CSkAutosaveWait(autosave);
+    DeleteAutosaveFile(autosave);
+    ReleaseDrawObjSnapshot(autosave->savedObjects, autosave->savedCount);
+    free(autosave);
+}
+
+//-------------------------------------------------------------------------------------------
+void CSkAutosaveDocumentSaved(CSkAutosavePtr autosave)
+{
+    if (autosave == NULL)
+	return;
+    CSkAutosaveWait(autosave);
+    DeleteAutosaveFile(autosave);
+    ReleaseDrawObjSnapshot(autosave->savedObjects, autosave->savedCount);
+    autosave->savedObjects = CreateDrawObjSnapshot(&autosave->docStP->objList, &autosave->savedCount);
+}
+
+//-------------------------------------------------------------------------------------------
+// The main thread's part: one pass over the object list, retaining each object.
+Boolean CSkAutosaveNow(CSkAutosavePtr autosave)
+{
+    DocStoragePtr   docStP = autosave->docStP;
+    CSkObjectPtr*   objects;
+    UInt32	    count;
+    CFAbsoluteTime  start;
+    int		    status;
+    CSK_TRACE_SPAN("CSkAutosaveNow");
+    
+    if (autosave->threadRunning)
+    {
+	if (!autosave->threadDone)
+	{
+	    autosave->metrics.skipped += 1;	    // still writing the last one
+	    return false;
+	}
+	FinishAutosave(autosave);
+    }
+    if (docStP->isTracking)
+    {
+	autosave->metrics.skipped += 1;
+	return false;
+    }
+    if ((docStP->mappedDoc != NULL) || (autosave->path[0] == 0))
+	return false;
+	
+    start = CFAbsoluteTimeGetCurrent();
+    objects = CreateDrawObjSnapshot(&docStP->objList, &count);
+    autosave->metrics.lastSnapshotDuration = CFAbsoluteTimeGetCurrent() - start;
+    if ((objects == NULL) && (docStP->objList.firstItem != NULL))
+	return false;			    // out of memory
+    if (IsSameSnapshot(objects, count, autosave->savedObjects, autosave->savedCount))
+    {
+	ReleaseDrawObjSnapshot(objects, count);	    // nothing changed
+	return false;
+    }
+    
+    autosave->objects = objects;
+    autosave->count = count;
+    autosave->threadDone = false;
+    status = pthread_create(&autosave->thread, NULL, AutosaveThread, autosave);
+    if (status != 0)
+    {
+	fprintf(stderr, "CSkAutosaveNow: can't start the autosave thread (%s)\n", strerror(status));
+	ReleaseDrawObjSnapshot(objects, count);
+	autosave->objects = NULL;
+	autosave->count = 0;
+	return false;
+    }
+    autosave->threadRunning = true;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------
+void CSkAutosaveWait(CSkAutosavePtr autosave)
+{
+    if (autosave->threadRunning)
+	FinishAutosave(autosave);
+}
+
+//-------------------------------------------------------------------------------------------
+void CSkAutosaveGetMetrics(const CSkAutosave* autosave, CSkAutosaveMetrics* outMetrics)
+{
+    *outMetrics = autosave->metrics;
+}
@@ -0,0 +1,88 @@
+/*
+    File:       CSkAutosave.h
+        
+    Contains:	Autosaving documents on a thread, from a snapshot of their objects
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#ifndef __CSKAUTOSAVE__
+#define __CSKAUTOSAVE__
+
+#include <Carbon/Carbon.h>
+
+struct DocStorage;
+
+enum {
+    kCSkDefaultAutosaveInterval	= 30	    // seconds
+};
+
+// Every interval, a document that changed since it was last saved or autosaved is written
+// to a file of its own in ~/Library/Application Support/CarbonSketch/Autosave. The main
+// thread only takes a snapshot of the object list: an array of retained object pointers.
+// Objects are copied when they are changed while a snapshot holds on to them (see
+// CSkObjectMakeWritable); a thread writes the snapshot out meanwhile.
+// Nothing is autosaved while the mouse is being tracked, or while a mapped document
+// still has objects on disk only.
+typedef struct CSkAutosave CSkAutosave, *CSkAutosavePtr;
+
+struct CSkAutosaveMetrics {
+    EventTimerInterval	interval;
+    EventTimerInterval	lastSnapshotDuration;	// main thread
+    EventTimerInterval	lastDuration;		// autosave thread: encoding and writing
+    UInt64		lastBytes;
+    UInt32		count;			// autosaves written
+    UInt32		skipped;		// ticks skipped because of tracking or a slow autosave
+};
+typedef struct CSkAutosaveMetrics CSkAutosaveMetrics;
+
+CSkAutosavePtr	CSkAutosaveCreate(struct DocStorage* docStP, EventTimerInterval interval);
+void		CSkAutosaveRelease(CSkAutosavePtr autosave);	// also deletes the autosave file
+
+// The document is what its file holds (it was just opened or saved): the autosave file goes.
+void		CSkAutosaveDocumentSaved(CSkAutosavePtr autosave);
+
+// Takes the snapshot and starts writing it, if anything changed; the timer calls this.
+// Returns whether an autosave was started.
+Boolean		CSkAutosaveNow(CSkAutosavePtr autosave);
+void		CSkAutosaveWait(CSkAutosavePtr autosave);	// until the autosave thread is done
+
+void		CSkAutosaveGetMetrics(const CSkAutosave* autosave, CSkAutosaveMetrics* outMetrics);
+
+#endif
@@ -0,0 +1,1052 @@
+/*
+    File:       CSkBenchmark.c
+        
+    Contains:	Command line tool that times document operations on synthetic documents
+                and writes the results as JSON.
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#include <Carbon/Carbon.h>
+#include <ApplicationServices/ApplicationServices.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "CSkConstants.h"
+#include "CSkDocReader.h"
+#include "CSkDocStorage.h"
+#include "CSkFileFormat.h"
+#include "CSkMappedDoc.h"
+#include "CSkObjects.h"
+#include "CSkPasteboard.h"
+#include "CSkPDFExport.h"
+#include "CSkPDFUpdate.h"
+#include "CSkRasterExport.h"
+#include "CSkSVGExport.h"
+#include "CSkShapes.h"
+#include "CSkSnapping.h"
+#include "CSkUtils.h"
+
+// CSkBench is a command line tool that builds synthetic documents in memory and times
+// the document paths of CarbonSketch without any windows: saving and loading the
+// .csk property list, rendering the whole page or a culled viewport, hit-testing,
+// drag-selection, moving (and the feedback frames drawn and dropped for a simulated
+// drag), dragging a polygon vertex, restyling, duplicating and deleting, copying and
+// pasting the selection (as objects, and as the PDF that Copy used to put on the pasteboard), and exporting the page as SVG and as PDF. Save As PDF
+// is timed with and without the export optimizations, counting the paths painted.
+// Results go to stdout (or -o file) as JSON, one record per scenario, object count
+// and operation, with percentiles over the collected samples, so that runs can be
+// compared over time.
+// With -p, it also measures a pdf background: held in memory, and mapped from the file.
+// With -r, it exports each document as PNG and TIFF at that many dpi, in megapixels per second.
+// geometry_bytes is what the shapes take up in memory; build with CSK_COMPACT_GEOMETRY=1
+// and compare it, and render_full and render_culled, against a default build.
+//
+//   CSkBench [-n 1000,10000,100000,1000000] [-i iterations] [-h hitPoints] [-s seed]
+//            [-S scenario] [-p file.pdf] [-r dpi] [-o out.json]
+
+enum {
+    kDefaultIterations	    = 10,
+    kDefaultHitPoints	    = 1000,
+    kMaxPolygonPointsTotal  = 16000000	    // skip polygon counts that would need more points than this
+};
+
+//-------------------------------------------------------------------------------------------------------
+// A synthetic document is described by the shapes it uses, their size relative to the page
+// (small objects hardly overlap, large ones pile up), how many vertices its polygons have,
+// and how many different styles are distributed across the objects (0 = every object random).
+// A fraction of the objects can be hidden: half of them fully transparent, half off the page.
+// Another fraction can be copies of the first few objects, moved, as duplicating makes them.
+
+struct BenchScenario
+{
+    const char*	name;
+    int		shapeType;	// kUndefined: mix of all shape types
+    float	minSize;
+    float	maxSize;
+    int		polygonPoints;
+    int		numStyles;
+    float	hidden;
+    float	copies;
+};
+typedef struct BenchScenario BenchScenario;
+
+static const BenchScenario sScenarios[] =
+{
+    { "line",		kLineShape,	8,  72, 0,    0,  0,   0 },
+    { "quad",		kQuadBezier,	8,  72, 0,    0,  0,   0 },
+    { "cubic",		kCubicBezier,	8,  72, 0,    0,  0,   0 },
+    { "rect",		kRectShape,	8,  72, 0,    0,  0,   0 },
+    { "oval",		kOvalShape,	8,  72, 0,    0,  0,   0 },
+    { "rrect",		kRRectShape,	8,  72, 0,    0,  0,   0 },
+    { "polygon",	kFreePolygon,	8,  72, 16,   0,  0,   0 },
+    { "polygon-large",	kFreePolygon,	72, 288, 1000, 0, 0,   0 },
+    { "mixed-sparse",	kUndefined,	4,  24, 16,   4,  0,   0 },
+    { "mixed-dense",	kUndefined,	72, 360, 16,  32, 0,   0 },
+    { "mixed-hidden",	kUndefined,	4,  24, 16,   4,  0.2, 0 },
+    { "symbols",	kUndefined,	8,  24, 16,   0,  0,   0.9 }
+};
+static const int sNumScenarios = sizeof(sScenarios) / sizeof(BenchScenario);
+
+//-------------------------------------------------------------------------------------------------------
+// Deterministic pseudo random numbers (xorshift), so that every run builds identical documents.
+static UInt32 sRandomState = 0x2545F491;
+
+static UInt32 NextRandom(void)
+{
+    UInt32 x = sRandomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sRandomState = x;
+    return x;
+}
+
+static float RandomFloat(float lo, float hi)
+{
+    return lo + (hi - lo) * ((float)(NextRandom() & 0xFFFFFF) / (float)0x1000000);
+}
+
+static CGPoint RandomPointInRect(CGRect r)
+{
+    return CGPointMake(RandomFloat(CGRectGetMinX(r), CGRectGetMaxX(r)), RandomFloat(CGRectGetMinY(r), CGRectGetMaxY(r)));
+}
+
+//-------------------------------------------------------------------------------------------------------
+static double MachToMilliseconds(uint64_t t)
+{
+    static double sFactor = 0.0;
+    if (sFactor == 0.0)
+    {
+	mach_timebase_info_data_t tb;
+	mach_timebase_info(&tb);
+	sFactor = ((double)tb.numer / (double)tb.denom) * 1.0e-6;
+    }
+    return (double)t * sFactor;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Sample collection; percentiles are computed over the sorted samples by nearest rank.
+
+struct BenchSamples
+{
+    double*	values;
+    int		count;
+    int		capacity;
+};
+typedef struct BenchSamples BenchSamples;
+
+static void AddSample(BenchSamples* s, double ms)
+{
+    if (s->count == s->capacity)
+    {
+	s->capacity = 2 * s->capacity + 16;
+	s->values = realloc(s->values, s->capacity * sizeof(double));
+    }
+    s->values[s->count++] = ms;
+}
+
+static int CompareDoubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+static double Percentile(const BenchSamples* s, double p)
+{
+    int rank = (int)ceil(p / 100.0 * s->count) - 1;
+    if (rank < 0)
+	rank = 0;
+    if (rank >= s->count)
+	rank = s->count - 1;
+    return s->values[rank];
+}
+
+static Boolean sFirstResult = true;
+
+static void EmitResult(FILE* out, const char* scenario, int numObjects, const char* op, BenchSamples* s)
+{
+    double  sum = 0.0;
+    int	    i;
+
+    if (s->count == 0)
+	return;
+
+    qsort(s->values, s->count, sizeof(double), CompareDoubles);
+    for (i = 0; i < s->count; ++i)
+	sum += s->values[i];
+
+    fprintf(out, "%s\n    { \"scenario\": \"%s\", \"objects\": %d, \"op\": \"%s\", \"unit\": \"ms\", \"samples\": %d, "
+		 "\"min\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f }",
+		 sFirstResult ? "" : ",", scenario, numObjects, op, s->count,
+		 s->values[0], Percentile(s, 50), Percentile(s, 90), Percentile(s, 99), s->values[s->count - 1], sum / s->count);
+    fflush(out);
+    sFirstResult = false;
+    s->count = 0;	// ready for the next operation
+}
+
+static void EmitBytes(FILE* out, const char* scenario, int numObjects, const char* op, long long bytes)
+{
+    fprintf(out, "%s\n    { \"scenario\": \"%s\", \"objects\": %d, \"op\": \"%s\", \"unit\": \"bytes\", \"value\": %lld }",
+		 sFirstResult ? "" : ",", scenario, numObjects, op, bytes);
+    fflush(out);
+    sFirstResult = false;
+}
+
+static void EmitValue(FILE* out, const char* scenario, int numObjects, const char* op, const char* unit, double value)
+{
+    fprintf(out, "%s\n    { \"scenario\": \"%s\", \"objects\": %d, \"op\": \"%s\", \"unit\": \"%s\", \"value\": %.4f }",
+		 sFirstResult ? "" : ",", scenario, numObjects, op, unit, value);
+    fflush(out);
+    sFirstResult = false;
+}
+
+static void EmitFileSize(FILE* out, const char* scenario, int numObjects, const char* op, const char* path)
+{
+    struct stat st;
+
+    if (stat(path, &st) == 0)
+	EmitBytes(out, scenario, numObjects, op, (long long)st.st_size);
+}
+
+// What the shapes of the document take up, polygon points included (see CSkShapeGetStorageSize)
+static long long GetGeometryBytes(const DrawObjList* objList)
+{
+    long long	    bytes = 0;
+    CSkObjectPtr    obj;
+    
+    for (obj = objList->firstItem; obj != NULL; obj = CSkObjectGetNext(obj))
+	bytes += CSkShapeGetStorageSize(CSkObjectGetShape(obj));
+    return bytes;
+}
+
+static long long GetResidentBytes(void)
+{
+    struct task_basic_info  info;
+    mach_msg_type_number_t  count = TASK_BASIC_INFO_COUNT;
+
+    if (task_info(mach_task_self(), TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS)
+	return 0;
+    return (long long)info.resident_size;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void MakeRandomAttributes(CSkObjectAttributes* attr)
+{
+    attr->lineWidth	= (float)(1 + NextRandom() % 8);
+    attr->lineCap	= NextRandom() % 3;
+    attr->lineJoin	= NextRandom() % 3;
+    attr->lineStyle	= (NextRandom() % 4 == 0) ? kStyleDashed : kStyleSolid;
+    attr->strokeColor.r = RandomFloat(0, 1);
+    attr->strokeColor.g = RandomFloat(0, 1);
+    attr->strokeColor.b = RandomFloat(0, 1);
+    attr->strokeColor.a = RandomFloat(0.5, 1);
+    attr->fillColor.r	= RandomFloat(0, 1);
+    attr->fillColor.g	= RandomFloat(0, 1);
+    attr->fillColor.b	= RandomFloat(0, 1);
+    attr->fillColor.a	= (NextRandom() % 3 == 0) ? 0.0 : RandomFloat(0.2, 1);	// a third is stroked only
+}
+
+//-------------------------------------------------------------------------------------------------------
+static CSkShapePtr MakeRandomShape(const BenchScenario* sc, int shapeType, CGRect pageRect)
+{
+    CSkShapePtr sh	= CSkShapeCreate(shapeType);
+    float	size	= RandomFloat(sc->minSize, sc->maxSize);
+    CGPoint	origin	= RandomPointInRect(CGRectInset(pageRect, 0.5 * sc->minSize, 0.5 * sc->minSize));
+    CGRect	box	= CGRectMake(origin.x - 0.5 * size, origin.y - 0.5 * size, size, RandomFloat(0.5, 1.5) * size);
+    int		i;
+
+    switch (shapeType)
+    {
+	case kLineShape:
+	case kQuadBezier:
+	case kCubicBezier:
+	    for (i = 0; i <= shapeType; ++i)	// shapeType + 1 points, see CSkConstants.h
+		CSkShapeSetPointAtIndex(sh, RandomPointInRect(box), i);
+	    break;
+
+	case kRectShape:
+	case kOvalShape:
+	case kRRectShape:
+	    CSkShapeSetBounds(sh, box);
+	    break;
+
+	case kFreePolygon:
+	{
+	    // A star-shaped polygon around the center of box, so that large ones stay reasonably compact
+	    int	    n = sc->polygonPoints;
+	    CGPoint center = CGPointMake(CGRectGetMidX(box), CGRectGetMidY(box));
+	    for (i = 0; i < n; ++i)
+	    {
+		float angle  = 6.283185307 * i / n;
+		float radius = 0.5 * size * RandomFloat(0.3, 1.0);
+		CSkShapeAddPolygonPoint(sh, CGPointMake(center.x + radius * cos(angle), center.y + radius * sin(angle)));
+	    }
+	}
+	break;
+    }
+    return sh;
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Objects are added to the front of the list one by one, just like drawing them interactively would do.
+static void BuildDocument(DocStoragePtr docStP, const BenchScenario* sc, int numObjects)
+{
+    enum { kNumSymbols = 16 };
+    CSkObjectAttributes* styles = NULL;
+    CSkObjectPtr symbols[kNumSymbols];
+    int i;
+
+    if (sc->numStyles > 0)
+    {
+	styles = (CSkObjectAttributes*)calloc(sc->numStyles, sizeof(CSkObjectAttributes));
+	for (i = 0; i < sc->numStyles; ++i)
+	    MakeRandomAttributes(&styles[i]);
+    }
+
+    for (i = 0; i < numObjects; ++i)
+    {
+	CSkObjectAttributes attr;
+	int shapeType = sc->shapeType;
+	CGRect shapeRect = docStP->pageRect;
+
+	if ((sc->copies > 0) && (i >= kNumSymbols) && (RandomFloat(0, 1) < sc->copies))
+	{
+	    CSkObjectPtr copy = CopyDrawObject(symbols[NextRandom() % kNumSymbols]);
+	    CGRect bounds = CSkShapeGetBounds(CSkObjectGetShape(copy));
+	    CGPoint to = RandomPointInRect(docStP->pageRect);
+
+	    CSkShapeOffset(CSkObjectGetShape(copy), to.x - bounds.origin.x, to.y - bounds.origin.y);
+	    AddDrawObjToList(&docStP->objList, copy);
+	    continue;
+	}
+	if (shapeType == kUndefined)
+	    shapeType = kLineShape + NextRandom() % (kFreePolygon - kLineShape + 1);
+
+	if (styles != NULL)	// skewed towards the first styles, the way real drawings reuse a few
+	{
+	    float u = RandomFloat(0, 1);
+	    attr = styles[(int)(u * u * sc->numStyles)];
+	}
+	else
+	    MakeRandomAttributes(&attr);
+
+	if ((sc->hidden > 0) && (RandomFloat(0, 1) < sc->hidden))
+	{
+	    if (NextRandom() % 2 == 0)
+		attr.strokeColor.a = attr.fillColor.a = 0;
+	    else
+		shapeRect = CGRectOffset(shapeRect, 2 * CGRectGetWidth(shapeRect), 0);
+	}
+
+	AddDrawObjToList(&docStP->objList, CreateCSkObj(CSkObjListGetStyles(&docStP->objList), &attr, MakeRandomShape(sc, shapeType, shapeRect)));
+	if (i < kNumSymbols)
+	    symbols[i] = docStP->objList.firstItem;
+    }
+    free(styles);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static CGContextRef CreatePageBitmapContext(CGRect pageRect)
+{
+    size_t	    width	= (size_t)CGRectGetWidth(pageRect);
+    size_t	    height	= (size_t)CGRectGetHeight(pageRect);
+    size_t	    rowBytes	= 4 * width;
+    void*	    data	= calloc(rowBytes * height, 1);
+    CGContextRef    ctx		= CGBitmapContextCreate(data, width, height, 8, rowBytes,
+							GetGenericRGBColorSpace(), kCGImageAlphaPremultipliedFirst);
+    return ctx;
+}
+
+static void ReleasePageBitmapContext(CGContextRef ctx)
+{
+    void* data = CGBitmapContextGetData(ctx);
+    CGContextRelease(ctx);
+    free(data);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void ReleaseObjects(DocStoragePtr docStP)
+{
+    ReleaseDrawObjList(&docStP->objList);
+    docStP->objList.firstItem = docStP->objList.lastItem = NULL;
+}
+
+//-------------------------------------------------------------------------------------------------------
+#define TIMED(samples, statement)	\
+    do { uint64_t t0_ = mach_absolute_time(); statement; AddSample(samples, MachToMilliseconds(mach_absolute_time() - t0_)); } while (0)
+
+//-------------------------------------------------------------------------------------------------------
+// Decodes the binary document at url from memory on one thread and on all processors.
+// Both have to give the same objects; we check by encoding them again.
+static void BenchDecode(FILE* out, const char* scenario, int numObjects, int iterations, CFURLRef url, BenchSamples* samples)
+{
+    CFDataRef	data = NULL;
+    CFDataRef	encoded[2] = { NULL, NULL };
+    SInt32	errorCode;
+    int		t, i;
+
+    if (!CFURLCreateDataAndPropertiesFromResource(kCFAllocatorDefault, url, &data, NULL, NULL, &errorCode))
+	return;
+	
+    for (t = 0; t < 2; ++t)
+    {
+	int numThreads = (t == 0) ? 1 : MPProcessorsScheduled();
+	for (i = 0; i < iterations; ++i)
+	{
+	    DrawObjList objList = { NULL, NULL, NULL };
+	    TIMED(samples, CSkDecodeBinaryDocument(CFDataGetBytePtr(data), CFDataGetLength(data), &objList, numThreads, NULL));
+	    if (i == 0)
+		encoded[t] = CSkCreateBinaryDocumentData(&objList);
+	    ReleaseDrawObjList(&objList);
+	}
+	EmitResult(out, scenario, numObjects, (t == 0) ? "decode_sequential" : "decode_parallel", samples);
+    }
+    
+    if ((encoded[0] == NULL) || (encoded[1] == NULL) || !CFEqual(encoded[0], encoded[1]))
+	fprintf(stderr, "CSkBench: %s, %d objects: parallel decoding differs from sequential decoding\n", scenario, numObjects);
+    for (t = 0; t < 2; ++t)
+    {
+	if (encoded[t] != NULL)
+	    CFRelease(encoded[t]);
+    }
+    CFRelease(data);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Opens the binary document at path mapped, and paints a quarter-page viewport from it: the
+// time to first paint of a large document. Skipped for documents too small to have an index.
+static void BenchMappedOpen(FILE* out, const char* scenario, int numObjects, int iterations, const char* path,
+			    CGContextRef pageCtx, CGRect pageRect, BenchSamples* samples)
+{
+    BenchSamples    paintSamples = { NULL, 0, 0 };
+    CGRect	    viewRect = CGRectMake(0, 0, 0.5 * CGRectGetWidth(pageRect), 0.5 * CGRectGetHeight(pageRect));
+    int		    i;
+    
+    if (numObjects < kCSkIndexMinObjects)
+	return;
+    for (i = 0; i < iterations; ++i)
+    {
+	DocStoragePtr	loadStP = CreateDocumentStorage(NULL, NULL);
+	
+	TIMED(samples, loadStP->mappedDoc = CSkMappedDocOpen(path));
+	if (loadStP->mappedDoc == NULL)
+	{
+	    fprintf(stderr, "CSkBench: %s, %d objects: can't map %s\n", scenario, numObjects, path);
+	    ReleaseDocumentStorage(loadStP);
+	    DisposePtr((Ptr)loadStP);
+	    break;
+	}
+	CGContextClearRect(pageCtx, pageRect);
+	CGContextSaveGState(pageCtx);
+	CGContextClipToRect(pageCtx, viewRect);
+	TIMED(&paintSamples, DrawThePage(pageCtx, loadStP); CGContextSynchronize(pageCtx));
+	CGContextRestoreGState(pageCtx);
+	ReleaseDocumentStorage(loadStP);
+	DisposePtr((Ptr)loadStP);
+    }
+    EmitResult(out, scenario, numObjects, "open_mapped", samples);
+    EmitResult(out, scenario, numObjects, "first_paint_mapped", &paintSamples);
+    free(paintSamples.values);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void RunScenario(FILE* out, const BenchScenario* sc, int numObjects, int iterations, int hitPoints, 
+			float rasterDPI, const char* tmpPath, CFURLRef tmpURL)
+{
+    DocStoragePtr   docStP  = CreateDocumentStorage(NULL, NULL);	// no windows: only objList, pageRect and bmCtx are used
+    BenchSamples    samples = { NULL, 0, 0 };
+    CGRect	    pageRect;
+    CGContextRef    pageCtx;
+    int		    i, f;
+
+    docStP->shouldDrawGrabbers = true;
+    pageRect = docStP->pageRect;
+    pageCtx = CreatePageBitmapContext(pageRect);
+
+    // Fewer iterations for the whole-document operations on large documents; they get slow.
+    if (numObjects >= 100000)
+	iterations = (iterations + 4) / 5;
+
+    fprintf(stderr, "CSkBench: %s, %d objects\n", sc->name, numObjects);
+
+    TIMED(&samples, BuildDocument(docStP, sc, numObjects));
+    EmitResult(out, sc->name, numObjects, "build", &samples);
+    EmitBytes(out, sc->name, numObjects, "geometry_bytes", GetGeometryBytes(&docStP->objList));
+
+    // save & load, in the legacy XML property list format and in the binary format
+    for (f = 0; f < 2; ++f)
+    {
+	int	    format = (f == 0) ? kCSkFormatXMLPropertyList : kCSkFormatBinary;
+	const char* suffix = (f == 0) ? "plist" : "binary";
+	char	    op[32];
+
+	for (i = 0; i < iterations; ++i)
+	    TIMED(&samples, CSkWriteDocumentToURL(docStP, tmpURL, format));
+	snprintf(op, sizeof(op), "save_%s", suffix);
+	EmitResult(out, sc->name, numObjects, op, &samples);
+	snprintf(op, sizeof(op), "size_%s", suffix);
+	EmitFileSize(out, sc->name, numObjects, op, tmpPath);
+
+	for (i = 0; i < iterations; ++i)
+	{
+	    DocStoragePtr loadStP = CreateDocumentStorage(NULL, NULL);
+	    TIMED(&samples, CSkReadDocumentFromURL(loadStP, tmpURL, NULL, NULL));
+	    ReleaseDocumentStorage(loadStP);
+	    DisposePtr((Ptr)loadStP);
+	}
+	snprintf(op, sizeof(op), "load_%s", suffix);
+	EmitResult(out, sc->name, numObjects, op, &samples);
+    }
+    BenchDecode(out, sc->name, numObjects, iterations, tmpURL, &samples);
+    BenchMappedOpen(out, sc->name, numObjects, iterations, tmpPath, pageCtx, pageRect, &samples);
+
+    // Save after a one-object edit appends a JRNL chunk to the binary file written above.
+    if (docStP->objList.firstItem != NULL)
+    {
+	for (i = 0; i < iterations; ++i)
+	{
+	    CSkObjectMarkChanged(docStP->objList.firstItem);
+	    TIMED(&samples, CSkSaveDocumentChanges(docStP));
+	}
+	EmitResult(out, sc->name, numObjects, "save_changes", &samples);
+    }
+
+    // rendering: whole page, and a viewport of a quarter of the page at 2x zoom
+    CSkObjListSetSelectState(&docStP->objList, false);
+    for (i = 0; i < iterations; ++i)
+    {
+	CGContextClearRect(pageCtx, pageRect);
+	TIMED(&samples, DrawThePage(pageCtx, docStP); CGContextSynchronize(pageCtx));
+    }
+    EmitResult(out, sc->name, numObjects, "render_full", &samples);
+
+    for (i = 0; i < iterations; ++i)
+    {
+	CGRect viewRect = CGRectMake(0, 0, 0.5 * CGRectGetWidth(pageRect), 0.5 * CGRectGetHeight(pageRect));
+	viewRect.origin = RandomPointInRect(CGRectMake(0, 0, viewRect.size.width, viewRect.size.height));
+
+	CGContextClearRect(pageCtx, pageRect);
+	CGContextSaveGState(pageCtx);
+	CGContextScaleCTM(pageCtx, 2.0, 2.0);
+	CGContextTranslateCTM(pageCtx, -viewRect.origin.x, -viewRect.origin.y);
+	CGContextClipToRect(pageCtx, viewRect);
+	TIMED(&samples, RenderDrawObjListInRect(pageCtx, &docStP->objList, viewRect, false); CGContextSynchronize(pageCtx));
+	CGContextRestoreGState(pageCtx);
+    }
+    EmitResult(out, sc->name, numObjects, "render_culled", &samples);
+
+    // hit-testing at random points; one sample per point
+    for (i = 0; i < hitPoints; ++i)
+    {
+	CGPoint pt = RandomPointInRect(pageRect);
+	int	grabber;
+	TIMED(&samples, DrawObjListHitTesting(&docStP->objList, docStP->bmCtx, CGAffineTransformIdentity, pt, pt, &grabber));
+    }
+    EmitResult(out, sc->name, numObjects, "hit_test", &samples);
+
+    // Snapping a dragged 72 x 36 rect, one sample per mouse move. The index is built on the
+    // first drag; from then on the list keeps it up to date, which the edits below include.
+    TIMED(&samples, CSkObjListGetSnapIndex(&docStP->objList));
+    EmitResult(out, sc->name, numObjects, "snap_index", &samples);
+    for (i = 0; i < hitPoints; ++i)
+    {
+	CGPoint pt = RandomPointInRect(pageRect);
+	TIMED(&samples, CSkSnapIndexSnapRect(docStP->objList.snapIndex, CGRectMake(pt.x, pt.y, 72, 36), kSnapDistance, docStP->gridWidth, NULL));
+    }
+    EmitResult(out, sc->name, numObjects, "snap", &samples);
+
+    // drag-select a random rect of about a quarter of the page; this selection is then
+    // moved, duplicated, and the duplicates (which are the selected ones) deleted again,
+    // so that the document keeps its size across iterations.
+    for (i = 0; i < iterations; ++i)
+    {
+	CGPoint a = RandomPointInRect(pageRect);
+	CGRect	selRect = CGRectMake(a.x, a.y, 0.5 * CGRectGetWidth(pageRect), 0.5 * CGRectGetHeight(pageRect));
+
+	TIMED(&samples, CSkObjListSetSelectState(&docStP->objList, false); CSkObjListSelectWithinRect(&docStP->objList, selRect));
+    }
+    EmitResult(out, sc->name, numObjects, "drag_select", &samples);
+
+    for (i = 0; i < iterations; ++i)
+    {
+	float dx = (i & 1) ? -9.0 : 9.0;
+	TIMED(&samples, MoveSelectedDrawObjs(&docStP->objList, dx, dx));
+    }
+    EmitResult(out, sc->name, numObjects, "move", &samples);
+
+    // Feedback for dragging the selection: a mouse move every 4 ms, and a 60 Hz frame timer that
+    // draws the latest position, as DoMouseTracking does (see CSkFramePacer). A frame that takes
+    // longer than a display frame delays the next one. One sample per frame drawn.
+    {
+	const double	kMouseMoveMs = 4.0, kFrameMs = 1000.0 / 60;
+	CSkFramePacer	pacer;
+	double		nextFrame = kFrameMs, frameEnd;
+	
+	CSkFramePacerReset(&pacer);
+	for (i = 0; i < hitPoints; ++i)
+	{
+	    for ( ; nextFrame <= i * kMouseMoveMs; nextFrame += kFrameMs)
+	    {
+		if (!CSkFramePacerTakeFrame(&pacer))
+		    continue;
+		CGContextClearRect(pageCtx, pageRect);
+		TIMED(&samples, RenderSelectedDrawObjs(pageCtx, &docStP->objList, i % 64, i % 64, 0.7); CGContextSynchronize(pageCtx));
+		frameEnd = nextFrame + samples.values[samples.count - 1];
+		while (nextFrame + kFrameMs < frameEnd)
+		    nextFrame += kFrameMs;	// ticks that fall while drawing are skipped
+	    }
+	    CSkFramePacerPost(&pacer);
+	}
+	CSkFramePacerFinish(&pacer);
+	EmitResult(out, sc->name, numObjects, "move_feedback", &samples);
+	EmitValue(out, sc->name, numObjects, "move_feedback_frames", "frames", pacer.rendered);
+	EmitValue(out, sc->name, numObjects, "move_feedback_dropped", "positions", pacer.dropped);
+    }
+
+    // dragging one vertex of the front polygon, one sample per mouse move (see CSkShapeResize)
+    if (GetDrawObjShapeType(docStP->objList.firstItem) == kFreePolygon)
+    {
+	CSkShapePtr	sh = CSkObjectGetShape(CSkObjectMakeWritable(&docStP->objList, docStP->objList.firstItem));
+	CGRect		bounds = CSkShapeGetBounds(sh);
+	int		grabber = CSkShapeGetPolygonCount(sh) / 2 + 1;
+	
+	for (i = 0; i < hitPoints; ++i)
+	{
+	    CGPoint pt = RandomPointInRect(bounds);
+	    TIMED(&samples, CSkShapeResize(sh, &grabber, pt));
+	}
+	EmitResult(out, sc->name, numObjects, "vertex_drag", &samples);
+    }
+
+    // a style change of the selection: each selected object gets its new style from the table
+    for (i = 0; i < iterations; ++i)
+	TIMED(&samples, SetStrokeAlphaOfSelecteds(&docStP->objList, (i & 1) ? 1.0 : 0.5));
+    EmitResult(out, sc->name, numObjects, "restyle", &samples);
+
+    // The main thread's part of an autosave, and a move while the autosave thread holds on to
+    // the objects: each moved object is copied first (see CSkObjectMakeWritable).
+    for (i = 0; i < iterations; ++i)
+    {
+	CSkObjectPtr*	objects;
+	UInt32		count;
+	TIMED(&samples, objects = CreateDrawObjSnapshot(&docStP->objList, &count));
+	ReleaseDrawObjSnapshot(objects, count);
+    }
+    EmitResult(out, sc->name, numObjects, "autosave_snapshot", &samples);
+
+    for (i = 0; i < iterations; ++i)
+    {
+	float		dx = (i & 1) ? -9.0 : 9.0;
+	UInt32		count;
+	CSkObjectPtr*	objects = CreateDrawObjSnapshot(&docStP->objList, &count);
+	TIMED(&samples, MoveSelectedDrawObjs(&docStP->objList, dx, dx));
+	ReleaseDrawObjSnapshot(objects, count);
+    }
+    EmitResult(out, sc->name, numObjects, "move_during_autosave", &samples);
+
+    {
+	BenchSamples deleteSamples = { NULL, 0, 0 };
+	for (i = 0; i < iterations; ++i)
+	{
+	    TIMED(&samples, DuplicateSelectedDrawObjs(&docStP->objList, docStP->dupOffset.x, docStP->dupOffset.y));
+	    TIMED(&deleteSamples, RemoveSelectedDrawObjs(&docStP->objList));
+	}
+	EmitResult(out, sc->name, numObjects, "duplicate", &samples);
+	EmitResult(out, sc->name, numObjects, "delete", &deleteSamples);
+	free(deleteSamples.values);
+    }
+
+    // Copy and Paste of a quarter of the page; the pasted objects are deleted again.
+    {
+	BenchSamples	copySamples = { NULL, 0, 0 }, pasteSamples = { NULL, 0, 0 };
+	long long	pdfBytes = 0, objectsBytes = 0;
+	CFDataRef	data;
+	
+	for (i = 0; i < iterations; ++i)
+	{
+	    CGPoint a = RandomPointInRect(pageRect);
+	    CSkObjListSetSelectState(&docStP->objList, false);
+	    CSkObjListSelectWithinRect(&docStP->objList, CGRectMake(a.x, a.y, 0.5 * CGRectGetWidth(pageRect), 0.5 * CGRectGetHeight(pageRect)));
+	    
+	    TIMED(&samples, data = CSkCreatePDFFlavorData(docStP));
+	    if (data != NULL)
+	    {
+		pdfBytes = CFDataGetLength(data);
+		CFRelease(data);
+	    }
+	    TIMED(&copySamples, data = CSkCreateObjectsFlavorData(&docStP->objList));
+	    if (data != NULL)
+	    {
+		objectsBytes = CFDataGetLength(data);
+		TIMED(&pasteSamples, CSkPasteObjectsFlavorData(docStP, data));
+		RemoveSelectedDrawObjs(&docStP->objList);
+		CFRelease(data);
+	    }
+	}
+	EmitResult(out, sc->name, numObjects, "copy_pdf", &samples);
+	EmitBytes(out, sc->name, numObjects, "copy_pdf_bytes", pdfBytes);
+	EmitResult(out, sc->name, numObjects, "copy_objects", &copySamples);
+	EmitBytes(out, sc->name, numObjects, "copy_objects_bytes", objectsBytes);
+	EmitResult(out, sc->name, numObjects, "paste_objects", &pasteSamples);
+	free(copySamples.values);
+	free(pasteSamples.values);
+    }
+
+    // The whole page as SVG, against the same page as PDF (with CSkCreatePDFFlavorData, as if
+    // nothing were selected); both are written to a file.
+    {
+	BenchSamples	svgSamples = { NULL, 0, 0 };
+	char		exportPath[256];
+	CFDataRef	data;
+	int		fd;
+	
+	CSkObjListSetSelectState(&docStP->objList, false);
+	snprintf(exportPath, sizeof(exportPath), "%s.export", tmpPath);
+	for (i = 0; i < iterations; ++i)
+	{
+	    TIMED(&svgSamples, 
+		if ((fd = open(exportPath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0)
+		{
+		    CSkWriteSVG(docStP, fd);
+		    close(fd);
+		});
+	}
+	EmitResult(out, sc->name, numObjects, "export_svg", &svgSamples);
+	EmitFileSize(out, sc->name, numObjects, "export_svg_bytes", exportPath);
+	for (i = 0; i < iterations; ++i)
+	{
+	    TIMED(&samples, 
+		if ((data = CSkCreatePDFFlavorData(docStP)) != NULL)
+		{
+		    if ((fd = open(exportPath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0)
+		    {
+			write(fd, CFDataGetBytePtr(data), CFDataGetLength(data));
+			close(fd);
+		    }
+		    CFRelease(data);
+		});
+	}
+	EmitResult(out, sc->name, numObjects, "export_pdf", &samples);
+	EmitFileSize(out, sc->name, numObjects, "export_pdf_bytes", exportPath);
+	unlink(exportPath);
+	free(svgSamples.values);
+    }
+
+    // Save As PDF, with every object drawn as it is, and optimized: invisible and off-page objects
+    // left out, and runs of them painted as one path (see CSkPageDrawerCreate).
+    {
+	static const char*  sPDFOps[2] = { "write_pdf", "write_pdf_optimized" };
+	CSkPageDrawStats    stats;
+	char		    exportPath[256], op[64];
+	CFURLRef	    exportURL;
+	
+	snprintf(exportPath, sizeof(exportPath), "%s.pdf", tmpPath);
+	exportURL = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8*)exportPath, strlen(exportPath), false);
+	for (f = 0; (f < 2) && (exportURL != NULL); ++f)
+	{
+	    UInt32  options = (f == 0) ? kCSkPageDrawAll : kCSkPageDrawOptimized;
+	    
+	    for (i = 0; i < iterations; ++i)
+		TIMED(&samples, CSkWritePDFDocument(docStP, exportURL, NULL, options, &stats));
+	    EmitResult(out, sc->name, numObjects, sPDFOps[f], &samples);
+	    snprintf(op, sizeof(op), "%s_bytes", sPDFOps[f]);
+	    EmitFileSize(out, sc->name, numObjects, op, exportPath);
+	    snprintf(op, sizeof(op), "%s_paths", sPDFOps[f]);
+	    EmitValue(out, sc->name, numObjects, op, "paths", stats.pathsPainted);
+	    if (options & kCSkPageDrawOptimized)
+		EmitValue(out, sc->name, numObjects, "write_pdf_dropped", "objects", stats.offPage + stats.invisible);
+	}
+	unlink(exportPath);
+	if (exportURL != NULL)
+	    CFRelease(exportURL);
+    }
+
+    // Update PDF: the whole file written again, without and with form XObjects for the copies
+    // of a shape, and appended to after moving the front object a little each time (see
+    // CSkPDFUpdate.h); the bytes and segments are per update.
+    {
+	BenchSamples	    appendSamples = { NULL, 0, 0 };
+	CSkPDFUpdateStats   stats = { 0 };
+	char		    exportPath[256];
+	long long	    appended = 0;
+	UInt32		    segmentsWritten = 0, numIncremental = 0;
+	Boolean		    drawGrabbers = docStP->shouldDrawGrabbers;
+	
+	docStP->shouldDrawGrabbers = false;	// as Update PDF sees the document
+	snprintf(exportPath, sizeof(exportPath), "%s.pdf", tmpPath);
+	for (i = 0; i < iterations; ++i)
+	    TIMED(&samples, CSkUpdatePDFDocument(docStP, exportPath, NULL, kCSkPDFRewrite | kCSkPDFNoForms, &stats));
+	EmitResult(out, sc->name, numObjects, "update_pdf_noforms", &samples);
+	EmitBytes(out, sc->name, numObjects, "update_pdf_noforms_bytes", stats.bytesWritten);
+	for (i = 0; i < iterations; ++i)
+	    TIMED(&samples, CSkUpdatePDFDocument(docStP, exportPath, NULL, kCSkPDFRewrite, &stats));
+	EmitResult(out, sc->name, numObjects, "update_pdf_full", &samples);
+	EmitBytes(out, sc->name, numObjects, "update_pdf_full_bytes", stats.bytesWritten);
+	EmitValue(out, sc->name, numObjects, "update_pdf_segments", "segments", stats.numSegments);
+	EmitValue(out, sc->name, numObjects, "update_pdf_forms", "forms", stats.numForms);
+	EmitValue(out, sc->name, numObjects, "update_pdf_form_placements", "objects", stats.formPlacements);
+	
+	CSkObjListSetSelectState(&docStP->objList, false);
+	SetDrawObjSelectState(docStP->objList.firstItem, true);
+	for (i = 0; i < iterations; ++i)
+	{
+	    MoveSelectedDrawObjs(&docStP->objList, 0, (i & 1) ? -1.0 : 1.0);
+	    TIMED(&appendSamples, CSkUpdatePDFDocument(docStP, exportPath, NULL, kCSkPDFUpdate, &stats));
+	    appended += stats.bytesWritten;
+	    segmentsWritten += stats.segmentsWritten;
+	    numIncremental += stats.incremental;
+	}
+	EmitResult(out, sc->name, numObjects, "update_pdf_incremental", &appendSamples);
+	EmitBytes(out, sc->name, numObjects, "update_pdf_incremental_bytes", appended / iterations);
+	EmitValue(out, sc->name, numObjects, "update_pdf_incremental_segments", "segments", (double)segmentsWritten / iterations);
+	EmitValue(out, sc->name, numObjects, "update_pdf_incremental_appended", "updates", numIncremental);
+	SetDrawObjSelectState(docStP->objList.firstItem, false);
+	docStP->shouldDrawGrabbers = drawGrabbers;
+	unlink(exportPath);
+	free(appendSamples.values);
+    }
+
+    // Raster export, once per format: it takes seconds at high resolutions.
+    if (rasterDPI > 0)
+    {
+	CSkRasterStats	stats;
+	char		rasterPath[256];
+	
+	for (f = 0; f < 2; ++f)
+	{
+	    int		format = (f == 0) ? kCSkRasterPNG : kCSkRasterTIFF;
+	    const char* suffix = (f == 0) ? "png" : "tiff";
+	    OSStatus	err;
+	    char	op[32];
+	    
+	    snprintf(rasterPath, sizeof(rasterPath), "%s.%s", tmpPath, suffix);
+	    TIMED(&samples, err = CSkExportRaster(docStP, rasterPath, format, rasterDPI, 0, &stats));
+	    if (err == noErr)
+	    {
+		snprintf(op, sizeof(op), "raster_%s", suffix);
+		EmitResult(out, sc->name, numObjects, op, &samples);
+		snprintf(op, sizeof(op), "raster_%s_mpps", suffix);
+		EmitValue(out, sc->name, numObjects, op, "MP/s", stats.megapixelsPerSecond);
+		snprintf(op, sizeof(op), "raster_%s_bytes", suffix);
+		EmitFileSize(out, sc->name, numObjects, op, rasterPath);
+		EmitBytes(out, sc->name, numObjects, "raster_buffer_bytes", (long long)stats.bufferBytes);
+	    }
+	    samples.count = 0;
+	    unlink(rasterPath);
+	}
+    }
+
+    free(samples.values);
+    ReleasePageBitmapContext(pageCtx);
+    ReleaseDocumentStorage(docStP);
+    DisposePtr((Ptr)docStP);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// A pdf background held in memory, as pasted pdfs are (and pdf files used to be), against
+// the mapped file: time to open it and draw page 1, and how much resident memory that takes
+// while the background is held.
+static void BenchPDFBackground(FILE* out, const char* pdfPath, int iterations)
+{
+    CFURLRef	    url = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8*)pdfPath, strlen(pdfPath), false);
+    CGRect	    pageRect = CGRectMake(0, 0, kDefaultDocWidth, kDefaultDocHeight);
+    CGContextRef    pageCtx = CreatePageBitmapContext(pageRect);
+    BenchSamples    samples = { NULL, 0, 0 };
+    int		    mapped, i;
+
+    fprintf(stderr, "CSkBench: pdf background %s\n", pdfPath);
+    EmitFileSize(out, "pdf", 0, "pdf_size", pdfPath);
+    for (mapped = 0; mapped < 2; ++mapped)
+    {
+	long long   before = GetResidentBytes(), grown = 0;
+
+	for (i = 0; i < iterations; ++i)
+	{
+	    CFDataRef		data = NULL;
+	    CGDataProviderRef	provider = NULL;
+	    CGPDFDocumentRef	document = NULL;
+	    uint64_t		t0 = mach_absolute_time();
+
+	    if (mapped)
+		provider = CreateMappedFileDataProvider(pdfPath);
+	    else if (CFURLCreateDataAndPropertiesFromResource(kCFAllocatorDefault, url, &data, NULL, NULL, NULL))
+		provider = CGDataProviderCreateWithData(NULL, CFDataGetBytePtr(data), CFDataGetLength(data), NULL);
+	    if (provider != NULL)
+	    {
+		document = CGPDFDocumentCreateWithProvider(provider);
+		CGDataProviderRelease(provider);
+	    }
+	    if (document != NULL)
+	    {
+		CGContextClearRect(pageCtx, pageRect);
+		DrawPDFData(pageCtx, document, 1, pageRect);
+		CGContextSynchronize(pageCtx);
+	    }
+	    AddSample(&samples, MachToMilliseconds(mach_absolute_time() - t0));
+	    if (i == 0)
+		grown = GetResidentBytes() - before;
+		
+	    if (document != NULL)
+		CGPDFDocumentRelease(document);
+	    if (data != NULL)
+		CFRelease(data);
+	}
+	EmitResult(out, "pdf", 0, mapped ? "pdf_open_draw_mapped" : "pdf_open_draw_copied", &samples);
+	EmitBytes(out, "pdf", 0, mapped ? "pdf_resident_mapped" : "pdf_resident_copied", grown);
+    }
+
+    free(samples.values);
+    ReleasePageBitmapContext(pageCtx);
+    CFRelease(url);
+}
+
+//-------------------------------------------------------------------------------------------------------
+static int ParseCounts(const char* arg, int* counts, int maxCounts)
+{
+    int n = 0;
+    while ((*arg != 0) && (n < maxCounts))
+    {
+	char* end;
+	long v = strtol(arg, &end, 10);
+	if (end == arg)
+	    break;
+	if (v > 0)
+	    counts[n++] = (int)v;
+	arg = (*end == ',') ? end + 1 : end;
+    }
+    return n;
+}
+
+static void Usage(void)
+{
+    int i;
+    fprintf(stderr, "usage: CSkBench [-n counts] [-i iterations] [-h hitPoints] [-s seed] [-S scenario] [-p file.pdf] [-r dpi] [-o out.json]\n");
+    fprintf(stderr, "scenarios:");
+    for (i = 0; i < sNumScenarios; ++i)
+	fprintf(stderr, " %s", sScenarios[i].name);
+    fprintf(stderr, "\n");
+}
+
+//-------------------------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    int		counts[16]	= { 1000, 10000, 100000, 1000000 };
+    int		numCounts	= 4;
+    int		iterations	= kDefaultIterations;
+    int		hitPoints	= kDefaultHitPoints;
+    UInt32	seed		= sRandomState;
+    const char* onlyScenario	= NULL;
+    const char* pdfPath		= NULL;
+    float	rasterDPI	= 0;
+    FILE*	out		= stdout;
+    char	tmpPath[256];
+    CFURLRef	tmpURL;
+    int		ch, s, c;
+
+    while ((ch = getopt(argc, argv, "n:i:h:s:S:p:r:o:")) != -1)
+    {
+	switch (ch)
+	{
+	    case 'n':	numCounts = ParseCounts(optarg, counts, 16);	break;
+	    case 'i':	iterations = atoi(optarg);			break;
+	    case 'h':	hitPoints = atoi(optarg);			break;
+	    case 's':	seed = (UInt32)strtoul(optarg, NULL, 0);	break;
+	    case 'S':	onlyScenario = optarg;				break;
+	    case 'p':	pdfPath = optarg;				break;
+	    case 'r':	rasterDPI = atof(optarg);			break;
+	    case 'o':
+		out = fopen(optarg, "w");
+		if (out == NULL)
+		{
+		    perror(optarg);
+		    return 1;
+		}
+		break;
+	    default:
+		Usage();
+		return 1;
+	}
+    }
+    if ((numCounts == 0) || (iterations < 1) || (hitPoints < 1) || (seed == 0) || (rasterDPI < 0))
+    {
+	Usage();
+	return 1;
+    }
+
+    snprintf(tmpPath, sizeof(tmpPath), "/tmp/CSkBench-%d.csk", (int)getpid());
+    tmpURL = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8*)tmpPath, strlen(tmpPath), false);
+
+    fprintf(out, "{\n  \"tool\": \"CSkBench\", \"version\": 2, \"seed\": %u, \"iterations\": %d, \"hitPoints\": %d,\n",
+		 (unsigned)seed, iterations, hitPoints);
+    fprintf(out, "  \"page\": { \"width\": %d, \"height\": %d },\n  \"results\": [", kDefaultDocWidth, kDefaultDocHeight);
+
+    if (pdfPath != NULL)
+	BenchPDFBackground(out, pdfPath, iterations);
+
+    for (s = 0; s < sNumScenarios; ++s)
+    {
+	const BenchScenario* sc = &sScenarios[s];
+	if ((onlyScenario != NULL) && (strcmp(onlyScenario, sc->name) != 0))
+	    continue;
+
+	for (c = 0; c < numCounts; ++c)
+	{
+	    if ((double)counts[c] * sc->polygonPoints > kMaxPolygonPointsTotal)
+	    {
+		fprintf(stderr, "CSkBench: skipping %s with %d objects (too many polygon points)\n", sc->name, counts[c]);
+		continue;
+	    }
+	    sRandomState = seed;	// same document for the same scenario and count, across runs
+	    RunScenario(out, sc, counts[c], iterations, hitPoints, rasterDPI, tmpPath, tmpURL);
+	}
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout)
+	fclose(out);
+
+    unlink(tmpPath);
+    CFRelease(tmpURL);
+    return 0;
+}
@@ -61,7 +61,8 @@ enum {
 
 
 enum {
-    kUnsupportedFileFormat	= 1    // error code range???
+    kUnsupportedFileFormat	= 1,    // error code range???
+    kBadFileFormat		= 2	// a damaged document
 };
 
 // Window controls
@@ -103,6 +104,10 @@ enum {
     kTopMargin			= 18,
     kGridWidth			= 18
 };
+
+enum {
+    kSnapDistance		= 5	// view pixels: how close an edge has to come to snap
+};
     
 // Geometry (shape) selectors
 enum {
@@ -202,6 +207,9 @@ enum
 enum
 {   
     kCmdWritePDF		= 'WPDF',
+    kCmdUpdatePDF		= 'UPDF',
+    kCmdWriteSVG		= 'WSVG',
+    kCmdCompactDocument		= 'Cmpt',
     kCmdDuplicate		= 'Dupl',
     kCmdLineWidthChanged	= 'LwCh',
     kCmdLineCapChanged		= 'LcCh',
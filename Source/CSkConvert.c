@@ -0,0 +1,669 @@
+/*
+    File:       CSkConvert.c
+        
+    Contains:	Command line batch converter of CarbonSketch documents
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#include <Carbon/Carbon.h>
+#include <ApplicationServices/ApplicationServices.h>
+#include <mach/mach_time.h>
+#include <mach-o/dyld.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "CSkConstants.h"
+#include "CSkDocReader.h"
+#include "CSkDocStorage.h"
+#include "CSkPDFUpdate.h"
+#include "CSkRasterExport.h"
+#include "CSkSVGExport.h"
+#include "CSkUtils.h"
+
+// CSkConvert is a command line tool that converts batches of .csk documents to PDF, PNG or SVG.
+// It links the document model and the rendering code, but none of the app's windows, views
+// or dialogs.
+// Each file is converted by a worker: this executable again, started with -W. Up to -j workers
+// run at once (default: one per processor). Workers are separate processes so that one that
+// takes longer than -t seconds can be killed, and one that crashes only loses its own file.
+// The summary goes to stdout (or -s file) as JSON: a record per file, in the order they are
+// done, with its status, error code and timings, and then the totals. The exit status is 0
+// if every file converted (and matched), 2 if any didn't.
+// PDFs are written by CSkUpdatePDFDocument, as the app's Save As PDF writes them, titled with
+// the name of the file the way the app titles the window; their records say how many content
+// streams were written, and how many form XObjects draw the copies of repeated shapes. With -c,
+// each one is checked against the PDF the app saved for the same document, refdir/<name>.pdf:
+// same number of pages and page boxes, and the same pixels when drawn at 72 dpi. (The bytes
+// can't be compared; every PDF file has its own creation date and ID.)
+// With -u, a PDF that an earlier run wrote is brought up to date in place instead of written
+// again: what changed is appended, or the file is written again if most of it did. The record
+// says which ("update": "incremental" or "full").
+// Raster files are rendered at -r dpi (default 72), on as many threads as the processors
+// divided among the workers.
+//
+//   CSkConvert [-f pdf|png|svg] [-r dpi] [-j jobs] [-t seconds] [-d outdir] [-c refdir] [-u] [-s summary.json] file.csk ...
+
+enum {
+    kFormatPDF		= 0,
+    kFormatPNG		= 1,
+    kFormatSVG		= 2,
+
+    kDefaultTimeout	= 300,		// seconds per file; 0 waits forever
+    kMaxResultSize	= 1024,		// a worker's part of the record
+
+    kWorkerConverted	= 0,		// worker exit status
+    kWorkerFailed	= 1,
+    kWorkerDiffers	= 2
+};
+
+static const char* sFormatNames[] = { "pdf", "png", "svg" };
+
+extern char** environ;
+
+struct ConvertOptions
+{
+    int		format;
+    float	dpi;
+    int		numThreads;	// for raster export, in each worker
+    const char* outDir;		// NULL: next to the input file
+    const char* refDir;		// NULL: no check
+    Boolean	update;		// -u: append to the PDFs written before
+};
+typedef struct ConvertOptions ConvertOptions;
+
+//-------------------------------------------------------------------------------------------------------
+static double MachToMilliseconds(uint64_t t)
+{
+    static double sFactor = 0.0;
+    if (sFactor == 0.0)
+    {
+	mach_timebase_info_data_t tb;
+	mach_timebase_info(&tb);
+	sFactor = ((double)tb.numer / (double)tb.denom) * 1.0e-6;
+    }
+    return (double)t * sFactor;
+}
+
+static void PutJSONString(FILE* out, const char* s)
+{
+    fputc('"', out);
+    for (; *s != 0; ++s)
+    {
+	unsigned char c = (unsigned char)*s;
+	if ((c == '"') || (c == '\\'))
+	    fprintf(out, "\\%c", c);
+	else if (c < 0x20)
+	    fprintf(out, "\\u%04x", c);
+	else
+	    fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// dir/name.ext for the input file inPath, dir being the input's own directory if outDir is NULL
+static Boolean MakeOutputPath(const char* inPath, const char* outDir, const char* ext, char* outPath, size_t size)
+{
+    const char* name = strrchr(inPath, '/');
+    const char* dot;
+    int		dirLength, nameLength;
+
+    name = (name != NULL) ? name + 1 : inPath;
+    dot = strrchr(name, '.');
+    nameLength = (dot != NULL) ? (int)(dot - name) : (int)strlen(name);
+    if (outDir != NULL)
+	return snprintf(outPath, size, "%s/%.*s.%s", outDir, nameLength, name, ext) < (int)size;
+
+    dirLength = (int)(name - inPath);
+    return snprintf(outPath, size, "%.*s%.*s.%s", dirLength, inPath, nameLength, name, ext) < (int)size;
+}
+
+static CFURLRef CreateURLWithPath(const char* path)
+{
+    return CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8*)path, strlen(path), false);
+}
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------------------
+// Draws the page into a bitmap of its media box, on white; NULL if it can't be allocated.
+static CGContextRef CreatePDFPageBitmap(CGPDFPageRef page)
+{
+    CGRect	    box	    = CGPDFPageGetBoxRect(page, kCGPDFMediaBox);
+    size_t	    width   = (size_t)ceil(CGRectGetWidth(box));
+    size_t	    height  = (size_t)ceil(CGRectGetHeight(box));
+    void*	    data    = calloc(4 * width * height, 1);
+    CGContextRef    ctx	    = NULL;
+
+    if (data != NULL)
+	ctx = CGBitmapContextCreate(data, width, height, 8, 4 * width, GetGenericRGBColorSpace(), kCGImageAlphaPremultipliedFirst);
+    if (ctx == NULL)
+    {
+	free(data);
+	return NULL;
+    }
+    CGContextSetRGBFillColor(ctx, 1, 1, 1, 1);
+    CGContextFillRect(ctx, CGRectMake(0, 0, width, height));
+    CGContextDrawPDFPage(ctx, page);
+    return ctx;
+}
+
+static void ReleasePDFPageBitmap(CGContextRef ctx)
+{
+    if (ctx != NULL)
+    {
+	void* data = CGBitmapContextGetData(ctx);
+	CGContextRelease(ctx);
+	free(data);
+    }
+}
+
+// Same pages with the same media boxes, drawn to the same pixels
+static OSStatus ComparePDFDocuments(CFURLRef url, CFURLRef refURL, Boolean* outIdentical)
+{
+    CGPDFDocumentRef	doc	= CGPDFDocumentCreateWithURL(url);
+    CGPDFDocumentRef	refDoc	= CGPDFDocumentCreateWithURL(refURL);
+    OSStatus		err	= noErr;
+    size_t		numPages, pageNumber;
+
+    *outIdentical = false;
+    require_action((doc != NULL) && (refDoc != NULL), CantCompare, err = fnfErr);
+
+    numPages = CGPDFDocumentGetNumberOfPages(doc);
+    *outIdentical = (numPages == CGPDFDocumentGetNumberOfPages(refDoc));
+    for (pageNumber = 1; *outIdentical && (pageNumber <= numPages); ++pageNumber)
+    {
+	CGPDFPageRef	page	= CGPDFDocumentGetPage(doc, pageNumber);
+	CGPDFPageRef	refPage = CGPDFDocumentGetPage(refDoc, pageNumber);
+	CGContextRef	bitmap, refBitmap;
+
+	*outIdentical = CGRectEqualToRect(CGPDFPageGetBoxRect(page, kCGPDFMediaBox), CGPDFPageGetBoxRect(refPage, kCGPDFMediaBox));
+	if (!*outIdentical)
+	    break;
+
+	bitmap	  = CreatePDFPageBitmap(page);
+	refBitmap = CreatePDFPageBitmap(refPage);
+	if ((bitmap != NULL) && (refBitmap != NULL))
+	    *outIdentical = (memcmp(CGBitmapContextGetData(bitmap), CGBitmapContextGetData(refBitmap),
+				    CGBitmapContextGetBytesPerRow(bitmap) * CGBitmapContextGetHeight(bitmap)) == 0);
+	else
+	    err = memFullErr;
+	ReleasePDFPageBitmap(bitmap);
+	ReleasePDFPageBitmap(refBitmap);
+	require_noerr(err, CantCompare);
+    }
+
+CantCompare:
+    if (doc != NULL)
+	CGPDFDocumentRelease(doc);
+    if (refDoc != NULL)
+	CGPDFDocumentRelease(refDoc);
+    return err;
+}
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------------------
+// Converts one file, and prints its part of the summary record to stdout for the parent.
+static int RunWorker(const ConvertOptions* opt, const char* inPath, const char* outPath)
+{
+    DocStoragePtr   docStP	= CreateDocumentStorage(NULL, NULL);	// no windows, like CSkBench
+    CFURLRef	    inURL	= CreateURLWithPath(inPath);
+    CFURLRef	    outURL	= CreateURLWithPath(outPath);
+    double	    loadMS	= 0, convertMS = 0, verifyMS = 0;
+    const char*	    verify	= NULL;
+    CSkPDFUpdateStats updateStats = { 0 };
+    int		    status	= kWorkerFailed;
+    OSStatus	    err;
+    uint64_t	    t0;
+    struct stat	    st;
+
+    require_action((docStP != NULL) && (inURL != NULL) && (outURL != NULL), Done, err = memFullErr);
+
+    t0 = mach_absolute_time();
+    err = CSkReadDocumentFromURL(docStP, inURL, NULL, NULL);
+    loadMS = MachToMilliseconds(mach_absolute_time() - t0);
+    require_noerr(err, Done);
+
+    t0 = mach_absolute_time();
+    switch (opt->format)
+    {
+	case kFormatPDF:
+	{
+	    CFStringRef title = CFURLCopyLastPathComponent(inURL);
+	    err = CSkUpdatePDFDocument(docStP, outPath, title, opt->update ? kCSkPDFUpdate : kCSkPDFRewrite, &updateStats);
+	    if (title != NULL)
+		CFRelease(title);
+	}
+	break;
+
+	case kFormatPNG:
+	    err = CSkExportRaster(docStP, outPath, kCSkRasterPNG, opt->dpi, opt->numThreads, NULL);
+	    break;
+
+	case kFormatSVG:
+	{
+	    int fd = open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	    if (fd < 0)
+	    {
+		err = (errno == ENOENT) ? dirNFErr : ioErr;
+		break;
+	    }
+	    err = CSkWriteSVG(docStP, fd);
+	    if ((close(fd) != 0) && (err == noErr))
+		err = ioErr;
+	}
+	break;
+    }
+    convertMS = MachToMilliseconds(mach_absolute_time() - t0);
+    require_noerr(err, Done);
+    status = kWorkerConverted;
+
+    if ((opt->format == kFormatPDF) && (opt->refDir != NULL))
+    {
+	char	    refPath[PATH_MAX];
+	CFURLRef    refURL;
+	Boolean	    identical;
+
+	t0 = mach_absolute_time();
+	verify = "no reference";
+	if (MakeOutputPath(inPath, opt->refDir, "pdf", refPath, sizeof(refPath)) && ((refURL = CreateURLWithPath(refPath)) != NULL))
+	{
+	    if ((access(refPath, R_OK) == 0) && (ComparePDFDocuments(outURL, refURL, &identical) == noErr))
+		verify = identical ? "identical" : "differs";
+	    CFRelease(refURL);
+	}
+	verifyMS = MachToMilliseconds(mach_absolute_time() - t0);
+	if (strcmp(verify, "identical") != 0)
+	    status = kWorkerDiffers;
+    }
+
+Done:
+    if (err != noErr)
+	fprintf(stderr, "CSkConvert: %s: error %d\n", inPath, (int)err);
+    printf(", \"error\": %d, \"load_ms\": %.3f, \"convert_ms\": %.3f", (int)err, loadMS, convertMS);
+    if ((status != kWorkerFailed) && (stat(outPath, &st) == 0))
+	printf(", \"bytes\": %lld", (long long)st.st_size);
+    if ((status != kWorkerFailed) && (opt->format == kFormatPDF))
+	printf(", \"update\": \"%s\", \"segments\": %u, \"segments_written\": %u, \"forms\": %u", updateStats.incremental ? "incremental" : "full",
+	       (unsigned)updateStats.numSegments, (unsigned)updateStats.segmentsWritten, (unsigned)updateStats.numForms);
+    if (verify != NULL)
+	printf(", \"verify\": \"%s\", \"verify_ms\": %.3f", verify, verifyMS);
+    fflush(stdout);
+
+    if (outURL != NULL)
+	CFRelease(outURL);
+    if (inURL != NULL)
+	CFRelease(inURL);
+    if (docStP != NULL)
+    {
+	ReleaseDocumentStorage(docStP);
+	DisposePtr((Ptr)docStP);
+    }
+    return status;
+}
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------------------
+// A file being converted by a worker, whose stdout comes back through resultFD
+struct ConvertJob
+{
+    const char*	inPath;
+    char	outPath[PATH_MAX];
+    pid_t	pid;
+    int		resultFD;
+    char	result[kMaxResultSize];
+    size_t	resultLength;
+    uint64_t	startTime;
+    Boolean	timedOut;
+};
+typedef struct ConvertJob ConvertJob;
+
+struct ConvertTotals
+{
+    int		converted, failed, differs, timedOut, crashed;
+};
+typedef struct ConvertTotals ConvertTotals;
+
+static Boolean sFirstRecord = true;
+
+static void EmitRecord(FILE* out, const ConvertJob* job, const char* status)
+{
+    fprintf(out, "%s\n    { \"input\": ", sFirstRecord ? "" : ",");
+    PutJSONString(out, job->inPath);
+    fprintf(out, ", \"output\": ");
+    PutJSONString(out, job->outPath);
+    fprintf(out, ", \"status\": \"%s\", \"wall_ms\": %.3f%.*s }", status,
+		 MachToMilliseconds(mach_absolute_time() - job->startTime), (int)job->resultLength, job->result);
+    fflush(out);
+    sFirstRecord = false;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static Boolean StartJob(ConvertJob* job, const char* selfPath, char* const workerArgs[], int numWorkerArgs)
+{
+    char*			argv[20];
+    int				fds[2], i, n = 0;
+    posix_spawn_file_actions_t	actions;
+    Boolean			started;
+
+    if (pipe(fds) != 0)
+	return false;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);	    // other workers mustn't hold on to this pipe
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    argv[n++] = (char*)selfPath;
+    for (i = 0; i < numWorkerArgs; ++i)
+	argv[n++] = workerArgs[i];
+    argv[n++] = "-o";
+    argv[n++] = job->outPath;
+    argv[n++] = (char*)job->inPath;
+    argv[n] = NULL;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    job->startTime = mach_absolute_time();
+    started = (posix_spawn(&job->pid, selfPath, &actions, NULL, argv, environ) == 0);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+
+    if (!started)
+    {
+	close(fds[0]);
+	return false;
+    }
+    job->resultFD = fds[0];
+    job->resultLength = 0;
+    job->timedOut = false;
+    return true;
+}
+
+// Once its pipe is closed, the worker is gone (or about to be); it's waited for, and its record written.
+static void FinishJob(FILE* out, ConvertJob* job, ConvertTotals* totals)
+{
+    const char* status;
+    int		waitStatus;
+
+    close(job->resultFD);
+    while ((waitpid(job->pid, &waitStatus, 0) < 0) && (errno == EINTR))
+	;
+    if (job->timedOut || WIFSIGNALED(waitStatus))
+	job->resultLength = 0;	    // whatever it got to write isn't a whole record
+    if (job->timedOut)
+    {
+	status = "timeout";
+	totals->timedOut++;
+    }
+    else if (WIFSIGNALED(waitStatus))
+    {
+	status = "crashed";
+	totals->crashed++;
+    }
+    else if (WEXITSTATUS(waitStatus) == kWorkerConverted)
+    {
+	status = "converted";
+	totals->converted++;
+    }
+    else if (WEXITSTATUS(waitStatus) == kWorkerDiffers)
+    {
+	status = "differs";
+	totals->differs++;
+    }
+    else
+    {
+	status = "failed";
+	totals->failed++;
+    }
+    EmitRecord(out, job, status);
+}
+
+//-------------------------------------------------------------------------------------------------------
+// Keeps up to numJobs workers busy until every file is done. Workers are only ever waited for
+// through their pipes, with the poll timeout set to the earliest deadline.
+static void RunJobs(FILE* out, const char* selfPath, char* const workerArgs[], int numWorkerArgs,
+		    const ConvertOptions* opt, char* const files[], int numFiles, int numJobs, int timeout, ConvertTotals* totals)
+{
+    ConvertJob*	    jobs    = (ConvertJob*)calloc(numJobs, sizeof(ConvertJob));
+    struct pollfd*  fds	    = (struct pollfd*)calloc(numJobs, sizeof(struct pollfd));
+    int		    running = 0, next = 0, i;
+
+    require(jobs != NULL && fds != NULL, CantAllocate);
+
+    while ((next < numFiles) || (running > 0))
+    {
+	double	now;
+	int	wait = -1;
+
+	// Fill the free slots, and leave out the files that can't even be started.
+	while ((running < numJobs) && (next < numFiles))
+	{
+	    ConvertJob* job = &jobs[running];
+
+	    memset(job, 0, sizeof(ConvertJob));
+	    job->inPath = files[next++];
+	    job->startTime = mach_absolute_time();
+	    if (!MakeOutputPath(job->inPath, opt->outDir, sFormatNames[opt->format], job->outPath, sizeof(job->outPath)))
+	    {
+		EmitRecord(out, job, "failed");
+		totals->failed++;
+	    }
+	    else if (!StartJob(job, selfPath, workerArgs, numWorkerArgs))
+	    {
+		fprintf(stderr, "CSkConvert: can't start a worker for %s (%s)\n", job->inPath, strerror(errno));
+		EmitRecord(out, job, "failed");
+		totals->failed++;
+	    }
+	    else
+		running++;
+	}
+	if (running == 0)
+	    continue;
+
+	now = MachToMilliseconds(mach_absolute_time());
+	for (i = 0; i < running; ++i)
+	{
+	    fds[i].fd = jobs[i].resultFD;
+	    fds[i].events = POLLIN;
+	    fds[i].revents = 0;
+	    if ((timeout > 0) && !jobs[i].timedOut)
+	    {
+		double left = MachToMilliseconds(jobs[i].startTime) + 1000.0 * timeout - now;
+		int ms = (left > 0) ? (int)ceil(left) : 0;
+		if ((wait < 0) || (ms < wait))
+		    wait = ms;
+	    }
+	}
+	if ((poll(fds, running, wait) < 0) && (errno != EINTR))
+	{
+	    perror("CSkConvert: poll");
+	    break;
+	}
+
+	now = MachToMilliseconds(mach_absolute_time());
+	for (i = running - 1; i >= 0; --i)	    // backwards, so that finished jobs can be replaced by the last one
+	{
+	    ConvertJob* job = &jobs[i];
+	    Boolean	done = false;
+
+	    if (fds[i].revents != 0)
+	    {
+		char	buffer[256];
+		ssize_t n = read(job->resultFD, buffer, sizeof(buffer));
+
+		if (n > 0)
+		{
+		    size_t room = kMaxResultSize - job->resultLength;
+		    if ((size_t)n > room)
+			n = room;
+		    memcpy(job->result + job->resultLength, buffer, n);
+		    job->resultLength += n;
+		}
+		else if ((n == 0) || (errno != EINTR))
+		    done = true;
+	    }
+	    if (!done && !job->timedOut && (timeout > 0) && (now - MachToMilliseconds(job->startTime) >= 1000.0 * timeout))
+	    {
+		fprintf(stderr, "CSkConvert: %s: timed out after %d s\n", job->inPath, timeout);
+		kill(job->pid, SIGKILL);
+		job->timedOut = true;	    // its pipe closes as it goes
+	    }
+	    if (done)
+	    {
+		FinishJob(out, job, totals);
+		jobs[i] = jobs[--running];
+		fds[i] = fds[running];
+	    }
+	}
+    }
+
+CantAllocate:
+    free(fds);
+    free(jobs);
+}
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------------------
+static void Usage(void)
+{
+    fprintf(stderr, "usage: CSkConvert [-f pdf|png|svg] [-r dpi] [-j jobs] [-t seconds] [-d outdir] [-c refdir] [-u] [-s summary.json] file.csk ...\n");
+}
+
+int main(int argc, char* argv[])
+{
+    ConvertOptions  opt		= { kFormatPDF, 72, 0, NULL, NULL, false };
+    int		    numJobs	= MPProcessorsScheduled();
+    int		    timeout	= kDefaultTimeout;
+    Boolean	    isWorker	= false;
+    const char*	    outPath	= NULL;
+    FILE*	    out		= stdout;
+    ConvertTotals   totals	= { 0, 0, 0, 0, 0 };
+    char	    selfPath[PATH_MAX];
+    uint32_t	    selfPathSize = sizeof(selfPath);
+    char	    dpiArg[32], threadsArg[32];
+    char*	    workerArgs[10];
+    int		    numWorkerArgs = 0;
+    uint64_t	    t0;
+    int		    ch, numProcessors = numJobs;
+
+    while ((ch = getopt(argc, argv, "f:r:j:t:d:c:us:WT:o:")) != -1)
+    {
+	switch (ch)
+	{
+	    case 'f':
+		for (opt.format = kFormatSVG; opt.format >= kFormatPDF; --opt.format)
+		{
+		    if (strcmp(optarg, sFormatNames[opt.format]) == 0)
+			break;
+		}
+		break;
+	    case 'r':	opt.dpi = atof(optarg);		break;
+	    case 'j':	numJobs = atoi(optarg);		break;
+	    case 't':	timeout = atoi(optarg);		break;
+	    case 'd':	opt.outDir = optarg;		break;
+	    case 'c':	opt.refDir = optarg;		break;
+	    case 'u':	opt.update = true;		break;
+	    case 'W':	isWorker = true;		break;	// what the parent passes on to workers
+	    case 'T':	opt.numThreads = atoi(optarg);	break;
+	    case 'o':	outPath = optarg;		break;
+	    case 's':
+		out = fopen(optarg, "w");
+		if (out == NULL)
+		{
+		    perror(optarg);
+		    return 1;
+		}
+		break;
+	    default:
+		Usage();
+		return 1;
+	}
+    }
+    if ((opt.format < kFormatPDF) || (opt.dpi <= 0) || (numJobs < 1) || (timeout < 0) || (optind >= argc))
+    {
+	Usage();
+	return 1;
+    }
+
+    if (isWorker)
+	return (outPath != NULL) ? RunWorker(&opt, argv[optind], outPath) : kWorkerFailed;
+
+    if (_NSGetExecutablePath(selfPath, &selfPathSize) != 0)
+    {
+	fprintf(stderr, "CSkConvert: can't find its own executable\n");
+	return 1;
+    }
+    if (numJobs > argc - optind)
+	numJobs = argc - optind;
+
+    // Raster export is threaded itself; split the processors among the workers.
+    snprintf(dpiArg, sizeof(dpiArg), "%g", opt.dpi);
+    snprintf(threadsArg, sizeof(threadsArg), "%d", (numProcessors > numJobs) ? numProcessors / numJobs : 1);
+    workerArgs[numWorkerArgs++] = "-W";
+    workerArgs[numWorkerArgs++] = "-f";
+    workerArgs[numWorkerArgs++] = (char*)sFormatNames[opt.format];
+    workerArgs[numWorkerArgs++] = "-r";
+    workerArgs[numWorkerArgs++] = dpiArg;
+    workerArgs[numWorkerArgs++] = "-T";
+    workerArgs[numWorkerArgs++] = threadsArg;
+    if (opt.refDir != NULL)
+    {
+	workerArgs[numWorkerArgs++] = "-c";
+	workerArgs[numWorkerArgs++] = (char*)opt.refDir;
+    }
+    if (opt.update)
+	workerArgs[numWorkerArgs++] = "-u";
+
+    fprintf(out, "{\n  \"tool\": \"CSkConvert\", \"version\": 1, \"format\": \"%s\", \"dpi\": %g, \"jobs\": %d, \"timeout\": %d,\n  \"files\": [",
+		 sFormatNames[opt.format], opt.dpi, numJobs, timeout);
+    t0 = mach_absolute_time();
+    RunJobs(out, selfPath, workerArgs, numWorkerArgs, &opt, argv + optind, argc - optind, numJobs, timeout, &totals);
+    fprintf(out, "\n  ],\n  \"totals\": { \"files\": %d, \"converted\": %d, \"failed\": %d, \"differs\": %d, \"timeout\": %d, \"crashed\": %d, \"wall_ms\": %.3f }\n}\n",
+		 argc - optind, totals.converted, totals.failed, totals.differs, totals.timedOut, totals.crashed,
+		 MachToMilliseconds(mach_absolute_time() - t0));
+    if (out != stdout)
+	fclose(out);
+
+    return (totals.converted == argc - optind) ? 0 : 2;
+}
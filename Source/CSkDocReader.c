@@ -0,0 +1,681 @@
+/*
+    File:       CSkDocReader.c
+        
+    Contains:	Streaming .csk document reader: binary and XML property list
+                documents are parsed straight into CSkObjects
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+#include <sys/stat.h>
+#include <ctype.h>
+#include <limits.h>
+#include "CSkDocReader.h"
+#include "CSkFileFormat.h"
+#include "CSkMappedDoc.h"
+#include "CSkObjects.h"
+#include "CSkAutosave.h"
+#include "CSkTrace.h"
+
+enum {
+    kReadBufferSize	    = 64 * 1024,
+    kMaxTagLength	    = 256,	// longer tags (a DOCTYPE, a comment) are read but cut short
+    kMaxTextLength	    = 1024,	// same for text; numbers and keys are short
+    kMaxNesting		    = 32,
+    kParallelDecodeMinSize  = 1024 * 1024,	// smaller binary documents decode as fast on one thread
+    kMappedOpenMinSize	    = 16 * 1024 * 1024	// larger ones are mapped, if they have an index
+};
+
+//-------------------------------------------------------------------------------------------
+// Moves what's left in the window to the start of the buffer and reads until there are
+// at least count bytes, or the file ends.
+static Boolean FillWindow(CSkReadStream* s, UInt32 count)
+{
+    if ((s->err != noErr) || (count > s->bufferSize))
+	return false;
+	
+    if (s->pos > 0)
+    {
+	memmove(s->buffer, s->buffer + s->pos, s->end - s->pos);
+	s->end -= s->pos;
+	s->pos = 0;
+    }
+    while (s->end < count)
+    {
+	CFIndex n = CFReadStreamRead(s->stream, s->buffer + s->end, s->bufferSize - s->end);
+	if (n < 0)
+	{
+	    fprintf(stderr, "CFReadStreamRead failed\n");
+	    s->err = ioErr;
+	    return false;
+	}
+	if (n == 0)
+	    return false;		    // end of file
+	    
+	s->end += n;
+	s->bytesRead += n;
+	if ((s->progressProc != NULL) && !(*s->progressProc)(s->refCon, s->bytesRead, s->totalBytes))
+	{
+	    s->err = userCanceledErr;
+	    return false;
+	}
+    }
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------
+const UInt8* CSkReadStreamPeek(CSkReadStream* s, UInt32 count)
+{
+    if ((s->end - s->pos < count) && !FillWindow(s, count))
+	return NULL;
+    return s->buffer + s->pos;
+}
+
+void CSkReadStreamConsume(CSkReadStream* s, UInt32 count)
+{
+    s->pos += count;
+}
+
+const UInt8* CSkReadStreamRead(CSkReadStream* s, UInt32 count)
+{
+    const UInt8* p = CSkReadStreamPeek(s, count);
+    if (p != NULL)
+	s->pos += count;
+    return p;
+}
+
+//-------------------------------------------------------------------------------------------
+// dest may be NULL to just step over count bytes.
+Boolean CSkReadStreamCopy(CSkReadStream* s, void* dest, UInt32 count)
+{
+    UInt8* d = (UInt8*)dest;
+    
+    while (count > 0)
+    {
+	UInt32 n;
+	if (CSkReadStreamPeek(s, 1) == NULL)
+	    return false;
+	n = s->end - s->pos;
+	if (n > count)
+	    n = count;
+	if (d != NULL)
+	{
+	    memcpy(d, s->buffer + s->pos, n);
+	    d += n;
+	}
+	s->pos += n;
+	count -= n;
+    }
+    return true;
+}
+
+Boolean CSkReadStreamSkip(CSkReadStream* s, UInt32 count)
+{
+    return CSkReadStreamCopy(s, NULL, count);
+}
+
+Boolean CSkReadStreamAtEnd(CSkReadStream* s)
+{
+    return (CSkReadStreamPeek(s, 1) == NULL) && (s->err == noErr);
+}
+
+//-------------------------------------------------------------------------------------------
+Boolean CSkReadStreamOpen(CSkReadStream* s, CFURLRef url, SInt64 offset, UInt32 bufferSize)
+{
+    CFNumberRef start = NULL;
+    
+    s->url = url;
+    s->pos = s->end = 0;
+    s->bytesRead = offset;
+    s->err = memFullErr;
+    s->bufferSize = bufferSize;
+    s->buffer = (UInt8*)NewPtr(bufferSize);
+    require(s->buffer != NULL, CantOpen);
+    
+    s->err = ioErr;
+    s->stream = CFReadStreamCreateWithFile(kCFAllocatorDefault, url);
+    require(s->stream != NULL, CantOpen);
+    if (offset > 0)
+    {
+	start = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &offset);
+	require((start != NULL) && CFReadStreamSetProperty(s->stream, kCFStreamPropertyFileCurrentOffset, start), CantOpen);
+    }
+    if (!CFReadStreamOpen(s->stream))
+    {
+	fprintf(stderr, "CFReadStreamOpen failed\n");
+	goto CantOpen;
+    }
+    s->err = noErr;
+    
+CantOpen:
+    if (start != NULL)
+	CFRelease(start);
+    return (s->err == noErr);
+}
+
+void CSkReadStreamClose(CSkReadStream* s)
+{
+    if (s->stream != NULL)
+    {
+	CFReadStreamClose(s->stream);
+	CFRelease(s->stream);
+	s->stream = NULL;
+    }
+    if (s->buffer != NULL)
+    {
+	DisposePtr((Ptr)s->buffer);
+	s->buffer = NULL;
+    }
+}
+
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------
+// Property list documents. We only need the subset of the XML plist format that
+// CFPropertyList writes, and only build CF containers for one drawing object at a time.
+
+enum {
+    kTokenEOF,
+    kTokenStart,	    // <name ...>
+    kTokenEnd,		    // </name>
+    kTokenEmpty,	    // <name/>
+    kTokenText
+};
+
+struct PlistParser {
+    CSkReadStream*  s;
+    int		    token;
+    char	    name[kMaxTagLength];
+    char	    text[kMaxTextLength];
+    Boolean	    failed;
+};
+typedef struct PlistParser PlistParser;
+
+//-------------------------------------------------------------------------------------------
+// Appends the bytes up to stopChar to buf (as much as fits) and consumes them; stopChar is
+// consumed too if consumeStop. Returns false if the file ends first.
+static Boolean ReadUntil(CSkReadStream* s, UInt8 stopChar, Boolean consumeStop, 
+			    char* buf, UInt32 bufSize, UInt32* ioLength)
+{
+    for (;;)
+    {
+	const UInt8*	p = CSkReadStreamPeek(s, 1);
+	const UInt8*	hit;
+	UInt32		n, keep;
+	
+	if (p == NULL)
+	    return false;
+	n = s->end - s->pos;
+	hit = memchr(p, stopChar, n);
+	if (hit != NULL)
+	    n = hit - p;
+	    
+	keep = (*ioLength + n < bufSize) ? n : bufSize - 1 - *ioLength;
+	memcpy(buf + *ioLength, p, keep);
+	*ioLength += keep;
+	buf[*ioLength] = 0;
+	
+	if (hit != NULL)
+	{
+	    CSkReadStreamConsume(s, consumeStop ? n + 1 : n);
+	    return true;
+	}
+	CSkReadStreamConsume(s, n);
+    }
+}
+
+//-------------------------------------------------------------------------------------------
+// Called after "<!--"; a comment may contain '>', so look for "-->".
+static Boolean SkipComment(CSkReadStream* s)
+{
+    int dashes = 0;
+    
+    for (;;)
+    {
+	const UInt8* b = CSkReadStreamRead(s, 1);
+	if (b == NULL)
+	    return false;
+	if ((*b == '>') && (dashes >= 2))
+	    return true;
+	dashes = (*b == '-') ? dashes + 1 : 0;
+    }
+}
+
+//-------------------------------------------------------------------------------------------
+static void DecodeEntities(char* text)
+{
+    static const struct { const char* entity; char c; } kEntities[] = {
+	{ "&lt;", '<' }, { "&gt;", '>' }, { "&amp;", '&' }, { "&quot;", '"' }, { "&apos;", '\'' }
+    };
+    char*   src = text;
+    char*   dst = text;
+    
+    while (*src != 0)
+    {
+	int i, n = sizeof(kEntities) / sizeof(kEntities[0]);
+	if (*src == '&')
+	{
+	    for (i = 0; i < n; ++i)
+	    {
+		size_t len = strlen(kEntities[i].entity);
+		if (strncmp(src, kEntities[i].entity, len) == 0)
+		{
+		    *dst++ = kEntities[i].c;
+		    src += len;
+		    break;
+		}
+	    }
+	    if (i < n)
+		continue;
+	}
+	*dst++ = *src++;
+    }
+    *dst = 0;
+}
+
+//-------------------------------------------------------------------------------------------
+// Leaves the next tag or non-blank text in p. Processing instructions, the DOCTYPE
+// and comments are skipped.
+static int NextToken(PlistParser* p)
+{
+    for (;;)
+    {
+	const UInt8*	b = CSkReadStreamPeek(p->s, 1);
+	UInt32		length = 0;
+	
+	if (b == NULL)
+	    return (p->token = kTokenEOF);
+	    
+	if (*b != '<')
+	{
+	    char* t;
+	    ReadUntil(p->s, '<', false, p->text, sizeof(p->text), &length);
+	    for (t = p->text; (*t != 0) && isspace(*t); ++t)
+		;
+	    if (*t == 0)
+		continue;			    // whitespace between tags
+	    DecodeEntities(p->text);
+	    return (p->token = kTokenText);
+	}
+	
+	CSkReadStreamConsume(p->s, 1);
+	b = CSkReadStreamPeek(p->s, 3);
+	if ((b != NULL) && (memcmp(b, "!--", 3) == 0))
+	{
+	    CSkReadStreamConsume(p->s, 3);
+	    if (!SkipComment(p->s))
+		return (p->token = kTokenEOF);
+	    continue;
+	}
+	if (!ReadUntil(p->s, '>', true, p->name, sizeof(p->name), &length))
+	    return (p->token = kTokenEOF);
+	if ((p->name[0] == '?') || (p->name[0] == '!'))
+	    continue;
+	    
+	if (p->name[0] == '/')
+	{
+	    memmove(p->name, p->name + 1, length);
+	    p->token = kTokenEnd;
+	}
+	else if ((length > 0) && (p->name[length - 1] == '/'))
+	{
+	    p->name[length - 1] = 0;
+	    p->token = kTokenEmpty;
+	}
+	else
+	{
+	    p->token = kTokenStart;
+	}
+	p->name[strcspn(p->name, " \t\r\n")] = 0;    // drop attributes
+	return p->token;
+    }
+}
+
+//-------------------------------------------------------------------------------------------
+// Reads the text of a <real>, <string> etc. and its end tag. Empty elements give "".
+static Boolean ReadElementText(PlistParser* p)
+{
+    char element[kMaxTagLength];
+    
+    strcpy(element, p->name);
+    if (NextToken(p) == kTokenText)
+    {
+	NextToken(p);
+    }
+    else
+    {
+	p->text[0] = 0;
+    }
+    return (p->token == kTokenEnd) && (strcmp(p->name, element) == 0);
+}
+
+//-------------------------------------------------------------------------------------------
+// Steps over the value whose start (or empty) tag is the current token.
+static Boolean SkipValue(PlistParser* p)
+{
+    int depth = (p->token == kTokenStart) ? 1 : 0;
+    
+    while (depth > 0)
+    {
+	switch (NextToken(p))
+	{
+	    case kTokenStart:	depth += 1;	break;
+	    case kTokenEnd:	depth -= 1;	break;
+	    case kTokenEOF:	return false;
+	}
+    }
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------
+// Builds the CF object for the value whose start (or empty) tag is the current token.
+// Returns NULL and sets p->failed if the value is malformed; elements we have no use
+// for (<date>, <data>) are skipped and also give NULL.
+static CFTypeRef CreateValue(PlistParser* p, int depth)
+{
+    CFTypeRef value = NULL;
+    
+    if ((p->token != kTokenStart) && (p->token != kTokenEmpty))
+	goto Malformed;
+    require(depth < kMaxNesting, Malformed);
+    
+    if (strcmp(p->name, "dict") == 0)
+    {
+	CFMutableDictionaryRef dict = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, 
+					&kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+	value = dict;
+	if (p->token == kTokenEmpty)
+	    return value;
+	    
+	while (NextToken(p) != kTokenEnd)
+	{
+	    CFStringRef key;
+	    CFTypeRef	item;
+	    
+	    require((p->token == kTokenStart) && (strcmp(p->name, "key") == 0) && ReadElementText(p), Malformed);
+	    key = CFStringCreateWithCString(kCFAllocatorDefault, p->text, kCFStringEncodingUTF8);
+	    require(key != NULL, Malformed);
+	    NextToken(p);
+	    item = CreateValue(p, depth + 1);
+	    if (item != NULL)
+	    {
+		CFDictionarySetValue(dict, key, item);
+		CFRelease(item);
+	    }
+	    CFRelease(key);
+	    if (p->failed)
+		goto Malformed;
+	}
+    }
+    else if (strcmp(p->name, "array") == 0)
+    {
+	CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+	value = array;
+	if (p->token == kTokenEmpty)
+	    return value;
+	    
+	while (NextToken(p) != kTokenEnd)
+	{
+	    CFTypeRef item = CreateValue(p, depth + 1);
+	    if (item != NULL)
+	    {
+		CFArrayAppendValue(array, item);
+		CFRelease(item);
+	    }
+	    if (p->failed)
+		goto Malformed;
+	}
+    }
+    else if ((strcmp(p->name, "true") == 0) || (strcmp(p->name, "false") == 0))
+    {
+	value = CFRetain((p->name[0] == 't') ? kCFBooleanTrue : kCFBooleanFalse);
+	require((p->token == kTokenEmpty) || ReadElementText(p), Malformed);
+    }
+    else if (strcmp(p->name, "real") == 0)
+    {
+	double d;
+	require((p->token == kTokenEmpty) || ReadElementText(p), Malformed);
+	d = (p->token == kTokenEmpty) ? 0 : strtod(p->text, NULL);
+	value = CFNumberCreate(kCFAllocatorDefault, kCFNumberDoubleType, &d);
+    }
+    else if (strcmp(p->name, "integer") == 0)
+    {
+	SInt64 n;
+	require((p->token == kTokenEmpty) || ReadElementText(p), Malformed);
+	n = (p->token == kTokenEmpty) ? 0 : strtoll(p->text, NULL, 10);
+	value = CFNumberCreate(kCFAllocatorDefault, kCFNumberSInt64Type, &n);
+    }
+    else if (strcmp(p->name, "string") == 0)
+    {
+	require((p->token == kTokenEmpty) || ReadElementText(p), Malformed);
+	value = CFStringCreateWithCString(kCFAllocatorDefault, (p->token == kTokenEmpty) ? "" : p->text, 
+					    kCFStringEncodingUTF8);
+    }
+    else
+    {
+	require(SkipValue(p), Malformed);
+    }
+    return value;
+    
+Malformed:
+    if (value != NULL)
+	CFRelease(value);
+    p->failed = true;
+    return NULL;
+}
+
+//-------------------------------------------------------------------------------------------
+// CSkCreateObjFromDict expects all of these.
+static Boolean IsObjectDict(CFTypeRef value)
+{
+    CFStringRef keys[] = { kKeyShapeType, kKeyLineWidth, kKeyLineCap, kKeyLineJoin, kKeyLineStyle, 
+			    kKeyStrokeColor, kKeyFillColor };
+    int		i;
+    
+    if ((value == NULL) || (CFGetTypeID(value) != CFDictionaryGetTypeID()))
+	return false;
+    for (i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i)
+    {
+	if (!CFDictionaryContainsKey(value, keys[i]))
+	    return false;
+    }
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------
+// <plist><dict> ... <key>objArray</key><array> one <dict> per object </array> ... </dict></plist>
+// Other document keys are skipped.
+static OSStatus ReadPropertyListDocument(CSkReadStream* s, DrawObjList* objList)
+{
+    PlistParser	    p;
+    
+    memset(&p, 0, sizeof(p));
+    p.s = s;
+    require((NextToken(&p) == kTokenStart) && (strcmp(p.name, "plist") == 0), Malformed);
+    require((NextToken(&p) == kTokenStart) && (strcmp(p.name, "dict") == 0), Malformed);
+    
+    while (NextToken(&p) != kTokenEnd)
+    {
+	CFStringRef key;
+	Boolean	    isObjArray;
+	
+	require((p.token == kTokenStart) && (strcmp(p.name, "key") == 0) && ReadElementText(&p), Malformed);
+	key = CFStringCreateWithCString(kCFAllocatorDefault, p.text, kCFStringEncodingUTF8);
+	isObjArray = (key != NULL) && CFEqual(key, kKeyObjectArray);
+	if (key != NULL)
+	    CFRelease(key);
+	    
+	NextToken(&p);
+	if (isObjArray && (p.token == kTokenStart) && (strcmp(p.name, "array") == 0))
+	{
+	    while (NextToken(&p) != kTokenEnd)
+	    {
+		CFTypeRef	objDict = CreateValue(&p, 1);
+		CSkObjectPtr	obj = IsObjectDict(objDict) ? CSkCreateObjFromDict(CSkObjListGetStyles(objList), objDict) : NULL;
+		
+		if (objDict != NULL)
+		    CFRelease(objDict);
+		require(obj != NULL, Malformed);
+		AppendDrawObjToList(objList, obj);
+	    }
+	}
+	else
+	{
+	    require((p.token == kTokenStart) || (p.token == kTokenEmpty), Malformed);
+	    require(SkipValue(&p), Malformed);
+	}
+    }
+    return noErr;
+    
+Malformed:
+    if (s->err != noErr)
+	return s->err;
+    fprintf(stderr, "ReadPropertyListDocument: damaged or not a CarbonSketch document\n");
+    return kBadFileFormat;
+}
+
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------
+// Large binary documents are read into memory in one piece (still through s, for progress
+// and cancel) and decoded on all processors.
+static OSStatus ReadBinaryDocumentParallel(CSkReadStream* s, DrawObjList* objList, CSkJournalPtr journal)
+{
+    UInt32	length = s->totalBytes;
+    UInt8*	bytes = (UInt8*)NewPtr(length);
+    OSStatus	err;
+    
+    if (bytes == NULL)
+	return memFullErr;
+    if (CSkReadStreamCopy(s, bytes, length) && CSkReadStreamAtEnd(s))
+	err = CSkDecodeBinaryDocument(bytes, length, objList, MPProcessorsScheduled(), journal);
+    else
+	err = (s->err != noErr) ? s->err : kBadFileFormat;	// or the file changed while we read it
+    DisposePtr((Ptr)bytes);
+    return err;
+}
+
+//-------------------------------------------------------------------------------------------
+// url may be NULL: the document has no file that Save can write to.
+static void SetDocumentFile(DocStoragePtr docStP, CFURLRef url, CSkJournalPtr journal)
+{
+    if (url != NULL)
+	CFRetain(url);
+    if (docStP->fileURL != NULL)
+	CFRelease(docStP->fileURL);
+    docStP->fileURL = url;
+    CSkJournalRelease(docStP->journal);
+    docStP->journal = journal;
+    CSkAutosaveDocumentSaved(docStP->autosave);
+}
+
+//-------------------------------------------------------------------------------------------
+OSStatus CSkReadDocumentFromURL(DocStoragePtr docStP, CFURLRef url, 
+				CSkReadProgressProcPtr progressProc, void* refCon)
+{
+    CSkReadStream   s;
+    DrawObjList	    objList = { NULL, NULL, NULL };
+    CSkJournalPtr   journal = NULL;
+    UInt8	    path[PATH_MAX];
+    struct stat	    sb;
+    const UInt8*    magic;
+    Boolean	    isBinary;
+    OSStatus	    err = ioErr;
+    CSK_TRACE_SPAN("CSkReadDocumentFromURL");
+    
+    memset(&s, 0, sizeof(s));
+    path[0] = 0;
+    if (CFURLGetFileSystemRepresentation(url, true, path, sizeof(path)) && (stat((char*)path, &sb) == 0))
+	s.totalBytes = sb.st_size;
+	
+    // A large indexed binary document is opened without reading its objects.
+    if (s.totalBytes >= kMappedOpenMinSize)
+    {
+	CSkMappedDocPtr md = CSkMappedDocOpen((char*)path);
+	if (md != NULL)
+	{
+	    ReleaseDrawObjList(&docStP->objList);
+	    docStP->objList.firstItem = docStP->objList.lastItem = NULL;
+	    CSkMappedDocClose(docStP->mappedDoc);
+	    docStP->mappedDoc = md;
+	    SetDocumentFile(docStP, url, CSkJournalCreate((char*)path, CSkMappedDocGetObjectCount(md)));
+	    return noErr;
+	}
+    }
+    
+    s.progressProc = progressProc;
+    s.refCon = refCon;
+    if (!CSkReadStreamOpen(&s, url, 0, kReadBufferSize))
+    {
+	err = s.err;
+	goto CantRead;
+    }
+    
+    // The first bytes tell binary and property list documents apart.
+    magic = CSkReadStreamPeek(&s, kCSkBinaryHeaderSize);
+    isBinary = (magic != NULL) && CSkIsBinaryDocumentData(magic, kCSkBinaryHeaderSize);
+    if (isBinary)
+    {
+	// Save appends to a binary document; a property list document goes through Save As.
+	journal = CSkJournalCreate((char*)path, 0);
+	if ((s.totalBytes >= kParallelDecodeMinSize) && (s.totalBytes < 0x7FFFFFFF) && (MPProcessorsScheduled() > 1))
+	    err = ReadBinaryDocumentParallel(&s, &objList, journal);
+	else
+	    err = CSkReadBinaryDocument(&s, &objList, journal);
+    }
+    else
+	err = ReadPropertyListDocument(&s, &objList);
+	
+    if (err == noErr)
+    {
+	ReleaseDrawObjList(&docStP->objList);
+	CSkMappedDocClose(docStP->mappedDoc);
+	docStP->mappedDoc = NULL;
+	docStP->objList = objList;
+	SetDocumentFile(docStP, isBinary ? url : NULL, journal);
+    }
+    else
+    {
+	ReleaseDrawObjList(&objList);
+	CSkJournalRelease(journal);
+    }
+    
+CantRead:
+    CSkReadStreamClose(&s);
+    return err;
+}
@@ -0,0 +1,100 @@
+/*
+    File:       CSkDocReader.h
+        
+    Contains:	Streaming .csk document reader
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#ifndef __CSKDOCREADER__
+#define __CSKDOCREADER__
+
+#include <Carbon/Carbon.h>
+#include "CSkDocStorage.h"
+
+// Called after each block read from the file. Return false to cancel the read.
+// totalBytes is 0 if the size isn't known.
+typedef Boolean (*CSkReadProgressProcPtr)(void* refCon, SInt64 bytesRead, SInt64 totalBytes);
+
+// A document is read through a fixed-size window onto the file, so memory use doesn't
+// depend on the size of the file. Parsers look at the next bytes with CSkReadStreamPeek
+// and step over them with CSkReadStreamConsume. A peeked pointer stays valid until the
+// next call on the stream.
+struct CSkReadStream {
+    CFURLRef		    url;	    // the file
+    CFReadStreamRef	    stream;
+    UInt8*		    buffer;
+    UInt32		    bufferSize;
+    UInt32		    pos;	    // window is buffer[pos..end)
+    UInt32		    end;
+    SInt64		    bytesRead;
+    SInt64		    totalBytes;
+    CSkReadProgressProcPtr  progressProc;
+    void*		    refCon;
+    OSStatus		    err;	    // ioErr or userCanceledErr once reading stopped
+};
+typedef struct CSkReadStream CSkReadStream;
+
+const UInt8*	CSkReadStreamPeek(CSkReadStream* s, UInt32 count);
+void		CSkReadStreamConsume(CSkReadStream* s, UInt32 count);
+const UInt8*	CSkReadStreamRead(CSkReadStream* s, UInt32 count);
+Boolean		CSkReadStreamCopy(CSkReadStream* s, void* dest, UInt32 count);
+Boolean		CSkReadStreamSkip(CSkReadStream* s, UInt32 count);
+Boolean		CSkReadStreamAtEnd(CSkReadStream* s);
+
+// Opens s on url, offset bytes in, with a window of bufferSize bytes. The other fields
+// (progress) are left as they are. A parser can open a second stream on s->url to read
+// two parts of the file side by side. Close it with CSkReadStreamClose.
+Boolean		CSkReadStreamOpen(CSkReadStream* s, CFURLRef url, SInt64 offset, UInt32 bufferSize);
+void		CSkReadStreamClose(CSkReadStream* s);
+
+// Read binary and (legacy) XML property list .csk documents straight into CSkObjects,
+// without building the whole document as CF containers first. docStP's object list is
+// replaced only if the whole document could be read; on error or cancel
+// (userCanceledErr) it is left alone. progressProc may be NULL.
+// Large binary documents are decoded on several threads (CSkDecodeBinaryDocument).
+// Very large ones with a spatial index are mapped instead (CSkMappedDoc.h) and show up
+// in docStP->mappedDoc, with an empty object list.
+// On success, a binary url becomes docStP->fileURL, the file that Save writes to. An XML
+// document gets none: Save goes to Save As, so that it is only converted to the binary
+// format, which older versions can't open, when the user says so.
+OSStatus	CSkReadDocumentFromURL(DocStoragePtr docStP, CFURLRef url,
+					CSkReadProgressProcPtr progressProc, void* refCon);
+
+#endif
@@ -42,6 +42,10 @@
 */
 
 #include "CSkDocStorage.h"
+#include "CSkMappedDoc.h"
+#include "CSkFileFormat.h"
+#include "CSkAutosave.h"
+#include "CSkTrace.h"
 
 //------------------------------------------------------------------------------------------------------------------
 // For convenience, we create this "single pixel CGBitmapContext" for hit-testing right away at creation of a new
@@ -74,6 +78,15 @@ DocStoragePtr GetWindowDocStoragePtr(WindowRef w)
     return docStP;
 }
 
+//--------------------------------------------------------------------------------------
+// Sheets don't overlap unless asked to, with "defaults write <bundle id> PageOverlap <points>".
+static float GetDefaultPageOverlap(void)
+{
+    Boolean valid = false;
+    CFIndex overlap = CFPreferencesGetAppIntegerValue(CFSTR("PageOverlap"), kCFPreferencesCurrentApplication, &valid);
+    return (valid && (overlap > 0)) ? overlap : 0;
+}
+
 //--------------------------------------------------------------------------------------
 // Allocation and initialization of document storage.
 // Note that we rely on NewPtrClear setting everything else to NULL.
@@ -93,6 +106,7 @@ DocStorage* CreateDocumentStorage(WindowRef window, WindowRef toolPalette)
     docStP->pageRect		= CGRectMake(0, 0, kDefaultDocWidth, kDefaultDocHeight);
     docStP->gridWidth		= kGridWidth;
     docStP->scale		= 1.0;
+    docStP->pageOverlap		= GetDefaultPageOverlap();
     docStP->dupOffset		= CGPointMake(9.0, 9.0);
     docStP->pageFormat		= kPMNoPageFormat;
     docStP->printSettings	= kPMNoPrintSettings;
@@ -109,7 +123,14 @@ DocStorage* CreateDocumentStorage(WindowRef window, WindowRef toolPalette)
 // Make all the necessary "..Release" calls, and deallocate any nested storage
 void ReleaseDocumentStorage(DocStorage* docStP)
 {
+    CSkAutosaveRelease(docStP->autosave);	// waits for the autosave thread
     ReleaseDrawObjList(&docStP->objList);
+    CSkMappedDocClose(docStP->mappedDoc);
+    CSkJournalRelease(docStP->journal);
+    if (docStP->fileURL != NULL)
+	CFRelease(docStP->fileURL);
+    if (docStP->pdfURL != NULL)
+	CFRelease(docStP->pdfURL);
     
     if (docStP->bmCtx != NULL)
         CGContextRelease(docStP->bmCtx);
@@ -193,9 +214,10 @@ void DrawDocumentBackgroundGrid(CGContextRef ctx, CGSize docSize, float gridWidt
 
 
 //--------------------------------------------------------------------------------------------------
-// We reuse this routine in NavServicesHandling.c, from "MakePDFDocument":
+// Everything below the objects: the grid, or a background pdf or image.
+// Also sets up the context's color spaces for the objects.
 
-void DrawThePage(CGContextRef ctx, const DocStorage* docStP)
+void DrawPageBackground(CGContextRef ctx, DocStorage* docStP)
 {
     CGColorSpaceRef genericColorSpace = GetGenericRGBColorSpace();
 
@@ -207,7 +229,7 @@ void DrawThePage(CGContextRef ctx, const DocStorage* docStP)
 	DrawDocumentBackgroundGrid(ctx, docStP->pageRect.size, docStP->gridWidth);
     
     // If we have a background pdf or image, draw it
-    if ((docStP->pdfData != NULL) && (docStP->pdfIsUnlocked))
+    if ((docStP->pdfDocument != NULL) && (docStP->pdfIsUnlocked))
     {
 	DrawPDFData(ctx, docStP->pdfDocument, docStP->indexOrPageNo, docStP->pageRect);
     }
@@ -229,8 +251,37 @@ void DrawThePage(CGContextRef ctx, const DocStorage* docStP)
 	    fprintf(stderr, "CGImageSourceCreateImageAtIndex %d failed\n", (int)docStP->indexOrPageNo);
 	}
     }
-	
-    RenderDrawObjList(ctx, &docStP->objList, docStP->shouldDrawGrabbers);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Printing and PDF export draw one sheet at a time instead; see CSkPDFExport.c.
+// Copy draws a snapshot of the page, when it's pasted; see CSkPasteboard.c.
+
+void DrawThePage(CGContextRef ctx, DocStorage* docStP)
+{
+    CGRect	    clipRect = CGContextGetClipBoundingBox(ctx);    // in document coordinates
+    CSK_TRACE_SPAN("DrawThePage");
+
+    DrawPageBackground(ctx, docStP);
+    MaterializeObjectsInRect(docStP, clipRect);
+    RenderDrawObjListInRect(ctx, &docStP->objList, clipRect, docStP->shouldDrawGrabbers);
+}
+
+//--------------------------------------------------------------------------------------------------
+void MaterializeObjectsInRect(DocStorage* docStP, CGRect r)
+{
+    if (docStP->mappedDoc != NULL)
+	CSkMappedDocMaterializeRect(docStP->mappedDoc, &docStP->objList, r);
+}
+
+void MaterializeAllObjects(DocStorage* docStP)
+{
+    if (docStP->mappedDoc != NULL)
+    {
+	CSkMappedDocMaterializeAll(docStP->mappedDoc, &docStP->objList);
+	CSkMappedDocClose(docStP->mappedDoc);
+	docStP->mappedDoc = NULL;
+    }
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -248,7 +299,8 @@ CFPropertyListRef CSkCreatePropertyList(DocStoragePtr docStP)
 void SetObjectListFromPropertyList(DocStoragePtr docStP, CFPropertyListRef propList)
 {
     CFArrayRef objArray = CFDictionaryGetValue(propList, kKeyObjectArray);
-    CSkConvertCFArrayToDrawObjectList(objArray, &docStP->objList);
+    if (objArray != NULL)
+	CSkConvertCFArrayToDrawObjectList(objArray, &docStP->objList);
 }
 
 
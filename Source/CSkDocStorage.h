@@ -68,15 +68,21 @@ struct DocStorage
 	HIViewRef			sketchView;			// the sketch view inside the scroll view
     CGAffineTransform   displayCTM;         // apply to windowContext before drawing document content into it (scales + offsets)
     DrawObjList         objList;            // our drawing objects
+    struct CSkMappedDoc* mappedDoc;         // for a large document, the objects not yet in objList
+    CFURLRef            fileURL;            // where Save writes to; NULL until saved, or opened from a binary file
+    CFURLRef            pdfURL;             // where Update PDF writes to; NULL until exported (CSkPDFUpdate.h)
+    struct CSkJournal*  journal;            // what Save needs to know about the file (CSkFileFormat.h)
+    struct CSkAutosave* autosave;           // NULL if the document isn't autosaved (CSkAutosave.h)
     CGRect				pageRect;
     CGPoint				pageTopLeft;        // because our "page" is being drawn offset on the background
     CGPoint             dupOffset;          // offset when duplicating selected objects
     float				gridWidth;          // unscaled
     float               scale;              // passed to CGContextScaleCTM
+    float               pageOverlap;        // shared by adjacent sheets when printing (CSkPDFExport.h)
     PMPageFormat		pageFormat;
     PMPrintSettings		printSettings;
     CFDataRef           flattenedPageFormat;
-	CFDataRef			pdfData;			// in case we pasted in a pdf from the pasteboard
+	CFDataRef			pdfData;			// in case we pasted in a pdf from the pasteboard; NULL for a mapped pdf file
 	CGImageSourceRef	cgImgSrc;			// background image
 	CGPDFDocumentRef	pdfDocument;		// temporary storage while waiting for PW-protected PDF to be unlocked
 	size_t				indexOrPageNo;		// index of image in cgImgSrc, or page number in PDF
@@ -85,6 +91,7 @@ struct DocStorage
 	Boolean				pdfIsUnlocked;		// for PW-protected PDFs, after providing the correct PW
 	Boolean				shouldDrawGrabbers;	// whether or not the "grabbers" on selected objects should be drawn
 	Boolean				shouldDrawGrid;		// whether or not the background grid should be drawn
+	Boolean				isTracking;			// in DoMouseTracking; no autosave meanwhile
 };
 typedef struct DocStorage DocStorage, *DocStoragePtr;
 
@@ -94,7 +101,14 @@ DocStorage* GetWindowDocStoragePtr(WindowRef window);
 void	ReleaseDocumentStorage(DocStorage* docStP);
 
 // Assuming a CGContextRef is set up correctly, the above DocStorage is all that's needed to draw the document page.
-void DrawThePage(CGContextRef ctx, const DocStorage* docStP);
+// Objects of a mapped document that fall into the context's clip are materialized first.
+void DrawThePage(CGContextRef ctx, DocStorage* docStP);
+void DrawPageBackground(CGContextRef ctx, DocStorage* docStP);
+
+// For a mapped document, bring objects into objList before looking at them (no-ops otherwise).
+// MaterializeAllObjects also unmaps the document.
+void MaterializeObjectsInRect(DocStorage* docStP, CGRect r);
+void MaterializeAllObjects(DocStorage* docStP);
 
 Boolean SetPageNumberOrImageIndex(DocStorage* docStP, size_t pageNumberOrImageIndex);
 
@@ -47,6 +47,8 @@
 
 #include "CSkDocumentView.h"
 #include "CSkDocStorage.h"
+#include "CSkSnapping.h"
+#include "CSkTrace.h"
 
 #define kCSkDocViewClassID	CFSTR( "com.apple.sample.cskdocview" )
 
@@ -76,6 +78,16 @@ struct CanvasData {
     CGPoint		curPt;			// current mouse location
     int			trackingMode;		// tracking mode
     CSkObjectPtr	objPtr;			// current drawing object
+    
+    // tracking feedback is rendered at most once per display frame
+    
+    EventTime		frameInterval;		// 1 / display refresh rate
+    EventLoopTimerRef	feedbackTimer;		// fires once per display frame while tracking
+    CSkFramePacer	feedback;		// frames rendered and positions dropped during this track
+    CGRect		feedbackRect;		// overlay view area covered by the last feedback frame
+    CGRect		selectionBounds;	// render bounds of the selection, for move feedback
+    CGRect		snapBounds;		// shape bounds of the selection, for snapping moves
+    CSkSnapGuides	snapGuides;		// the edges the tracked shape snapped to, if any
 };
 typedef struct CanvasData   CanvasData;
 
@@ -103,6 +115,7 @@ OverlayViewHandler( EventHandlerCallRef inCaller, EventRef inEvent, void* inRefc
     const HIViewID  kDocViewID = { kDocumentViewSignature, 0 };
     HIViewRef	    docView;
     CanvasData*	    data;
+    CSK_TRACE_SPAN("OverlayViewHandler");
     
     HIViewFindByID( docStP->theScrollView, kDocViewID, &docView );
     data = HIObjectDynamicCast( (HIObjectRef) docView, kCSkDocViewClassID );
@@ -147,7 +160,9 @@ OverlayViewHandler( EventHandlerCallRef inCaller, EventRef inEvent, void* inRefc
 		    // And now (that the CTM is set up) also clip to the document bounds
 		    CGContextClipToRect(ctx, docStP->pageRect);
     
-		    CGContextClearRect(ctx, docStP->pageRect);
+		    // RenderTrackingFeedback only invalidates the old and new feedback areas,
+		    // and the view system has clipped to those. Don't clear beyond them.
+		    CGContextClearRect(ctx, CGContextGetClipBoundingBox(ctx));
 
 		    CGRect r = CGRectMake(data->startPt.x, data->startPt.y, data->curPt.x - data->startPt.x, data->curPt.y - data->startPt.y);
 		    r = CGRectStandardize(r);	// convert it such that width and height are positive
@@ -187,6 +202,25 @@ OverlayViewHandler( EventHandlerCallRef inCaller, EventRef inEvent, void* inRefc
 			}
 		    }	// switch (trackingMode)
 		    
+		    // alignment guides across the page
+		    if (data->snapGuides.hasX || data->snapGuides.hasY)
+		    {
+			CGContextSetRGBStrokeColor(ctx, 0.0, 0.6, 1.0, 0.8);
+			CGContextSetLineWidth(ctx, 1.0 / data->zoomFactor);
+			CGContextSetLineDash(ctx, 0, NULL, 0);
+			if (data->snapGuides.hasX)
+			{
+			    CGContextMoveToPoint(ctx, data->snapGuides.x, CGRectGetMinY(docStP->pageRect));
+			    CGContextAddLineToPoint(ctx, data->snapGuides.x, CGRectGetMaxY(docStP->pageRect));
+			}
+			if (data->snapGuides.hasY)
+			{
+			    CGContextMoveToPoint(ctx, CGRectGetMinX(docStP->pageRect), data->snapGuides.y);
+			    CGContextAddLineToPoint(ctx, CGRectGetMaxX(docStP->pageRect), data->snapGuides.y);
+			}
+			CGContextStrokePath(ctx);
+		    }
+		    
 		    CGContextSynchronize(ctx);
 
 		    err = noErr;
@@ -211,6 +245,7 @@ static void DrawTheDocumentView(CGContextRef ctx, CanvasData* data)
     WindowRef	w = GetControlOwner(data->theView);
     DocStorage*	docStP = GetWindowDocStoragePtr(w);
     HIRect	viewBounds;
+    CSK_TRACE_SPAN("DrawTheDocumentView");
 
     HIViewGetBounds(data->theView, &viewBounds);
 	
@@ -336,6 +371,43 @@ static void AdjustEndPoint(CGPoint* ioPt, CGPoint beginPt, int selectedShape, UI
     }
 }	// AdjustEndPoint
 
+//------------------------------------------------------------------------------------------------
+// Snaps curPt to the edges and centers of the other objects, or to the grid if it is shown.
+// A moved selection snaps with its shape bounds, offset by curPt - startPt; a new shape or a
+// grabber with the point itself. The command key turns snapping off, and the shift key
+// constrains the point instead (see AdjustEndPoint). Leaves the guides to draw in data.
+static CGPoint SnapTrackingPoint(DocStorage* docStP, CanvasData* data, int trackingMode, 
+				    CGPoint startPt, CGPoint curPt, UInt32 modifiers)
+{
+    float   gridWidth = docStP->shouldDrawGrid ? docStP->gridWidth : 0;
+    CGRect  r;
+    CGSize  d;
+    
+    data->snapGuides.hasX = data->snapGuides.hasY = false;
+    if ((modifiers & (cmdKey | shiftKey)) != 0)
+	return curPt;
+	
+    switch (trackingMode)
+    {
+	case eMoveSelection:
+	case eDuplicateSelection:
+	    r = CGRectOffset(data->snapBounds, curPt.x - startPt.x, curPt.y - startPt.y);
+	    break;
+	    
+	case eResizeViaGrabber:
+	case eCreateObject:
+	    r = CGRectMake(curPt.x, curPt.y, 0, 0);
+	    break;
+	    
+	default:
+	    return curPt;
+    }
+    if (CGRectIsNull(r))
+	return curPt;
+    d = CSkSnapIndexSnapRect(CSkObjListGetSnapIndex(&docStP->objList), r, kSnapDistance / data->zoomFactor, gridWidth, &data->snapGuides);
+    return CGPointMake(curPt.x + d.width, curPt.y + d.height);
+}
+
 
 //------------------------------------------------------------------------------------------------
 static void DoHitTest(EventRef inEvent, CanvasData* data)
@@ -357,6 +429,7 @@ static void DealWithNewMouseLocation(DocStorage* docStP, CanvasData* data,
 				    UInt32 modifiers)
 {
     Boolean redrawOverlay = false;
+    CSK_TRACE_SPAN("DealWithNewMouseLocation");
     
     CGRect r = CGRectMake(startPt.x, startPt.y, curPt.x - startPt.x, curPt.y - startPt.y);
     r = CGRectStandardize(r);	// convert it such that width and height are positive
@@ -371,6 +444,7 @@ static void DealWithNewMouseLocation(DocStorage* docStP, CanvasData* data,
 	case eDragSelection:
 	    if ((modifiers & shiftKey) == 0)	// no shift key down - don't extend selection
 		CSkObjListSetSelectState(&docStP->objList, false);
+	    MaterializeObjectsInRect(docStP, r);
 	    CSkObjListSelectWithinRect(&docStP->objList, r);
 	    redrawOverlay = true;
 	    break;
@@ -382,6 +456,7 @@ static void DealWithNewMouseLocation(DocStorage* docStP, CanvasData* data,
 	    
 	case eResizeViaGrabber:
 	    CSkShapeResize(CSkObjectGetShape(objPtr), hitCounter, curPt);
+	    CSkObjectMarkChanged(objPtr);
 	    redrawOverlay = true;
 	    break;
 	    
@@ -421,12 +496,106 @@ static void DealWithNewMouseLocation(DocStorage* docStP, CanvasData* data,
 	    break;
     }	// switch (trackingMode)
     
+    // The overlay is drawn later by RenderTrackingFeedback, from the latest tracking state
     if ( redrawOverlay )
+	CSkFramePacerPost(&data->feedback);
+}   // DealWithNewMouseLocation
+
+//------------------------------------------------------------------------------------------------
+// LCDs report a refresh rate of 0; assume 60 Hz for those.
+static EventTime GetMainDisplayFrameInterval(void)
+{
+    double	    refreshRate = 0.0;
+    CFDictionaryRef mode = CGDisplayCurrentMode(CGMainDisplayID());
+    
+    if (mode != NULL)
     {
-	HIViewSetNeedsDisplay( docStP->overlayView, true );
-	HIWindowFlush( docStP->overlayWindow );
+	CFNumberRef rate = (CFNumberRef)CFDictionaryGetValue(mode, kCGDisplayRefreshRate);
+	if (rate != NULL)
+	    CFNumberGetValue(rate, kCFNumberDoubleType, &refreshRate);
     }
-}   // DealWithNewMouseLocation
+    if (refreshRate <= 0.0)
+	refreshRate = 60.0;
+    return 1.0 / refreshRate;
+}
+
+//------------------------------------------------------------------------------------------------
+// The overlay view area that OverlayViewHandler draws into for the current tracking state.
+static CGRect GetTrackingFeedbackRect(DocStorage* docStP, CanvasData* data)
+{
+    float   dx = data->curPt.x - data->startPt.x;
+    float   dy = data->curPt.y - data->startPt.y;
+    CGRect  r = CGRectStandardize(CGRectMake(data->startPt.x, data->startPt.y, dx, dy));
+    
+    switch (data->trackingMode)
+    {
+	case eDragSelection:
+	    break;
+
+	case eMoveSelection:
+	case eDuplicateSelection:
+	    r = CGRectOffset(data->selectionBounds, dx, dy);
+	    break;
+	    
+	case eResizeViaGrabber:
+	    r = GetDrawObjRenderBounds(data->objPtr, true);
+	    break;
+
+	case eCreateObject:
+	    if (GetDrawObjShapeType(data->objPtr) == kFreePolygon)	// also the "loose end"
+	    {
+		float d = CSkObjectGetAttributes(data->objPtr)->lineWidth;
+		r = CGRectUnion(CGRectInset(r, -d, -d), GetDrawObjRenderBounds(data->objPtr, true));
+	    }
+	    else
+		r = GetDrawObjRenderBounds(data->objPtr, true);
+	    break;
+	    
+	default:
+	    return CGRectNull;
+    }
+    if (data->snapGuides.hasX)
+	r = CGRectUnion(r, CGRectMake(data->snapGuides.x, CGRectGetMinY(docStP->pageRect), 0, CGRectGetHeight(docStP->pageRect)));
+    if (data->snapGuides.hasY)
+	r = CGRectUnion(r, CGRectMake(CGRectGetMinX(docStP->pageRect), data->snapGuides.y, CGRectGetWidth(docStP->pageRect), 0));
+    
+    CGAffineTransform m =  MakeDisplayTransform(data->zoomFactor, 
+						docStP->pageRect.size.height,
+						docStP->pageTopLeft, 
+						data->scrollPosition );
+    r = CGRectApplyAffineTransform(r, m);
+    return CGRectIntegral(CGRectInset(r, -1.0, -1.0));	    // room for antialiasing
+}
+
+//------------------------------------------------------------------------------------------------
+// Invalidate and flush the overlay if it is behind the tracking state. This is the only place
+// that invalidates while tracking, and it runs once per display frame (see TrackingFrameTimerProc).
+static void RenderTrackingFeedback(DocStorage* docStP, CanvasData* data)
+{
+    CGRect newRect, dirtyRect;
+    
+    if (!CSkFramePacerTakeFrame(&data->feedback))
+	return;
+    CSK_TRACE_SPAN("RenderTrackingFeedback");
+    newRect = GetTrackingFeedbackRect(docStP, data);
+    dirtyRect = CGRectUnion(data->feedbackRect, newRect);	// erase the old, draw the new
+    if (!CGRectIsNull(dirtyRect))
+	HIViewSetNeedsDisplayInRect( docStP->overlayView, &dirtyRect, true );
+    if (data->trackingMode == eResizeViaGrabber)
+	HIViewSetNeedsDisplay(data->theView, true);	// the object itself changes, under the overlay
+    HIWindowFlush( docStP->overlayWindow );
+    data->feedbackRect = newRect;
+}
+
+//------------------------------------------------------------------------------------------------
+// Installed by DoMouseTracking for the duration of a track; fires in TrackMouseLocation.
+static pascal void TrackingFrameTimerProc(EventLoopTimerRef timer, void* userData)
+{
+#pragma unused(timer)
+    CanvasData* data = (CanvasData*)userData;
+    
+    RenderTrackingFeedback(GetWindowDocStoragePtr(GetControlOwner(data->theView)), data);
+}
 
 //------------------------------------------------------------------------------------------------
 static void DealWithMouseReleased(DocStorage* docStP, CSkObjectPtr objPtr, 
@@ -443,6 +612,10 @@ static void DealWithMouseReleased(DocStorage* docStP, CSkObjectPtr objPtr,
 	    DuplicateSelectedDrawObjs(&docStP->objList, curPt.x - startPt.x, curPt.y - startPt.y);
 	    break;
 	    
+	case eResizeViaGrabber:
+	    SetDrawObjSnapping(&docStP->objList, objPtr, true);	    // back in, with its new bounds
+	    break;
+	    
 	case eCreateObject:
 	    {
 		CSkObjectSetAttributes(objPtr, CSkToolPaletteGetAttributes(docStP->toolPalette));
@@ -533,6 +706,12 @@ static void DoMouseTracking(EventRef inEvent, CanvasData* data)
     int			clickCount = 0;
     
     ShowWindow(docStP->overlayWindow);
+    docStP->isTracking = true;	    // the autosave timer can fire in TrackMouseLocation; it waits
+    
+    data->frameInterval = GetMainDisplayFrameInterval();
+    data->feedbackTimer = NULL;
+    CSkFramePacerReset(&data->feedback);
+    HIViewGetBounds(docStP->overlayView, &data->feedbackRect);	// the first frame clears what the last track left
     
     CGAffineTransform m =  MakeDisplayTransform(data->zoomFactor, 
 						docStP->pageRect.size.height,
@@ -547,6 +726,7 @@ static void DoMouseTracking(EventRef inEvent, CanvasData* data)
     // Check if we hit one of our drawn objects, and if so, if we hit one of the "grabbers" for resizing.
     // Apply the inverse of the displayCTM to the local "where" point, so we can work in document coordinates.
     CGPoint	docPt = CGPointApplyAffineTransform(where, CGAffineTransformInvert(docStP->displayCTM));
+    MaterializeObjectsInRect(docStP, CGRectMake(docPt.x - 0.5, docPt.y - 0.5, 1, 1));
     CSkObjectPtr hitObj = DrawObjListHitTesting(&docStP->objList, docStP->bmCtx, docStP->displayCTM, where, docPt, &data->hitGrabber);
 
     GetEventParameter(inEvent, kEventParamKeyModifiers, typeUInt32, NULL, sizeof(UInt32), NULL, &modifiers);
@@ -555,6 +735,20 @@ static void DoMouseTracking(EventRef inEvent, CanvasData* data)
     int  trackingMode	= DetermineTrackingMode(&docStP->objList, hitObj, data->hitGrabber, modifiers, shapeSelect);
     CSkObjectPtr objPtr = NULL;
     CSkShapePtr sh	= NULL;
+    
+    if ((trackingMode == eMoveSelection) || (trackingMode == eDuplicateSelection))
+    {
+	data->selectionBounds = GetSelectedDrawObjsRenderBounds(&docStP->objList);   // doesn't change while tracking
+	data->snapBounds = GetSelectedDrawObjsShapeBounds(&docStP->objList);
+    }
+    data->snapGuides.hasX = data->snapGuides.hasY = false;
+    if (trackingMode == eMoveSelection)
+    {
+	CSkObjListGetSnapIndex(&docStP->objList);			// built once; the list keeps it up to date
+	CSkObjListSetSelectedSnapping(&docStP->objList, false);	// until MoveSelectedDrawObjs puts them back
+    }
+    else if (trackingMode == eCreateObject)
+	startPt = SnapTrackingPoint(docStP, data, trackingMode, startPt, startPt, modifiers);
     MouseTrackingResult lastTrackingResult = 0xFFFF;	// indicate that we are starting
     
 //    fprintf(stderr, "Shape %d   ", shapeSelect);
@@ -566,7 +760,7 @@ static void DoMouseTracking(EventRef inEvent, CanvasData* data)
     {
 	case eCreateObject:
 	    sh = CSkShapeCreate(shapeSelect);
-	    objPtr = CreateCSkObj( CSkToolPaletteGetAttributes(docStP->toolPalette), sh);
+	    objPtr = CreateCSkObj( CSkObjListGetStyles(&docStP->objList), CSkToolPaletteGetAttributes(docStP->toolPalette), sh);
 	    SetDrawObjSelectState(objPtr, true);    // so we can see the grabber control lines during tracking
 
 	    switch (shapeSelect)
@@ -590,7 +784,9 @@ static void DoMouseTracking(EventRef inEvent, CanvasData* data)
 	    break;
 	    
 	case eResizeViaGrabber:
-	    objPtr = hitObj;
+	    objPtr = CSkObjectMakeWritable(&docStP->objList, hitObj);	// an autosave may be writing hitObj
+	    CSkObjListGetSnapIndex(&docStP->objList);
+	    SetDrawObjSnapping(&docStP->objList, objPtr, false);	// don't snap to its own edges
 	    SetThemeCursor(kThemeCrossCursor);
 	    break;
 
@@ -605,9 +801,19 @@ static void DoMouseTracking(EventRef inEvent, CanvasData* data)
     
     if (trackingMode != eChangedSelectState)	// else ignore mousetracking
     {
+	static EventLoopTimerUPP    sFrameTimerUPP = NULL;
 	Boolean	keepGoing = true;
 	UInt32 lastClick = 0;
 	
+	if (sFrameTimerUPP == NULL)
+	    sFrameTimerUPP = NewEventLoopTimerUPP(TrackingFrameTimerProc);
+	if (InstallEventLoopTimer(GetMainEventLoop(), data->frameInterval, data->frameInterval, 
+				    sFrameTimerUPP, data, &data->feedbackTimer) != noErr)
+	{
+	    fprintf(stderr, "DoMouseTracking: no frame timer; drawing feedback for every mouse event\n");
+	    data->feedbackTimer = NULL;
+	}
+	
 	while (keepGoing)
 	{
 	    Point	    qdPt;
@@ -616,9 +822,12 @@ static void DoMouseTracking(EventRef inEvent, CanvasData* data)
 	    UInt32	    modifiers;
 	    
 	    // Watch the mouse for change: qdPt comes back in global coordinates!
+	    // The frame timer draws the feedback while we wait here.
 	    TrackMouseLocationWithOptions(NULL, 0, kEventDurationForever, &qdPt, &modifiers, &trackingResult );
+		
 	    where = QDGlobalToHIViewLocal(qdPt, data->theView);
 	    curPt = CGPointApplyAffineTransform(where, t);
+	    curPt = SnapTrackingPoint(docStP, data, trackingMode, startPt, curPt, modifiers);
 	    
 	    if (data->mouseUpTracking)  // we only stop tracking after a double-click or when clickCount matches required pointCount
 	    {
@@ -666,6 +875,8 @@ static void DoMouseTracking(EventRef inEvent, CanvasData* data)
 		if (trackingMode == eCreateObject)  // In this case, "hitGrabber" is unused. Use it for "clickCount", instead.
 		    data->hitGrabber = clickCount;
 		DealWithNewMouseLocation(docStP, data, objPtr, startPt, curPt, &data->hitGrabber, trackingMode, modifiers);
+		if (data->feedbackTimer == NULL)
+		    RenderTrackingFeedback(docStP, data);
 	    }
 	    else
 	    {
@@ -674,25 +885,38 @@ static void DoMouseTracking(EventRef inEvent, CanvasData* data)
 		if ((shapeSelect == kLineShape) && CGPointEqualToPoint(startPt, curPt))
 		{
 		    CSkShapePtr sh = CSkObjectGetShape(objPtr);
-		    CGPoint* pts = CSkShapeGetPoints(sh);
-		    pts[1] = pts[0];
+		    CGPoint pts[4];
+		    CSkShapeGetPoints(sh, pts);
+		    CSkShapeSetPointAtIndex(sh, pts[0], 1);
 		}
 		DealWithMouseReleased(docStP, objPtr, startPt, curPt, trackingMode);
 		HideWindow(docStP->overlayWindow);
+		HIViewSetNeedsDisplay(data->theView, true);
 	    }
 	    
-	    HIViewSetNeedsDisplay(data->theView, true);
-	    
 	    part = kControlNoPart;
 	    SetEventParameter(inEvent, kEventParamControlPart, typeControlPartCode, sizeof(ControlPartCode), &part); 
 	}
     }
     
+    if (data->feedbackTimer != NULL)
+    {
+	RemoveEventLoopTimer(data->feedbackTimer);
+	data->feedbackTimer = NULL;
+    }
+    CSkFramePacerFinish(&data->feedback);	    // a pending position is superseded by the mouse-up
+    data->snapGuides.hasX = data->snapGuides.hasY = false;
+#if CSK_TRACING
+    fprintf(stderr, "tracking feedback: %u frames rendered, %u dropped\n", 
+		    (unsigned)data->feedback.rendered, (unsigned)data->feedback.dropped);
+#endif
+
     // Send back the part upon which the mouse was released
     part = kControlEntireControl;
     SetEventParameter(inEvent, kEventParamControlPart, typeControlPartCode, sizeof(ControlPartCode), &part); 
 
     SetThemeCursor( kThemeArrowCursor );
+    docStP->isTracking = false;
 }   // DoMouseTracking
 
 
@@ -0,0 +1,2230 @@
+/*
+    File:       CSkFileFormat.c
+        
+    Contains:	Reading and writing binary .csk documents, and opening legacy
+                XML property list documents
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <libkern/OSAtomic.h>
+#include "CSkFileFormat.h"
+#include "CSkMappedDoc.h"
+#include "CSkAutosave.h"
+#include "CSkObjects.h"
+#include "CSkShapes.h"
+#include "CSkTrace.h"
+
+static const char kCSkBinaryMagic[4] = { 'C', 'S', 'k', 'B' };
+
+enum {
+    kFeatureEntrySize		= 8,
+    kChunkHeaderSize		= 8,
+    kTableHeaderSize		= 8,	    // record count and record size at the start of OBJS, PNTS, STYL and OTOC
+    kTocEntrySize		= 8,
+    kMaxRecordSize		= 4096,
+    kMaxHeaderSize		= 4096,
+    kMaxDecodeThreads		= 16,
+    
+    kGridHeaderSize		= 28,
+    kGridObjectsPerCell		= 8,
+    kGridMaxColsRows		= 4096,
+    kGridMaxCellsPerObject	= 64,	    // bigger objects go to the overflow cell
+    
+    // offsets in an object record
+    kObjShapeType		= 0,	    // UInt8
+    kObjStyleIndex		= 4,	    // UInt32
+    kObjGeometry		= 8,	    // float32[8]: up to 4 points; or x y w h (rX rY); for polygons
+					    // UInt32 first path record, UInt32 path record count
+    // offsets in a style record, and in an object record with the attributes in it
+    kObjLineCap			= 1,	    // UInt8 each: lineCap, lineJoin, lineStyle
+    kObjLineJoin		= 2,
+    kObjLineStyle		= 3,
+    kObjLineWidth		= 4,	    // float32
+    kObjStrokeColor		= 8,	    // float32[4], r g b a
+    kObjFillColor		= 24,	    // float32[4]
+    kObjInlineGeometry		= 40,
+    
+    kPathContinuation		= 0xFF,	    // element type of the 2nd/3rd point of a curve element
+    
+    kStyleIndexObjectsVersion	= 3	    // OBJS version from which object records refer to STYL records
+};
+
+
+//-------------------------------------------------------------------------------------------
+// Little-endian accessors. The caller checks the bounds.
+
+static void PutUInt16(UInt8* p, UInt16 v)	{ v = CFSwapInt16HostToLittle(v); memcpy(p, &v, 2); }
+static void PutUInt32(UInt8* p, UInt32 v)	{ v = CFSwapInt32HostToLittle(v); memcpy(p, &v, 4); }
+static void PutFloat32(UInt8* p, float f)	{ UInt32 v; memcpy(&v, &f, 4); PutUInt32(p, v); }
+
+static UInt16 GetUInt16(const UInt8* p)		{ UInt16 v; memcpy(&v, p, 2); return CFSwapInt16LittleToHost(v); }
+static UInt32 GetUInt32(const UInt8* p)		{ UInt32 v; memcpy(&v, p, 4); return CFSwapInt32LittleToHost(v); }
+static float  GetFloat32(const UInt8* p)	{ UInt32 v = GetUInt32(p); float f; memcpy(&f, &v, 4); return f; }
+
+static void PutColor(UInt8* p, const CGrgba* c)
+{
+    PutFloat32(p, c->r);    PutFloat32(p + 4, c->g);	PutFloat32(p + 8, c->b);    PutFloat32(p + 12, c->a);
+}
+
+static void GetColor(const UInt8* p, CGrgba* c)
+{
+    c->r = GetFloat32(p);   c->g = GetFloat32(p + 4);	c->b = GetFloat32(p + 8);   c->a = GetFloat32(p + 12);
+}
+
+static UInt32 Padded(UInt32 size)
+{
+    return (size + 3) & ~3;
+}
+
+//-------------------------------------------------------------------------------------------
+Boolean CSkIsBinaryDocumentData(const UInt8* bytes, CFIndex length)
+{
+    return (length >= kCSkBinaryHeaderSize) && (memcmp(bytes, kCSkBinaryMagic, sizeof(kCSkBinaryMagic)) == 0);
+}
+
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------
+// Writing. Polygon paths go to the PNTS chunk, one record per point. The first point of an
+// element carries its CGPathElementType; the other points of a curve are marked kPathContinuation.
+// A closeSubpath gets a record too, with a zero point.
+
+struct PathWriter {
+    UInt8*	records;	// NULL: only count
+    UInt32	count;
+};
+typedef struct PathWriter PathWriter;
+
+static void PutPathRecord(PathWriter* w, UInt8 elementType, CGPoint pt)
+{
+    if (w->records != NULL)
+    {
+	UInt8* p = w->records + w->count * kCSkPathPointRecordSize;
+	p[0] = elementType;
+	p[1] = p[2] = p[3] = 0;
+	PutFloat32(p + 4, pt.x);
+	PutFloat32(p + 8, pt.y);
+    }
+    w->count += 1;
+}
+
+// The polygon's verbs map directly to the record types. The points are copied out
+// kPolygonChunkSize at a time, so that a compact polygon is decoded in blocks.
+#define kPolygonChunkSize   256
+
+static void PutPolygonRecords(PathWriter* w, const CSkShape* sh)
+{
+    CGPoint	pts[kPolygonChunkSize];
+    UInt8	verbs[kPolygonChunkSize];
+    UInt32	first, i, n, count = CSkShapeGetPolygonCount(sh);
+    
+    for (first = 0; first < count; first += n)
+    {
+	n = (count - first < kPolygonChunkSize) ? count - first : kPolygonChunkSize;
+	CSkShapeGetPolygonPoints(sh, first, n, pts, verbs);
+	for (i = 0; i < n; ++i)
+	{
+	    UInt8 verb = verbs[i] & kCSkPolygonVerbMask;
+	    PutPathRecord(w, (verb == kCSkPolygonContinuation) ? kPathContinuation : verb, pts[i]);
+	    if (verbs[i] & kCSkPolygonClose)
+		PutPathRecord(w, kCGPathElementCloseSubpath, CGPointZero);
+	}
+    }
+}
+
+//-------------------------------------------------------------------------------------------
+// The STYL chunk has the styles of the objects, numbered in the order they first come up.
+// The objects all come from one list, so style IDs tell their styles apart.
+
+struct StyleNumbering {
+    UInt32*	    indexByID;	    // STYL record index, by style ID
+    UInt32	    numIDs;
+    CSkStylePtr*    styles;	    // by STYL record index
+    UInt32	    count;
+};
+typedef struct StyleNumbering StyleNumbering;
+
+static Boolean NumberStyles(const CSkObjectPtr* objects, UInt32 numObjects, StyleNumbering* sn)
+{
+    UInt32 i;
+    
+    memset(sn, 0, sizeof(StyleNumbering));
+    for (i = 0; i < numObjects; ++i)
+    {
+	UInt32 styleID = CSkStyleGetID(CSkObjectGetStyle(objects[i]));
+	if (styleID >= sn->numIDs)
+	    sn->numIDs = styleID + 1;
+    }
+    sn->indexByID = (UInt32*)malloc((sn->numIDs + 1) * sizeof(UInt32));
+    sn->styles = (CSkStylePtr*)malloc((sn->numIDs + 1) * sizeof(CSkStylePtr));
+    if ((sn->indexByID == NULL) || (sn->styles == NULL))
+	return false;
+    memset(sn->indexByID, 0xFF, sn->numIDs * sizeof(UInt32));
+    for (i = 0; i < numObjects; ++i)
+    {
+	CSkStylePtr style = CSkObjectGetStyle(objects[i]);
+	if (sn->indexByID[CSkStyleGetID(style)] == 0xFFFFFFFF)
+	{
+	    sn->indexByID[CSkStyleGetID(style)] = sn->count;
+	    sn->styles[sn->count++] = style;
+	}
+    }
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------
+// A style record, or the attributes in an object record that has them
+static void PutAttributes(UInt8* p, const CSkObjectAttributes* attr)
+{
+    p[kObjLineCap]   = attr->lineCap;
+    p[kObjLineJoin]  = attr->lineJoin;
+    p[kObjLineStyle] = attr->lineStyle;
+    PutFloat32(p + kObjLineWidth, attr->lineWidth);
+    PutColor(p + kObjStrokeColor, &attr->strokeColor);
+    PutColor(p + kObjFillColor, &attr->fillColor);
+}
+
+//-------------------------------------------------------------------------------------------
+// With styles, the record refers to its STYL record; without, the attributes go in the record
+// (kCSkInlineObjectRecordSize).
+static void PutObjectRecord(UInt8* p, CSkObjectPtr obj, PathWriter* pathWriter, const StyleNumbering* styles)
+{
+    CSkShapePtr	    sh = CSkObjectGetShape(obj);
+    int		    shapeType = CSkShapeGetType(sh);
+    UInt8*	    g;
+    
+    if (styles != NULL)
+    {
+	memset(p, 0, kCSkObjectRecordSize);
+	PutUInt32(p + kObjStyleIndex, styles->indexByID[CSkStyleGetID(CSkObjectGetStyle(obj))]);
+	g = p + kObjGeometry;
+    }
+    else
+    {
+	memset(p, 0, kCSkInlineObjectRecordSize);
+	PutAttributes(p, CSkObjectGetAttributes(obj));
+	g = p + kObjInlineGeometry;
+    }
+    p[kObjShapeType] = shapeType;
+    
+    switch (shapeType)
+    {
+	case kLineShape:
+	case kQuadBezier:
+	case kCubicBezier:
+	{
+	    CGPoint	pts[4];
+	    int		i, numPoints = CSkShapeGetPoints(sh, pts);
+	    for (i = 0; i < numPoints; ++i)
+	    {
+		PutFloat32(g + 8 * i, pts[i].x);
+		PutFloat32(g + 8 * i + 4, pts[i].y);
+	    }
+	}
+	break;
+	
+	case kRRectShape:
+	{
+	    CGPoint radii = CSkShapeGetRRectRadii(sh);
+	    PutFloat32(g + 16, radii.x);
+	    PutFloat32(g + 20, radii.y);
+	}
+	// fall through
+	    
+	case kRectShape:
+	case kOvalShape:
+	{
+	    CGRect r = CSkShapeGetBounds(sh);
+	    PutFloat32(g, r.origin.x);
+	    PutFloat32(g + 4, r.origin.y);
+	    PutFloat32(g + 8, r.size.width);
+	    PutFloat32(g + 12, r.size.height);
+	}
+	break;
+	
+	case kFreePolygon:
+	{
+	    UInt32 first = pathWriter->count;
+	    PutPolygonRecords(pathWriter, sh);
+	    PutUInt32(g, first);
+	    PutUInt32(g + 4, pathWriter->count - first);
+	}
+	break;
+    }
+}
+
+//-------------------------------------------------------------------------------------------
+static UInt8* PutChunkHeader(UInt8* p, UInt32 type, UInt32 size)
+{
+    PutUInt32(p, type);
+    PutUInt32(p + 4, size);
+    return p + kChunkHeaderSize;
+}
+
+static UInt8* PutFeature(UInt8* p, UInt32 tag, UInt16 version, UInt16 flags)
+{
+    PutUInt32(p, tag);
+    PutUInt16(p + 4, version);
+    PutUInt16(p + 6, flags);
+    return p + kFeatureEntrySize;
+}
+
+//-------------------------------------------------------------------------------------------
+// The spatial index is a uniform grid over the union of the object bounds, with about
+// kGridObjectsPerCell objects per cell.
+
+struct GridLayout {
+    float	originX, originY;
+    float	cellWidth, cellHeight;
+    UInt32	cols, rows;
+};
+typedef struct GridLayout GridLayout;
+
+static void MakeGridLayout(CGRect allBounds, UInt32 numObjects, GridLayout* g)
+{
+    double  numCells = (numObjects + kGridObjectsPerCell - 1) / kGridObjectsPerCell;
+    double  aspect;
+    
+    if (CGRectIsNull(allBounds) || (CGRectGetWidth(allBounds) <= 0) || (CGRectGetHeight(allBounds) <= 0))
+	allBounds = CGRectMake(0, 0, 1, 1);
+    aspect = CGRectGetWidth(allBounds) / CGRectGetHeight(allBounds);
+    
+    g->cols = (UInt32)sqrt(numCells * aspect);
+    g->cols = (g->cols < 1) ? 1 : (g->cols > kGridMaxColsRows) ? kGridMaxColsRows : g->cols;
+    g->rows = (UInt32)(numCells / g->cols);
+    g->rows = (g->rows < 1) ? 1 : (g->rows > kGridMaxColsRows) ? kGridMaxColsRows : g->rows;
+    g->originX = CGRectGetMinX(allBounds);
+    g->originY = CGRectGetMinY(allBounds);
+    g->cellWidth = CGRectGetWidth(allBounds) / g->cols;
+    g->cellHeight = CGRectGetHeight(allBounds) / g->rows;
+}
+
+//-------------------------------------------------------------------------------------------
+// The range of cells r overlaps, [*c0..*c1] x [*r0..*r1]. Returns false if r is outside the grid.
+static Boolean GetGridCells(const GridLayout* g, CGRect r, UInt32* c0, UInt32* c1, UInt32* r0, UInt32* r1)
+{
+    double x0 = (CGRectGetMinX(r) - g->originX) / g->cellWidth;
+    double x1 = (CGRectGetMaxX(r) - g->originX) / g->cellWidth;
+    double y0 = (CGRectGetMinY(r) - g->originY) / g->cellHeight;
+    double y1 = (CGRectGetMaxY(r) - g->originY) / g->cellHeight;
+    
+    if (CGRectIsNull(r) || !(x1 >= 0) || !(y1 >= 0) || !(x0 < g->cols) || !(y0 < g->rows))
+	return false;	    // (also catches NaNs)
+	
+    *c0 = (x0 > 0) ? (UInt32)x0 : 0;
+    *r0 = (y0 > 0) ? (UInt32)y0 : 0;
+    *c1 = (x1 < g->cols - 1) ? (UInt32)x1 : g->cols - 1;
+    *r1 = (y1 < g->rows - 1) ? (UInt32)y1 : g->rows - 1;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------
+// Calls proc with the index of every cell an object with bounds r goes to.
+static void ForEachGridCell(const GridLayout* g, CGRect r, void (*proc)(void* refCon, UInt32 cell), void* refCon)
+{
+    UInt32 c0, c1, r0, r1, c, row;
+    
+    if (!GetGridCells(g, r, &c0, &c1, &r0, &r1) || ((c1 - c0 + 1) * (r1 - r0 + 1) > kGridMaxCellsPerObject))
+    {
+	(*proc)(refCon, g->cols * g->rows);	    // the overflow cell
+	return;
+    }
+    for (row = r0; row <= r1; ++row)
+    {
+	for (c = c0; c <= c1; ++c)
+	    (*proc)(refCon, row * g->cols + c);
+    }
+}
+
+struct GridFiller {
+    UInt32*	counts;	    // per cell; while filling, the next free slot
+    UInt8*	indices;    // NULL while counting
+    UInt32	objIndex;
+};
+typedef struct GridFiller GridFiller;
+
+static void GridFillerProc(void* refCon, UInt32 cell)
+{
+    GridFiller* f = (GridFiller*)refCon;
+    
+    if (f->indices == NULL)
+	f->counts[cell] += 1;
+    else
+	PutUInt32(f->indices + 4 * f->counts[cell]++, f->objIndex);
+}
+
+//-------------------------------------------------------------------------------------------
+// The whole document is laid out in one CFData: header, OTOC chunk, BNDS and GRID chunks
+// (for larger documents), PNTS chunk (if there are polygons), STYL chunk and the OBJS chunks.
+// Paths are walked twice, once to size the PNTS chunk.
+// Only looks at the objects, not at their list links, so it can run on another thread
+// while the list changes (see CSkAutosave.c).
+CFDataRef CSkCreateBinaryDocumentDataFromObjects(const CSkObjectPtr* objects, UInt32 numObjects)
+{
+    PathWriter		pathWriter = { NULL, 0 };
+    StyleNumbering	styles;
+    UInt32		numFeatures, numChunks, headerSize, tocSize, pntsSize, stylSize, i, k;
+    UInt32		bndsSize = 0, gridSize = 0, numCells = 0, numIndices = 0;
+    CGRect*		bounds = NULL;
+    CGRect		allBounds = CGRectNull;
+    GridLayout		grid;
+    GridFiller		filler = { NULL, NULL, 0 };
+    CFMutableDataRef	data = NULL;
+    UInt8*		base;
+    UInt8*		p;
+    UInt8*		toc;
+    UInt8*		points;
+    
+    for (i = 0; i < numObjects; ++i)
+    {
+	CSkShapePtr sh = CSkObjectGetShape(objects[i]);
+	if (CSkShapeGetType(sh) == kFreePolygon)
+	    PutPolygonRecords(&pathWriter, sh);
+    }
+    require(NumberStyles(objects, numObjects, &styles), CantAllocate);
+    
+    // render bounds and grid cell counts, for the spatial index
+    if (numObjects >= kCSkIndexMinObjects)
+    {
+	bounds = (CGRect*)malloc(numObjects * sizeof(CGRect));
+	require(bounds != NULL, CantAllocate);
+	for (i = 0; i < numObjects; ++i)
+	{
+	    CGRect r = GetDrawObjRenderBounds(objects[i], false);
+	    // as stored, so that the reader puts it in the same cells
+	    bounds[i] = CGRectMake((float)r.origin.x, (float)r.origin.y, (float)r.size.width, (float)r.size.height);
+	    allBounds = CGRectUnion(allBounds, bounds[i]);
+	}
+	MakeGridLayout(allBounds, numObjects, &grid);
+	numCells = grid.cols * grid.rows + 1;
+	filler.counts = (UInt32*)calloc(numCells + 1, sizeof(UInt32));
+	require(filler.counts != NULL, CantAllocate);
+	for (i = 0; i < numObjects; ++i)
+	    ForEachGridCell(&grid, bounds[i], GridFillerProc, &filler);
+	for (i = 0; i < numCells; ++i)
+	    numIndices += filler.counts[i];
+	    
+	bndsSize = kTableHeaderSize + numObjects * kCSkBoundsRecordSize;
+	gridSize = kGridHeaderSize + 4 * (numCells + 1) + 4 * numIndices;
+    }
+    
+    numChunks	= (numObjects > 0) ? (numObjects + kCSkObjectsPerChunk - 1) / kCSkObjectsPerChunk : 1;
+    numFeatures = 4 + ((pathWriter.count > 0) ? 1 : 0) + ((bounds != NULL) ? 2 : 0);
+    headerSize	= kCSkBinaryHeaderSize + numFeatures * kFeatureEntrySize;
+    tocSize	= kTableHeaderSize + numChunks * kTocEntrySize;
+    pntsSize	= (pathWriter.count > 0) ? kTableHeaderSize + pathWriter.count * kCSkPathPointRecordSize : 0;
+    stylSize	= kTableHeaderSize + styles.count * kCSkStyleRecordSize;
+    
+    data = CFDataCreateMutable(kCFAllocatorDefault, 0);
+    require(data != NULL, CantAllocate);
+    CFDataSetLength(data, headerSize + kChunkHeaderSize + tocSize
+			    + ((bounds != NULL) ? 2 * kChunkHeaderSize + bndsSize + gridSize : 0)
+			    + (pntsSize > 0 ? kChunkHeaderSize + Padded(pntsSize) : 0)
+			    + kChunkHeaderSize + stylSize
+			    + numChunks * (kChunkHeaderSize + kTableHeaderSize) 
+			    + numObjects * kCSkObjectRecordSize);	// zero-filled
+    base = p = CFDataGetMutableBytePtr(data);
+    
+    // header and feature table
+    memcpy(p, kCSkBinaryMagic, sizeof(kCSkBinaryMagic));
+    PutUInt16(p + 4, kCSkBinaryMajorVersion);
+    PutUInt16(p + 6, kCSkBinaryMinorVersion);
+    PutUInt32(p + 8, headerSize);
+    PutUInt32(p + 12, numFeatures);
+    p += kCSkBinaryHeaderSize;
+    p = PutFeature(p, kCSkChunkObjects, kCSkObjectsVersion, kCSkFeatureRequired);
+    p = PutFeature(p, kCSkChunkObjectIndex, kCSkObjectIndexVersion, 0);
+    p = PutFeature(p, kCSkChunkJournal, kCSkJournalVersion, kCSkFeatureRequired);
+    p = PutFeature(p, kCSkChunkStyles, kCSkStylesVersion, kCSkFeatureRequired);
+    if (bounds != NULL)
+    {
+	p = PutFeature(p, kCSkChunkBounds, kCSkBoundsVersion, 0);
+	p = PutFeature(p, kCSkChunkGrid, kCSkGridVersion, 0);
+    }
+    if (pntsSize > 0)
+	p = PutFeature(p, kCSkChunkPathPoints, kCSkPathPointsVersion, kCSkFeatureRequired);
+    
+    // OTOC, filled in as the OBJS chunks are written
+    toc = PutChunkHeader(p, kCSkChunkObjectIndex, tocSize);
+    PutUInt32(toc, numChunks);
+    PutUInt32(toc + 4, kTocEntrySize);
+    toc += kTableHeaderSize;
+    p = toc + numChunks * kTocEntrySize;
+    
+    // BNDS and GRID
+    if (bounds != NULL)
+    {
+	UInt32 start = 0;
+	
+	p = PutChunkHeader(p, kCSkChunkBounds, bndsSize);
+	PutUInt32(p, numObjects);
+	PutUInt32(p + 4, kCSkBoundsRecordSize);
+	p += kTableHeaderSize;
+	for (i = 0; i < numObjects; ++i, p += kCSkBoundsRecordSize)
+	{
+	    PutFloat32(p, bounds[i].origin.x);
+	    PutFloat32(p + 4, bounds[i].origin.y);
+	    PutFloat32(p + 8, bounds[i].size.width);
+	    PutFloat32(p + 12, bounds[i].size.height);
+	}
+	
+	p = PutChunkHeader(p, kCSkChunkGrid, gridSize);
+	PutFloat32(p, grid.originX);
+	PutFloat32(p + 4, grid.originY);
+	PutFloat32(p + 8, grid.cellWidth);
+	PutFloat32(p + 12, grid.cellHeight);
+	PutUInt32(p + 16, grid.cols);
+	PutUInt32(p + 20, grid.rows);
+	PutUInt32(p + 24, numIndices);
+	p += kGridHeaderSize;
+	for (i = 0; i <= numCells; ++i)
+	{
+	    UInt32 count = (i < numCells) ? filler.counts[i] : 0;
+	    PutUInt32(p + 4 * i, start);
+	    filler.counts[i] = start;			// next free slot
+	    start += count;
+	}
+	filler.indices = p + 4 * (numCells + 1);
+	for (filler.objIndex = 0; filler.objIndex < numObjects; ++filler.objIndex)
+	    ForEachGridCell(&grid, bounds[filler.objIndex], GridFillerProc, &filler);
+	p = filler.indices + 4 * numIndices;
+    }
+    
+    // PNTS and STYL, followed by OBJS, so that a reader has the path and style records by
+    // the time it gets to the objects. The object records fill in the path records as they go.
+    points = p;
+    if (pntsSize > 0)
+    {
+	points = PutChunkHeader(points, kCSkChunkPathPoints, pntsSize);
+	PutUInt32(points, pathWriter.count);
+	PutUInt32(points + 4, kCSkPathPointRecordSize);
+	points += kTableHeaderSize;
+	p += kChunkHeaderSize + Padded(pntsSize);
+    }
+    
+    p = PutChunkHeader(p, kCSkChunkStyles, stylSize);
+    PutUInt32(p, styles.count);
+    PutUInt32(p + 4, kCSkStyleRecordSize);
+    p += kTableHeaderSize;
+    for (i = 0; i < styles.count; ++i, p += kCSkStyleRecordSize)
+	PutAttributes(p, CSkStyleGetAttributes(styles.styles[i]));
+    
+    pathWriter.records = points;
+    pathWriter.count = 0;
+    for (i = 0; i < numChunks; ++i)
+    {
+	UInt32 count = numObjects - i * kCSkObjectsPerChunk;
+	if (count > kCSkObjectsPerChunk)
+	    count = kCSkObjectsPerChunk;
+	    
+	PutUInt32(toc + i * kTocEntrySize, p - base);
+	PutUInt32(toc + i * kTocEntrySize + 4, count);
+	p = PutChunkHeader(p, kCSkChunkObjects, kTableHeaderSize + count * kCSkObjectRecordSize);
+	PutUInt32(p, count);
+	PutUInt32(p + 4, kCSkObjectRecordSize);
+	p += kTableHeaderSize;
+	
+	for (k = 0; k < count; ++k)
+	{
+	    PutObjectRecord(p, objects[i * kCSkObjectsPerChunk + k], &pathWriter, &styles);
+	    p += kCSkObjectRecordSize;
+	}
+    }
+    
+CantAllocate:
+    free(bounds);
+    free(filler.counts);
+    free(styles.indexByID);
+    free(styles.styles);
+    return data;
+}
+
+//-------------------------------------------------------------------------------------------
+CFDataRef CSkCreateBinaryDocumentData(const DrawObjList* objList)
+{
+    CSkObjectPtr*   objects = NULL;
+    CSkObjectPtr    obj;
+    UInt32	    numObjects = 0, i = 0;
+    CFDataRef	    data;
+    
+    for (obj = objList->firstItem; obj != NULL; obj = CSkObjectGetNext(obj))
+	numObjects += 1;
+    if (numObjects > 0)
+    {
+	objects = (CSkObjectPtr*)malloc(numObjects * sizeof(CSkObjectPtr));
+	if (objects == NULL)
+	    return NULL;
+	for (obj = objList->firstItem; obj != NULL; obj = CSkObjectGetNext(obj))
+	    objects[i++] = obj;
+    }
+    data = CSkCreateBinaryDocumentDataFromObjects(objects, numObjects);
+    free(objects);
+    return data;
+}
+
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------
+// Reading. Everything read from the file is range-checked before use.
+
+// A document read from a stream gets its PNTS records through a stream of its own, a
+// window of kPolygonChunkSize records at a time as the polygons take them, so they are
+// never all in memory. Polygons take their records in order; one that goes back to
+// records already read starts the stream over.
+struct PathCursor {
+    CSkReadStream   s;
+    CFURLRef	    url;
+    SInt64	    offset;	// of the first record in the file
+    UInt32	    next;	// the record s is at
+};
+typedef struct PathCursor PathCursor;
+
+struct PathTable {
+    const UInt8*    records;	// NULL: read through cursor
+    UInt32	    count;
+    UInt32	    recordSize;
+    PathCursor*	    cursor;
+};
+typedef struct PathTable PathTable;
+
+// Where the objects read get their styles. Object records that refer to STYL records (OBJS
+// from version 3) take them from interned if the reader interned the STYL records up front;
+// otherwise the STYL record, or the attributes in the object record, are interned in table.
+struct RecordStyles {
+    CSkStyleTablePtr	table;
+    Boolean		byIndex;	// the object records refer to STYL records
+    const UInt8*	records;	// STYL records
+    UInt32		count;
+    UInt32		recordSize;
+    CSkStylePtr*	interned;	// by STYL record index, or NULL
+};
+typedef struct RecordStyles RecordStyles;
+
+//-------------------------------------------------------------------------------------------
+// Path record i. One read through the cursor is good until the next call.
+static const UInt8* GetPathRecord(const PathTable* table, UInt32 i)
+{
+    PathCursor* c = table->cursor;
+    
+    if (table->records != NULL)
+	return table->records + i * table->recordSize;
+    if ((c->s.stream == NULL) || (i < c->next))
+    {
+	CSkReadStreamClose(&c->s);
+	c->next = 0;
+	if (!CSkReadStreamOpen(&c->s, c->url, c->offset, kPolygonChunkSize * table->recordSize))
+	    return NULL;
+    }
+    if (!CSkReadStreamSkip(&c->s, (i - c->next) * table->recordSize))
+	return NULL;
+    c->next = i + 1;
+    return CSkReadStreamRead(&c->s, table->recordSize);
+}
+
+// Adds the polygon of count records from first to sh. False if they are out of range,
+// can't be read, or the points can't be allocated.
+static Boolean AddPolygonFromRecords(CSkShapePtr sh, const PathTable* table, UInt32 first, UInt32 count)
+{
+    UInt32 i = first, end = first + count;
+    
+    if ((first > table->count) || (count > table->count - first))
+	return false;
+	
+    while (i < end)
+    {
+	const UInt8*	p = GetPathRecord(table, i++);
+	UInt8		type;
+	CGPoint		pt[3];
+	int		k, numPoints;
+
+	if (p == NULL)
+	    return false;
+	type = p[0];
+	switch (type)
+	{
+	    case kCGPathElementMoveToPoint:
+	    case kCGPathElementAddLineToPoint:	    numPoints = 1;  break;
+	    case kCGPathElementAddQuadCurveToPoint: numPoints = 2;  break;
+	    case kCGPathElementAddCurveToPoint:	    numPoints = 3;  break;
+	    case kCGPathElementCloseSubpath:	    CSkShapeClosePolygonSubpath(sh);	continue;
+	    default:				    continue;	// stray continuation record
+	}
+	if (i - 1 + numPoints > end)
+	    break;					// truncated element
+	for (k = 0; k < numPoints; ++k)
+	{
+	    if ((k > 0) && ((p = GetPathRecord(table, i++)) == NULL))
+		return false;
+	    pt[k] = CGPointMake(GetFloat32(p + 4), GetFloat32(p + 8));
+	}
+	if (!CSkShapeAddPolygonElement(sh, type, pt))
+	    return false;
+    }
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------
+static void GetAttributes(const UInt8* p, CSkObjectAttributes* attr)
+{
+    attr->lineCap   = p[kObjLineCap];
+    attr->lineJoin  = p[kObjLineJoin];
+    attr->lineStyle = p[kObjLineStyle];
+    attr->lineWidth = GetFloat32(p + kObjLineWidth);
+    GetColor(p + kObjStrokeColor, &attr->strokeColor);
+    GetColor(p + kObjFillColor, &attr->fillColor);
+}
+
+// Interns all of the STYL records, so that the objects only need to retain their style.
+static Boolean InternStyleRecords(RecordStyles* styles)
+{
+    UInt32 i;
+    
+    styles->interned = (CSkStylePtr*)calloc(styles->count + 1, sizeof(CSkStylePtr));
+    if (styles->interned == NULL)
+	return false;
+    for (i = 0; i < styles->count; ++i)
+    {
+	CSkObjectAttributes attr;
+	
+	GetAttributes(styles->records + i * styles->recordSize, &attr);
+	styles->interned[i] = CSkStyleTableIntern(styles->table, &attr);
+	if (styles->interned[i] == NULL)
+	    return false;
+    }
+    return true;
+}
+
+static void ReleaseStyleRecords(RecordStyles* styles)
+{
+    UInt32 i;
+    
+    if (styles->interned == NULL)
+	return;
+    for (i = 0; (i < styles->count) && (styles->interned[i] != NULL); ++i)
+	CSkStyleRelease(styles->interned[i]);
+    free(styles->interned);
+    styles->interned = NULL;
+}
+
+// The style of the object record at p, retained; NULL if the record is damaged.
+static CSkStylePtr GetRecordStyle(const UInt8* p, const RecordStyles* styles)
+{
+    CSkObjectAttributes attr;
+    
+    if (styles->byIndex)
+    {
+	UInt32 index = GetUInt32(p + kObjStyleIndex);
+	if (index >= styles->count)
+	    return NULL;
+	if (styles->interned != NULL)
+	    return CSkStyleRetain(styles->interned[index]);
+	p = styles->records + index * styles->recordSize;
+    }
+    GetAttributes(p, &attr);
+    return (styles->table != NULL) ? CSkStyleTableIntern(styles->table, &attr) : NULL;
+}
+
+//-------------------------------------------------------------------------------------------
+static CSkObjectPtr CreateObjectFromRecord(const UInt8* p, const PathTable* paths, const RecordStyles* styles)
+{
+    int			shapeType = p[kObjShapeType];
+    const UInt8*	g = p + (styles->byIndex ? kObjGeometry : kObjInlineGeometry);
+    CSkShapePtr		sh;
+    CSkStylePtr		style;
+    CSkObjectPtr	obj = NULL;
+    
+    if ((shapeType < kLineShape) || (shapeType > kFreePolygon))
+	return NULL;
+    
+    sh = CSkShapeCreate(shapeType);
+    switch (shapeType)
+    {
+	case kLineShape:
+	case kQuadBezier:
+	case kCubicBezier:
+	{
+	    int i;
+	    for (i = 0; i <= shapeType; ++i)
+		CSkShapeSetPointAtIndex(sh, CGPointMake(GetFloat32(g + 8 * i), GetFloat32(g + 8 * i + 4)), i);
+	}
+	break;
+	
+	case kRRectShape:
+	    CSkShapeSetRRectRadii(sh, GetFloat32(g + 16), GetFloat32(g + 20));
+	    // fall through
+	    
+	case kRectShape:
+	case kOvalShape:
+	    CSkShapeSetBounds(sh, CGRectMake(GetFloat32(g), GetFloat32(g + 4), GetFloat32(g + 8), GetFloat32(g + 12)));
+	    break;
+	
+	case kFreePolygon:
+	    if (!AddPolygonFromRecords(sh, paths, GetUInt32(g), GetUInt32(g + 4)))
+	    {
+		CSkShapeRelease(sh);
+		return NULL;
+	    }
+	    break;
+    }
+    
+    style = GetRecordStyle(p, styles);
+    if (style != NULL)
+    {
+	obj = CreateCSkObjWithStyle(style, sh);
+	CSkStyleRelease(style);
+    }
+    if (obj == NULL)
+	CSkShapeRelease(sh);
+    return obj;
+}
+
+//-------------------------------------------------------------------------------------------
+// Checks the fixed header and the feature table; header points at headerSize bytes.
+// *outByIndex: the object records refer to STYL records.
+static OSStatus CheckHeader(const UInt8* header, UInt32 headerSize, Boolean* outHasPaths, Boolean* outByIndex)
+{
+    UInt32  numFeatures, i;
+    
+    *outHasPaths = false;
+    *outByIndex = false;
+    if (GetUInt16(header + 4) > kCSkBinaryMajorVersion)
+    {
+	fprintf(stderr, "CSkBinaryDocument: format version %d is too new\n", (int)GetUInt16(header + 4));
+	return kUnsupportedFileFormat;
+    }
+    numFeatures = GetUInt32(header + 12);
+    if (numFeatures > (headerSize - kCSkBinaryHeaderSize) / kFeatureEntrySize)
+	return kBadFileFormat;
+    
+    for (i = 0; i < numFeatures; ++i)
+    {
+	const UInt8*	f = header + kCSkBinaryHeaderSize + i * kFeatureEntrySize;
+	UInt32		tag = GetUInt32(f);
+	UInt16		version = GetUInt16(f + 4);
+	Boolean		known = ((tag == kCSkChunkObjects) && (version <= kCSkObjectsVersion))
+			    || ((tag == kCSkChunkPathPoints) && (version <= kCSkPathPointsVersion))
+			    || ((tag == kCSkChunkObjectIndex) && (version <= kCSkObjectIndexVersion))
+			    || ((tag == kCSkChunkBounds) && (version <= kCSkBoundsVersion))
+			    || ((tag == kCSkChunkGrid) && (version <= kCSkGridVersion))
+			    || ((tag == kCSkChunkJournal) && (version <= kCSkJournalVersion))
+			    || ((tag == kCSkChunkStyles) && (version <= kCSkStylesVersion));
+	
+	if (!known && (GetUInt16(f + 6) & kCSkFeatureRequired))
+	{
+	    char tagStr[5] = { tag >> 24, tag >> 16, tag >> 8, tag, 0 };
+	    fprintf(stderr, "CSkBinaryDocument: unsupported feature '%s' version %d\n", tagStr, (int)version);
+	    return kUnsupportedFileFormat;
+	}
+	*outHasPaths |= (tag == kCSkChunkPathPoints);
+	*outByIndex |= (tag == kCSkChunkObjects) && (version >= kStyleIndexObjectsVersion);
+    }
+    return noErr;
+}
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------
+// JRNL chunks. While a document is read, byID finds the objects a chunk refers to.
+
+struct CSkJournal {
+    CSkObjectPtr*   byID;	    // only while reading
+    UInt8*	    gone;	    // a bit per ID: deleted by a JRNL chunk
+    UInt32	    capacity;	    // IDs that byID and gone have room for
+    UInt32	    nextObjectID;
+    UInt32	    sequence;	    // of the last JRNL chunk, 0 if there is none
+    UInt32	    baseLength;	    // where the first JRNL chunk starts
+    UInt32	    validLength;    // where the next one goes; anything after it is a torn write
+    dev_t	    fileDevice;	    // the file as we last read or wrote it, to notice
+    ino_t	    fileInode;	    // when somebody else changed or replaced it
+    off_t	    fileSize;
+    time_t	    fileModDate;
+};
+
+enum {
+    kJournalHeaderSize		= 28,
+    kJournalPutHeaderSize	= 8,	    // object ID, ID of the object in front of it
+    kJournalChecksumSize	= 4,
+    kJournalMinCapacity		= 1024
+};
+
+static Boolean TestBit(const UInt8* bits, UInt32 i)	{ return (bits[i >> 3] >> (i & 7)) & 1; }
+static void SetBit(UInt8* bits, UInt32 i)		{ bits[i >> 3] |= 1 << (i & 7); }
+static void ClearBit(UInt8* bits, UInt32 i)		{ bits[i >> 3] &= ~(1 << (i & 7)); }
+
+//-------------------------------------------------------------------------------------------
+static UInt32 Adler32(const UInt8* p, UInt32 length)
+{
+    UInt32 a = 1, b = 0;
+    
+    while (length > 0)
+    {
+	UInt32 n = (length < 5552) ? length : 5552;	// so that b can't overflow
+	length -= n;
+	while (n-- > 0)
+	{
+	    a += *p++;
+	    b += a;
+	}
+	a %= 65521;
+	b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+//-------------------------------------------------------------------------------------------
+// Makes room for IDs below numIDs.
+static Boolean GrowJournal(CSkJournal* j, UInt32 numIDs)
+{
+    UInt32  capacity = j->capacity;
+    UInt8*  gone;
+    
+    if (numIDs <= capacity)
+	return true;
+    while (capacity < numIDs)
+	capacity = (capacity < kJournalMinCapacity) ? kJournalMinCapacity 
+			: (capacity < 0x80000000) ? 2 * capacity : numIDs;
+    gone = (UInt8*)realloc(j->gone, capacity / 8 + 1);
+    if (gone == NULL)
+	return false;
+    memset(gone + (j->capacity + 7) / 8, 0, capacity / 8 + 1 - (j->capacity + 7) / 8);
+    j->gone = gone;
+    if (j->byID != NULL)
+    {
+	CSkObjectPtr* byID = (CSkObjectPtr*)realloc(j->byID, capacity * sizeof(CSkObjectPtr));
+	if (byID == NULL)
+	    return false;
+	memset(byID + j->capacity, 0, (capacity - j->capacity) * sizeof(CSkObjectPtr));
+	j->byID = byID;
+    }
+    j->capacity = capacity;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------
+// The file has numObjects objects (IDs 1 to numObjects) and no JRNL chunks from baseLength on.
+static Boolean SetJournalBase(CSkJournal* j, UInt32 numObjects, UInt32 baseLength)
+{
+    free(j->byID);
+    j->byID = NULL;
+    if (j->gone != NULL)
+	memset(j->gone, 0, (j->capacity + 7) / 8);
+    j->nextObjectID = numObjects + 1;
+    j->sequence = 0;
+    j->baseLength = j->validLength = baseLength;
+    return GrowJournal(j, j->nextObjectID);
+}
+
+static void RememberJournalFile(CSkJournal* j, const struct stat* sb)
+{
+    j->fileDevice = sb->st_dev;
+    j->fileInode = sb->st_ino;
+    j->fileSize = sb->st_size;
+    j->fileModDate = sb->st_mtime;
+}
+
+static Boolean IsJournalFile(const CSkJournal* j, const struct stat* sb)
+{
+    return (sb->st_dev == j->fileDevice) && (sb->st_ino == j->fileInode) 
+	    && (sb->st_size == j->fileSize) && (sb->st_mtime == j->fileModDate);
+}
+
+//-------------------------------------------------------------------------------------------
+CSkJournalPtr CSkJournalCreate(const char* path, UInt32 numObjects)
+{
+    CSkJournal*	j = (CSkJournal*)calloc(1, sizeof(CSkJournal));
+    struct stat	sb;
+    
+    if (j == NULL)
+	return NULL;
+    if ((stat(path, &sb) != 0) || (sb.st_size > 0xFFFFFFFF) || !SetJournalBase(j, numObjects, sb.st_size))
+    {
+	CSkJournalRelease(j);
+	return NULL;
+    }
+    RememberJournalFile(j, &sb);
+    return j;
+}
+
+void CSkJournalRelease(CSkJournalPtr journal)
+{
+    if (journal != NULL)
+    {
+	free(journal->byID);
+	free(journal->gone);
+	free(journal);
+    }
+}
+
+//-------------------------------------------------------------------------------------------
+// Called by the readers once the objects of the OBJS chunks are in objList.
+static Boolean StartJournal(CSkJournal* j, DrawObjList* objList, UInt32 baseLength)
+{
+    CSkObjectPtr    obj;
+    UInt32	    numObjects = 0;
+    
+    for (obj = objList->firstItem; obj != NULL; obj = CSkObjectGetNext(obj))
+	CSkObjectSetID(obj, ++numObjects);
+    return SetJournalBase(j, numObjects, baseLength);
+}
+
+static Boolean MakeJournalIDTable(CSkJournal* j, const DrawObjList* objList)
+{
+    CSkObjectPtr obj;
+    
+    if (j->byID != NULL)
+	return true;
+    j->byID = (CSkObjectPtr*)calloc(j->capacity, sizeof(CSkObjectPtr));
+    if (j->byID == NULL)
+	return false;
+    for (obj = objList->firstItem; obj != NULL; obj = CSkObjectGetNext(obj))
+    {
+	if (CSkObjectGetID(obj) < j->capacity)
+	    j->byID[CSkObjectGetID(obj)] = obj;
+    }
+    return true;
+}
+
+static void RemoveJournalObject(CSkJournal* j, DrawObjList* objList, UInt32 objectID)
+{
+    CSkObjectPtr obj = j->byID[objectID];
+    
+    if (obj != NULL)
+    {
+	RemoveDrawObjFromList(objList, obj);
+	ReleaseDrawObj(obj);
+	j->byID[objectID] = NULL;
+    }
+}
+
+//-------------------------------------------------------------------------------------------
+// Applies one JRNL chunk to objList. Everything is checked and decoded before objList is
+// touched, so a chunk that doesn't check out leaves the document as it was.
+static Boolean ApplyJournalChunk(CSkJournal* j, DrawObjList* objList, const UInt8* payload, UInt32 size)
+{
+    UInt32	    sequence, nextID, numDeleted, numPuts, putSize, objectID, prevID, i;
+    UInt64	    tableSize;
+    PathTable	    paths;
+    RecordStyles    styles = { NULL, false, NULL, 0, 0, NULL };
+    const UInt8*    deleted;
+    const UInt8*    puts;
+    CSkObjectPtr*   newObjs = NULL;
+    Boolean	    ok = false;
+    
+    if ((size < kJournalHeaderSize + kJournalChecksumSize)
+	    || (Adler32(payload, size - kJournalChecksumSize) != GetUInt32(payload + size - kJournalChecksumSize)))
+	return false;
+    sequence = GetUInt32(payload);
+    nextID = GetUInt32(payload + 4);
+    numDeleted = GetUInt32(payload + 8);
+    numPuts = GetUInt32(payload + 12);
+    putSize = GetUInt32(payload + 16);
+    paths.count = GetUInt32(payload + 20);
+    paths.recordSize = GetUInt32(payload + 24);
+    tableSize = kJournalHeaderSize + 4 * (UInt64)numDeleted + (UInt64)numPuts * putSize
+		+ (UInt64)paths.count * paths.recordSize + kJournalChecksumSize;
+    if ((sequence != j->sequence + 1) || (nextID < j->nextObjectID) || (tableSize > size)
+	    || (putSize < kJournalPutHeaderSize + kCSkInlineObjectRecordSize) || (putSize > kMaxRecordSize)
+	    || (paths.recordSize < kCSkPathPointRecordSize) || (paths.recordSize > kMaxRecordSize))
+	return false;
+    deleted = payload + kJournalHeaderSize;
+    puts = deleted + 4 * numDeleted;
+    paths.records = puts + numPuts * putSize;
+    paths.cursor = NULL;
+    styles.table = CSkObjListGetStyles(objList);
+    
+    require(GrowJournal(j, nextID) && MakeJournalIDTable(j, objList), Done);
+    newObjs = (CSkObjectPtr*)calloc(numPuts + 1, sizeof(CSkObjectPtr));
+    require(newObjs != NULL, Done);
+    for (i = 0; i < numDeleted; ++i)
+    {
+	objectID = GetUInt32(deleted + 4 * i);
+	require((objectID > 0) && (objectID < nextID), Done);
+    }
+    for (i = 0; i < numPuts; ++i)
+    {
+	objectID = GetUInt32(puts + i * putSize);
+	prevID = GetUInt32(puts + i * putSize + 4);
+	require((objectID > 0) && (objectID < nextID), Done);
+	require((prevID < nextID) || ((prevID == kCSkJournalSamePlace) && (j->byID[objectID] != NULL)), Done);
+	newObjs[i] = CreateObjectFromRecord(puts + i * putSize + kJournalPutHeaderSize, &paths, &styles);
+	require(newObjs[i] != NULL, Done);
+	CSkObjectSetID(newObjs[i], objectID);
+    }
+    
+    // Deletions, then the objects replaced in place, then the ones that go behind another
+    // object, front to back, so that the object in front of each is already where it goes.
+    for (i = 0; i < numDeleted; ++i)
+    {
+	objectID = GetUInt32(deleted + 4 * i);
+	RemoveJournalObject(j, objList, objectID);
+	SetBit(j->gone, objectID);
+    }
+    for (i = 0; i < numPuts; ++i)
+    {
+	CSkObjectPtr oldObj;
+	
+	objectID = GetUInt32(puts + i * putSize);
+	oldObj = j->byID[objectID];
+	if ((GetUInt32(puts + i * putSize + 4) == kCSkJournalSamePlace) && (oldObj != NULL))
+	{
+	    InsertDrawObjBefore(objList, newObjs[i], oldObj);
+	    RemoveJournalObject(j, objList, objectID);
+	    j->byID[objectID] = newObjs[i];
+	    newObjs[i] = NULL;
+	}
+	else
+	{
+	    RemoveJournalObject(j, objList, objectID);
+	}
+	ClearBit(j->gone, objectID);
+    }
+    for (i = 0; i < numPuts; ++i)
+    {
+	CSkObjectPtr prevObj;
+	
+	if (newObjs[i] == NULL)
+	    continue;
+	objectID = GetUInt32(puts + i * putSize);
+	prevID = GetUInt32(puts + i * putSize + 4);
+	prevObj = (prevID != kCSkJournalSamePlace) ? j->byID[prevID] : NULL;
+	if (prevObj == NULL)
+	    AddDrawObjToList(objList, newObjs[i]);
+	else if (CSkObjectGetNext(prevObj) != NULL)
+	    InsertDrawObjBefore(objList, newObjs[i], CSkObjectGetNext(prevObj));
+	else
+	    AppendDrawObjToList(objList, newObjs[i]);
+	j->byID[objectID] = newObjs[i];
+	newObjs[i] = NULL;
+    }
+    j->sequence = sequence;
+    j->nextObjectID = nextID;
+    ok = true;
+    
+Done:
+    if (newObjs != NULL)
+    {
+	for (i = 0; i < numPuts; ++i)
+	{
+	    if (newObjs[i] != NULL)
+		ReleaseDrawObj(newObjs[i]);
+	}
+	free(newObjs);
+    }
+    return ok;
+}
+
+//-------------------------------------------------------------------------------------------
+// Reads the record count and size that start an OBJS or PNTS chunk of the given size.
+// A record has to fit in the read window.
+static Boolean ReadRecordTableHeader(CSkReadStream* s, UInt32 size, UInt32 minRecordSize,
+					UInt32* outCount, UInt32* outRecordSize)
+{
+    const UInt8*    p;
+    UInt32	    count, recordSize;
+
+    if ((size < kTableHeaderSize) || ((p = CSkReadStreamRead(s, kTableHeaderSize)) == NULL))
+	return false;
+    count = GetUInt32(p);
+    recordSize = GetUInt32(p + 4);
+    if ((recordSize < minRecordSize) || (recordSize > kMaxRecordSize) 
+	    || ((UInt64)count * recordSize > size - kTableHeaderSize))
+	return false;
+	
+    *outCount = count;
+    *outRecordSize = recordSize;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------
+// Sets up the cursor of paths at the PNTS chunk of url. That can come before or after the
+// OBJS chunks, so it is looked for from the end of the header, with a stream of its own.
+static OSStatus FindPathRecords(PathTable* paths, PathCursor* cursor, CFURLRef url, UInt32 headerSize)
+{
+    CSkReadStream   s;
+    const UInt8*    p;
+    UInt32	    type, size;
+    OSStatus	    err = kBadFileFormat;
+    
+    memset(&s, 0, sizeof(s));
+    require(CSkReadStreamOpen(&s, url, headerSize, kPolygonChunkSize * kCSkPathPointRecordSize), Done);
+    while ((p = CSkReadStreamRead(&s, kChunkHeaderSize)) != NULL)
+    {
+	type = GetUInt32(p);
+	size = GetUInt32(p + 4);
+	if ((type == kCSkChunkJournal) || (Padded(size) < size))
+	    break;					// no PNTS before the changes
+	if (type == kCSkChunkPathPoints)
+	{
+	    if (ReadRecordTableHeader(&s, size, kCSkPathPointRecordSize, &paths->count, &paths->recordSize))
+	    {
+		cursor->url = url;
+		cursor->offset = s.bytesRead - (s.end - s.pos);
+		paths->cursor = cursor;
+		err = noErr;
+	    }
+	    break;
+	}
+	if (!CSkReadStreamSkip(&s, Padded(size)))
+	    break;
+    }
+    
+Done:
+    if (s.err != noErr)
+	err = s.err;
+    CSkReadStreamClose(&s);
+    return err;
+}
+
+//-------------------------------------------------------------------------------------------
+// Builds objList (front to back) from a binary document, one object record at a time.
+// The STYL table is kept in memory while reading, since object records refer into it;
+// the PNTS records are read alongside the objects, through a second stream on s->url.
+// JRNL chunks are applied as they come.
+OSStatus CSkReadBinaryDocument(CSkReadStream* s, DrawObjList* objList, CSkJournalPtr journal)
+{
+    const UInt8*    p;
+    PathTable	    paths = { NULL, 0, kCSkPathPointRecordSize, NULL };
+    PathCursor	    pathCursor;
+    RecordStyles    styles = { NULL, false, NULL, 0, kCSkStyleRecordSize, NULL };
+    UInt8*	    styleRecords = NULL;
+    UInt8*	    chunk;
+    Boolean	    hasPaths, sawObjects = false, inJournal = false;
+    UInt32	    headerSize, i, count, recordSize;
+    CSkJournal	    localJournal;
+    OSStatus	    err = kBadFileFormat;
+    CSK_TRACE_SPAN("CSkReadBinaryDocument");
+    
+    memset(&pathCursor, 0, sizeof(pathCursor));
+    if (journal == NULL)
+    {
+	memset(&localJournal, 0, sizeof(localJournal));
+	journal = &localJournal;
+    }
+
+    require(((p = CSkReadStreamPeek(s, kCSkBinaryHeaderSize)) != NULL) 
+		&& CSkIsBinaryDocumentData(p, kCSkBinaryHeaderSize), BadFormat);
+    headerSize = GetUInt32(p + 8);
+    require((headerSize >= kCSkBinaryHeaderSize) && (headerSize <= kMaxHeaderSize), BadFormat);
+    require((p = CSkReadStreamRead(s, headerSize)) != NULL, BadFormat);
+    err = CheckHeader(p, headerSize, &hasPaths, &styles.byIndex);
+    if (err != noErr)
+	goto BadFormat;
+    err = kBadFileFormat;
+    styles.table = CSkObjListGetStyles(objList);
+    require(styles.table != NULL, NoMemory);
+    
+    while (!CSkReadStreamAtEnd(s))
+    {
+	UInt32 type, size, rest, offset = s->bytesRead - (s->end - s->pos);
+	
+	if ((p = CSkReadStreamRead(s, kChunkHeaderSize)) == NULL)
+	{
+	    require(inJournal && (s->err == noErr), BadFormat);
+	    break;					// a torn JRNL chunk
+	}
+	type = GetUInt32(p);
+	size = GetUInt32(p + 4);
+	rest = Padded(size);
+	require((rest >= size) || inJournal, BadFormat);
+	
+	if (type == kCSkChunkJournal)
+	{
+	    // Saved changes. One that a crash cut short, or that doesn't check out, is
+	    // ignored along with anything after it.
+	    Boolean applied;
+	    
+	    require(sawObjects, BadFormat);
+	    if (!inJournal)
+	    {
+		require(StartJournal(journal, objList, offset), NoMemory);
+		inJournal = true;
+	    }
+	    if ((rest < size) || ((s->totalBytes > 0) && (size > s->totalBytes - offset)))
+		break;
+	    chunk = (UInt8*)malloc(size + 1);
+	    require(chunk != NULL, NoMemory);
+	    applied = CSkReadStreamCopy(s, chunk, size) && CSkReadStreamSkip(s, rest - size)
+			&& ApplyJournalChunk(journal, objList, chunk, size);
+	    free(chunk);
+	    if (!applied)
+	    {
+		require(s->err == noErr, BadFormat);
+		fprintf(stderr, "CSkReadBinaryDocument: ignoring unfinished or damaged changes\n");
+		break;
+	    }
+	    journal->validLength = offset + kChunkHeaderSize + rest;
+	    continue;
+	}
+	else if ((type == kCSkChunkStyles) && styles.byIndex && (styleRecords == NULL))
+	{
+	    require(ReadRecordTableHeader(s, size, kCSkStyleRecordSize, &count, &recordSize), BadFormat);
+	    styleRecords = (UInt8*)NewPtr(count * recordSize + 1);
+	    require(styleRecords != NULL, NoMemory);
+	    require(CSkReadStreamCopy(s, styleRecords, count * recordSize), BadFormat);
+	    styles.records = styleRecords;
+	    styles.count = count;
+	    styles.recordSize = recordSize;
+	    require(InternStyleRecords(&styles), NoMemory);
+	    rest -= kTableHeaderSize + count * recordSize;
+	}
+	else if (type == kCSkChunkObjects)
+	{
+	    require(!styles.byIndex || (styleRecords != NULL), BadFormat);
+	    require(ReadRecordTableHeader(s, size, styles.byIndex ? kCSkObjectRecordSize : kCSkInlineObjectRecordSize,
+					    &count, &recordSize), BadFormat);
+	    sawObjects = true;
+	    rest -= kTableHeaderSize + count * recordSize;
+	    if (hasPaths && (paths.cursor == NULL))
+	    {
+		err = FindPathRecords(&paths, &pathCursor, s->url, headerSize);
+		require_noerr(err, BadFormat);
+		err = kBadFileFormat;
+	    }
+	    for (i = 0; i < count; ++i)
+	    {
+		CSkObjectPtr obj;
+		
+		require((p = CSkReadStreamRead(s, recordSize)) != NULL, BadFormat);
+		obj = CreateObjectFromRecord(p, &paths, &styles);
+		require(obj != NULL, BadFormat);
+		AppendDrawObjToList(objList, obj);
+	    }
+	}
+	require(CSkReadStreamSkip(s, rest), BadFormat);
+    }
+    require(sawObjects, BadFormat);
+    if (!inJournal)
+	require(StartJournal(journal, objList, s->bytesRead - (s->end - s->pos)), NoMemory);
+    err = noErr;
+    goto Done;
+    
+NoMemory:
+    err = memFullErr;
+    goto Done;
+    
+BadFormat:
+    if (s->err != noErr)
+	err = s->err;
+    else if (pathCursor.s.err != noErr)
+	err = pathCursor.s.err;
+    else if (err == kBadFileFormat)
+	fprintf(stderr, "CSkReadBinaryDocument: damaged file\n");
+	
+Done:
+    CSkReadStreamClose(&pathCursor.s);
+    ReleaseStyleRecords(&styles);
+    if (styleRecords != NULL)
+	DisposePtr((Ptr)styleRecords);
+    free(journal->byID);
+    journal->byID = NULL;
+    if (journal == &localJournal)
+	free(localJournal.gone);
+    return err;
+}
+
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------
+// Parallel decoding of a document that is in memory. Each OBJS chunk is a job. Workers take
+// the next job and decode its records into the job's range of one preallocated array of
+// object pointers, which is linked up in file (z-) order once all workers are done.
+// CreateObjectFromRecord is the same as for the sequential reader, so the result is too.
+// The STYL records are interned before the workers start; they only retain the styles.
+
+struct DecodeJob {
+    const UInt8*    records;
+    UInt32	    count;
+    UInt32	    recordSize;
+    UInt32	    firstSlot;
+};
+typedef struct DecodeJob DecodeJob;
+
+struct DecodeState {
+    DecodeJob*	    jobs;
+    SInt32	    numJobs;
+    int32_t	    nextJob;	    // OSAtomicIncrement32
+    PathTable	    paths;
+    RecordStyles    styles;
+    CSkObjectPtr*   slots;
+    volatile SInt32 failed;
+};
+typedef struct DecodeState DecodeState;
+
+static void* DecodeWorker(void* arg)
+{
+    DecodeState*    st = (DecodeState*)arg;
+    SInt32	    j;
+    
+    while (!st->failed && ((j = OSAtomicIncrement32(&st->nextJob) - 1) < st->numJobs))
+    {
+	const DecodeJob*    job = &st->jobs[j];
+	UInt32		    i;
+	
+	for (i = 0; i < job->count; ++i)
+	{
+	    CSkObjectPtr obj = CreateObjectFromRecord(job->records + i * job->recordSize, &st->paths, &st->styles);
+	    if (obj == NULL)
+	    {
+		st->failed = true;
+		break;
+	    }
+	    st->slots[job->firstSlot + i] = obj;
+	}
+    }
+    return NULL;
+}
+
+//-------------------------------------------------------------------------------------------
+// The record count and size at the start of an OBJS, PNTS or OTOC chunk in memory.
+static Boolean GetRecordTable(const UInt8* payload, UInt32 size, UInt32 minRecordSize,
+				UInt32* outCount, UInt32* outRecordSize)
+{
+    UInt32 count, recordSize;
+
+    if (size < kTableHeaderSize)
+	return false;
+    count = GetUInt32(payload);
+    recordSize = GetUInt32(payload + 4);
+    if ((recordSize < minRecordSize) || ((UInt64)count * recordSize > size - kTableHeaderSize))
+	return false;
+	
+    *outCount = count;
+    *outRecordSize = recordSize;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------
+// Looks up the chunk at offset; returns its payload, or NULL if it isn't all in bytes.
+static const UInt8* GetChunk(const UInt8* bytes, UInt32 length, UInt32 offset, UInt32* outType, UInt32* outSize)
+{
+    if ((offset > length) || (length - offset < kChunkHeaderSize))
+	return NULL;
+    *outType = GetUInt32(bytes + offset);
+    *outSize = GetUInt32(bytes + offset + 4);
+    if (*outSize > length - offset - kChunkHeaderSize)
+	return NULL;
+    return bytes + offset + kChunkHeaderSize;
+}
+
+//-------------------------------------------------------------------------------------------
+static Boolean AddDecodeJob(DecodeState* st, const UInt8* payload, UInt32 size, UInt32* ioNumObjects)
+{
+    DecodeJob*	job;
+    UInt32	count, recordSize;
+    
+    if (!GetRecordTable(payload, size, st->styles.byIndex ? kCSkObjectRecordSize : kCSkInlineObjectRecordSize,
+			&count, &recordSize))
+	return false;
+    if ((st->numJobs & (st->numJobs - 1)) == 0)	    // grow at powers of 2
+    {
+	DecodeJob* jobs = realloc(st->jobs, (st->numJobs ? 2 * st->numJobs : 16) * sizeof(DecodeJob));
+	if (jobs == NULL)
+	    return false;
+	st->jobs = jobs;
+    }
+    job = &st->jobs[st->numJobs++];
+    job->records = payload + kTableHeaderSize;
+    job->count = count;
+    job->recordSize = recordSize;
+    job->firstSlot = *ioNumObjects;
+    *ioNumObjects += count;
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------
+// Builds objList (front to back) from a binary document in memory, with up to numThreads
+// threads. The OBJS chunks are found through the OTOC chunk if there is one. The JRNL
+// chunks after them are applied once the objects are linked up.
+OSStatus CSkDecodeBinaryDocument(const UInt8* bytes, UInt32 length, DrawObjList* objList, 
+					int numThreads, CSkJournalPtr journal)
+{
+    DecodeState	    st;
+    pthread_t	    threads[kMaxDecodeThreads];
+    const UInt8*    toc = NULL;
+    const UInt8*    payload;
+    Boolean	    hasPaths;
+    UInt32	    headerSize, offset, type, size, numObjects = 0, baseEnd = length, i;
+    int		    numStarted = 0;
+    CSkJournal	    localJournal;
+    OSStatus	    err = kBadFileFormat;
+    CSK_TRACE_SPAN("CSkDecodeBinaryDocument");
+    
+    if (journal == NULL)
+    {
+	memset(&localJournal, 0, sizeof(localJournal));
+	journal = &localJournal;
+    }
+    memset(&st, 0, sizeof(st));
+    st.paths.recordSize = kCSkPathPointRecordSize;
+    
+    require(CSkIsBinaryDocumentData(bytes, length), BadFormat);
+    headerSize = GetUInt32(bytes + 8);
+    require((headerSize >= kCSkBinaryHeaderSize) && (headerSize <= length), BadFormat);
+    err = CheckHeader(bytes, headerSize, &hasPaths, &st.styles.byIndex);
+    if (err != noErr)
+	return err;
+    err = kBadFileFormat;
+    st.styles.table = CSkObjListGetStyles(objList);
+    require(st.styles.table != NULL, NoMemory);
+    
+    // Find PNTS, STYL and OTOC; without an OTOC, every OBJS chunk on the way is a job.
+    for (offset = headerSize; offset < length; offset += kChunkHeaderSize + Padded(size))
+    {
+	require((payload = GetChunk(bytes, length, offset, &type, &size)) != NULL, BadFormat);
+	if (type == kCSkChunkJournal)
+	{
+	    baseEnd = offset;
+	    break;
+	}
+	if ((type == kCSkChunkPathPoints) && (st.paths.records == NULL))
+	{
+	    require(GetRecordTable(payload, size, kCSkPathPointRecordSize, &st.paths.count, &st.paths.recordSize), BadFormat);
+	    st.paths.records = payload + kTableHeaderSize;
+	}
+	else if ((type == kCSkChunkStyles) && st.styles.byIndex && (st.styles.records == NULL))
+	{
+	    require(GetRecordTable(payload, size, kCSkStyleRecordSize, &st.styles.count, &st.styles.recordSize), BadFormat);
+	    st.styles.records = payload + kTableHeaderSize;
+	}
+	else if ((type == kCSkChunkObjectIndex) && (toc == NULL) && (st.numJobs == 0))
+	{
+	    UInt32 tocCount, tocEntrySize;
+	    require(GetRecordTable(payload, size, kTocEntrySize, &tocCount, &tocEntrySize), BadFormat);
+	    toc = payload;
+	    baseEnd = 0;
+	    for (i = 0; i < tocCount; ++i)
+	    {
+		const UInt8*	entry = payload + kTableHeaderSize + i * tocEntrySize;
+		UInt32		objsType, objsSize;
+		const UInt8*	objs = GetChunk(bytes, length, GetUInt32(entry), &objsType, &objsSize);
+		
+		require((objs != NULL) && (objsType == kCSkChunkObjects), BadFormat);
+		require(AddDecodeJob(&st, objs, objsSize, &numObjects), BadFormat);
+		require(st.jobs[st.numJobs - 1].count == GetUInt32(entry + 4), BadFormat);
+		if (GetUInt32(entry) + kChunkHeaderSize + Padded(objsSize) > baseEnd)
+		    baseEnd = GetUInt32(entry) + kChunkHeaderSize + Padded(objsSize);
+	    }
+	}
+	else if ((type == kCSkChunkObjects) && (toc == NULL))
+	{
+	    require(!st.styles.byIndex || (st.styles.records != NULL), BadFormat);
+	    require(AddDecodeJob(&st, payload, size, &numObjects), BadFormat);
+	}
+	if ((toc != NULL) && (!hasPaths || (st.paths.records != NULL)) 
+		&& (!st.styles.byIndex || (st.styles.records != NULL)))
+	    break;
+    }
+    require(st.numJobs > 0, BadFormat);
+    require(!st.styles.byIndex || (st.styles.records != NULL), BadFormat);
+    require(InternStyleRecords(&st.styles), NoMemory);
+    
+    st.slots = (CSkObjectPtr*)calloc(numObjects + 1, sizeof(CSkObjectPtr));
+    require(st.slots != NULL, NoMemory);
+    
+    // the calling thread is one of the workers
+    if (numThreads > kMaxDecodeThreads)
+	numThreads = kMaxDecodeThreads;
+    if (numThreads > st.numJobs)
+	numThreads = st.numJobs;
+    for (numStarted = 0; numStarted < numThreads - 1; ++numStarted)
+    {
+	if (pthread_create(&threads[numStarted], NULL, DecodeWorker, &st) != 0)
+	    break;
+    }
+    DecodeWorker(&st);
+    while (numStarted > 0)
+	pthread_join(threads[--numStarted], NULL);
+    
+    if (st.failed)
+    {
+	for (i = 0; i < numObjects; ++i)
+	{
+	    if (st.slots[i] != NULL)
+		ReleaseDrawObj(st.slots[i]);
+	}
+	goto BadFormat;
+    }
+    for (i = 0; i < numObjects; ++i)
+	AppendDrawObjToList(objList, st.slots[i]);
+	
+    // Saved changes, up to the first one that a crash cut short or that doesn't check out.
+    require(StartJournal(journal, objList, baseEnd), NoMemory);
+    for (offset = baseEnd; offset < length; offset += kChunkHeaderSize + Padded(size))
+    {
+	payload = GetChunk(bytes, length, offset, &type, &size);
+	if ((payload == NULL) || ((type == kCSkChunkJournal) && !ApplyJournalChunk(journal, objList, payload, size)))
+	{
+	    fprintf(stderr, "CSkDecodeBinaryDocument: ignoring unfinished or damaged changes\n");
+	    break;
+	}
+	if (type == kCSkChunkJournal)
+	    journal->validLength = offset + kChunkHeaderSize + Padded(size);
+    }
+    err = noErr;
+    goto Done;
+    
+NoMemory:
+    err = memFullErr;
+    goto Done;
+    
+BadFormat:
+    fprintf(stderr, "CSkDecodeBinaryDocument: damaged file\n");
+    err = kBadFileFormat;
+    
+Done:
+    ReleaseStyleRecords(&st.styles);
+    free(st.slots);
+    free(st.jobs);
+    free(journal->byID);
+    journal->byID = NULL;
+    if (journal == &localJournal)
+	free(localJournal.gone);
+    return err;
+}
+
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------
+// A binary document read in place, for documents that carry BNDS and GRID chunks.
+// Only the tables needed to find a record are looked at up front; an OBJS chunk is
+// checked when an object is first created from it.
+
+struct CSkBinaryDoc {
+    const UInt8*    bytes;
+    UInt32	    length;
+    UInt32	    numObjects;
+    UInt32	    numChunks;
+    const UInt8*    toc;	    // OTOC entries
+    UInt32	    tocEntrySize;
+    UInt32*	    chunkStarts;    // index of the first record in each OBJS chunk, plus numObjects
+    const UInt8*    bounds;	    // BNDS records
+    UInt32	    boundsRecordSize;
+    GridLayout	    grid;
+    const UInt8*    cellStarts;	    // cols * rows + 2 entries
+    const UInt8*    cellIndices;
+    UInt32	    numIndices;
+    PathTable	    paths;
+    RecordStyles    styles;	    // STYL records; interned in the table CSkBinaryDocCreateObject gets
+};
+
+//-------------------------------------------------------------------------------------------
+static Boolean SetUpGrid(CSkBinaryDoc* doc, const UInt8* payload, UInt32 size)
+{
+    GridLayout* g = &doc->grid;
+    UInt64	tableSize;
+    
+    if (size < kGridHeaderSize)
+	return false;
+    g->originX = GetFloat32(payload);
+    g->originY = GetFloat32(payload + 4);
+    g->cellWidth = GetFloat32(payload + 8);
+    g->cellHeight = GetFloat32(payload + 12);
+    g->cols = GetUInt32(payload + 16);
+    g->rows = GetUInt32(payload + 20);
+    doc->numIndices = GetUInt32(payload + 24);
+    if ((g->cols < 1) || (g->cols > kGridMaxColsRows) || (g->rows < 1) || (g->rows > kGridMaxColsRows))
+	return false;
+    if (!(g->cellWidth > 0) || !(g->cellHeight > 0) || !isfinite(g->originX) || !isfinite(g->originY))
+	return false;
+	
+    tableSize = 4 * ((UInt64)g->cols * g->rows + 2) + 4 * (UInt64)doc->numIndices;
+    if (tableSize > size - kGridHeaderSize)
+	return false;
+    doc->cellStarts = payload + kGridHeaderSize;
+    doc->cellIndices = doc->cellStarts + 4 * (g->cols * g->rows + 2);
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------
+// Returns NULL if bytes isn't a binary document with a spatial index, or has saved changes.
+// The bytes have to stay put until the document is released.
+CSkBinaryDocPtr CSkBinaryDocCreate(const UInt8* bytes, UInt32 length)
+{
+    CSkBinaryDoc*   doc = NULL;
+    const UInt8*    payload;
+    Boolean	    hasPaths, hasGrid = false;
+    UInt32	    headerSize, offset, type, size, count, recordSize, i;
+    CSK_TRACE_SPAN("CSkBinaryDocCreate");
+    
+    require(CSkIsBinaryDocumentData(bytes, length), BadFormat);
+    headerSize = GetUInt32(bytes + 8);
+    require((headerSize >= kCSkBinaryHeaderSize) && (headerSize <= length), BadFormat);
+    doc = (CSkBinaryDoc*)calloc(1, sizeof(CSkBinaryDoc));
+    require(doc != NULL, BadFormat);
+    require(CheckHeader(bytes, headerSize, &hasPaths, &doc->styles.byIndex) == noErr, BadFormat);
+    doc->bytes = bytes;
+    doc->length = length;
+    doc->paths.recordSize = kCSkPathPointRecordSize;
+    
+    // The tables come before the first OBJS chunk.
+    for (offset = headerSize; offset < length; offset += kChunkHeaderSize + Padded(size))
+    {
+	require((payload = GetChunk(bytes, length, offset, &type, &size)) != NULL, BadFormat);
+	if (type == kCSkChunkObjects)
+	    break;
+	if ((type == kCSkChunkObjectIndex) && (doc->toc == NULL))
+	{
+	    require(GetRecordTable(payload, size, kTocEntrySize, &doc->numChunks, &doc->tocEntrySize), BadFormat);
+	    doc->toc = payload + kTableHeaderSize;
+	}
+	else if ((type == kCSkChunkBounds) && (doc->bounds == NULL))
+	{
+	    require(GetRecordTable(payload, size, kCSkBoundsRecordSize, &count, &doc->boundsRecordSize), BadFormat);
+	    doc->bounds = payload + kTableHeaderSize;
+	    doc->numObjects = count;
+	}
+	else if ((type == kCSkChunkGrid) && !hasGrid)
+	{
+	    require(SetUpGrid(doc, payload, size), BadFormat);
+	    hasGrid = true;
+	}
+	else if ((type == kCSkChunkPathPoints) && (doc->paths.records == NULL))
+	{
+	    require(GetRecordTable(payload, size, kCSkPathPointRecordSize, &doc->paths.count, &doc->paths.recordSize), BadFormat);
+	    doc->paths.records = payload + kTableHeaderSize;
+	}
+	else if ((type == kCSkChunkStyles) && doc->styles.byIndex && (doc->styles.records == NULL))
+	{
+	    require(GetRecordTable(payload, size, kCSkStyleRecordSize, &doc->styles.count, &doc->styles.recordSize), BadFormat);
+	    doc->styles.records = payload + kTableHeaderSize;
+	}
+    }
+    require(!doc->styles.byIndex || (doc->styles.records != NULL), BadFormat);
+    if ((doc->toc == NULL) || (doc->bounds == NULL) || !hasGrid || (hasPaths && (doc->paths.records == NULL)))
+	goto NoIndex;
+	
+    doc->chunkStarts = (UInt32*)malloc((doc->numChunks + 1) * sizeof(UInt32));
+    require(doc->chunkStarts != NULL, BadFormat);
+    for (i = 0, count = 0; i < doc->numChunks; ++i)
+    {
+	recordSize = GetUInt32(doc->toc + i * doc->tocEntrySize + 4);
+	require(recordSize <= doc->numObjects - count, BadFormat);
+	doc->chunkStarts[i] = count;
+	count += recordSize;
+    }
+    require(count == doc->numObjects, BadFormat);
+    doc->chunkStarts[doc->numChunks] = count;
+    
+    // A document with saved changes (JRNL chunks) after its objects has to be read.
+    if (doc->numChunks > 0)
+    {
+	offset = GetUInt32(doc->toc + (doc->numChunks - 1) * doc->tocEntrySize);
+	require(GetChunk(bytes, length, offset, &type, &size) != NULL, BadFormat);
+	if (offset + kChunkHeaderSize + Padded(size) < length)
+	    goto NoIndex;
+    }
+    return doc;
+    
+BadFormat:
+    fprintf(stderr, "CSkBinaryDocCreate: damaged file\n");
+NoIndex:
+    CSkBinaryDocRelease(doc);
+    return NULL;
+}
+
+//-------------------------------------------------------------------------------------------
+void CSkBinaryDocRelease(CSkBinaryDocPtr doc)
+{
+    if (doc != NULL)
+    {
+	free(doc->chunkStarts);
+	free(doc);
+    }
+}
+
+//-------------------------------------------------------------------------------------------
+UInt32 CSkBinaryDocGetObjectCount(const CSkBinaryDoc* doc)
+{
+    return doc->numObjects;
+}
+
+//-------------------------------------------------------------------------------------------
+static CGRect GetRecordBounds(const CSkBinaryDoc* doc, UInt32 recordIndex)
+{
+    const UInt8* b = doc->bounds + recordIndex * doc->boundsRecordSize;
+    return CGRectMake(GetFloat32(b), GetFloat32(b + 4), GetFloat32(b + 8), GetFloat32(b + 12));
+}
+
+//-------------------------------------------------------------------------------------------
+// Calls proc once for each record whose bounds intersect r, in no particular order.
+// An object that spans several cells is reported from the first of them inside r.
+void CSkBinaryDocFindRecordsInRect(const CSkBinaryDoc* doc, CGRect r, CSkBinaryDocRecordProcPtr proc, void* refCon)
+{
+    const GridLayout*	g = &doc->grid;
+    UInt32		overflow = g->cols * g->rows;
+    UInt32		c0 = 0, c1 = 0, r0 = 0, r1 = 0, c = 0, row = 0, cell, k, end;
+    CSK_TRACE_SPAN("CSkBinaryDocFindRecordsInRect");
+    
+    for (cell = overflow; ; cell = row * g->cols + c)
+    {
+	k = GetUInt32(doc->cellStarts + 4 * cell);
+	end = GetUInt32(doc->cellStarts + 4 * (cell + 1));
+	for ( ; (k < end) && (k < doc->numIndices); ++k)
+	{
+	    UInt32  index = GetUInt32(doc->cellIndices + 4 * k);
+	    CGRect  b;
+	    UInt32  bc0, bc1, br0, br1;
+	    
+	    if (index >= doc->numObjects)
+		continue;	// damaged
+	    b = GetRecordBounds(doc, index);
+	    if (!CGRectIntersectsRect(b, r))
+		continue;
+	    if ((cell != overflow) && GetGridCells(g, b, &bc0, &bc1, &br0, &br1)
+		&& ((row * g->cols + c) != ((br0 > r0) ? br0 : r0) * g->cols + ((bc0 > c0) ? bc0 : c0)))
+		continue;	// reported from another cell
+	    (*proc)(refCon, index);
+	}
+	
+	// the overflow cell first, then the cells r overlaps
+	if (cell == overflow)
+	{
+	    if (!GetGridCells(g, r, &c0, &c1, &r0, &r1))
+		break;
+	    c = c0;
+	    row = r0;
+	}
+	else if (c < c1)
+	    c += 1;
+	else if (row < r1)
+	{
+	    c = c0;
+	    row += 1;
+	}
+	else
+	    break;
+    }
+}
+
+//-------------------------------------------------------------------------------------------
+// Creates the object for a record, with its style from styles, or returns NULL if its
+// OBJS chunk is damaged.
+CSkObjectPtr CSkBinaryDocCreateObject(const CSkBinaryDoc* doc, UInt32 recordIndex, CSkStyleTablePtr styles)
+{
+    UInt32	    lo = 0, hi = doc->numChunks, type, size, count, recordSize;
+    RecordStyles    recordStyles = doc->styles;
+    const UInt8*    entry;
+    const UInt8*    payload;
+    
+    if (recordIndex >= doc->numObjects)
+	return NULL;
+    while (hi - lo > 1)		    // the last chunk starting at or before recordIndex
+    {
+	UInt32 mid = (lo + hi) / 2;
+	if (doc->chunkStarts[mid] <= recordIndex)
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+    entry = doc->toc + lo * doc->tocEntrySize;
+    payload = GetChunk(doc->bytes, doc->length, GetUInt32(entry), &type, &size);
+    if ((payload == NULL) || (type != kCSkChunkObjects)
+	|| !GetRecordTable(payload, size, doc->styles.byIndex ? kCSkObjectRecordSize : kCSkInlineObjectRecordSize,
+			    &count, &recordSize)
+	|| (count != GetUInt32(entry + 4)))
+    {
+	fprintf(stderr, "CSkBinaryDocCreateObject: damaged file\n");
+	return NULL;
+    }
+    payload += kTableHeaderSize + (recordIndex - doc->chunkStarts[lo]) * recordSize;
+    recordStyles.table = styles;
+    return CreateObjectFromRecord(payload, &doc->paths, &recordStyles);
+}
+
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------
+// Saving changes. A save appends one JRNL chunk in a single write after the last good chunk,
+// and flushes it to the disk; nothing before validLength is ever written to. If we crash
+// while writing, the reader finds a torn chunk and ignores it.
+
+enum {
+    kMaxJournalChunks		= 1000,	    // compact after that many saves,
+    kMaxJournalPercent		= 50	    // or when the journal is this big, relative to the rest
+};
+
+struct JournalPut {
+    CSkObjectPtr    obj;
+    UInt32	    objectID;
+    UInt32	    prevID;
+};
+typedef struct JournalPut JournalPut;
+
+//-------------------------------------------------------------------------------------------
+// Whether objectID is in the file but not in docStP->objList. Objects of a mapped document
+// that were never materialized aren't in objList either, but they are still there.
+static Boolean IsDeletedObject(DocStoragePtr docStP, const UInt8* seen, UInt32 objectID)
+{
+    CSkMappedDocPtr md = docStP->mappedDoc;
+    
+    if (TestBit(seen, objectID) || TestBit(docStP->journal->gone, objectID))
+	return false;
+    return (md == NULL) || (objectID > CSkMappedDocGetObjectCount(md)) 
+	    || CSkMappedDocIsMaterialized(md, objectID - 1);
+}
+
+//-------------------------------------------------------------------------------------------
+// The JRNL chunk, header included, for what changed in docStP since the last save; or NULL,
+// with *outErr = noErr, if nothing did. New objects get IDs from nextObjectID on, front to
+// back, as CommitJournalChunk will assign them.
+static CFMutableDataRef CreateJournalChunk(DocStoragePtr docStP, UInt32* outNextID, OSStatus* outErr)
+{
+    CSkJournal*		j = docStP->journal;
+    PathWriter		pathWriter = { NULL, 0 };
+    JournalPut*		puts = NULL;
+    UInt8*		seen = NULL;
+    UInt32		numObjects = 0, numPuts = 0, numDeleted = 0, nextID = j->nextObjectID, prevID = 0;
+    UInt32		payloadSize, objectID, i;
+    CSkObjectPtr	obj;
+    CFMutableDataRef	data = NULL;
+    UInt8*		p;
+    
+    *outErr = memFullErr;
+    for (obj = docStP->objList.firstItem; obj != NULL; obj = CSkObjectGetNext(obj))
+	numObjects += 1;
+    puts = (JournalPut*)malloc((numObjects + 1) * sizeof(JournalPut));
+    seen = (UInt8*)calloc(j->nextObjectID / 8 + 1, 1);
+    require((puts != NULL) && (seen != NULL), Done);
+    
+    for (obj = docStP->objList.firstItem; obj != NULL; obj = CSkObjectGetNext(obj), prevID = objectID)
+    {
+	UInt8 changes = CSkObjectGetChanges(obj);
+	
+	objectID = CSkObjectGetID(obj);
+	if ((objectID == 0) || (objectID >= j->nextObjectID) || TestBit(seen, objectID))
+	{
+	    JournalPut put = { obj, nextID++, prevID };
+	    puts[numPuts++] = put;
+	    objectID = put.objectID;
+	    continue;
+	}
+	SetBit(seen, objectID);
+	if (changes != 0)
+	{
+	    JournalPut put = { obj, objectID, (changes & kCSkObjectMoved) ? prevID : kCSkJournalSamePlace };
+	    puts[numPuts++] = put;
+	}
+    }
+    for (objectID = 1; objectID < j->nextObjectID; ++objectID)
+	numDeleted += IsDeletedObject(docStP, seen, objectID);
+    if ((numPuts == 0) && (numDeleted == 0))
+    {
+	*outErr = noErr;
+	goto Done;
+    }
+    
+    for (i = 0; i < numPuts; ++i)
+    {
+	CSkShapePtr sh = CSkObjectGetShape(puts[i].obj);
+	if (CSkShapeGetType(sh) == kFreePolygon)
+	    PutPolygonRecords(&pathWriter, sh);
+    }
+    payloadSize = kJournalHeaderSize + 4 * numDeleted 
+		    + numPuts * (kJournalPutHeaderSize + kCSkInlineObjectRecordSize)
+		    + pathWriter.count * kCSkPathPointRecordSize + kJournalChecksumSize;
+    data = CFDataCreateMutable(kCFAllocatorDefault, 0);
+    require(data != NULL, Done);
+    CFDataSetLength(data, kChunkHeaderSize + Padded(payloadSize));	    // zero-filled
+    p = PutChunkHeader(CFDataGetMutableBytePtr(data), kCSkChunkJournal, payloadSize);
+    PutUInt32(p, j->sequence + 1);
+    PutUInt32(p + 4, nextID);
+    PutUInt32(p + 8, numDeleted);
+    PutUInt32(p + 12, numPuts);
+    PutUInt32(p + 16, kJournalPutHeaderSize + kCSkInlineObjectRecordSize);
+    PutUInt32(p + 20, pathWriter.count);
+    PutUInt32(p + 24, kCSkPathPointRecordSize);
+    p += kJournalHeaderSize;
+    for (objectID = 1; objectID < j->nextObjectID; ++objectID)
+    {
+	if (IsDeletedObject(docStP, seen, objectID))
+	{
+	    PutUInt32(p, objectID);
+	    p += 4;
+	}
+    }
+    pathWriter.records = p + numPuts * (kJournalPutHeaderSize + kCSkInlineObjectRecordSize);
+    pathWriter.count = 0;
+    for (i = 0; i < numPuts; ++i)
+    {
+	PutUInt32(p, puts[i].objectID);
+	PutUInt32(p + 4, puts[i].prevID);
+	PutObjectRecord(p + kJournalPutHeaderSize, puts[i].obj, &pathWriter, NULL);
+	p += kJournalPutHeaderSize + kCSkInlineObjectRecordSize;
+    }
+    p = CFDataGetMutableBytePtr(data) + kChunkHeaderSize;
+    PutUInt32(p + payloadSize - kJournalChecksumSize, Adler32(p, payloadSize - kJournalChecksumSize));
+    *outNextID = nextID;
+    *outErr = noErr;
+    
+Done:
+    free(puts);
+    free(seen);
+    return data;
+}
+
+//-------------------------------------------------------------------------------------------
+// The chunk is on the disk: the new objects get their IDs, and nothing is changed any more.
+static void CommitJournalChunk(DocStoragePtr docStP, CFDataRef chunk, UInt32 nextID, const struct stat* sb)
+{
+    CSkJournal*	    j = docStP->journal;
+    const UInt8*    payload = CFDataGetBytePtr(chunk) + kChunkHeaderSize;
+    UInt32	    numDeleted = GetUInt32(payload + 8), newID = j->nextObjectID, i;
+    UInt8*	    seen = (UInt8*)calloc(j->nextObjectID / 8 + 1, 1);
+    CSkObjectPtr    obj;
+    
+    for (obj = docStP->objList.firstItem; obj != NULL; obj = CSkObjectGetNext(obj))
+    {
+	UInt32 objectID = CSkObjectGetID(obj);
+	if ((objectID == 0) || (objectID >= j->nextObjectID) || ((seen != NULL) && TestBit(seen, objectID)))
+	    CSkObjectSetID(obj, newID++);
+	else if (seen != NULL)
+	    SetBit(seen, objectID);
+	CSkObjectSetChanges(obj, 0);
+    }
+    free(seen);
+    
+    if (GrowJournal(j, nextID))
+    {
+	for (i = 0; i < numDeleted; ++i)
+	    SetBit(j->gone, GetUInt32(payload + kJournalHeaderSize + 4 * i));
+    }
+    j->nextObjectID = nextID;
+    j->sequence += 1;
+    j->validLength += CFDataGetLength(chunk);
+    RememberJournalFile(j, sb);
+    CSkAutosaveDocumentSaved(docStP->autosave);
+}
+
+//-------------------------------------------------------------------------------------------
+// fsync only gets the data as far as the drive; F_FULLFSYNC gets it onto the disk.
+static int FlushFile(int fd)
+{
+    if (fcntl(fd, F_FULLFSYNC) == 0)
+	return 0;
+    return fsync(fd);
+}
+
+//-------------------------------------------------------------------------------------------
+// Writes data to a new file next to path, then renames it over path, so that path is either
+// the old or the new file even if we crash. Keeps the file's Finder info (type and creator).
+OSStatus CSkReplaceFileContents(const char* path, CFDataRef data)
+{
+    char	    tempPath[PATH_MAX];
+    struct stat	    sb;
+    FSRef	    ref;
+    FSCatalogInfo   info;
+    Boolean	    hasInfo;
+    CFIndex	    length = CFDataGetLength(data);
+    int		    fd;
+    
+    if (snprintf(tempPath, sizeof(tempPath), "%s.saving", path) >= (int)sizeof(tempPath))
+	return bdNamErr;
+    hasInfo = (FSPathMakeRef((const UInt8*)path, &ref, NULL) == noErr)
+		&& (FSGetCatalogInfo(&ref, kFSCatInfoFinderInfo, &info, NULL, NULL, NULL) == noErr);
+    fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, (stat(path, &sb) == 0) ? (sb.st_mode & 0777) : 0644);
+    require(fd >= 0, CantWrite);
+    if ((write(fd, CFDataGetBytePtr(data), length) != length) || (FlushFile(fd) != 0))
+    {
+	fprintf(stderr, "CSkReplaceFileContents: can't write %s (%s)\n", tempPath, strerror(errno));
+	close(fd);
+	goto CantReplace;
+    }
+    close(fd);
+    
+    if (hasInfo && (FSPathMakeRef((const UInt8*)tempPath, &ref, NULL) == noErr))
+	(void)FSSetCatalogInfo(&ref, kFSCatInfoFinderInfo, &info);
+    require(rename(tempPath, path) == 0, CantWrite);
+    return noErr;
+    
+CantWrite:
+    fprintf(stderr, "CSkReplaceFileContents: can't write %s (%s)\n", path, strerror(errno));
+CantReplace:
+    unlink(tempPath);
+    return ioErr;
+}
+
+//-------------------------------------------------------------------------------------------
+// After the whole document was written to path, its objects are the file's objects 1 to N.
+static void ResetJournal(DocStoragePtr docStP, const char* path)
+{
+    CSkObjectPtr    obj;
+    UInt32	    numObjects = 0;
+    
+    for (obj = docStP->objList.firstItem; obj != NULL; obj = CSkObjectGetNext(obj))
+    {
+	CSkObjectSetID(obj, ++numObjects);
+	CSkObjectSetChanges(obj, 0);
+    }
+    CSkJournalRelease(docStP->journal);
+    docStP->journal = CSkJournalCreate(path, numObjects);	// if NULL, the next save compacts
+    CSkAutosaveDocumentSaved(docStP->autosave);
+}
+
+//-------------------------------------------------------------------------------------------
+OSStatus CSkSaveDocumentChanges(DocStoragePtr docStP)
+{
+    CSkJournal*		j = docStP->journal;
+    CFMutableDataRef	chunk;
+    UInt8		path[PATH_MAX];
+    struct stat		sb;
+    UInt32		nextID = 0;
+    CFIndex		length;
+    int			fd = -1;
+    OSStatus		err;
+    CSK_TRACE_SPAN("CSkSaveDocumentChanges");
+    
+    if (docStP->fileURL == NULL)
+	return fnfErr;
+    if ((j == NULL) || !CFURLGetFileSystemRepresentation(docStP->fileURL, true, path, sizeof(path)))
+	return CSkCompactDocument(docStP);
+    chunk = CreateJournalChunk(docStP, &nextID, &err);
+    if (chunk == NULL)
+	return err;		// nothing changed, or out of memory
+    length = CFDataGetLength(chunk);
+    
+    // Write the whole document instead if the journal has grown too big, or if the file
+    // isn't the one we read or wrote last.
+    if ((j->sequence >= kMaxJournalChunks) 
+	    || ((UInt64)j->validLength - j->baseLength + length > (UInt64)j->baseLength * kMaxJournalPercent / 100))
+	goto Compact;
+    fd = open((char*)path, O_WRONLY);
+    if ((fd < 0) || (fstat(fd, &sb) != 0) || !IsJournalFile(j, &sb))
+	goto Compact;
+	
+    // Cut off what an unfinished save left behind first.
+    if (((sb.st_size != j->validLength) && (ftruncate(fd, j->validLength) != 0))
+	    || (pwrite(fd, CFDataGetBytePtr(chunk), length, j->validLength) != length)
+	    || (FlushFile(fd) != 0) || (fstat(fd, &sb) != 0))
+    {
+	fprintf(stderr, "CSkSaveDocumentChanges: can't write %s (%s)\n", (char*)path, strerror(errno));
+	err = ioErr;
+    }
+    else
+    {
+	CommitJournalChunk(docStP, chunk, nextID, &sb);
+	err = noErr;
+    }
+    close(fd);
+    CFRelease(chunk);
+    return err;
+    
+Compact:
+    if (fd >= 0)
+	close(fd);
+    CFRelease(chunk);
+    return CSkCompactDocument(docStP);
+}
+
+//-------------------------------------------------------------------------------------------
+OSStatus CSkCompactDocument(DocStoragePtr docStP)
+{
+    UInt8	path[PATH_MAX];
+    CFDataRef	data;
+    OSStatus	err;
+    CSK_TRACE_SPAN("CSkCompactDocument");
+    
+    if ((docStP->fileURL == NULL) || !CFURLGetFileSystemRepresentation(docStP->fileURL, true, path, sizeof(path)))
+	return fnfErr;
+    MaterializeAllObjects(docStP);
+    data = CSkCreateBinaryDocumentData(&docStP->objList);
+    if (data == NULL)
+    {
+	fprintf(stderr, "CSkCompactDocument: can't create document data\n");
+	return memFullErr;
+    }
+    err = CSkReplaceFileContents((char*)path, data);
+    if (err == noErr)
+	ResetJournal(docStP, (char*)path);
+    CFRelease(data);
+    return err;
+}
+
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------
+// The whole document, written like a compaction (see CSkReplaceFileContents): a crash can't
+// leave a truncated file behind, and later saves of a binary document append to this one.
+OSStatus CSkWriteDocumentToURL(DocStoragePtr docStP, CFURLRef url, int format)
+{
+    CFDataRef	data = NULL;
+    OSStatus	err;
+    UInt8	path[PATH_MAX];
+    
+    if (!CFURLGetFileSystemRepresentation(url, true, path, sizeof(path)))
+    {
+	fprintf(stderr, "CSkWriteDocumentToURL: not a file URL\n");
+	return fnfErr;
+    }
+    // The file may be the one a mapped document lives in; let go of it before writing.
+    MaterializeAllObjects(docStP);
+    if (format == kCSkFormatBinary)
+    {
+	data = CSkCreateBinaryDocumentData(&docStP->objList);
+    }
+    else
+    {
+	CFPropertyListRef docPList = CSkCreatePropertyList(docStP);
+	data = CFPropertyListCreateXMLData(kCFAllocatorDefault, docPList);
+	CFRelease(docPList);
+    }
+    if (data == NULL)
+    {
+	fprintf(stderr, "CSkWriteDocumentToURL: can't create document data\n");
+	return memFullErr;
+    }
+    
+    err = CSkReplaceFileContents((char*)path, data);
+    if ((err == noErr) && (format == kCSkFormatBinary))
+    {
+	// the file that Save appends to from now on
+	CFRetain(url);
+	if (docStP->fileURL != NULL)
+	    CFRelease(docStP->fileURL);
+	docStP->fileURL = url;
+	ResetJournal(docStP, (char*)path);
+    }
+    CFRelease(data);
+    return err;
+}
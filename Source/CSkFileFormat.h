@@ -0,0 +1,192 @@
+/*
+    File:       CSkFileFormat.h
+        
+    Contains:	Binary .csk document format: layout and entry points
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#ifndef __CSKFILEFORMAT__
+#define __CSKFILEFORMAT__
+
+#include <Carbon/Carbon.h>
+#include "CSkDocStorage.h"
+#include "CSkDocReader.h"
+
+// Binary .csk documents. All integers and floats are little-endian.
+//
+//  header:	char[4]	    "CSkB"
+//		UInt16	    major version (a reader refuses a newer major version)
+//		UInt16	    minor version
+//		UInt32	    header size in bytes, including the feature table
+//		UInt32	    feature count
+//		feature table: { FourCC tag, UInt16 version, UInt16 flags } per feature.
+//		A reader refuses a file that has a kCSkFeatureRequired feature it doesn't know.
+//  chunks:	FourCC	    type
+//		UInt32	    payload size in bytes
+//		payload, padded with zeros to a multiple of 4 bytes. Unknown chunks are skipped.
+//
+//  'OTOC':	UInt32 entry count, UInt32 entry size, then one { UInt32 file offset of the chunk
+//		header, UInt32 record count } per OBJS chunk. Lets a reader find the OBJS chunks
+//		(and where their objects go) without walking the file.
+//  'OBJS':	UInt32 record count, UInt32 record size, then fixed-size object records, front to back.
+//		Readers ignore bytes beyond the fields they know, so records can grow.
+//		From version 2 of the OBJS feature, the objects are split over several OBJS chunks
+//		of at most kCSkObjectsPerChunk records, in order. Chunks can be decoded independently.
+//		From version 3, a record is UInt8 shape type, 3 pad bytes, UInt32 index of its
+//		STYL record, then the geometry. Before, the attributes were in the record, laid
+//		out as in a STYL record, and the geometry came after them, at byte 40.
+//  'STYL':	UInt32 record count, UInt32 record size, then the distinct attribute sets of the
+//		objects (see CSkStyles.h), once each: 1 pad byte, UInt8 lineCap, lineJoin, lineStyle,
+//		float32 lineWidth, float32[4] strokeColor r g b a, float32[4] fillColor.
+//		Written before OBJS, like PNTS.
+//  'BNDS':	UInt32 record count, UInt32 record size, then one float32 x y w h per object:
+//		its render bounds, in the order of the object records.
+//  'GRID':	a spatial index over the BNDS rectangles:
+//		float32 originX, originY, cellWidth, cellHeight; UInt32 columns, rows, index count;
+//		then UInt32 cell start[columns * rows + 2] and UInt32 object index[index count].
+//		The objects of cell (c, r) are index[start[k] .. start[k + 1]), k = r * columns + c,
+//		in front to back order. Cell k = columns * rows holds objects that span too many
+//		cells, and objects outside the grid.
+//		BNDS and GRID are written for documents of kCSkIndexMinObjects or more.
+//  'PNTS':	UInt32 record count, UInt32 record size, then the polygon path records
+//		(one per point: UInt8 element type, 3 pad bytes, float32 x, float32 y).
+//		Written before OBJS, so a streaming reader has the paths when the objects come.
+//  'JRNL':	one saved set of changes, appended after the OBJS chunks (see CSkSaveDocumentChanges).
+//		The objects written with the OBJS chunks have IDs 1 to record count, in order.
+//		UInt32 sequence number (1, 2, ...), UInt32 next object ID, UInt32 deleted count,
+//		UInt32 put count, UInt32 put size, UInt32 point count, UInt32 point size;
+//		then UInt32 deleted object ID[deleted count];
+//		then the puts: { UInt32 object ID, UInt32 ID of the object in front of it (0: none;
+//		kCSkJournalSamePlace: stays where it is), object record with the attributes in it,
+//		as in OBJS before version 3 (a style added since isn't in the file's STYL chunk) };
+//		then path records for the puts' polygons, as in PNTS;
+//		then the Adler-32 checksum of all of the above. A JRNL chunk that is cut short or
+//		doesn't check out ends the document; it and anything after it are ignored.
+//		The JRNL feature is listed as required in every document, since a reader that
+//		skipped the chunks would show the document as it was before the saved changes.
+//
+//  Chunk offsets are relative to the start of the file and nothing needs fixing up after
+//  loading, so a document can be used in place (CSkBinaryDoc, CSkMappedDoc.c).
+
+enum {
+    kCSkBinaryMajorVersion	= 1,
+    kCSkBinaryMinorVersion	= 0,
+    kCSkBinaryHeaderSize	= 16,	    // up to the feature table
+    
+    kCSkFeatureRequired		= 0x0001,   // feature flags
+
+    kCSkChunkObjects		= 'OBJS',   // chunk types, also used as feature tags
+    kCSkChunkPathPoints		= 'PNTS',
+    kCSkChunkObjectIndex	= 'OTOC',
+    kCSkChunkBounds		= 'BNDS',
+    kCSkChunkGrid		= 'GRID',
+    kCSkChunkJournal		= 'JRNL',
+    kCSkChunkStyles		= 'STYL',
+    
+    kCSkObjectsVersion		= 3,	    // feature versions written
+    kCSkPathPointsVersion	= 1,
+    kCSkObjectIndexVersion	= 1,
+    kCSkBoundsVersion		= 1,
+    kCSkGridVersion		= 1,
+    kCSkJournalVersion		= 1,
+    kCSkStylesVersion		= 1,
+    
+    kCSkObjectRecordSize	= 40,
+    kCSkInlineObjectRecordSize	= 72,	    // with the attributes in it: OBJS before version 3, JRNL
+    kCSkStyleRecordSize		= 40,
+    kCSkPathPointRecordSize	= 12,
+    kCSkBoundsRecordSize	= 16,
+    kCSkObjectsPerChunk		= 4096,
+    kCSkIndexMinObjects		= 4096,
+    
+    kCSkJournalSamePlace	= 0xFFFFFFFF
+};
+
+// Document formats for CSkWriteDocumentToURL
+enum {
+    kCSkFormatBinary		= 1,
+    kCSkFormatXMLPropertyList	= 2	    // the original .csk format
+};
+
+Boolean	    CSkIsBinaryDocumentData(const UInt8* bytes, CFIndex length);
+CFDataRef   CSkCreateBinaryDocumentData(const DrawObjList* objList);
+CFDataRef   CSkCreateBinaryDocumentDataFromObjects(const CSkObjectPtr* objects, UInt32 numObjects);
+
+// What a document needs to know about its file to save only its changes: the IDs in the
+// file, and where the next JRNL chunk goes. CSkJournalCreate takes the file at path as it
+// is now, holding numObjects objects and no JRNL chunks; the readers fill in the rest
+// (their journal may be NULL).
+typedef struct CSkJournal CSkJournal, *CSkJournalPtr;
+
+CSkJournalPtr	CSkJournalCreate(const char* path, UInt32 numObjects);
+void		CSkJournalRelease(CSkJournalPtr journal);
+
+OSStatus    CSkReadBinaryDocument(CSkReadStream* s, DrawObjList* objList, CSkJournalPtr journal);
+OSStatus    CSkDecodeBinaryDocument(const UInt8* bytes, UInt32 length, DrawObjList* objList, 
+					int numThreads, CSkJournalPtr journal);
+
+// Writes the whole document. A binary document written this way becomes the file that
+// CSkSaveDocumentChanges appends to.
+OSStatus    CSkWriteDocumentToURL(DocStoragePtr docStP, CFURLRef url, int format);
+
+// Save: appends the changed, added and deleted objects to docStP->fileURL as one JRNL chunk.
+// Compacts instead if the journal has grown too big, or the file can't be appended to.
+OSStatus    CSkSaveDocumentChanges(DocStoragePtr docStP);
+
+// Rewrites docStP->fileURL without a journal. The new file replaces the old one only
+// once it is completely written.
+OSStatus    CSkCompactDocument(DocStoragePtr docStP);
+
+// Writes data next to path, then renames it over path; path is never half written.
+OSStatus    CSkReplaceFileContents(const char* path, CFDataRef data);
+
+// A binary document with BNDS and GRID chunks, read in place: objects are created one
+// at a time, on request. The bytes have to stay around until CSkBinaryDocRelease.
+typedef struct CSkBinaryDoc CSkBinaryDoc, *CSkBinaryDocPtr;
+typedef void (*CSkBinaryDocRecordProcPtr)(void* refCon, UInt32 recordIndex);
+
+CSkBinaryDocPtr	CSkBinaryDocCreate(const UInt8* bytes, UInt32 length);
+void		CSkBinaryDocRelease(CSkBinaryDocPtr doc);
+UInt32		CSkBinaryDocGetObjectCount(const CSkBinaryDoc* doc);
+void		CSkBinaryDocFindRecordsInRect(const CSkBinaryDoc* doc, CGRect r, 
+						CSkBinaryDocRecordProcPtr proc, void* refCon);
+CSkObjectPtr	CSkBinaryDocCreateObject(const CSkBinaryDoc* doc, UInt32 recordIndex, CSkStyleTablePtr styles);
+
+#endif
@@ -0,0 +1,281 @@
+/*
+    File:       CSkMappedDoc.c
+        
+    Contains:	Large .csk documents, mapped into memory and materialized on demand
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include "CSkMappedDoc.h"
+#include "CSkFileFormat.h"
+#include "CSkTrace.h"
+
+struct CSkMappedDoc {
+    void*	    base;
+    size_t	    length;
+    CSkBinaryDocPtr doc;
+    UInt8*	    materialized;	// one bit per record
+    UInt32	    numObjects;
+    UInt32	    numMaterialized;
+};
+
+#define IsMaterialized(md, i)	(((md)->materialized[(i) >> 3] >> ((i) & 7)) & 1)
+#define SetMaterialized(md, i)	((md)->materialized[(i) >> 3] |= (1 << ((i) & 7)))
+
+//-------------------------------------------------------------------------------------------
+CSkMappedDocPtr CSkMappedDocOpen(const char* path)
+{
+    CSkMappedDoc*   md;
+    struct stat	    sb;
+    int		    fd;
+    CSK_TRACE_SPAN("CSkMappedDocOpen");
+    
+    md = (CSkMappedDoc*)calloc(1, sizeof(CSkMappedDoc));
+    if (md == NULL)
+	return NULL;
+    fd = open(path, O_RDONLY);
+    require(fd >= 0, CantMap);
+    if ((fstat(fd, &sb) != 0) || (sb.st_size <= 0) || (sb.st_size > 0xFFFFFFFF))
+    {
+	close(fd);
+	goto CantMap;
+    }
+    md->length = sb.st_size;
+    md->base = mmap(NULL, md->length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);			// the mapping keeps the file open
+    if (md->base == MAP_FAILED)
+    {
+	fprintf(stderr, "CSkMappedDocOpen: mmap failed (%d)\n", errno);
+	md->base = NULL;
+	goto CantMap;
+    }
+    (void)madvise(md->base, md->length, MADV_RANDOM);	// we only look at what's in view
+    
+    md->doc = CSkBinaryDocCreate((const UInt8*)md->base, md->length);
+    require(md->doc != NULL, CantMap);
+    md->numObjects = CSkBinaryDocGetObjectCount(md->doc);
+    md->materialized = (UInt8*)calloc((md->numObjects + 7) / 8 + 1, 1);
+    require(md->materialized != NULL, CantMap);
+    return md;
+    
+CantMap:
+    CSkMappedDocClose(md);
+    return NULL;
+}
+
+//-------------------------------------------------------------------------------------------
+void CSkMappedDocClose(CSkMappedDocPtr md)
+{
+    if (md == NULL)
+	return;
+    CSkBinaryDocRelease(md->doc);
+    if (md->base != NULL)
+	munmap(md->base, md->length);
+    free(md->materialized);
+    free(md);
+}
+
+//-------------------------------------------------------------------------------------------
+UInt32 CSkMappedDocGetObjectCount(const CSkMappedDoc* md)
+{
+    return md->numObjects;
+}
+
+UInt32 CSkMappedDocGetMaterializedCount(const CSkMappedDoc* md)
+{
+    return md->numMaterialized;
+}
+
+Boolean CSkMappedDocIsMaterialized(const CSkMappedDoc* md, UInt32 recordIndex)
+{
+    return (recordIndex < md->numObjects) && IsMaterialized(md, recordIndex);
+}
+
+//-------------------------------------------------------------------------------------------
+// Inserts the object for recordIndex in front of the first mapped object with a higher
+// record index, starting at *ioCursor; records have to come in ascending order.
+static Boolean MaterializeRecord(CSkMappedDocPtr md, DrawObjList* objList, UInt32 recordIndex, CSkObjectPtr* ioCursor)
+{
+    CSkObjectPtr    obj = CSkBinaryDocCreateObject(md->doc, recordIndex, CSkObjListGetStyles(objList));
+    CSkObjectPtr    cursor = *ioCursor;
+    
+    SetMaterialized(md, recordIndex);	    // a damaged record isn't tried again
+    md->numMaterialized += 1;
+    if (obj == NULL)
+	return false;
+    CSkObjectSetMapIndex(obj, recordIndex);
+    CSkObjectSetID(obj, recordIndex + 1);	    // as the reader would number it
+    
+    while ((cursor != NULL) && ((CSkObjectGetMapIndex(cursor) == kCSkNotMapped) || (CSkObjectGetMapIndex(cursor) < recordIndex)))
+	cursor = CSkObjectGetNext(cursor);
+    if (cursor != NULL)
+	InsertDrawObjBefore(objList, obj, cursor);
+    else
+	AppendDrawObjToList(objList, obj);
+    *ioCursor = cursor;
+    return true;
+}
+
+struct RecordCollector {
+    const CSkMappedDoc*	md;
+    UInt32*		indices;
+    UInt32		count;
+    UInt32		capacity;
+};
+typedef struct RecordCollector RecordCollector;
+
+static void CollectRecord(void* refCon, UInt32 recordIndex)
+{
+    RecordCollector* rc = (RecordCollector*)refCon;
+    
+    if (IsMaterialized(rc->md, recordIndex))
+	return;
+    if (rc->count == rc->capacity)
+    {
+	UInt32* indices = (UInt32*)realloc(rc->indices, (rc->capacity ? 2 * rc->capacity : 256) * sizeof(UInt32));
+	if (indices == NULL)
+	    return;	    // the rest come in with the next update
+	rc->indices = indices;
+	rc->capacity = rc->capacity ? 2 * rc->capacity : 256;
+    }
+    rc->indices[rc->count++] = recordIndex;
+}
+
+static int CompareRecordIndices(const void* a, const void* b)
+{
+    UInt32 x = *(const UInt32*)a, y = *(const UInt32*)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+//-------------------------------------------------------------------------------------------
+// Looks up the records in r through the grid, and merges them into objList in one pass.
+UInt32 CSkMappedDocMaterializeRect(CSkMappedDocPtr md, DrawObjList* objList, CGRect r)
+{
+    RecordCollector rc = { md, NULL, 0, 0 };
+    CSkObjectPtr    cursor = objList->firstItem;
+    UInt32	    numAdded = 0, i;
+    CSK_TRACE_SPAN("CSkMappedDocMaterializeRect");
+    
+    if (md->numMaterialized == md->numObjects)
+	return 0;
+    CSkBinaryDocFindRecordsInRect(md->doc, r, CollectRecord, &rc);
+    qsort(rc.indices, rc.count, sizeof(UInt32), CompareRecordIndices);
+    for (i = 0; i < rc.count; ++i)
+    {
+	if (MaterializeRecord(md, objList, rc.indices[i], &cursor))
+	    numAdded += 1;
+    }
+    free(rc.indices);
+    return numAdded;
+}
+
+//-------------------------------------------------------------------------------------------
+UInt32 CSkMappedDocMaterializeAll(CSkMappedDocPtr md, DrawObjList* objList)
+{
+    CSkObjectPtr    cursor = objList->firstItem;
+    UInt32	    numAdded = 0, i;
+    CSK_TRACE_SPAN("CSkMappedDocMaterializeAll");
+    
+    for (i = 0; (i < md->numObjects) && (md->numMaterialized < md->numObjects); ++i)
+    {
+	if (!IsMaterialized(md, i) && MaterializeRecord(md, objList, i, &cursor))
+	    numAdded += 1;
+    }
+    return numAdded;
+}
+
+//-------------------------------------------------------------------------------------------
+// The map index of the first mapped object from obj towards the front, or -1 if there is none.
+static SInt64 GetMappedIndexFrom(const CSkObject* obj)
+{
+    for ( ; obj != NULL; obj = CSkObjectGetPrev(obj))
+    {
+	if (CSkObjectGetMapIndex(obj) != kCSkNotMapped)
+	    return CSkObjectGetMapIndex(obj);
+    }
+    return -1;
+}
+
+// The records not materialized from *ioNext down to above + 1, each as a temporary object.
+static Boolean WalkRecordsAbove(const CSkMappedDoc* md, CSkStyleTablePtr styles, SInt64 above, SInt64* ioNext,
+				CSkMappedDocObjectProcPtr proc, void* refCon)
+{
+    Boolean ok = true;
+    
+    for ( ; ok && (*ioNext > above); *ioNext -= 1)
+    {
+	CSkObjectPtr obj;
+	
+	if (IsMaterialized(md, *ioNext))
+	    continue;
+	obj = CSkBinaryDocCreateObject(md->doc, *ioNext, styles);
+	if (obj != NULL)		    // a damaged record is left out, as when materializing
+	{
+	    ok = (*proc)(refCon, obj);
+	    ReleaseDrawObj(obj);
+	}
+    }
+    return ok;
+}
+
+//-------------------------------------------------------------------------------------------
+// A record goes in front of the first mapped object with a higher index, behind the objects
+// that aren't mapped before that one (see MaterializeRecord). So going from the back, the
+// records above the next mapped object come right after each mapped object, and at the start.
+void CSkMappedDocWalkBackToFront(const CSkMappedDoc* md, DrawObjList* objList,
+				    CSkMappedDocObjectProcPtr proc, void* refCon)
+{
+    CSkStyleTablePtr	styles = CSkObjListGetStyles(objList);
+    CSkObjectPtr	obj = objList->lastItem;
+    SInt64		next = (SInt64)md->numObjects - 1;
+    Boolean		ok;
+    CSK_TRACE_SPAN("CSkMappedDocWalkBackToFront");
+    
+    ok = WalkRecordsAbove(md, styles, GetMappedIndexFrom(obj), &next, proc, refCon);
+    for ( ; ok && (obj != NULL); obj = CSkObjectGetPrev(obj))
+    {
+	ok = (*proc)(refCon, obj);
+	if (ok && (CSkObjectGetMapIndex(obj) != kCSkNotMapped))
+	    ok = WalkRecordsAbove(md, styles, GetMappedIndexFrom(CSkObjectGetPrev(obj)), &next, proc, refCon);
+    }
+}
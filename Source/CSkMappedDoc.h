@@ -0,0 +1,77 @@
+/*
+    File:       CSkMappedDoc.h
+        
+    Contains:	Large .csk documents, mapped into memory and materialized on demand
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#ifndef __CSKMAPPEDDOC__
+#define __CSKMAPPEDDOC__
+
+#include <Carbon/Carbon.h>
+#include "CSkObjects.h"
+
+// A large binary document with a spatial index (BNDS and GRID chunks) is mapped into
+// memory instead of being read. Its records stay on disk until they are materialized into
+// the document's object list: when they come into view, get hit, or the whole document
+// is needed (saving, Select All, reordering). Materialized objects keep their stacking
+// order among each other; objects created since the document was opened are in front.
+typedef struct CSkMappedDoc CSkMappedDoc, *CSkMappedDocPtr;
+
+CSkMappedDocPtr	CSkMappedDocOpen(const char* path);	// NULL if not a binary document with an index
+void		CSkMappedDocClose(CSkMappedDocPtr md);
+UInt32		CSkMappedDocGetObjectCount(const CSkMappedDoc* md);
+UInt32		CSkMappedDocGetMaterializedCount(const CSkMappedDoc* md);
+Boolean		CSkMappedDocIsMaterialized(const CSkMappedDoc* md, UInt32 recordIndex);
+
+// These return the number of objects added to objList.
+UInt32		CSkMappedDocMaterializeRect(CSkMappedDocPtr md, DrawObjList* objList, CGRect r);
+UInt32		CSkMappedDocMaterializeAll(CSkMappedDocPtr md, DrawObjList* objList);
+
+// Hands proc the whole document from back to front without materializing it, for exporting:
+// the objects of objList, and in between, where CSkMappedDocMaterializeAll would put them,
+// an object for each record that isn't materialized, created for proc and released after.
+// Only one such object exists at a time. The walk stops when proc returns false.
+typedef Boolean (*CSkMappedDocObjectProcPtr)(void* refCon, const CSkObject* obj);
+
+void		CSkMappedDocWalkBackToFront(const CSkMappedDoc* md, DrawObjList* objList,
+						CSkMappedDocObjectProcPtr proc, void* refCon);
+
+#endif
@@ -46,30 +46,43 @@
 
 #include <Carbon/Carbon.h>
 #include <ApplicationServices/ApplicationServices.h>
+#include <libkern/OSAtomic.h>
 
 #include "CSkObjects.h"
 // also includes "CSkShapes.h"
 #include "CSkConstants.h"
 #include "CSkToolPalette.h"
+#include "CSkSnapping.h"
+#include "CSkTrace.h"
 
 // CSkObjects (or "DrawObjects" as they were called in the first stages of development) are stored 
 // in a double-linked list. They contain a CSkShapePtr to the geometry definition, and
-// specifications needed for drawing. 
+// the style they are drawn with (see CSkStyles.c).
 
 struct CSkObject
 {
     CSkShapePtr		shape;
-    CSkObjectAttributes	attr;
+    CSkStylePtr		style;		// retained; from the style table of the object's list
     Boolean		selected;
+    UInt32		mapIndex;	// record index in a mapped document, or kCSkNotMapped
+    UInt32		objectID;	// identifies the object in its file; 0 until saved
+    UInt8		changes;	// kCSkObjectChanged, kCSkObjectMoved since the last save
+    int32_t		refCount;	// the list, plus any autosave snapshots holding on to it
+    CGRect		snapBounds;	// what the list's snap index holds for it, or CGRectNull
     CSkObjectPtr	nextObj;
     CSkObjectPtr	prevObj;
 };
 
 
 //------------------------------------------------------------------------------
-CSkObjectAttributes* CSkObjectGetAttributes(CSkObjectPtr obj)
+const CSkObjectAttributes* CSkObjectGetAttributes(const CSkObject* obj)
 {
-    return &obj->attr;
+    return CSkStyleGetAttributes(obj->style);
+}
+
+CSkStylePtr CSkObjectGetStyle(const CSkObject* obj)
+{
+    return obj->style;
 }
 
 //------------------------------------------------------------------------------
@@ -81,10 +94,11 @@ void GetLineAttributes(const CSkObject* obj, float* width, CGLineCap* cap, CGLin
 {
     if (obj != NULL)
     {
-	*width  = obj->attr.lineWidth;
-	*cap	= obj->attr.lineCap;
-	*join   = obj->attr.lineJoin;
-	*style  = obj->attr.lineStyle;
+	const CSkObjectAttributes* attr = CSkStyleGetAttributes(obj->style);
+	*width  = attr->lineWidth;
+	*cap	= attr->lineCap;
+	*join   = attr->lineJoin;
+	*style  = attr->lineStyle;
     }
     else
     {
@@ -93,15 +107,81 @@ void GetLineAttributes(const CSkObject* obj, float* width, CGLineCap* cap, CGLin
 }
 
 //------------------------------------------------------------------------------
-// Allocate new drawObject with attributes from the current settings in the CSkToolPalette.
-// Bounds are empty.
-CSkObjectPtr CreateCSkObj(CSkObjectAttributes* attributes, CSkShapePtr sh)
+// The style table of objList, created on first use. Objects that go into objList are
+// created with it.
+CSkStyleTablePtr CSkObjListGetStyles(DrawObjListPtr objList)
+{
+    if (objList->styles == NULL)
+	objList->styles = CSkStyleTableCreate();
+    return objList->styles;
+}
+
+//------------------------------------------------------------------------------
+// The snap index of objList, created on first use from the objects it has. From then on,
+// the list routines below keep it up to date; an object's snapBounds are its entry.
+CSkSnapIndexPtr CSkObjListGetSnapIndex(DrawObjListPtr objList)
+{
+    CSkObjectPtr obj;
+    
+    if (objList->snapIndex == NULL)
+    {
+	objList->snapIndex = CSkSnapIndexCreate();
+	for (obj = objList->firstItem; obj != NULL; obj = obj->nextObj)
+	    SetDrawObjSnapping(objList, obj, true);
+    }
+    return objList->snapIndex;
+}
+
+// Puts the current shape bounds of obj, which is in objList, into the snap index, or takes
+// obj out of it (while it is being dragged, say, so that it doesn't snap to itself).
+void SetDrawObjSnapping(DrawObjListPtr objList, CSkObjectPtr obj, Boolean snapTo)
+{
+    if (objList->snapIndex == NULL)
+	return;
+    CSkSnapIndexRemoveRect(objList->snapIndex, obj->snapBounds);	// nothing for CGRectNull
+    obj->snapBounds = snapTo ? CSkShapeGetBounds(obj->shape) : CGRectNull;
+    CSkSnapIndexAddRect(objList->snapIndex, obj->snapBounds);
+}
+
+void CSkObjListSetSelectedSnapping(DrawObjListPtr objList, Boolean snapTo)
+{
+    CSkObjectPtr obj;
+    
+    for (obj = objList->firstItem; obj != NULL; obj = obj->nextObj)
+    {
+	if (obj->selected)
+	    SetDrawObjSnapping(objList, obj, snapTo);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Allocate new drawObject with attributes from the current settings in the CSkToolPalette,
+// interned in styles. Bounds are empty.
+CSkObjectPtr CreateCSkObj(CSkStyleTablePtr styles, const CSkObjectAttributes* attributes, CSkShapePtr sh)
+{
+    CSkStylePtr	    style = (styles != NULL) ? CSkStyleTableIntern(styles, attributes) : NULL;
+    CSkObjectPtr    obj = NULL;
+    
+    if (style != NULL)
+    {
+	obj = CreateCSkObjWithStyle(style, sh);
+	CSkStyleRelease(style);
+    }
+    return obj;
+}
+
+// Same, for a style that is already interned (the file readers look up their styles once)
+CSkObjectPtr CreateCSkObjWithStyle(CSkStylePtr style, CSkShapePtr sh)
 {
     CSkObjectPtr obj = (CSkObjectPtr)NewPtrClear(sizeof(CSkObject));
     if (obj != NULL)
     {
-	CSkObjectSetAttributes(obj, attributes);
+	obj->style = CSkStyleRetain(style);
 	obj->shape = sh;
+	obj->mapIndex = kCSkNotMapped;
+	obj->changes = 0;
+	obj->refCount = 1;
+	obj->snapBounds = CGRectNull;
     }
     return obj;
 }
@@ -115,19 +195,37 @@ CSkObjectPtr CopyDrawObject(const CSkObject* obj)
     if (newObj)
     {
 	memcpy(newObj, obj, sizeof(CSkObject));
-        newObj->shape = CSkShapeCreate(kUndefined);
-	memcpy(newObj->shape, obj->shape, CSkShapeSize());
+        newObj->shape = CSkShapeCreateCopy(obj->shape);	// a polygon shares the points until one changes
+        CSkStyleRetain(newObj->style);
         newObj->nextObj = NULL;
         newObj->prevObj = NULL;
+        newObj->mapIndex = kCSkNotMapped;
+        newObj->objectID = 0;	    // a new object, as far as the file is concerned
+        newObj->changes = 0;
+        newObj->refCount = 1;
+        newObj->snapBounds = CGRectNull;   // not in any list yet
     }
     return newObj;
 }
 
 //------------------------------------------------------------------------------
+// Objects are reference counted so that an autosave snapshot can share them with the list
+// (see CSkAutosave.c). The count is changed atomically: the autosave thread releases its
+// snapshot while the main thread edits.
+CSkObjectPtr RetainDrawObj(CSkObjectPtr obj)
+{
+    OSAtomicIncrement32(&obj->refCount);
+    return obj;
+}
+
 void ReleaseDrawObj(CSkObjectPtr obj)
 {
-    CSkShapeRelease(obj->shape);
+    if (OSAtomicDecrement32(&obj->refCount) == 0)
+    {
+	CSkShapeRelease(obj->shape);
+	CSkStyleRelease(obj->style);
 	DisposePtr((Ptr)obj);
+    }
 }
 
 void ReleaseDrawObjList(DrawObjListPtr objList)
@@ -140,6 +238,82 @@ void ReleaseDrawObjList(DrawObjListPtr objList)
         obj = obj->nextObj;
         ReleaseDrawObj(deleteThis);
     }
+    CSkStyleTableRelease(objList->styles);  // gone once autosave snapshots let go of their objects
+    objList->styles = NULL;
+    CSkSnapIndexRelease(objList->snapIndex);
+    objList->snapIndex = NULL;
+}
+
+
+//------------------------------------------------------------------------------
+// Before changing the shape or attributes of obj, which is in objList: if a snapshot shares
+// obj, replace it in objList with a copy, and change that. The snapshot keeps the original.
+// The copy is the same object as far as the file is concerned.
+CSkObjectPtr CSkObjectMakeWritable(DrawObjListPtr objList, CSkObjectPtr obj)
+{
+    CSkObjectPtr copy;
+    
+    if (obj->refCount == 1)
+	return obj;
+    copy = CopyDrawObject(obj);
+    if (copy == NULL)
+	return obj;		    // the snapshot will see the change; the document is still right
+    copy->mapIndex = obj->mapIndex;
+    copy->objectID = obj->objectID;
+    copy->changes = obj->changes;
+    InsertDrawObjBefore(objList, copy, obj);
+    RemoveDrawObjFromList(objList, obj);
+    ReleaseDrawObj(obj);
+    return copy;
+}
+
+//------------------------------------------------------------------------------
+// An array of the objects in objList, front to back, each of them retained; NULL if objList
+// is empty or we're out of memory. Costs a pointer per object, whatever the objects are.
+static CSkObjectPtr* CreateSnapshot(const DrawObjList* objList, Boolean selectedOnly, UInt32* outCount)
+{
+    CSkObjectPtr*   objects;
+    CSkObjectPtr    obj;
+    UInt32	    count = 0;
+    
+    for (obj = objList->firstItem; obj != NULL; obj = obj->nextObj)
+    {
+	if (obj->selected || !selectedOnly)
+	    count += 1;
+    }
+    *outCount = 0;
+    if (count == 0)
+	return NULL;
+    objects = (CSkObjectPtr*)malloc(count * sizeof(CSkObjectPtr));
+    if (objects != NULL)
+    {
+	for (obj = objList->firstItem; obj != NULL; obj = obj->nextObj)
+	{
+	    if (obj->selected || !selectedOnly)
+		objects[(*outCount)++] = RetainDrawObj(obj);
+	}
+    }
+    return objects;
+}
+
+CSkObjectPtr* CreateDrawObjSnapshot(const DrawObjList* objList, UInt32* outCount)
+{
+    return CreateSnapshot(objList, false, outCount);
+}
+
+// Same, for the selected objects only
+CSkObjectPtr* CreateSelectedDrawObjSnapshot(const DrawObjList* objList, UInt32* outCount)
+{
+    return CreateSnapshot(objList, true, outCount);
+}
+
+void ReleaseDrawObjSnapshot(CSkObjectPtr* objects, UInt32 count)
+{
+    UInt32 i;
+    
+    for (i = 0; i < count; ++i)
+	ReleaseDrawObj(objects[i]);
+    free(objects);
 }
 
 
@@ -155,14 +329,63 @@ CSkShape* CSkObjectGetShape( const CSkObject* drawObj )
     return (drawObj == NULL ? NULL : drawObj->shape);
 }
 
+// For walking a DrawObjList front to back, outside of this file
+CSkObjectPtr CSkObjectGetNext( const CSkObject* drawObj )
+{
+    return drawObj->nextObj;
+}
+
+// ... and back to front
+CSkObjectPtr CSkObjectGetPrev( const CSkObject* drawObj )
+{
+    return drawObj->prevObj;
+}
+
+// Objects materialized from a mapped document remember their record (see CSkMappedDoc.c)
+UInt32 CSkObjectGetMapIndex( const CSkObject* drawObj )
+{
+    return drawObj->mapIndex;
+}
+
+void CSkObjectSetMapIndex( CSkObjectPtr drawObj, UInt32 mapIndex )
+{
+    drawObj->mapIndex = mapIndex;
+}
+
+// For incremental saves (see CSkFileFormat.c)
+UInt32 CSkObjectGetID( const CSkObject* drawObj )
+{
+    return drawObj->objectID;
+}
+
+void CSkObjectSetID( CSkObjectPtr drawObj, UInt32 objectID )
+{
+    drawObj->objectID = objectID;
+}
+
+UInt8 CSkObjectGetChanges( const CSkObject* drawObj )
+{
+    return drawObj->changes;
+}
+
+void CSkObjectSetChanges( CSkObjectPtr drawObj, UInt8 changes )
+{
+    drawObj->changes = changes;
+}
+
+void CSkObjectMarkChanged( CSkObjectPtr drawObj )
+{
+    drawObj->changes |= kCSkObjectChanged;
+}
+
 float GetFillAlpha( const CSkObject* drawObj )
 {
-    return drawObj->attr.fillColor.a;
+    return CSkStyleGetAttributes(drawObj->style)->fillColor.a;
 }
 
 float GetStrokeAlpha( const CSkObject* drawObj )
 {
-    return drawObj->attr.strokeColor.a;
+    return CSkStyleGetAttributes(drawObj->style)->strokeColor.a;
 }
 
 void SetDrawObjSelectState( CSkObjectPtr drawObj, Boolean selected )
@@ -177,126 +400,189 @@ Boolean IsDrawObjSelected( const CSkObject* drawObj )
 
 
 //------------------------------------------------------------------------------
-void CSkObjectSetAttributes(CSkObjectPtr obj, CSkObjectAttributes* attributes)
+static void SetObjectStyle(CSkObjectPtr obj, CSkStylePtr style)
 {
-    memcpy(&obj->attr, attributes, sizeof(CSkObjectAttributes));
+    CSkStyleRetain(style);
+    CSkStyleRelease(obj->style);
+    obj->style = style;
+    obj->changes |= kCSkObjectChanged;
 }
 
-void CSkSetObjAttributesIfSelected(DrawObjListPtr objListP, CSkObjectAttributes* attributes)
+// The style with these attributes comes from the table of obj's current style.
+void CSkObjectSetAttributes(CSkObjectPtr obj, const CSkObjectAttributes* attributes)
 {
-    CSkObjectPtr obj = objListP->firstItem;
+    CSkStylePtr style = CSkStyleTableIntern(CSkStyleGetTable(obj->style), attributes);
+    if (style != NULL)
+    {
+	if (style != obj->style)
+	    SetObjectStyle(obj, style);
+	CSkStyleRelease(style);
+    }
+}
+
+void CSkSetObjAttributesIfSelected(DrawObjListPtr objListP, const CSkObjectAttributes* attributes)
+{
+    CSkStylePtr	    style = CSkStyleTableIntern(CSkObjListGetStyles(objListP), attributes);
+    CSkObjectPtr    obj = objListP->firstItem;
+    
+    if (style == NULL)
+	return;
     while (obj != NULL)
     {
-        if (obj->selected)
-            CSkObjectSetAttributes(obj, attributes);
-        obj = obj->nextObj;
+	if (obj->selected && (obj->style != style))
+	{
+	    obj = CSkObjectMakeWritable(objListP, obj);
+	    SetObjectStyle(obj, style);
+	}
+	obj = obj->nextObj;
     }
+    CSkStyleRelease(style);
 }
 
 //------------------------------------------------------------------------------
-void SetLineWidthOfSelecteds(DrawObjListPtr objListP, float lineWidth)
+// The Set...OfSelecteds functions change one attribute of the selected objects, which gives
+// each of them another style. Objects that shared a style get the same new one; the last
+// old -> new pair is remembered, so a selection of like objects is interned only once.
+typedef void (*AttributeSetterProcPtr)(CSkObjectAttributes* attr, const void* value);
+
+static void SetAttributeOfSelecteds(DrawObjListPtr objListP, AttributeSetterProcPtr setter, const void* value)
 {
-    CSkObjectPtr  obj = objListP->firstItem;
+    CSkStylePtr	    oldStyle = NULL;	// retained, so that its address isn't reused meanwhile
+    CSkStylePtr	    newStyle = NULL;
+    CSkObjectPtr    obj = objListP->firstItem;
+    
     while (obj != NULL)
     {
-        if (obj->selected)
-        {
-	    if (lineWidth == kMakeItThinner)
+	if (obj->selected)
+	{
+	    if (obj->style != oldStyle)
 	    {
-		if (obj->attr.lineWidth >= 2.0)
-		    obj->attr.lineWidth -= 1.0;
+		CSkObjectAttributes attr = *CSkStyleGetAttributes(obj->style);
+		CSkStylePtr	    style;
+		
+		setter(&attr, value);
+		style = CSkStyleTableIntern(CSkStyleGetTable(obj->style), &attr);
+		if (style == NULL)
+		    break;
+		if (oldStyle != NULL)
+		{
+		    CSkStyleRelease(oldStyle);
+		    CSkStyleRelease(newStyle);
+		}
+		oldStyle = CSkStyleRetain(obj->style);
+		newStyle = style;
+	    }
+	    if (obj->style != newStyle)
+	    {
+		obj = CSkObjectMakeWritable(objListP, obj);
+		SetObjectStyle(obj, newStyle);
 	    }
-	    else if (lineWidth == kMakeItThicker)
-		obj->attr.lineWidth += 1.0;
-	    else
-		obj->attr.lineWidth = lineWidth;
 	}
-        obj = obj->nextObj;
+	obj = obj->nextObj;
+    }
+    if (oldStyle != NULL)
+    {
+	CSkStyleRelease(oldStyle);
+	CSkStyleRelease(newStyle);
     }
 }
 
 //------------------------------------------------------------------------------
-void SetLineCapOfSelecteds(DrawObjListPtr objListP, CGLineCap lineCap)
+static void ChangeLineWidth(CSkObjectAttributes* attr, const void* value)
 {
-    CSkObjectPtr  obj = objListP->firstItem;
-    while (obj != NULL)
+    float lineWidth = *(const float*)value;
+    
+    if (lineWidth == kMakeItThinner)
     {
-        if (obj->selected)
-            obj->attr.lineCap = lineCap;
-        obj = obj->nextObj;
+	if (attr->lineWidth >= 2.0)
+	    attr->lineWidth -= 1.0;
     }
+    else if (lineWidth == kMakeItThicker)
+	attr->lineWidth += 1.0;
+    else
+	attr->lineWidth = lineWidth;
+}
+
+void SetLineWidthOfSelecteds(DrawObjListPtr objListP, float lineWidth)
+{
+    SetAttributeOfSelecteds(objListP, ChangeLineWidth, &lineWidth);
+}
+
+//------------------------------------------------------------------------------
+static void ChangeLineCap(CSkObjectAttributes* attr, const void* value)
+{
+    attr->lineCap = *(const CGLineCap*)value;
+}
+
+void SetLineCapOfSelecteds(DrawObjListPtr objListP, CGLineCap lineCap)
+{
+    SetAttributeOfSelecteds(objListP, ChangeLineCap, &lineCap);
 }
 
 //------------------------------------------------------------------------------
+static void ChangeLineJoin(CSkObjectAttributes* attr, const void* value)
+{
+    attr->lineJoin = *(const CGLineJoin*)value;
+}
+
 void SetLineJoinOfSelecteds(DrawObjListPtr objListP, CGLineJoin lineJoin)
 {
-    CSkObjectPtr  obj = objListP->firstItem;
-    while (obj != NULL)
-    {
-        if (obj->selected)
-            obj->attr.lineJoin = lineJoin;
-        obj = obj->nextObj;
-    }
+    SetAttributeOfSelecteds(objListP, ChangeLineJoin, &lineJoin);
 }
 
 //------------------------------------------------------------------------------
+static void ChangeLineStyle(CSkObjectAttributes* attr, const void* value)
+{
+    attr->lineStyle = *(const int*)value;
+}
+
 void SetLineStyleOfSelecteds(DrawObjListPtr objListP, int lineStyle)
 {
-    CSkObjectPtr  obj = objListP->firstItem;
-    while (obj != NULL)
-    {
-        if (obj->selected)
-            obj->attr.lineStyle = lineStyle;
-        obj = obj->nextObj;
-    }
+    SetAttributeOfSelecteds(objListP, ChangeLineStyle, &lineStyle);
 }
 
 //------------------------------------------------------------------------------
+static void ChangeStrokeColor(CSkObjectAttributes* attr, const void* value)
+{
+    attr->strokeColor = *(const CGrgba*)value;
+}
+
 void SetStrokeColorOfSelecteds(DrawObjListPtr objListP, CGrgba* color)
 {
-    CSkObjectPtr  obj = objListP->firstItem;
-    while (obj != NULL)
-    {
-        if (obj->selected)
-            obj->attr.strokeColor = *color;
-        obj = obj->nextObj;
-    }
+    SetAttributeOfSelecteds(objListP, ChangeStrokeColor, color);
 }
 
 //------------------------------------------------------------------------------
+static void ChangeStrokeAlpha(CSkObjectAttributes* attr, const void* value)
+{
+    attr->strokeColor.a = *(const float*)value;
+}
+
 void SetStrokeAlphaOfSelecteds(DrawObjListPtr objListP, float alpha)
 {
-    CSkObjectPtr  obj = objListP->firstItem;
-    while (obj != NULL)
-    {
-        if (obj->selected)
-            obj->attr.strokeColor.a = alpha;
-        obj = obj->nextObj;
-    }
+    SetAttributeOfSelecteds(objListP, ChangeStrokeAlpha, &alpha);
 }
 
 //------------------------------------------------------------------------------
+static void ChangeFillColor(CSkObjectAttributes* attr, const void* value)
+{
+    attr->fillColor = *(const CGrgba*)value;
+}
+
 void SetFillColorOfSelecteds(DrawObjListPtr objListP, CGrgba* color)
 {
-    CSkObjectPtr  obj = objListP->firstItem;
-    while (obj != NULL)
-    {
-        if (obj->selected)
-            obj->attr.fillColor = *color;
-        obj = obj->nextObj;
-    }
+    SetAttributeOfSelecteds(objListP, ChangeFillColor, color);
 }
 
 //------------------------------------------------------------------------------
+static void ChangeFillAlpha(CSkObjectAttributes* attr, const void* value)
+{
+    attr->fillColor.a = *(const float*)value;
+}
+
 void SetFillAlphaOfSelecteds(DrawObjListPtr objListP, float alpha)
 {
-    CSkObjectPtr  obj = objListP->firstItem;
-    while (obj != NULL)
-    {
-        if (obj->selected)
-            obj->attr.fillColor.a = alpha;
-        obj = obj->nextObj;
-    }
+    SetAttributeOfSelecteds(objListP, ChangeFillAlpha, &alpha);
 }
 
 //------------------------------------------------------------------------------
@@ -334,7 +620,10 @@ void CSkObjListSelectWithinRect(DrawObjList* objListP, CGRect selectionRect)
 // "stroke only" is achieved by setting the fillColor alpha to fully
 // transparent. Similarly, if we want "filled only", we have to set
 // the alpha of the strokeColor to 0.
-// Consequently, we always pass kCGPathFillStroke to CGContextDrawPath.
+// Consequently, we always pass kCGPathFillStroke to CGContextDrawPath (lines are only stroked).
+//
+// The Add... functions append a shape to the current path as subpaths of its own, so that
+// RenderMergedDrawObjsAtIndices can paint several shapes of the same style at once.
 
 //------------------------------------------------------------------------------
 static void DrawRect(CGContextRef ctx, CGRect cgRect)
@@ -345,7 +634,7 @@ static void DrawRect(CGContextRef ctx, CGRect cgRect)
 }
 
 //------------------------------------------------------------------------------
-static void DrawOval(CGContextRef ctx, CGRect cgRect)
+static void AddOval(CGContextRef ctx, CGRect cgRect)
 {
     const float TWOPI   = 6.283185307;
     float   halfWidth   = 0.5 * CGRectGetWidth(cgRect);
@@ -372,19 +661,16 @@ static void DrawOval(CGContextRef ctx, CGRect cgRect)
 
     CGContextSaveGState(ctx);				// because we temporarily change the CTM
     CGContextScaleCTM(ctx, scaleX, scaleY);  // so the full-circle arc will appear as oval
-    CGContextBeginPath(ctx);
+    if (!CGContextIsPathEmpty(ctx))	    // or the arc would be joined to the previous shape
+	CGContextMoveToPoint(ctx, centerX + radius, centerY);
     CGContextAddArc(ctx, centerX, centerY, radius, 0.0, TWOPI, 0);
     CGContextClosePath(ctx);
     CGContextRestoreGState(ctx);	// back to the previous CTM
-
-	CGContextDrawPath(ctx, kCGPathFillStroke);
 }
 
 //------------------------------------------------------------------------------
-static void DrawRRect(CGContextRef ctx, CGRect cgRect, CGPoint radii)
+static void AddRRect(CGContextRef ctx, CGRect cgRect, CGPoint radii)
 {
-	CGContextBeginPath(ctx);
-
     if ((radii.x > 0) && (radii.y > 0))
     {
         float width     = CGRectGetWidth(cgRect);
@@ -420,56 +706,79 @@ static void DrawRRect(CGContextRef ctx, CGRect cgRect, CGPoint radii)
     }           
     
     CGContextClosePath(ctx);
-    CGContextDrawPath(ctx, kCGPathFillStroke);
 }
 
 //------------------------------------------------------------------------------
-static void DrawCGLine(CGContextRef ctx, CGPoint a, CGPoint b)
+static void AddCGLine(CGContextRef ctx, CGPoint a, CGPoint b)
 {
     CGContextMoveToPoint( ctx, a.x, a.y );
     CGContextAddLineToPoint( ctx, b.x, b.y );
-    CGContextStrokePath(ctx);
 }
 
 //------------------------------------------------------------------------------
-static void DrawCGQuad(CGContextRef ctx, CGPoint a, CGPoint b, CGPoint c)
+static void AddCGQuad(CGContextRef ctx, CGPoint a, CGPoint b, CGPoint c)
 {
     CGContextMoveToPoint( ctx, a.x, a.y );
     CGContextAddQuadCurveToPoint( ctx, b.x, b.y, c.x, c.y );
-    CGContextDrawPath(ctx, kCGPathFillStroke);
 }
 
 //------------------------------------------------------------------------------
-static void DrawCGCubic(CGContextRef ctx, CGPoint a, CGPoint b, CGPoint c, CGPoint d)
+static void AddCGCubic(CGContextRef ctx, CGPoint a, CGPoint b, CGPoint c, CGPoint d)
 {
     CGContextMoveToPoint( ctx, a.x, a.y );
     CGContextAddCurveToPoint( ctx, b.x, b.y, c.x, c.y, d.x, d.y );
-    CGContextDrawPath(ctx, kCGPathFillStroke);
 }
 
 //------------------------------------------------------------------------------
-static void DrawPath(CGContextRef ctx, CGPathRef path)
+static void AddDrawObjPath(CGContextRef ctx, const CSkObject* obj)
 {
-    CGContextAddPath(ctx, path);
-    CGContextDrawPath(ctx, kCGPathFillStroke);
+    int	    shapeType   = CSkShapeGetType(obj->shape);
+    CGPoint ptP[4];
+    CGRect  shapeBounds = CSkShapeGetBounds(obj->shape);
+	
+    CSkShapeGetPoints(obj->shape, ptP);
+	
+    switch (shapeType)
+    {
+	case kLineShape:    AddCGLine(ctx, ptP[0], ptP[1]);			break;
+	case kQuadBezier:   AddCGQuad(ctx, ptP[0], ptP[1], ptP[2]);		break;
+	case kCubicBezier:  AddCGCubic(ctx, ptP[0], ptP[1], ptP[2], ptP[3]);   break;	    
+	case kRectShape:    CGContextAddRect(ctx, shapeBounds);			break;
+	case kOvalShape:    AddOval(ctx, shapeBounds);				break;
+	case kFreePolygon:  CSkShapeAddPolygonToContext(obj->shape, ctx);	break;
+	case kRRectShape:   
+	    AddRRect(ctx, shapeBounds, CSkShapeGetRRectRadii(obj->shape));	break;
+    }
 }
 
 //------------------------------------------------------------------------------
-// Keep this separate from RenderCSkObject; this way, RenderCSkObject can
-// be reused from within the mousetracking loops when drawing into an overlay window.
-void SetContextStateForDrawObject(CGContextRef ctx, const CSkObject* obj)
+static CGPathDrawingMode GetDrawObjPathMode(const CSkObject* obj)
+{
+    return (CSkShapeGetType(obj->shape) == kLineShape) ? kCGPathStroke : kCGPathFillStroke;
+}
+
+//------------------------------------------------------------------------------
+static void SetContextStateForAttributes(CGContextRef ctx, const CSkObjectAttributes* attr)
 {
-    CGContextSetLineWidth(ctx, obj->attr.lineWidth);
-    CGContextSetLineCap(ctx, obj->attr.lineCap);
-    CGContextSetLineJoin(ctx, obj->attr.lineJoin);
-    if (obj->attr.lineStyle == kStyleDashed)
+    CGContextSetLineWidth(ctx, attr->lineWidth);
+    CGContextSetLineCap(ctx, attr->lineCap);
+    CGContextSetLineJoin(ctx, attr->lineJoin);
+    if (attr->lineStyle == kStyleDashed)
     {
-        CGFloat dashLengths[2] = { obj->attr.lineWidth + 4, obj->attr.lineWidth + 4 };
+        CGFloat dashLengths[2] = { attr->lineWidth + 4, attr->lineWidth + 4 };
         CGContextSetLineDash(ctx, 1.0, dashLengths, 2);
     }
     
-    CGContextSetStrokeColor( ctx, (CGFloat *)&(obj->attr.strokeColor));
-    CGContextSetFillColor( ctx, (CGFloat *)&(obj->attr.fillColor));
+    CGContextSetStrokeColor( ctx, (CGFloat *)&(attr->strokeColor));
+    CGContextSetFillColor( ctx, (CGFloat *)&(attr->fillColor));
+}
+
+//------------------------------------------------------------------------------
+// Keep this separate from RenderCSkObject; this way, RenderCSkObject can
+// be reused from within the mousetracking loops when drawing into an overlay window.
+void SetContextStateForDrawObject(CGContextRef ctx, const CSkObject* obj)
+{
+    SetContextStateForAttributes(ctx, CSkStyleGetAttributes(obj->style));
 }
 
 
@@ -479,20 +788,10 @@ void SetContextStateForDrawObject(CGContextRef ctx, const CSkObject* obj)
 void RenderCSkObject(CGContextRef ctx, const CSkObject* obj, Boolean drawSelection)
 {
     int	    shapeType   = CSkShapeGetType(obj->shape);
-    CGPoint* ptP	= CSkShapeGetPoints(obj->shape);
-    CGRect  shapeBounds = CSkShapeGetBounds(obj->shape);
 	
-    switch (shapeType)
-    {
-	case kLineShape:    DrawCGLine(ctx, ptP[0], ptP[1]);			break;
-	case kQuadBezier:   DrawCGQuad(ctx, ptP[0], ptP[1], ptP[2]);		break;
-	case kCubicBezier:  DrawCGCubic(ctx, ptP[0], ptP[1], ptP[2], ptP[3]);   break;	    
-	case kRectShape:    DrawRect(ctx, shapeBounds);				break;
-	case kOvalShape:    DrawOval(ctx, shapeBounds);				break;
-	case kFreePolygon:  DrawPath(ctx, CSkShapeGetPath(obj->shape));		break;
-	case kRRectShape:   
-	    DrawRRect(ctx, shapeBounds, CSkShapeGetRRectRadii(obj->shape));	break;
-    }
+    CGContextBeginPath(ctx);
+    AddDrawObjPath(ctx, obj);
+    CGContextDrawPath(ctx, GetDrawObjPathMode(obj));
 	
     if (drawSelection && obj->selected)  // draw little "grabber" squares
     {
@@ -533,33 +832,225 @@ void RenderCSkObject(CGContextRef ctx, const CSkObject* obj, Boolean drawSelecti
 }	// RenderCSkObject
 
 //------------------------------------------------------------------------------
-// Draw the CSkObjects in the linked list from back to front. For each object, the GState needs
-// to be saved and restored.
+// Objects are drawn in stacking order, so they can't be sorted by style; but a run of objects
+// with the same style (as shapes drawn one after the other mostly are) shares one GState.
+// *ioStyle is the style the GState was set up for, NULL if none.
+static void SetContextStateForRun(CGContextRef ctx, const CSkObject* obj, CSkStylePtr* ioStyle)
+{
+    if (obj->style == *ioStyle)
+	return;
+    if (*ioStyle != NULL)
+	CGContextRestoreGState(ctx);	// undo the changes for the previous run
+    CGContextSaveGState(ctx);		// because SetContextStateForDrawObject is doing what it says it will
+    SetContextStateForDrawObject(ctx, obj);
+    *ioStyle = obj->style;
+}
+
+static void EndRun(CGContextRef ctx, CSkStylePtr style)
+{
+    if (style != NULL)
+	CGContextRestoreGState(ctx);
+}
+
+//------------------------------------------------------------------------------
+// Draw the CSkObjects in the linked list from back to front.
 void  RenderDrawObjList(CGContextRef ctx, const DrawObjList* objListP, Boolean drawSelection)
 {
-    CSkObjectPtr obj = objListP->lastItem;    // draw from back to front
+    CSkObjectPtr    obj = objListP->lastItem;    // draw from back to front
+    CSkStylePtr	    style = NULL;
+    CSK_TRACE_SPAN("RenderDrawObjList");
+
     while (obj != NULL)
     {
-	CGContextSaveGState(ctx);	// because SetContextStateForDrawObject is doing what it says it will
-	SetContextStateForDrawObject(ctx, obj);
+	SetContextStateForRun(ctx, obj, &style);
         RenderCSkObject(ctx, obj, drawSelection);
-	CGContextRestoreGState(ctx);	// undo the changes for the specific obj drawing
         obj = obj->prevObj;
     }
+    EndRun(ctx, style);
 }
 
 
 //------------------------------------------------------------------------------
-// Multiply in a transparency factor. Used for tracking feedback when resizing an object.
-void MakeDrawObjTransparent(CSkObject* obj, float alpha)
+// The area RenderCSkObject may touch, in document coordinates: the shape bounds, outset for the
+// stroke (a miter join can stick out by miterLimit * lineWidth/2) and, if drawn, the grabbers.
+CGRect GetDrawObjRenderBounds(const CSkObject* obj, Boolean drawSelection)
 {
-    obj->attr.strokeColor.a *= alpha;
-    obj->attr.fillColor.a *= alpha;
+    const float kMiterLimit	= 10.0;	    // the CG default; we never change it
+    const float kGrabberOutset	= 4.5;	    // half the grabber size, plus half its 1-pixel frame
+    const CSkObjectAttributes* attr = CSkStyleGetAttributes(obj->style);
+    float	d = 0.5 * attr->lineWidth;
+    
+    d *= (attr->lineJoin == kCGLineJoinMiter) ? kMiterLimit : 1.5;	// 1.5 > sqrt(2), for square caps
+    if (drawSelection && obj->selected && (d < kGrabberOutset))
+	d = kGrabberOutset;
+    return CGRectInset(CSkShapeGetBounds(obj->shape), -d, -d);
 }
 
+//------------------------------------------------------------------------------
+// Union of the render bounds of the selected objects, with grabbers (cf. RenderSelectedDrawObjs).
+CGRect GetSelectedDrawObjsRenderBounds(const DrawObjList* objListP)
+{
+    CGRect	    bounds = CGRectNull;
+    CSkObjectPtr    obj;
+    
+    for (obj = objListP->firstItem; obj != NULL; obj = obj->nextObj)
+    {
+	if (obj->selected)
+	    bounds = CGRectUnion(bounds, GetDrawObjRenderBounds(obj, true));
+    }
+    return bounds;
+}
+
+// Same, for the shapes alone: what the selection snaps with while it is moved
+CGRect GetSelectedDrawObjsShapeBounds(const DrawObjList* objListP)
+{
+    CGRect	    bounds = CGRectNull;
+    CSkObjectPtr    obj;
+    
+    for (obj = objListP->firstItem; obj != NULL; obj = obj->nextObj)
+    {
+	if (obj->selected)
+	    bounds = CGRectUnion(bounds, CSkShapeGetBounds(obj->shape));
+    }
+    return bounds;
+}
+
+//------------------------------------------------------------------------------
+// Same as RenderDrawObjList, but skip objects whose render bounds don't intersect
+// visibleRect, given in document coordinates.
+void  RenderDrawObjListInRect(CGContextRef ctx, const DrawObjList* objListP, CGRect visibleRect, Boolean drawSelection)
+{
+    CSkObjectPtr    obj = objListP->lastItem;    // draw from back to front
+    CSkStylePtr	    style = NULL;
+    
+    while (obj != NULL)
+    {
+	if (CGRectIntersectsRect(GetDrawObjRenderBounds(obj, drawSelection), visibleRect))
+	{
+	    SetContextStateForRun(ctx, obj, &style);
+	    RenderCSkObject(ctx, obj, drawSelection);
+	}
+        obj = obj->prevObj;
+    }
+    EndRun(ctx, style);
+}
+
+//------------------------------------------------------------------------------
+// Draws objects[indices[i]] from back to front, for indices in ascending order
+// (front to back) into objects, a snapshot; see CSkSpatialIndexFindInRect.
+void  RenderDrawObjsAtIndices(CGContextRef ctx, const CSkObjectPtr* objects, const UInt32* indices, UInt32 count, Boolean drawSelection)
+{
+    CSkStylePtr	style = NULL;
+    
+    while (count > 0)
+    {
+	const CSkObject* obj = objects[indices[--count]];
+	SetContextStateForRun(ctx, obj, &style);
+	RenderCSkObject(ctx, obj, drawSelection);
+    }
+    EndRun(ctx, style);
+}
+
+//------------------------------------------------------------------------------
+// False if obj paints nothing but fully transparent color. A line width of 0 doesn't make a
+// stroke invisible: it is drawn as the thinnest line the device can render.
+Boolean IsDrawObjVisible(const CSkObject* obj)
+{
+    const CSkObjectAttributes* attr = CSkStyleGetAttributes(obj->style);
+    
+    if (attr->strokeColor.a > 0)
+	return true;
+    return (attr->fillColor.a > 0) && (CSkShapeGetType(obj->shape) != kLineShape);
+}
+
+//------------------------------------------------------------------------------
+// Can obj, with render bounds bounds, be added to the path of a run of objects drawn with one
+// CGContextDrawPath? It can if it has the same style and drawing mode, and doesn't overlap any of
+// them: then the order they are painted in makes no difference. The margin keeps antialiased
+// edges apart, down to 72 dpi.
+enum { kMaxMergedRun = 128 };	// the overlap test is quadratic in the length of a run
+
+static Boolean CanJoinRun(const CSkObject* const* run, const CGRect* runBounds, UInt32 runLength, const CSkObject* obj, CGRect bounds)
+{
+    const float kMergeMargin = 1.0;
+    UInt32	i;
+    
+    if ((runLength >= kMaxMergedRun) || (obj->style != run[0]->style) || (GetDrawObjPathMode(obj) != GetDrawObjPathMode(run[0])))
+	return false;
+    bounds = CGRectInset(bounds, -kMergeMargin, -kMergeMargin);
+    for (i = 0; i < runLength; ++i)
+    {
+	if (CGRectIntersectsRect(bounds, runBounds[i]))
+	    return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Same as RenderDrawObjsAtIndices, but runs of objects that CanJoinRun are painted as one path,
+// which makes for much smaller PDFs. Selected objects are drawn on their own if drawSelection
+// is true. Returns the number of paths painted.
+UInt32  RenderMergedDrawObjsAtIndices(CGContextRef ctx, const CSkObjectPtr* objects, const UInt32* indices, UInt32 count, Boolean drawSelection)
+{
+    const CSkObject*	run[kMaxMergedRun];
+    CGRect		runBounds[kMaxMergedRun];
+    UInt32		runLength = 0, numPaths = 0;
+    CSkStylePtr		style = NULL;
+    
+    while (count > 0)
+    {
+	const CSkObject* obj = objects[indices[--count]];
+	CGRect		bounds = GetDrawObjRenderBounds(obj, false);
+	Boolean		alone = drawSelection && obj->selected;
+	
+	if ((runLength > 0) && (alone || !CanJoinRun(run, runBounds, runLength, obj, bounds)))
+	{
+	    CGContextDrawPath(ctx, GetDrawObjPathMode(run[0]));
+	    numPaths++;
+	    runLength = 0;
+	}
+	SetContextStateForRun(ctx, obj, &style);
+	if (alone)
+	{
+	    RenderCSkObject(ctx, obj, true);
+	    numPaths++;
+	    continue;
+	}
+	if (runLength == 0)
+	    CGContextBeginPath(ctx);
+	AddDrawObjPath(ctx, obj);
+	run[runLength] = obj;
+	runBounds[runLength++] = bounds;
+    }
+    if (runLength > 0)
+    {
+	CGContextDrawPath(ctx, GetDrawObjPathMode(run[0]));
+	numPaths++;
+    }
+    EndRun(ctx, style);
+    return numPaths;
+}
+
+//------------------------------------------------------------------------------
+// Draws all the objects of a snapshot (front to back) from back to front.
+void  RenderDrawObjSnapshot(CGContextRef ctx, const CSkObjectPtr* objects, UInt32 count, Boolean drawSelection)
+{
+    CSkStylePtr	style = NULL;
+    
+    while (count > 0)
+    {
+	const CSkObject* obj = objects[--count];
+	SetContextStateForRun(ctx, obj, &style);
+	RenderCSkObject(ctx, obj, drawSelection);
+    }
+    EndRun(ctx, style);
+}
+
+
 //------------------------------------------------------------------------------
 // The following is used during moving selected objects around (ctx is overlayWindowContext).
 // Draw the selected objects only, and with an additional alpha multiplied in for more transparency.
+// The alpha goes into the GState only; the objects' styles stay as they are.
 void  RenderSelectedDrawObjs(CGContextRef ctx, const DrawObjList* objListP, float offsetX, float offsetY, float alpha)
 {
     CSkObjectPtr obj = objListP->lastItem;    // draw from back to front
@@ -569,15 +1060,12 @@ void  RenderSelectedDrawObjs(CGContextRef ctx, const DrawObjList* objListP, floa
     {
         if (obj->selected)
         {
-            CGrgba saveStrokeColor  = obj->attr.strokeColor;
-            CGrgba saveFillColor    = obj->attr.fillColor;
+            CSkObjectAttributes attr = *CSkStyleGetAttributes(obj->style);
             
-	    MakeDrawObjTransparent(obj, alpha);
-	    SetContextStateForDrawObject(ctx, obj);
+	    attr.strokeColor.a *= alpha;
+	    attr.fillColor.a *= alpha;
+	    SetContextStateForAttributes(ctx, &attr);
             RenderCSkObject(ctx, obj, true);
-			
-            obj->attr.strokeColor = saveStrokeColor;
-            obj->attr.fillColor = saveFillColor;
         }
         obj = obj->prevObj;
     }
@@ -585,7 +1073,9 @@ void  RenderSelectedDrawObjs(CGContextRef ctx, const DrawObjList* objListP, floa
 }
 
 //------------------------------------------------------------------------------
-// Called at the end of mouse tracking when selected objects have been moved
+// Called at the end of mouse tracking when selected objects have been moved. A polygon only
+// records the offset, whatever its number of points (see CSkPolygonOffset); if a snapshot shares
+// the object, the copy shares the points with it, so that case costs no more.
 void  MoveSelectedDrawObjs(DrawObjList* objListP, float offsetX, float offsetY)
 {
     CSkObjectPtr obj = objListP->firstItem;
@@ -593,7 +1083,10 @@ void  MoveSelectedDrawObjs(DrawObjList* objListP, float offsetX, float offsetY)
     {
         if (obj->selected)
         {
+	    obj = CSkObjectMakeWritable(objListP, obj);
 	    CSkShapeOffset(obj->shape, offsetX, offsetY);
+	    obj->changes |= kCSkObjectChanged;
+	    SetDrawObjSnapping(objListP, obj, true);
         }
         obj = obj->nextObj;
     }
@@ -653,10 +1146,56 @@ void AddDrawObjToList(DrawObjListPtr objList, CSkObjectPtr obj)
     {
         firstObj->prevObj = obj;
     }
+    SetDrawObjSnapping(objList, obj, true);
+}
+
+//----------------------------------------------------------------------
+// Puts obj behind everything else; for building a list front to back.
+void AppendDrawObjToList(DrawObjListPtr objList, CSkObjectPtr obj)
+{
+    CSkObjectPtr lastObj = objList->lastItem;
+    
+    obj->nextObj = NULL;
+    obj->prevObj = lastObj;
+    objList->lastItem = obj;
+
+    if (lastObj == NULL)
+    {
+        objList->firstItem = obj;
+    }
+    else
+    {
+        lastObj->nextObj = obj;
+    }
+    SetDrawObjSnapping(objList, obj, true);
+}
+
+//----------------------------------------------------------------------
+// Puts the objects of fromList in front of those of objList, in their order; fromList is
+// left empty. The objects have to be from objList's style table.
+void MoveDrawObjListToFront(DrawObjListPtr objList, DrawObjListPtr fromList)
+{
+    CSkObjectPtr obj;
+    
+    if (fromList->firstItem == NULL)
+	return;
+    for (obj = fromList->firstItem; obj != NULL; obj = obj->nextObj)
+    {
+	SetDrawObjSnapping(fromList, obj, false);
+	SetDrawObjSnapping(objList, obj, true);
+    }
+    fromList->lastItem->nextObj = objList->firstItem;
+    if (objList->firstItem == NULL)
+	objList->lastItem = fromList->lastItem;
+    else
+	objList->firstItem->prevObj = fromList->lastItem;
+    objList->firstItem = fromList->firstItem;
+    fromList->firstItem = NULL;
+    fromList->lastItem = NULL;
 }
 
 //----------------------------------------------------------------------
-static void RemoveDrawObjFromList(DrawObjListPtr objList, const CSkObject* obj)
+void RemoveDrawObjFromList(DrawObjListPtr objList, CSkObjectPtr obj)
 {
     CSkObjectPtr prevObj = obj->prevObj;
     CSkObjectPtr nextObj = obj->nextObj;
@@ -672,6 +1211,8 @@ static void RemoveDrawObjFromList(DrawObjListPtr objList, const CSkObject* obj)
             
     if (objList->lastItem == obj)
         objList->lastItem = obj->prevObj;
+    
+    SetDrawObjSnapping(objList, obj, false);
 }
 
 //------------------------------------------------------------------------------
@@ -684,13 +1225,14 @@ void RemoveSelectedDrawObjs(DrawObjListPtr objList)
         if (obj->selected)
         {
             RemoveDrawObjFromList(objList, obj);
+	    ReleaseDrawObj(obj);	// unless an autosave snapshot still holds on to it
         }
         obj = nextObj;
     }
 }
 
 //------------------------------------------------------------------------------
-static void InsertDrawObjBefore(DrawObjListPtr objList, CSkObjectPtr obj, CSkObjectPtr beforeObj)
+void InsertDrawObjBefore(DrawObjListPtr objList, CSkObjectPtr obj, CSkObjectPtr beforeObj)
 {
     CSkObjectPtr prevObj = beforeObj->prevObj;
     
@@ -703,6 +1245,8 @@ static void InsertDrawObjBefore(DrawObjListPtr objList, CSkObjectPtr obj, CSkObj
     
     if (objList->firstItem == beforeObj)
             objList->firstItem = obj;
+    
+    SetDrawObjSnapping(objList, obj, true);
 }
 
 
@@ -720,6 +1264,8 @@ static void InsertDrawObjAfter(DrawObjListPtr objList, CSkObjectPtr obj, CSkObje
     
     if (objList->lastItem == afterObj)
         objList->lastItem = obj;
+    
+    SetDrawObjSnapping(objList, obj, true);
 }
 
 //------------------------------------------------------------------------------
@@ -764,6 +1310,7 @@ void MoveObjectForward(DrawObjListPtr objList)
         {
             RemoveDrawObjFromList(objList, obj);    // pull obj out of list
             InsertDrawObjBefore(objList, obj, prevObj);
+            obj->changes |= kCSkObjectMoved;
         }
     }
 }
@@ -782,6 +1329,7 @@ void MoveObjectBackward(DrawObjListPtr objList)
         {
             RemoveDrawObjFromList(objList, obj);    // pull obj out of list
             InsertDrawObjAfter(objList, obj, nextObj);
+            obj->changes |= kCSkObjectMoved;
         }
     }
 }
@@ -794,6 +1342,7 @@ void MoveObjectToFront(DrawObjListPtr objList)
     {
         RemoveDrawObjFromList(objList, obj);	// pull obj out of list
         AddDrawObjToList(objList, obj);		// add it in front
+        obj->changes |= kCSkObjectMoved;
     }
 }
 
@@ -809,6 +1358,8 @@ void MoveObjectToBack(DrawObjListPtr objList)
         obj->prevObj->nextObj = obj;
         objList->lastItem = obj;
         obj->nextObj = NULL;
+        obj->changes |= kCSkObjectMoved;
+        SetDrawObjSnapping(objList, obj, true);
     }
 }
 
@@ -825,6 +1376,7 @@ CSkObjectPtr DrawObjListHitTesting(DrawObjListPtr objList, CGContextRef bmCtx, C
     CSkObjectPtr    obj		= objList->firstItem;                       // traverse front to back
     int		    hitGrabber  = -1;
     Boolean	    hit		= false;
+    CSK_TRACE_SPAN("DrawObjListHitTesting");
 	
     CGContextSaveGState(bmCtx);						// because we are temporarily changing the CTM
     CGContextTranslateCTM( bmCtx, -windowCtxPt.x, -windowCtxPt.y );     // move 1x1 bitmap context to "windowCtxPt"
@@ -833,7 +1385,7 @@ CSkObjectPtr DrawObjListHitTesting(DrawObjListPtr objList, CGContextRef bmCtx, C
     while ((obj != NULL) && !hit)
     {
 	int	shapeType   = CSkShapeGetType(obj->shape);
-        float   d	    = 0.5 * obj->attr.lineWidth;
+        float   d	    = 0.5 * CSkStyleGetAttributes(obj->style)->lineWidth;
         CGRect  cgR	    = CSkShapeGetBounds(obj->shape);
 	
 	cgR = CGRectInset(cgR, -d, -d);
@@ -894,14 +1446,14 @@ CSkObjectPtr DrawObjListHitTesting(DrawObjListPtr objList, CGContextRef bmCtx, C
 }
 
 //------------------------------------------------------------------------------
-static void AddAttributesToDict(CSkObjectAttributes* attr, CFMutableDictionaryRef objDict)
+static void AddAttributesToDict(const CSkObjectAttributes* attr, CFMutableDictionaryRef objDict)
 {
     AddFloatToDict(objDict, kKeyLineWidth, attr->lineWidth);
     AddIntegerToDict(objDict, kKeyLineCap, attr->lineCap);
     AddIntegerToDict(objDict, kKeyLineJoin, attr->lineJoin);
     AddIntegerToDict(objDict, kKeyLineStyle, attr->lineStyle);
-    AddRGBAColorToDict(objDict, kKeyStrokeColor, &attr->strokeColor);
-    AddRGBAColorToDict(objDict, kKeyFillColor, &attr->fillColor);
+    AddRGBAColorToDict(objDict, kKeyStrokeColor, (CGrgba*)&attr->strokeColor);
+    AddRGBAColorToDict(objDict, kKeyFillColor, (CGrgba*)&attr->fillColor);
 }
 
 //------------------------------------------------------------------------------
@@ -933,7 +1485,7 @@ CFMutableArrayRef CSkObjectListConvertToCFArray(CSkObjectPtr objPtr)
 					    &kCFTypeDictionaryKeyCallBacks, 
 					    &kCFTypeDictionaryValueCallBacks);
 	    AddCSkShapeToDict(objPtr->shape, objDict);
-	    AddAttributesToDict(&objPtr->attr, objDict);
+	    AddAttributesToDict(CSkStyleGetAttributes(objPtr->style), objDict);
 	    CFArrayAppendValue(objArray, objDict);
 	    CFRelease(objDict);
 	    objPtr = objPtr->nextObj;
@@ -943,12 +1495,14 @@ CFMutableArrayRef CSkObjectListConvertToCFArray(CSkObjectPtr objPtr)
 }
 
 //------------------------------------------------------------------------------
-static CSkObjectPtr CSkCreateObjFromDict(CFDictionaryRef objDict)
+CSkObjectPtr CSkCreateObjFromDict(CSkStyleTablePtr styles, CFDictionaryRef objDict)
 {
     CSkObjectAttributes attr;
     GetAttributesFromObjDict(objDict, &attr);
     CSkShape* sh = CreateCSkShapeFromDict(objDict);
-    CSkObjectPtr objPtr = CreateCSkObj(&attr, sh);
+    CSkObjectPtr objPtr = CreateCSkObj(styles, &attr, sh);
+    if (objPtr == NULL)
+	CSkShapeRelease(sh);
     return objPtr;
 }
 
@@ -961,7 +1515,8 @@ void CSkConvertCFArrayToDrawObjectList(CFArrayRef objArray, DrawObjList* objList
     while (--i >= 0)
     {
 	CFDictionaryRef objDict = CFArrayGetValueAtIndex(objArray, i);
-	CSkObjectPtr obj = CSkCreateObjFromDict(objDict);
-	AddDrawObjToList(objList, obj);	
+	CSkObjectPtr obj = CSkCreateObjFromDict(CSkObjListGetStyles(objList), objDict);
+	if (obj != NULL)
+	    AddDrawObjToList(objList, obj);	
     }
 }
@@ -49,40 +49,51 @@
 #include <ApplicationServices/ApplicationServices.h>
 #include "CSkUtils.h"
 #include "CSkShapes.h"
+#include "CSkStyles.h"	// CSkObjectAttributes
 
 
-struct CSkObjectAttributes  // as set in ToolPalette
-{
-    float           lineWidth;
-    CGLineCap       lineCap;
-    CGLineJoin      lineJoin;
-    int             lineStyle;
-    CGrgba          strokeColor;
-    CGrgba          fillColor;
-};
-typedef struct CSkObjectAttributes CSkObjectAttributes;
+typedef struct CSkObject CSkObject, *CSkObjectPtr;  // struct CSkObject defined in CSkObjects.c
 
+enum { kCSkNotMapped = 0xFFFFFFFF };	// CSkObjectGetMapIndex of an object not read from a mapped document
 
-typedef struct CSkObject CSkObject, *CSkObjectPtr;  // struct CSkObject defined in CSkObjects.c
+enum {	// CSkObjectGetChanges: what happened to an object since it was last saved
+    kCSkObjectChanged	= 1,	// shape or attributes
+    kCSkObjectMoved	= 2	// stacking order
+};
 
 // Currently, CSkObjects are limited to lines, rectangles, ovals and roundRectangles
 // (see enumeration of shape selectors in CSkConstants.h); but obviously,
 // we'll want to extand that in the future.
 // CSkObjects are stored in a double-linked list, and drawn from back to front.
+// The objects in a list get their attributes from the list's style table.
+// Once something has asked for a list's snap index, the list keeps the index up to date as its
+// objects are added, removed and moved (see CSkSnapping.h).
 
 
 struct DrawObjList
 {
-    CSkObjectPtr  firstItem;
-    CSkObjectPtr  lastItem;
+    CSkObjectPtr	firstItem;
+    CSkObjectPtr	lastItem;
+    CSkStyleTablePtr	styles;	    // created with the first object; see CSkObjListGetStyles
+    struct CSkSnapIndex* snapIndex; // NULL until CSkObjListGetSnapIndex
 };
 typedef struct DrawObjList  DrawObjList, *DrawObjListPtr;
 
 
-CSkObjectPtr	CreateCSkObj(CSkObjectAttributes* attributes, CSkShapePtr sh);
+CSkStyleTablePtr CSkObjListGetStyles(DrawObjListPtr objList);
+struct CSkSnapIndex* CSkObjListGetSnapIndex(DrawObjListPtr objList);
+void		SetDrawObjSnapping(DrawObjListPtr objList, CSkObjectPtr obj, Boolean snapTo);
+void		CSkObjListSetSelectedSnapping(DrawObjListPtr objList, Boolean snapTo);
+CSkObjectPtr	CreateCSkObj(CSkStyleTablePtr styles, const CSkObjectAttributes* attributes, CSkShapePtr sh);
+CSkObjectPtr	CreateCSkObjWithStyle(CSkStylePtr style, CSkShapePtr sh);
 CSkObjectPtr    CopyDrawObject(const CSkObject* obj);
+CSkObjectPtr	RetainDrawObj(CSkObjectPtr drawObj);
 void		ReleaseDrawObj(CSkObjectPtr drawObj);
 void		ReleaseDrawObjList(DrawObjListPtr objList);
+CSkObjectPtr	CSkObjectMakeWritable(DrawObjListPtr objList, CSkObjectPtr drawObj);
+CSkObjectPtr*	CreateDrawObjSnapshot(const DrawObjList* objList, UInt32* outCount);
+CSkObjectPtr*	CreateSelectedDrawObjSnapshot(const DrawObjList* objList, UInt32* outCount);
+void		ReleaseDrawObjSnapshot(CSkObjectPtr* objects, UInt32 count);
 void		SetLineWidthOfSelecteds(DrawObjListPtr objListP, float lineWidth);
 void		SetLineCapOfSelecteds(DrawObjListPtr objListP, CGLineCap lineCap);
 void		SetLineJoinOfSelecteds(DrawObjListPtr objListP, CGLineJoin lineJoin);
@@ -91,15 +102,25 @@ void		SetStrokeColorOfSelecteds(DrawObjListPtr objListP, CGrgba* color);
 void		SetStrokeAlphaOfSelecteds(DrawObjListPtr objListP, float alpha);
 void		SetFillColorOfSelecteds(DrawObjListPtr objListP, CGrgba* color);
 void		SetFillAlphaOfSelecteds(DrawObjListPtr objListP, float alpha);
-void		CSkObjectSetAttributes(CSkObjectPtr obj, CSkObjectAttributes* attributes);
-void		CSkSetObjAttributesIfSelected(DrawObjListPtr objListP, CSkObjectAttributes* attributes);
+void		CSkObjectSetAttributes(CSkObjectPtr obj, const CSkObjectAttributes* attributes);
+void		CSkSetObjAttributesIfSelected(DrawObjListPtr objListP, const CSkObjectAttributes* attributes);
 
-CSkObjectAttributes* CSkObjectGetAttributes(CSkObjectPtr obj);
+const CSkObjectAttributes* CSkObjectGetAttributes(const CSkObject* obj);
+CSkStylePtr	CSkObjectGetStyle(const CSkObject* obj);
 
 void		GetLineAttributes(const CSkObject* obj, float* width, CGLineCap* cap, CGLineJoin* join, int* style);
 
 int		GetDrawObjShapeType( const CSkObject* drawObj );
 CSkShapePtr	CSkObjectGetShape( const CSkObject* drawObj );
+CSkObjectPtr	CSkObjectGetNext( const CSkObject* drawObj );
+CSkObjectPtr	CSkObjectGetPrev( const CSkObject* drawObj );
+UInt32		CSkObjectGetMapIndex( const CSkObject* drawObj );
+void		CSkObjectSetMapIndex( CSkObjectPtr drawObj, UInt32 mapIndex );
+UInt32		CSkObjectGetID( const CSkObject* drawObj );
+void		CSkObjectSetID( CSkObjectPtr drawObj, UInt32 objectID );
+UInt8		CSkObjectGetChanges( const CSkObject* drawObj );
+void		CSkObjectSetChanges( CSkObjectPtr drawObj, UInt8 changes );
+void		CSkObjectMarkChanged( CSkObjectPtr drawObj );
 float		GetFillAlpha( const CSkObject* drawObj );
 float		GetStrokeAlpha( const CSkObject* drawObj );
 Boolean		IsDrawObjSelected( const CSkObject* drawObj );
@@ -110,8 +131,15 @@ void		CSkObjListSelectWithinRect(DrawObjList* objList, CGRect selectionRect);
 void		SetContextStateForDrawObject(CGContextRef ctx, const CSkObject* obj);
 void		RenderCSkObject ( CGContextRef ctx, const CSkObject* obj, Boolean drawSelection);
 void		RenderDrawObjList( CGContextRef ctx, const DrawObjList* objListP, Boolean drawSelection);
+Boolean		IsDrawObjVisible(const CSkObject* obj);
+CGRect		GetDrawObjRenderBounds(const CSkObject* obj, Boolean drawSelection);
+CGRect		GetSelectedDrawObjsRenderBounds(const DrawObjList* objListP);
+CGRect		GetSelectedDrawObjsShapeBounds(const DrawObjList* objListP);
+void		RenderDrawObjListInRect(CGContextRef ctx, const DrawObjList* objListP, CGRect visibleRect, Boolean drawSelection);
+void		RenderDrawObjsAtIndices(CGContextRef ctx, const CSkObjectPtr* objects, const UInt32* indices, UInt32 count, Boolean drawSelection);
+UInt32		RenderMergedDrawObjsAtIndices(CGContextRef ctx, const CSkObjectPtr* objects, const UInt32* indices, UInt32 count, Boolean drawSelection);
+void		RenderDrawObjSnapshot(CGContextRef ctx, const CSkObjectPtr* objects, UInt32 count, Boolean drawSelection);
 void		RenderSelectedDrawObjs(CGContextRef ctx, const DrawObjList* objListP, float dx, float dy, float alpha);
-void		MakeDrawObjTransparent(CSkObject* obj, float alpha);
 void		MoveSelectedDrawObjs(DrawObjList* objListP, float dx, float dy);
 CSkObjectPtr    DrawObjListHitTesting ( DrawObjListPtr objList, 
 					CGContextRef bmCtx,
@@ -121,6 +149,10 @@ CSkObjectPtr    DrawObjListHitTesting ( DrawObjListPtr objList,
 					int* outGrabber);
 
 void		AddDrawObjToList(DrawObjListPtr objList, CSkObjectPtr obj);
+void		AppendDrawObjToList(DrawObjListPtr objList, CSkObjectPtr obj);
+void		MoveDrawObjListToFront(DrawObjListPtr objList, DrawObjListPtr fromList);
+void		InsertDrawObjBefore(DrawObjListPtr objList, CSkObjectPtr obj, CSkObjectPtr beforeObj);
+void		RemoveDrawObjFromList(DrawObjListPtr objList, CSkObjectPtr obj);
 void		RemoveSelectedDrawObjs(DrawObjListPtr objList);
 void		DuplicateSelectedDrawObjs(DrawObjListPtr objList, float dx, float dy);
 void		MoveObjectForward(DrawObjListPtr objList);
@@ -130,5 +162,6 @@ void		MoveObjectToBack(DrawObjListPtr objList);
 
 CFMutableArrayRef CSkObjectListConvertToCFArray(CSkObjectPtr firstItem);
 void	CSkConvertCFArrayToDrawObjectList(CFArrayRef objArray, DrawObjList* objList);
+CSkObjectPtr CSkCreateObjFromDict(CSkStyleTablePtr styles, CFDictionaryRef objDict);
 
 #endif
@@ -0,0 +1,291 @@
+/*
+    File:       CSkPDFExport.c
+        
+    Contains:	Pagination and PDF export of the document, without windows
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#include "CSkPDFExport.h"
+#include "CSkConstants.h"
+#include "CSkObjects.h"
+#include "CSkSpatialIndex.h"
+#include "CSkTrace.h"
+
+struct CSkPageDrawer
+{
+    DocStoragePtr	docStP;
+    CSkPageTiling	tiling;
+    CSkObjectPtr*	objects;    // snapshot of docStP->objList
+    UInt32		numObjects;
+    CSkSpatialIndexPtr	index;
+    UInt32*		found;	    // room for numObjects indices
+    UInt32		options;
+    CSkPageDrawStats	stats;
+};
+
+//-----------------------------------------------------------------------------------------------------------------------
+OSStatus CSkCreateDefaultPageFormat(PMPrintSession printSession, PMPageFormat *pageFormat)
+{
+    OSStatus status = PMCreatePageFormat(pageFormat);
+	
+    //  Note that PMPageFormat is not session-specific, but calling
+    //  PMSessionDefaultPageFormat assigns values specific to the printer
+    //  associated with the current printing session.
+    if ((status == noErr) && (*pageFormat != kPMNoPageFormat))
+	status = PMSessionDefaultPageFormat(printSession, *pageFormat);
+	
+    return status;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+// How many tiles of tileLength it takes to cover docLength, when adjacent ones share overlap
+static UInt32 CountTiles(float docLength, float tileLength, float overlap)
+{
+    if (docLength <= tileLength)
+	return 1;
+    return 1 + (UInt32)ceil((docLength - tileLength) / (tileLength - overlap));
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+// Paginates against docStP->pageFormat; a document that has none gets the default page format.
+OSStatus CSkGetPageTiling(DocStoragePtr docStP, CSkPageTiling* tiling)
+{
+    PMRect	pageRect;
+    OSStatus	status = noErr;
+    float	maxOverlap;
+    
+    if (docStP->pageFormat == kPMNoPageFormat)
+    {
+	PMPrintSession printSession = NULL;
+	status = PMCreateSession(&printSession);
+	require_noerr(status, CantGetPageFormat);
+	status = CSkCreateDefaultPageFormat(printSession, &docStP->pageFormat);
+	PMRelease(printSession);
+	require_noerr(status, CantGetPageFormat);
+    }
+    status = PMGetAdjustedPageRect(docStP->pageFormat, &pageRect);
+    require_noerr(status, CantGetPageFormat);
+    require_action((pageRect.right > pageRect.left) && (pageRect.bottom > pageRect.top), CantGetPageFormat, status = kPMInvalidPageFormat);
+    
+    tiling->docRect = docStP->pageRect;
+    tiling->tileSize = CGSizeMake(pageRect.right - pageRect.left, pageRect.bottom - pageRect.top);
+    maxOverlap = ((tiling->tileSize.width < tiling->tileSize.height) ? tiling->tileSize.width : tiling->tileSize.height) / 2;
+    tiling->overlap = (docStP->pageOverlap < 0) ? 0 : (docStP->pageOverlap > maxOverlap) ? maxOverlap : docStP->pageOverlap;
+    tiling->cols = CountTiles(CGRectGetWidth(tiling->docRect), tiling->tileSize.width, tiling->overlap);
+    tiling->rows = CountTiles(CGRectGetHeight(tiling->docRect), tiling->tileSize.height, tiling->overlap);
+    if ((tiling->cols == 1) && (tiling->rows == 1))
+	tiling->tileSize = tiling->docRect.size;
+    return noErr;
+    
+CantGetPageFormat:
+    fprintf(stderr, "CSkGetPageTiling: no page format (%d)\n", (int)status);
+    return status;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+UInt32 CSkPageTilingGetCount(const CSkPageTiling* tiling)
+{
+    return tiling->cols * tiling->rows;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+// In document coordinates; the tiles of the last column and row may reach beyond docRect.
+CGRect CSkPageTilingGetTile(const CSkPageTiling* tiling, UInt32 pageNumber)
+{
+    UInt32  col = (pageNumber - 1) % tiling->cols;
+    UInt32  row = (pageNumber - 1) / tiling->cols;
+    
+    return CGRectMake(CGRectGetMinX(tiling->docRect) + col * (tiling->tileSize.width - tiling->overlap),
+		      CGRectGetMaxY(tiling->docRect) - tiling->tileSize.height - row * (tiling->tileSize.height - tiling->overlap),
+		      tiling->tileSize.width, tiling->tileSize.height);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+// The objects of a mapped document on the pages from firstPage to lastPage are materialized first.
+// The snapshot keeps the objects alive while the pages are drawn. With kCSkPageDrawOptimized,
+// objects that would draw nothing are dropped from it.
+CSkPageDrawerPtr CSkPageDrawerCreate(DocStoragePtr docStP, const CSkPageTiling* tiling, UInt32 firstPage, UInt32 lastPage, UInt32 options)
+{
+    CSkPageDrawer*  drawer = (CSkPageDrawer*)calloc(1, sizeof(CSkPageDrawer));
+    CGRect	    pagesRect = CGRectNull;
+    UInt32	    pageNumber, i, kept;
+    CSK_TRACE_SPAN("CSkPageDrawerCreate");
+    
+    require(drawer != NULL, CantAllocate);
+    drawer->docStP = docStP;
+    drawer->tiling = *tiling;
+    for (pageNumber = firstPage; pageNumber <= lastPage; ++pageNumber)
+	pagesRect = CGRectUnion(pagesRect, CSkPageTilingGetTile(tiling, pageNumber));
+    MaterializeObjectsInRect(docStP, CGRectIntersection(pagesRect, tiling->docRect));
+    
+    drawer->objects = CreateDrawObjSnapshot(&docStP->objList, &drawer->numObjects);
+    drawer->options = options;
+    drawer->stats.numObjects = drawer->numObjects;
+    for (i = kept = 0; i < drawer->numObjects; ++i)
+    {
+	CSkObjectPtr	obj = drawer->objects[i];
+	Boolean		drop = false;
+	
+	if (!CGRectIntersectsRect(GetDrawObjRenderBounds(obj, docStP->shouldDrawGrabbers), tiling->docRect))
+	{
+	    drawer->stats.offPage++;
+	    drop = (options & kCSkPageDrawOptimized) != 0;
+	}
+	else if ((options & kCSkPageDrawOptimized) && !IsDrawObjVisible(obj)
+		 && !(docStP->shouldDrawGrabbers && IsDrawObjSelected(obj)))
+	{
+	    drawer->stats.invisible++;
+	    drop = true;
+	}
+	if (drop)
+	    ReleaseDrawObj(obj);
+	else
+	    drawer->objects[kept++] = obj;
+    }
+    drawer->numObjects = kept;
+    drawer->index = CSkSpatialIndexCreate(drawer->objects, drawer->numObjects, docStP->shouldDrawGrabbers);
+    drawer->found = (UInt32*)malloc((drawer->numObjects + 1) * sizeof(UInt32));
+    require((drawer->index != NULL) && (drawer->found != NULL), CantAllocate);
+    return drawer;
+    
+CantAllocate:
+    fprintf(stderr, "CSkPageDrawerCreate: can't allocate\n");
+    CSkPageDrawerRelease(drawer);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+// Moves the tile to the origin of ctx, the bottom left corner of the sheet's printable area.
+void CSkPageDrawerDrawPage(CSkPageDrawerPtr drawer, CGContextRef ctx, UInt32 pageNumber)
+{
+    CGRect  tile = CSkPageTilingGetTile(&drawer->tiling, pageNumber);
+    CGRect  visibleRect = CGRectIntersection(tile, drawer->tiling.docRect);
+    UInt32  count;
+    CSK_TRACE_SPAN("CSkPageDrawerDrawPage");
+    
+    CGContextSaveGState(ctx);
+    CGContextTranslateCTM(ctx, -tile.origin.x, -tile.origin.y);
+    CGContextClipToRect(ctx, visibleRect);
+    DrawPageBackground(ctx, drawer->docStP);
+    count = CSkSpatialIndexFindInRect(drawer->index, visibleRect, drawer->found);
+    drawer->stats.objectsDrawn += count;
+    if (drawer->options & kCSkPageDrawOptimized)
+	drawer->stats.pathsPainted += RenderMergedDrawObjsAtIndices(ctx, drawer->objects, drawer->found, count, drawer->docStP->shouldDrawGrabbers);
+    else
+    {
+	RenderDrawObjsAtIndices(ctx, drawer->objects, drawer->found, count, drawer->docStP->shouldDrawGrabbers);
+	drawer->stats.pathsPainted += count;
+    }
+    CGContextRestoreGState(ctx);
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+void CSkPageDrawerGetStats(CSkPageDrawerPtr drawer, CSkPageDrawStats* stats)
+{
+    *stats = drawer->stats;
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+void CSkPageDrawerRelease(CSkPageDrawerPtr drawer)
+{
+    if (drawer != NULL)
+    {
+	CSkSpatialIndexRelease(drawer->index);
+	ReleaseDrawObjSnapshot(drawer->objects, drawer->numObjects);
+	free(drawer->found);
+	free(drawer);
+    }
+}
+
+//-----------------------------------------------------------------------------------------------------------------------
+// Title and Creator go into the document info dictionary; the grid is never exported.
+OSStatus CSkWritePDFDocument(DocStoragePtr docStP, CFURLRef url, CFStringRef title, UInt32 options, CSkPageDrawStats* outStats)
+{
+    OSStatus                err         = -1;   // generic error code: watch console output!
+    CFMutableDictionaryRef  dict        = CFDictionaryCreateMutable( kCFAllocatorDefault, 0,
+								    &kCFTypeDictionaryKeyCallBacks, 
+								    &kCFTypeDictionaryValueCallBacks); 
+    CSkPageTiling           tiling;
+    CSK_TRACE_SPAN("CSkWritePDFDocument");
+
+    if ((dict != NULL) && (CSkGetPageTiling(docStP, &tiling) == noErr))
+    {
+	CGRect          mediaBox    = CGRectMake(0, 0, tiling.tileSize.width, tiling.tileSize.height);
+	CGContextRef    ctx;
+	
+	if (title != NULL)
+	    CFDictionaryAddValue(dict, CFSTR("Title"), title);
+	CFDictionaryAddValue(dict, CFSTR("Creator"), CFSTR("CarbonSketch"));
+	ctx = CGPDFContextCreateWithURL(url, &mediaBox, dict);
+
+	if (ctx != NULL)
+	{
+	    UInt32		numPages = CSkPageTilingGetCount(&tiling), pageNumber;
+	    CSkPageDrawerPtr	drawer;
+	    Boolean		shouldDrawGrid = docStP->shouldDrawGrid;
+	    
+	    docStP->shouldDrawGrid = false;
+	    drawer = CSkPageDrawerCreate(docStP, &tiling, 1, numPages, options);
+	    if (drawer != NULL)
+	    {
+		for (pageNumber = 1; pageNumber <= numPages; ++pageNumber)
+		{
+		    CGContextBeginPage(ctx, &mediaBox);
+		    CSkPageDrawerDrawPage(drawer, ctx, pageNumber);
+		    CGContextEndPage(ctx);
+		}
+		if (outStats != NULL)
+		    CSkPageDrawerGetStats(drawer, outStats);
+		CSkPageDrawerRelease(drawer);
+		err = noErr;
+	    }
+	    docStP->shouldDrawGrid = shouldDrawGrid;
+	    CGContextRelease(ctx);
+	}
+    }
+    if (dict != NULL)
+	CFRelease(dict);
+    else 
+    {
+	fprintf(stderr, "CFDictionaryCreateMutable FAILED\n");
+    }
+    
+    return err;
+}   // CSkWritePDFDocument
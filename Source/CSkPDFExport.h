@@ -0,0 +1,103 @@
+/*
+    File:       CSkPDFExport.h
+        
+    Contains:	Interface to pagination and PDF export of the document
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#ifndef __CSKPDFEXPORT__
+#define __CSKPDFEXPORT__
+
+#include <Carbon/Carbon.h>
+#include "CSkDocStorage.h"
+
+// Pagination and PDF export of the document, without any windows or dialogs, so that command
+// line tools can link it (see CSkConvert.c). Printing (CSkPrinting.c) draws through the same tiles.
+
+// Printing and PDF export lay the document's pageRect out on sheets: columns and rows of tiles
+// the size of the printable area of the page format, numbered from 1, left to right and top
+// to bottom. Adjacent tiles share docStP->pageOverlap points. A document that fits on one
+// sheet is a single tile of its own size.
+struct CSkPageTiling
+{
+    CGRect	docRect;
+    CGSize	tileSize;
+    float	overlap;
+    UInt32	cols;
+    UInt32	rows;
+};
+typedef struct CSkPageTiling CSkPageTiling;
+
+// Draws tiles one at a time, each with only the objects that intersect it, found through
+// a spatial index over a snapshot of the objects (see CSkSpatialIndex.h).
+typedef struct CSkPageDrawer CSkPageDrawer, *CSkPageDrawerPtr;
+
+enum {	// CSkPageDrawerCreate options
+    kCSkPageDrawAll		= 0,
+    kCSkPageDrawOptimized	= 1	// leave out invisible objects, paint runs of them as one path
+};
+
+// What a page drawer left out and painted, over all the pages drawn so far.
+struct CSkPageDrawStats
+{
+    UInt32	numObjects;	// in the document
+    UInt32	offPage;	// not drawn: entirely outside the pageRect
+    UInt32	invisible;	// not drawn: nothing but transparent paint (kCSkPageDrawOptimized)
+    UInt32	objectsDrawn;	// on all pages; an object on two pages counts twice
+    UInt32	pathsPainted;	// objectsDrawn, less what was merged (kCSkPageDrawOptimized)
+};
+typedef struct CSkPageDrawStats CSkPageDrawStats;
+
+extern OSStatus		CSkCreateDefaultPageFormat(PMPrintSession printSession, PMPageFormat* pageFormat);
+
+extern OSStatus		CSkGetPageTiling(DocStoragePtr docStP, CSkPageTiling* tiling);
+extern UInt32		CSkPageTilingGetCount(const CSkPageTiling* tiling);
+extern CGRect		CSkPageTilingGetTile(const CSkPageTiling* tiling, UInt32 pageNumber);
+
+extern CSkPageDrawerPtr	CSkPageDrawerCreate(DocStoragePtr docStP, const CSkPageTiling* tiling, UInt32 firstPage, UInt32 lastPage, UInt32 options);
+extern void		CSkPageDrawerDrawPage(CSkPageDrawerPtr drawer, CGContextRef ctx, UInt32 pageNumber);
+extern void		CSkPageDrawerGetStats(CSkPageDrawerPtr drawer, CSkPageDrawStats* stats);
+extern void		CSkPageDrawerRelease(CSkPageDrawerPtr drawer);
+
+// Writes one PDF page per tile to url, titled title (the window title, in the app), drawn with
+// the CSkPageDrawerCreate options; outStats may be NULL.
+extern OSStatus		CSkWritePDFDocument(DocStoragePtr docStP, CFURLRef url, CFStringRef title, UInt32 options, CSkPageDrawStats* outStats);
+
+#endif
@@ -0,0 +1,1656 @@
+/*
+    File:       CSkPDFUpdate.c
+        
+    Contains:	Incremental PDF export: appends updates to a PDF written before.
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "CSkPDFUpdate.h"
+#include "CSkConstants.h"
+#include "CSkObjects.h"
+#include "CSkPDFExport.h"
+#include "CSkShapes.h"
+#include "CSkTrace.h"
+#include "CSkUtils.h"
+
+enum {
+    kPDFBufferSize	= 64 * 1024,
+    kPDFMaxItemSize	= 512,		// an object header, a cross-reference entry or a path element
+    kSegmentLength	= 256,		// objects per segment, at most
+    kMaxUpdatePercent	= 50,		// of the content that may change for an incremental update
+    kMaxFileGrowth	= 2,		// times the size of a fresh file, after an update
+    kMaxTailSize	= 1024,		// where startxref is looked for
+    kMaxXrefSize	= 64 * 1024 * 1024,
+    kPageSizeEstimate	= 256,		// bytes of a page and its head, roughly
+    kMinFormPath	= 96,		// bytes of path, for an object to be drawn from a form
+    kFormQuantum	= 64,		// the points of a form are rounded to 1/kFormQuantum
+    kNoFormKey		= 0xFFFFFFFF,
+    kMapVersion		= 4
+};
+
+// Object numbers: the fixed ones, then a page and its head for each tile, then the segments
+// and the forms.
+enum {
+    kCatalogObj		= 1,
+    kPagesObj		= 2,
+    kInfoObj		= 3,
+    kResourcesObj	= 4,	    // the color space, an ExtGState for each pair of alpha values, and the forms
+    kTailObj		= 5,	    // "Q", ends the /Contents of every page
+    kMapObj		= 6,
+    kFirstPageObj	= 7
+};
+
+#define kHashSeed   0xCBF29CE484222325ULL   // FNV-1a, 64 bits
+#define kHashPrime  0x100000001B3ULL
+#define kKappa	    0.5522847498	    // control point distance of a quarter ellipse, per radius
+
+// The generic RGB space that DrawPageBackground draws in (see GetGenericRGBColorSpace), as
+// CalRGB: the D65 white point, gamma 1.8 and the XYZ of its primaries, from its profile.
+#define kGenericRGBSpace    "[/CalRGB << /WhitePoint [0.9505 1 1.0891] /Gamma [1.8 1.8 1.8] " \
+			    "/Matrix [0.4497 0.2446 0.0252 0.3163 0.672 0.1412 0.1845 0.0833 0.9227] >>]"
+
+// Bytes being collected: a content stream, a page's /Contents, the map. The points of a path
+// that goes into a form are taken relative to origin, and rounded, so that copies of a shape
+// come out the same wherever they are.
+struct PDFBuffer
+{
+    char*	bytes;
+    size_t	length;
+    size_t	capacity;
+    Boolean	failed;	    // out of memory; nothing more gets added
+    Boolean	relative;
+    CGPoint	origin;
+};
+typedef struct PDFBuffer PDFBuffer;
+
+struct PDFSegment
+{
+    UInt32	objNum;
+    UInt64	firstHash;	// of its first object, with its style
+    UInt64	hash;		// of its content
+    UInt32	rawLength;	// of its content
+    UInt32	length;		// in the file, compressed
+    UInt32	numObjects;
+    CGRect	bounds;		// render bounds of its objects
+    SInt32	old;		// the segment of the previous export at the same place, or -1
+    PDFBuffer	content;	// until it's written
+    PDFBuffer	packed;		// compressed content
+};
+typedef struct PDFSegment PDFSegment;
+
+// A form XObject: a shape that several objects draw, relative to their origins, in their style.
+struct PDFForm
+{
+    UInt32	objNum;		// 0 until it's numbered
+    UInt64	hash;		// of its content; it's named /X<hash>
+    UInt32	rawLength;	// of its content
+    UInt32	length;		// in the file, compressed
+    UInt32	count;		// objects that place it
+    CGRect	bbox;
+    PDFBuffer	content;	// once it's used, until it's written
+    PDFBuffer	packed;		// compressed content
+};
+typedef struct PDFForm PDFForm;
+
+struct PDFPage
+{
+    UInt32	objNum;		// its head follows
+    UInt64	hash;		// of its /Contents array
+};
+typedef struct PDFPage PDFPage;
+
+struct PDFAlphas
+{
+    float	stroke;
+    float	fill;
+};
+typedef struct PDFAlphas PDFAlphas;
+
+// What the map of the previous export says, or what goes into the next one.
+struct PDFExportMap
+{
+    CSkPageTiling   tiling;
+    UInt32	    size;	    // the next free object number
+    UInt32	    numGStates;
+    UInt32	    gstateCapacity;
+    PDFAlphas*	    gstates;
+    UInt32*	    gstateSlots;    // hash table of indices + 1 into gstates, gstateCapacity * 2 of them
+    UInt32	    numPages;
+    PDFPage*	    pages;
+    UInt32	    numSegments;
+    UInt32	    segmentCapacity;
+    PDFSegment*	    segments;
+    UInt32	    numForms;
+    UInt32	    formCapacity;
+    PDFForm*	    forms;
+    SInt64	    xrefOffset;	    // of the last cross-reference section
+    SInt64	    fileSize;
+};
+typedef struct PDFExportMap PDFExportMap;
+
+struct PDFWriter
+{
+    int		fd;
+    char*	buffer;
+    size_t	used;
+    SInt64	position;	// in the file, of buffer[0]
+    SInt64*	offsets;	// of the objects written, by number; 0 for the others
+    OSStatus	err;		// of the first write that failed
+};
+typedef struct PDFWriter PDFWriter;
+
+//--------------------------------------------------------------------------------------
+static UInt64 HashBytes(UInt64 h, const void* bytes, size_t length)
+{
+    const UInt8* p = (const UInt8*)bytes;
+
+    while (length-- > 0)
+	h = (h ^ *p++) * kHashPrime;
+    return h;
+}
+
+static void AppendBytes(PDFBuffer* b, const void* bytes, size_t length)
+{
+    if (b->failed)
+	return;
+    if (b->length + length > b->capacity)
+    {
+	size_t	capacity = 2 * b->capacity + length + 1024;
+	char*	bytes = (char*)realloc(b->bytes, capacity);
+
+	if (bytes == NULL)
+	{
+	    b->failed = true;
+	    return;
+	}
+	b->bytes = bytes;
+	b->capacity = capacity;
+    }
+    memcpy(b->bytes + b->length, bytes, length);
+    b->length += length;
+}
+
+static void AppendString(PDFBuffer* b, const char* s)
+{
+    AppendBytes(b, s, strlen(s));
+}
+
+static void FreeBuffer(PDFBuffer* b)
+{
+    free(b->bytes);
+    memset(b, 0, sizeof(PDFBuffer));
+}
+
+// A point as it goes into b.
+static CGPoint BufferPoint(const PDFBuffer* b, CGPoint p)
+{
+    if (b->relative)
+    {
+	p.x = roundf((p.x - b->origin.x) * kFormQuantum) / kFormQuantum;
+	p.y = roundf((p.y - b->origin.y) * kFormQuantum) / kFormQuantum;
+    }
+    return p;
+}
+
+// Points, then the operator and a newline: "x y m\n".
+static void AppendPathOp(PDFBuffer* b, const CGPoint* pts, int count, const char* op)
+{
+    char    line[kPDFMaxItemSize];
+    int	    i, n = 0;
+
+    for (i = 0; i < count; ++i)
+    {
+	CGPoint p = BufferPoint(b, pts[i]);
+
+	n += FormatShortestFloat(line + n, p.x);
+	line[n++] = ' ';
+	n += FormatShortestFloat(line + n, p.y);
+	line[n++] = ' ';
+    }
+    n += sprintf(line + n, "%s\n", op);
+    AppendBytes(b, line, n);
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+// The ExtGStates, one for each pair of alpha values, named /G0, /G1 and so on in the order
+// they first appear; an update only ever adds to them.
+static UInt32 HashAlphas(PDFAlphas a)
+{
+    return (UInt32)HashBytes(kHashSeed, &a, sizeof(a));
+}
+
+static void AddGStateToTable(PDFExportMap* map, PDFAlphas a, UInt32 index)
+{
+    UInt32  mask = 2 * map->gstateCapacity - 1;
+    UInt32  slot = HashAlphas(a) & mask;
+
+    while (map->gstateSlots[slot] != 0)
+	slot = (slot + 1) & mask;
+    map->gstateSlots[slot] = index + 1;
+}
+
+static Boolean GrowGStates(PDFExportMap* map)
+{
+    UInt32	capacity = (map->gstateCapacity == 0) ? 64 : 2 * map->gstateCapacity;
+    PDFAlphas*	gstates = (PDFAlphas*)realloc(map->gstates, capacity * sizeof(PDFAlphas));
+    UInt32	i;
+
+    if (gstates == NULL)
+	return false;
+    map->gstates = gstates;
+    free(map->gstateSlots);
+    map->gstateSlots = (UInt32*)calloc(2 * capacity, sizeof(UInt32));
+    if (map->gstateSlots == NULL)
+	return false;
+    map->gstateCapacity = capacity;
+    for (i = 0; i < map->numGStates; ++i)
+	AddGStateToTable(map, map->gstates[i], i);
+    return true;
+}
+
+// The index of the ExtGState for a, added if it's new; -1 if out of memory.
+static SInt32 GetGStateIndex(PDFExportMap* map, PDFAlphas a)
+{
+    UInt32  mask, slot;
+
+    if ((map->numGStates == map->gstateCapacity) && !GrowGStates(map))
+	return -1;
+    mask = 2 * map->gstateCapacity - 1;
+    for (slot = HashAlphas(a) & mask; map->gstateSlots[slot] != 0; slot = (slot + 1) & mask)
+    {
+	const PDFAlphas* b = &map->gstates[map->gstateSlots[slot] - 1];
+	if ((b->stroke == a.stroke) && (b->fill == a.fill))
+	    return map->gstateSlots[slot] - 1;
+    }
+    map->gstates[map->numGStates] = a;
+    map->gstateSlots[slot] = ++map->numGStates;
+    return map->numGStates - 1;
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+// The graphics state as SetContextStateForAttributes sets it up, colors in /CS0; the miter
+// limit is 10 in both Quartz and PDF.
+static int FormatStyleOps(char* p, const CSkObjectAttributes* attr, UInt32 gstate)
+{
+    int n = sprintf(p, "/G%u gs /CS0 CS /CS0 cs ", (unsigned)gstate);
+
+    n += FormatShortestFloat(p + n, attr->strokeColor.r);	p[n++] = ' ';
+    n += FormatShortestFloat(p + n, attr->strokeColor.g);	p[n++] = ' ';
+    n += FormatShortestFloat(p + n, attr->strokeColor.b);
+    n += sprintf(p + n, " SC ");
+    n += FormatShortestFloat(p + n, attr->fillColor.r);	p[n++] = ' ';
+    n += FormatShortestFloat(p + n, attr->fillColor.g);	p[n++] = ' ';
+    n += FormatShortestFloat(p + n, attr->fillColor.b);
+    n += sprintf(p + n, " sc ");
+    n += FormatShortestFloat(p + n, attr->lineWidth);
+    n += sprintf(p + n, " w %d J %d j ", (int)attr->lineCap, (int)attr->lineJoin);
+    if (attr->lineStyle == kStyleDashed)
+    {
+	char dash[32];
+
+	FormatShortestFloat(dash, attr->lineWidth + 4);
+	n += sprintf(p + n, "[%s %s] 1 d\n", dash, dash);
+    }
+    else
+	n += sprintf(p + n, "[] 0 d\n");
+    return n;
+}
+
+// A rounded rect with elliptic corners of radii rx, ry, counterclockwise from the middle of
+// the right side, like DrawRRect.
+static void AppendRRectPath(PDFBuffer* b, CGRect r, float rx, float ry)
+{
+    float   x0 = CGRectGetMinX(r), x1 = CGRectGetMaxX(r), y0 = CGRectGetMinY(r), y1 = CGRectGetMaxY(r);
+    float   kx = kKappa * rx, ky = kKappa * ry;
+    CGPoint pts[3];
+
+    pts[0] = CGPointMake(x1, CGRectGetMidY(r));			    AppendPathOp(b, pts, 1, "m");
+    pts[0] = CGPointMake(x1, y1 - ry);				    AppendPathOp(b, pts, 1, "l");
+    pts[0] = CGPointMake(x1, y1 - ry + ky);
+    pts[1] = CGPointMake(x1 - rx + kx, y1);
+    pts[2] = CGPointMake(x1 - rx, y1);				    AppendPathOp(b, pts, 3, "c");
+    pts[0] = CGPointMake(x0 + rx, y1);				    AppendPathOp(b, pts, 1, "l");
+    pts[0] = CGPointMake(x0 + rx - kx, y1);
+    pts[1] = CGPointMake(x0, y1 - ry + ky);
+    pts[2] = CGPointMake(x0, y1 - ry);				    AppendPathOp(b, pts, 3, "c");
+    pts[0] = CGPointMake(x0, y0 + ry);				    AppendPathOp(b, pts, 1, "l");
+    pts[0] = CGPointMake(x0, y0 + ry - ky);
+    pts[1] = CGPointMake(x0 + rx - kx, y0);
+    pts[2] = CGPointMake(x0 + rx, y0);				    AppendPathOp(b, pts, 3, "c");
+    pts[0] = CGPointMake(x1 - rx, y0);				    AppendPathOp(b, pts, 1, "l");
+    pts[0] = CGPointMake(x1 - rx + kx, y0);
+    pts[1] = CGPointMake(x1, y0 + ry - ky);
+    pts[2] = CGPointMake(x1, y0 + ry);				    AppendPathOp(b, pts, 3, "c");
+    AppendString(b, "h\n");
+}
+
+// A full ellipse, counterclockwise from angle 0, like DrawOval.
+static void AppendOvalPath(PDFBuffer* b, CGRect r)
+{
+    float   cx = CGRectGetMidX(r), cy = CGRectGetMidY(r);
+    float   rx = 0.5 * CGRectGetWidth(r), ry = 0.5 * CGRectGetHeight(r);
+    float   kx = kKappa * rx, ky = kKappa * ry;
+    CGPoint pts[3];
+
+    pts[0] = CGPointMake(cx + rx, cy);				    AppendPathOp(b, pts, 1, "m");
+    pts[0] = CGPointMake(cx + rx, cy + ky);
+    pts[1] = CGPointMake(cx + kx, cy + ry);
+    pts[2] = CGPointMake(cx, cy + ry);				    AppendPathOp(b, pts, 3, "c");
+    pts[0] = CGPointMake(cx - kx, cy + ry);
+    pts[1] = CGPointMake(cx - rx, cy + ky);
+    pts[2] = CGPointMake(cx - rx, cy);				    AppendPathOp(b, pts, 3, "c");
+    pts[0] = CGPointMake(cx - rx, cy - ky);
+    pts[1] = CGPointMake(cx - kx, cy - ry);
+    pts[2] = CGPointMake(cx, cy - ry);				    AppendPathOp(b, pts, 3, "c");
+    pts[0] = CGPointMake(cx + kx, cy - ry);
+    pts[1] = CGPointMake(cx + rx, cy - ky);
+    pts[2] = CGPointMake(cx + rx, cy);				    AppendPathOp(b, pts, 3, "c");
+    AppendString(b, "h\n");
+}
+
+// PDF has no quadratic curves; each one becomes the cubic with the same shape.
+static void AppendQuadAsCubic(PDFBuffer* b, CGPoint from, CGPoint control, CGPoint to)
+{
+    CGPoint pts[3];
+
+    pts[0] = CGPointMake(from.x + (2.0f / 3) * (control.x - from.x), from.y + (2.0f / 3) * (control.y - from.y));
+    pts[1] = CGPointMake(to.x + (2.0f / 3) * (control.x - to.x), to.y + (2.0f / 3) * (control.y - to.y));
+    pts[2] = to;
+    AppendPathOp(b, pts, 3, "c");
+}
+
+static void AppendPolygonPath(PDFBuffer* b, const CSkShape* sh)
+{
+    UInt32	count = CSkShapeGetPolygonCount(sh), i;
+    CGPoint*	pts = (CGPoint*)malloc((count + 1) * sizeof(CGPoint));
+    UInt8*	verbs = (UInt8*)malloc(count + 1);
+    CGPoint	current = CGPointZero, start = CGPointZero;
+
+    if ((pts == NULL) || (verbs == NULL))
+    {
+	b->failed = true;
+	goto Done;
+    }
+    CSkShapeGetPolygonPoints(sh, 0, count, pts, verbs);
+    for (i = 0; i < count; ++i)
+    {
+	UInt32 last = i;
+
+	switch (verbs[i] & kCSkPolygonVerbMask)
+	{
+	    case kCSkPolygonMoveTo:
+		AppendPathOp(b, &pts[i], 1, "m");
+		start = pts[i];
+		break;
+	    case kCSkPolygonLineTo:
+		AppendPathOp(b, &pts[i], 1, "l");
+		break;
+	    case kCSkPolygonQuadTo:
+		if ((last = i + 1) >= count)
+		    goto Done;
+		AppendQuadAsCubic(b, current, pts[i], pts[last]);
+		break;
+	    case kCSkPolygonCurveTo:
+		if ((last = i + 2) >= count)
+		    goto Done;
+		AppendPathOp(b, &pts[i], 3, "c");
+		break;
+	}
+	current = pts[last];
+	if (verbs[last] & kCSkPolygonClose)
+	{
+	    AppendString(b, "h\n");
+	    current = start;
+	}
+	i = last;
+    }
+Done:
+    free(pts);
+    free(verbs);
+}
+
+// The path of obj and the operator that paints it: lines are stroked, everything else is
+// filled and stroked (see RenderCSkObject).
+static void AppendObjectPath(PDFBuffer* b, const CSkObject* obj)
+{
+    CSkShapePtr	sh = CSkObjectGetShape(obj);
+    CGRect	r = CSkShapeGetBounds(sh);
+    CGPoint	pts[4], radii;
+    char	line[kPDFMaxItemSize];
+    int		n = 0;
+
+    CSkShapeGetPoints(sh, pts);
+    switch (CSkShapeGetType(sh))
+    {
+	case kLineShape:
+	    AppendPathOp(b, &pts[0], 1, "m");
+	    AppendPathOp(b, &pts[1], 1, "l");
+	    AppendString(b, "S\n");
+	    return;
+	case kQuadBezier:
+	    AppendPathOp(b, &pts[0], 1, "m");
+	    AppendQuadAsCubic(b, pts[0], pts[1], pts[2]);
+	    break;
+	case kCubicBezier:
+	    AppendPathOp(b, &pts[0], 1, "m");
+	    AppendPathOp(b, &pts[1], 3, "c");
+	    break;
+	case kOvalShape:
+	    AppendOvalPath(b, r);
+	    break;
+	case kRRectShape:
+	    radii = CSkShapeGetRRectRadii(sh);
+	    if ((radii.x > 0) && (radii.y > 0))
+	    {
+		AppendRRectPath(b, r, fminf(radii.x, 0.5 * CGRectGetWidth(r)), fminf(radii.y, 0.5 * CGRectGetHeight(r)));
+		break;
+	    }
+	    // else a plain rect
+	case kRectShape:
+	    if (b->relative)
+	    {
+		CGPoint p0 = BufferPoint(b, r.origin);
+		CGPoint p1 = BufferPoint(b, CGPointMake(CGRectGetMaxX(r), CGRectGetMaxY(r)));
+		r = CGRectMake(p0.x, p0.y, p1.x - p0.x, p1.y - p0.y);
+	    }
+	    n += FormatShortestFloat(line + n, r.origin.x);	line[n++] = ' ';
+	    n += FormatShortestFloat(line + n, r.origin.y);	line[n++] = ' ';
+	    n += FormatShortestFloat(line + n, r.size.width);	line[n++] = ' ';
+	    n += FormatShortestFloat(line + n, r.size.height);
+	    n += sprintf(line + n, " re\n");
+	    AppendBytes(b, line, n);
+	    break;
+	case kFreePolygon:
+	    if (CSkShapeGetPolygonCount(sh) == 0)
+		return;
+	    AppendPolygonPath(b, sh);
+	    break;
+	default:
+	    return;
+    }
+    AppendString(b, "B\n");
+}
+
+// The operators that set up the graphics state for an object's style, and their hash; they
+// are only formatted again when the style changes.
+struct PDFStyleOps
+{
+    CSkStylePtr	style;
+    char		ops[kPDFMaxItemSize];
+    int		length;
+    UInt64	hash;
+};
+typedef struct PDFStyleOps PDFStyleOps;
+
+static Boolean SetStyleOps(PDFExportMap* map, PDFStyleOps* s, CSkStylePtr style)
+{
+    if (style != s->style)
+    {
+	const CSkObjectAttributes*	attr = CSkStyleGetAttributes(style);
+	PDFAlphas			alphas = { attr->strokeColor.a, attr->fillColor.a };
+	SInt32				gstate = GetGStateIndex(map, alphas);
+
+	if (gstate < 0)
+	    return false;
+	s->length = FormatStyleOps(s->ops, attr, gstate);
+	s->hash = HashBytes(kHashSeed, s->ops, s->length);
+	s->style = style;
+    }
+    return true;
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+// Objects whose style and path, relative to the origin of their bounds, hash the same are
+// copies of one shape, moved. A shape that's drawn more than once and has a long enough path
+// becomes a form, which the copies place with a translation; the forms of the previous export
+// are placed by any object that matches one.
+struct FormKey
+{
+    UInt64	hash;	    // of the style and path
+    UInt32	count;	    // objects that hash to it
+    UInt32	form;	    // index + 1 into the map's forms, 0 while it isn't one
+};
+typedef struct FormKey FormKey;
+
+struct FormTable
+{
+    FormKey*	keys;	    // open addressing, mask + 1 of them
+    UInt32	mask;
+    UInt32*	slots;	    // for each object, back to front: the index of its key, or kNoFormKey
+};
+typedef struct FormTable FormTable;
+
+// Where hash is in the table, or the empty key where it goes.
+static UInt32 FindFormKey(const FormTable* table, UInt64 hash)
+{
+    UInt32 slot = (UInt32)hash & table->mask;
+
+    while (((table->keys[slot].count != 0) || (table->keys[slot].form != 0)) && (table->keys[slot].hash != hash))
+	slot = (slot + 1) & table->mask;
+    return slot;
+}
+
+static PDFForm* AddForm(PDFExportMap* map)
+{
+    PDFForm* form;
+
+    if (map->numForms == map->formCapacity)
+    {
+	UInt32	    capacity = 2 * map->formCapacity + 16;
+	PDFForm*    forms = (PDFForm*)realloc(map->forms, capacity * sizeof(PDFForm));
+
+	if (forms == NULL)
+	    return NULL;
+	map->forms = forms;
+	map->formCapacity = capacity;
+    }
+    form = &map->forms[map->numForms++];
+    memset(form, 0, sizeof(PDFForm));
+    return form;
+}
+
+// "q 1 0 0 1 x y cm /X<hash> Do Q\n"
+static void AppendFormPlacement(PDFBuffer* b, const PDFForm* form, CGPoint origin)
+{
+    char    line[kPDFMaxItemSize];
+    int	    n = sprintf(line, "q 1 0 0 1 ");
+
+    n += FormatShortestFloat(line + n, origin.x);	line[n++] = ' ';
+    n += FormatShortestFloat(line + n, origin.y);
+    n += sprintf(line + n, " cm /X%016llx Do Q\n", (unsigned long long)form->hash);
+    AppendBytes(b, line, n);
+}
+
+// The first walk over the objects, with the same ones left out as in BuildSegments: it counts
+// the copies of each shape, and makes the forms. A form's content comes from the first copy
+// that's seen once the shape is known to be one.
+static OSStatus CollectForms(DocStoragePtr docStP, PDFExportMap* map, FormTable* table)
+{
+    PDFBuffer	    path = { NULL, 0, 0, false, true, { 0, 0 } };
+    PDFStyleOps	    styleOps;
+    UInt32	    numObjects = 0, size, i;
+    CSkObjectPtr    obj;
+    OSStatus	    err = memFullErr;
+
+    for (obj = docStP->objList.lastItem; obj != NULL; obj = CSkObjectGetPrev(obj))
+	numObjects++;
+    for (size = 64; size < 2 * (numObjects + map->numForms); size *= 2)
+	;
+    table->mask = size - 1;
+    table->keys = (FormKey*)calloc(size, sizeof(FormKey));
+    table->slots = (UInt32*)malloc((numObjects + 1) * sizeof(UInt32));
+    require((table->keys != NULL) && (table->slots != NULL), Done);
+    for (i = 0; i < map->numForms; ++i)
+    {
+	FormKey* key = &table->keys[FindFormKey(table, map->forms[i].hash)];
+
+	key->hash = map->forms[i].hash;
+	key->form = i + 1;
+    }
+    styleOps.style = NULL;
+
+    for (obj = docStP->objList.lastItem, i = 0; obj != NULL; obj = CSkObjectGetPrev(obj), ++i)
+    {
+	CGRect	    bounds = GetDrawObjRenderBounds(obj, false);
+	UInt64	    hash;
+	UInt32	    slot;
+	FormKey*    key;
+	PDFForm*    form;
+
+	table->slots[i] = kNoFormKey;
+	if (!IsDrawObjVisible(obj) || !CGRectIntersectsRect(bounds, map->tiling.docRect))
+	    continue;
+	path.origin = CSkShapeGetBounds(CSkObjectGetShape(obj)).origin;
+	path.length = 0;
+	AppendObjectPath(&path, obj);
+	require(!path.failed, Done);
+	if (path.length < kMinFormPath)
+	    continue;
+	require(SetStyleOps(map, &styleOps, CSkObjectGetStyle(obj)), Done);
+
+	hash = HashBytes(styleOps.hash, path.bytes, path.length);
+	slot = FindFormKey(table, hash);
+	key = &table->keys[slot];
+	key->hash = hash;
+	key->count++;
+	table->slots[i] = slot;
+	if ((key->form == 0) && (key->count >= 2))
+	{
+	    require((form = AddForm(map)) != NULL, Done);
+	    form->hash = key->hash;
+	    key->form = map->numForms;
+	}
+	if ((key->form != 0) && ((form = &map->forms[key->form - 1])->content.length == 0))
+	{
+	    AppendBytes(&form->content, styleOps.ops, styleOps.length);
+	    AppendBytes(&form->content, path.bytes, path.length);
+	    require(!form->content.failed, Done);
+	    form->rawLength = form->content.length;
+	    form->bbox.origin.x = floorf(CGRectGetMinX(bounds) - path.origin.x) - 1;
+	    form->bbox.origin.y = floorf(CGRectGetMinY(bounds) - path.origin.y) - 1;
+	    form->bbox.size.width = ceilf(CGRectGetMaxX(bounds) - path.origin.x) + 1 - form->bbox.origin.x;
+	    form->bbox.size.height = ceilf(CGRectGetMaxY(bounds) - path.origin.y) + 1 - form->bbox.origin.y;
+	}
+    }
+    err = noErr;
+
+Done:
+    FreeBuffer(&path);
+    return err;
+}
+
+static void FreeFormTable(FormTable* table)
+{
+    free(table->keys);
+    free(table->slots);
+    memset(table, 0, sizeof(FormTable));
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+struct SegmentStart
+{
+    UInt64	firstHash;
+    UInt32	index;
+};
+typedef struct SegmentStart SegmentStart;
+
+static int CompareSegmentStarts(const void* a, const void* b)
+{
+    const SegmentStart*	s = (const SegmentStart*)a;
+    const SegmentStart*	t = (const SegmentStart*)b;
+
+    if (s->firstHash != t->firstHash)
+	return (s->firstHash < t->firstHash) ? -1 : 1;
+    return (s->index < t->index) ? -1 : (s->index > t->index);
+}
+
+// The first segment of the previous export, from index from on, that starts with an object
+// hashing to hash; starts are its segments, sorted by first hash. -1 if there is none.
+static SInt32 FindOldSegment(const SegmentStart* starts, UInt32 count, UInt64 hash, UInt32 from)
+{
+    UInt32  lo = 0, hi = count;
+
+    while (lo < hi)
+    {
+	UInt32 mid = (lo + hi) / 2;
+	if (starts[mid].firstHash < hash)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    for (; (lo < count) && (starts[lo].firstHash == hash); ++lo)
+    {
+	if (starts[lo].index >= from)
+	    return starts[lo].index;
+    }
+    return -1;
+}
+
+static PDFSegment* AddSegment(PDFExportMap* map)
+{
+    PDFSegment* seg;
+
+    if (map->numSegments == map->segmentCapacity)
+    {
+	UInt32	    capacity = 2 * map->segmentCapacity + 16;
+	PDFSegment* segments = (PDFSegment*)realloc(map->segments, capacity * sizeof(PDFSegment));
+
+	if (segments == NULL)
+	    return NULL;
+	map->segments = segments;
+	map->segmentCapacity = capacity;
+    }
+    seg = &map->segments[map->numSegments++];
+    memset(seg, 0, sizeof(PDFSegment));
+    seg->bounds = CGRectNull;
+    seg->old = -1;
+    return seg;
+}
+
+static void EndSegment(PDFSegment* seg)
+{
+    AppendString(&seg->content, "Q\n");
+    seg->hash = HashBytes(kHashSeed, seg->content.bytes, seg->content.length);
+    seg->rawLength = seg->content.length;
+}
+
+// Walks the objects back to front, leaving out those that draw nothing on the page, and
+// cuts them into segments. A segment starts after kSegmentLength objects, and at every object
+// that started a segment of the previous export (old, if any), in the same order. The objects
+// that CollectForms found copies of a form (forms, if it ran) place it instead of their path.
+static OSStatus BuildSegments(DocStoragePtr docStP, const PDFExportMap* old, const FormTable* forms, PDFExportMap* map)
+{
+    PDFBuffer	    path = { NULL, 0, 0, false, false, { 0, 0 } };
+    PDFSegment*	    seg = NULL;
+    PDFStyleOps	    styleOps;
+    CSkStylePtr	    segStyle = NULL;
+    SegmentStart*   starts = NULL;
+    UInt32	    numStarts = 0, nextOld = 0, i;
+    CSkObjectPtr    obj;
+    OSStatus	    err = memFullErr;
+
+    styleOps.style = NULL;
+    if ((old != NULL) && (old->numSegments > 0))
+    {
+	starts = (SegmentStart*)malloc(old->numSegments * sizeof(SegmentStart));
+	require(starts != NULL, Done);
+	for (i = 0; i < old->numSegments; ++i)
+	{
+	    starts[i].firstHash = old->segments[i].firstHash;
+	    starts[i].index = i;
+	}
+	numStarts = old->numSegments;
+	qsort(starts, numStarts, sizeof(SegmentStart), CompareSegmentStarts);
+    }
+
+    for (obj = docStP->objList.lastItem, i = 0; obj != NULL; obj = CSkObjectGetPrev(obj), ++i)
+    {
+	CGRect	    bounds = GetDrawObjRenderBounds(obj, false);
+	CSkStylePtr style = CSkObjectGetStyle(obj);
+	PDFForm*    form = NULL;
+	UInt64	    hash;
+	SInt32	    match = -1;
+
+	if (!IsDrawObjVisible(obj) || !CGRectIntersectsRect(bounds, map->tiling.docRect))
+	    continue;
+	if ((forms->slots != NULL) && (forms->slots[i] != kNoFormKey) && (forms->keys[forms->slots[i]].form != 0))
+	    form = &map->forms[forms->keys[forms->slots[i]].form - 1];
+	path.length = 0;
+	if (form != NULL)
+	{
+	    AppendFormPlacement(&path, form, CSkShapeGetBounds(CSkObjectGetShape(obj)).origin);
+	    form->count++;
+	}
+	else
+	    AppendObjectPath(&path, obj);
+	require(!path.failed, Done);
+	if (path.length == 0)
+	    continue;
+	require(SetStyleOps(map, &styleOps, style), Done);
+	hash = HashBytes(styleOps.hash, path.bytes, path.length);
+	if (starts != NULL)
+	    match = FindOldSegment(starts, numStarts, hash, nextOld);
+
+	if ((seg == NULL) || (seg->numObjects >= kSegmentLength) || (match >= 0))
+	{
+	    if (seg != NULL)
+		EndSegment(seg);
+	    seg = AddSegment(map);
+	    require(seg != NULL, Done);
+	    seg->firstHash = hash;
+	    seg->old = match;
+	    if (match >= 0)
+		nextOld = match + 1;
+	    AppendString(&seg->content, "q\n");
+	    segStyle = NULL;
+	}
+	if ((form == NULL) && (style != segStyle))    // a form sets up its own
+	{
+	    AppendBytes(&seg->content, styleOps.ops, styleOps.length);
+	    segStyle = style;
+	}
+	AppendBytes(&seg->content, path.bytes, path.length);
+	require(!seg->content.failed, Done);
+	seg->bounds = CGRectUnion(seg->bounds, bounds);
+	seg->numObjects++;
+    }
+    if (seg != NULL)
+	EndSegment(seg);
+    err = noErr;
+
+Done:
+    FreeBuffer(&path);
+    free(starts);
+    return err;
+}
+
+static OSStatus CompressBuffer(PDFBuffer* content, PDFBuffer* packed)
+{
+    uLongf  length = compressBound(content->length);
+
+    packed->bytes = (char*)malloc(length);
+    if (packed->bytes == NULL)
+	return memFullErr;
+    if (compress2((Bytef*)packed->bytes, &length, (const Bytef*)content->bytes, content->length, Z_DEFAULT_COMPRESSION) != Z_OK)
+	return memFullErr;
+    packed->length = packed->capacity = length;
+    FreeBuffer(content);
+    return noErr;
+}
+
+static OSStatus CompressSegment(PDFSegment* seg)
+{
+    OSStatus err = CompressBuffer(&seg->content, &seg->packed);
+
+    seg->length = seg->packed.length;
+    return err;
+}
+
+static OSStatus CompressForm(PDFForm* form)
+{
+    OSStatus err = CompressBuffer(&form->content, &form->packed);
+
+    form->length = form->packed.length;
+    return err;
+}
+
+// The /Contents array of a page: its head, the segments that reach into its tile, the tail.
+static void AppendPageContents(PDFBuffer* b, const PDFExportMap* map, UInt32 pageNumber)
+{
+    CGRect  tile = CSkPageTilingGetTile(&map->tiling, pageNumber);
+    CGRect  visibleRect = CGRectIntersection(tile, map->tiling.docRect);
+    char    ref[32];
+    UInt32  i;
+
+    sprintf(ref, "[%u 0 R", (unsigned)map->pages[pageNumber - 1].objNum + 1);
+    AppendString(b, ref);
+    for (i = 0; i < map->numSegments; ++i)
+    {
+	if (CGRectIntersectsRect(map->segments[i].bounds, visibleRect))
+	{
+	    sprintf(ref, " %u 0 R", (unsigned)map->segments[i].objNum);
+	    AppendString(b, ref);
+	}
+    }
+    sprintf(ref, " %u 0 R]", (unsigned)kTailObj);
+    AppendString(b, ref);
+}
+
+static void FreeExportMap(PDFExportMap* map)
+{
+    UInt32 i;
+
+    for (i = 0; i < map->numSegments; ++i)
+    {
+	FreeBuffer(&map->segments[i].content);
+	FreeBuffer(&map->segments[i].packed);
+    }
+    for (i = 0; i < map->numForms; ++i)
+    {
+	FreeBuffer(&map->forms[i].content);
+	FreeBuffer(&map->forms[i].packed);
+    }
+    free(map->segments);
+    free(map->forms);
+    free(map->pages);
+    free(map->gstates);
+    free(map->gstateSlots);
+    memset(map, 0, sizeof(PDFExportMap));
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+// The map goes into the file as a stream of text lines:
+//   CSkExportMap <version>
+//   tiling <docRect x y width height> <tile width height> <overlap> <cols> <rows>
+//   size <next free object number>
+//   gstate <stroke alpha> <fill alpha>				    for each ExtGState, in order
+//   page <object number> <hash of /Contents>			    for each page, in order
+//   segment <object number> <first hash> <hash> <raw length> <length>	for each segment, in order
+//   form <object number> <hash> <raw length> <length>			for each form, in order
+// The tiling keeps all the digits of a CGFloat, so that SamePages can compare it exactly.
+static void AppendMapText(PDFBuffer* b, const PDFExportMap* map)
+{
+    const CSkPageTiling*    t = &map->tiling;
+    char		    line[kPDFMaxItemSize];
+    UInt32		    i;
+
+    sprintf(line, "CSkExportMap %d\ntiling %.17g %.17g %.17g %.17g %.17g %.17g %.17g %u %u\nsize %u\n", kMapVersion,
+	    t->docRect.origin.x, t->docRect.origin.y, t->docRect.size.width, t->docRect.size.height,
+	    t->tileSize.width, t->tileSize.height, t->overlap, (unsigned)t->cols, (unsigned)t->rows,
+	    (unsigned)map->size);
+    AppendString(b, line);
+    for (i = 0; i < map->numGStates; ++i)
+    {
+	sprintf(line, "gstate %.9g %.9g\n", map->gstates[i].stroke, map->gstates[i].fill);
+	AppendString(b, line);
+    }
+    for (i = 0; i < map->numPages; ++i)
+    {
+	sprintf(line, "page %u %016llx\n", (unsigned)map->pages[i].objNum, (unsigned long long)map->pages[i].hash);
+	AppendString(b, line);
+    }
+    for (i = 0; i < map->numSegments; ++i)
+    {
+	const PDFSegment* seg = &map->segments[i];
+	sprintf(line, "segment %u %016llx %016llx %u %u\n", (unsigned)seg->objNum, (unsigned long long)seg->firstHash,
+		(unsigned long long)seg->hash, (unsigned)seg->rawLength, (unsigned)seg->length);
+	AppendString(b, line);
+    }
+    for (i = 0; i < map->numForms; ++i)
+    {
+	const PDFForm* form = &map->forms[i];
+	sprintf(line, "form %u %016llx %u %u\n", (unsigned)form->objNum, (unsigned long long)form->hash,
+		(unsigned)form->rawLength, (unsigned)form->length);
+	AppendString(b, line);
+    }
+}
+
+// A map that doesn't add up, say one edited by hand, is as good as none.
+static OSStatus ParseMapText(char* text, PDFExportMap* map)
+{
+    CSkPageTiling*  t = &map->tiling;
+    char*	    line;
+    char*	    next;
+    int		    version = 0;
+    UInt32	    i;
+
+    for (line = text; (line != NULL) && (*line != 0); line = next)
+    {
+	unsigned	    a, b, c;
+	unsigned long long  h1, h2;
+	double		    f[7];
+
+	if ((next = strchr(line, '\n')) != NULL)
+	    *next++ = 0;
+	if (sscanf(line, "CSkExportMap %d", &version) == 1)
+	    continue;
+	if (sscanf(line, "tiling %lg %lg %lg %lg %lg %lg %lg %u %u", &f[0], &f[1], &f[2], &f[3], &f[4], &f[5], &f[6], &a, &b) == 9)
+	{
+	    t->docRect = CGRectMake(f[0], f[1], f[2], f[3]);
+	    t->tileSize = CGSizeMake(f[4], f[5]);
+	    t->overlap = f[6];
+	    t->cols = a;
+	    t->rows = b;
+	}
+	else if (sscanf(line, "size %u", &a) == 1)
+	    map->size = a;
+	else if (sscanf(line, "gstate %lg %lg", &f[0], &f[1]) == 2)
+	{
+	    PDFAlphas alphas = { f[0], f[1] };
+	    if (GetGStateIndex(map, alphas) != map->numGStates - 1)
+		return memFullErr;  // or a duplicate
+	}
+	else if (sscanf(line, "page %u %llx", &a, &h1) == 2)
+	{
+	    PDFPage* pages = (PDFPage*)realloc(map->pages, (map->numPages + 1) * sizeof(PDFPage));
+	    if (pages == NULL)
+		return memFullErr;
+	    map->pages = pages;
+	    map->pages[map->numPages].objNum = a;
+	    map->pages[map->numPages++].hash = h1;
+	}
+	else if (sscanf(line, "segment %u %llx %llx %u %u", &a, &h1, &h2, &b, &c) == 5)
+	{
+	    PDFSegment* seg = AddSegment(map);
+	    if (seg == NULL)
+		return memFullErr;
+	    seg->objNum = a;
+	    seg->firstHash = h1;
+	    seg->hash = h2;
+	    seg->rawLength = b;
+	    seg->length = c;
+	}
+	else if (sscanf(line, "form %u %llx %u %u", &a, &h1, &b, &c) == 4)
+	{
+	    PDFForm* form = AddForm(map);
+	    if (form == NULL)
+		return memFullErr;
+	    form->objNum = a;
+	    form->hash = h1;
+	    form->rawLength = b;
+	    form->length = c;
+	}
+	else
+	    return paramErr;
+    }
+    if ((version != kMapVersion) || (map->size <= kFirstPageObj) || (map->numPages != t->cols * t->rows))
+	return paramErr;
+    for (i = 0; i < map->numPages; ++i)	    // each is written at its offsets[objNum]
+	if ((map->pages[i].objNum < kFirstPageObj) || (map->pages[i].objNum >= map->size))
+	    return paramErr;
+    for (i = 0; i < map->numSegments; ++i)
+	if ((map->segments[i].objNum < kFirstPageObj) || (map->segments[i].objNum >= map->size))
+	    return paramErr;
+    for (i = 0; i < map->numForms; ++i)
+	if ((map->forms[i].objNum < kFirstPageObj) || (map->forms[i].objNum >= map->size))
+	    return paramErr;
+    return noErr;
+}
+
+// Finds the map of the last export through the trailer at the end of the file, and the
+// cross-reference section before it.
+static OSStatus ReadExportMap(const char* path, PDFExportMap* map)
+{
+    int		fd = open(path, O_RDONLY);
+    char	tail[kMaxTailSize + 1];
+    char*	section = NULL;
+    char*	text = NULL;
+    char*	p;
+    struct stat	st;
+    SInt64	mapOffset = 0;
+    long long	xrefOffset;
+    size_t	n;
+    unsigned	first, count, objNum, length;
+    int		headerLength = 0;
+    OSStatus	err = paramErr;
+
+    if (fd < 0)
+	return fnfErr;
+    require(fstat(fd, &st) == 0, Done);
+    map->fileSize = st.st_size;
+    n = (st.st_size < kMaxTailSize) ? st.st_size : kMaxTailSize;
+    require(pread(fd, tail, n, st.st_size - n) == (ssize_t)n, Done);
+    tail[n] = 0;
+    for (p = tail + n; (p > tail) && (strncmp(p, "startxref", 9) != 0); --p)
+	;
+    require(sscanf(p, "startxref %lld", &xrefOffset) == 1, Done);
+    map->xrefOffset = xrefOffset;
+    require((map->xrefOffset > 0) && (map->xrefOffset < st.st_size) && (st.st_size - map->xrefOffset < kMaxXrefSize), Done);
+
+    n = st.st_size - map->xrefOffset;
+    section = (char*)malloc(n + 1);
+    require_action(section != NULL, Done, err = memFullErr);
+    require(pread(fd, section, n, map->xrefOffset) == (ssize_t)n, Done);
+    section[n] = 0;
+    require(strncmp(section, "xref\n", 5) == 0, Done);
+    for (p = section + 5; sscanf(p, "%u %u\n", &first, &count) == 2; p += 20 * count)
+    {
+	p = strchr(p, '\n');
+	require(p != NULL, Done);	// cut short: no map
+	p += 1;
+	require(section + n - p >= 20 * count, Done);
+	if ((kMapObj >= first) && (kMapObj < first + count))
+	    mapOffset = strtoll(p + 20 * (kMapObj - first), NULL, 10);
+    }
+    sprintf(tail, "/CSkExportMap %d 0 R", kMapObj);
+    require((strncmp(p, "trailer", 7) == 0) && (strstr(p, tail) != NULL) && (mapOffset > 0), Done);
+
+    n = (st.st_size - mapOffset < 64) ? st.st_size - mapOffset : 64;
+    require(pread(fd, tail, n, mapOffset) == (ssize_t)n, Done);
+    tail[n] = 0;
+    require((sscanf(tail, "%u 0 obj << /Length %u >> stream%n", &objNum, &length, &headerLength) == 2) && (objNum == kMapObj), Done);
+    require((headerLength > 0) && (mapOffset + headerLength + 1 + length <= st.st_size), Done);
+    text = (char*)malloc(length + 1);
+    require_action(text != NULL, Done, err = memFullErr);
+    require(pread(fd, text, length, mapOffset + headerLength + 1) == (ssize_t)length, Done);
+    text[length] = 0;
+    err = ParseMapText(text, map);
+
+Done:
+    close(fd);
+    free(section);
+    free(text);
+    return err;
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+static void WritePDFBytes(PDFWriter* w, const char* p, size_t left)
+{
+    w->position += left;
+    while ((left > 0) && (w->err == noErr))
+    {
+	ssize_t n = write(w->fd, p, left);
+	if (n > 0)
+	{
+	    p += n;
+	    left -= n;
+	}
+	else if ((n < 0) && (errno != EINTR))
+	    w->err = (errno == ENOSPC) ? dskFulErr : ioErr;
+    }
+}
+
+static void FlushPDF(PDFWriter* w)
+{
+    WritePDFBytes(w, w->buffer, w->used);
+    w->used = 0;
+}
+
+static void PutPDFBytes(PDFWriter* w, const void* bytes, size_t length)
+{
+    if (w->used + length > kPDFBufferSize)
+	FlushPDF(w);
+    if (length > kPDFBufferSize)
+	WritePDFBytes(w, (const char*)bytes, length);	// straight from where it is
+    else
+    {
+	memcpy(w->buffer + w->used, bytes, length);
+	w->used += length;
+    }
+}
+
+static void PutPDFString(PDFWriter* w, const char* s)
+{
+    PutPDFBytes(w, s, strlen(s));
+}
+
+static void BeginPDFObject(PDFWriter* w, UInt32 objNum)
+{
+    char header[32];
+
+    w->offsets[objNum] = w->position + w->used;
+    sprintf(header, "%u 0 obj\n", (unsigned)objNum);
+    PutPDFString(w, header);
+}
+
+// Extra entries for the stream's dictionary go before /Length, each followed by a space.
+static void PutPDFStream(PDFWriter* w, UInt32 objNum, const char* entries, const void* bytes, size_t length, Boolean compressed)
+{
+    char header[kPDFMaxItemSize];
+
+    BeginPDFObject(w, objNum);
+    sprintf(header, "<< %s/Length %lu%s >>\nstream\n", entries, (unsigned long)length, compressed ? " /Filter /FlateDecode" : "");
+    PutPDFString(w, header);
+    PutPDFBytes(w, bytes, length);
+    PutPDFString(w, "\nendstream\nendobj\n");
+}
+
+static void PutResources(PDFWriter* w, const PDFExportMap* map)
+{
+    char    entry[kPDFMaxItemSize];
+    UInt32  i;
+
+    BeginPDFObject(w, kResourcesObj);
+    PutPDFString(w, "<< /ProcSet [/PDF] /ColorSpace << /CS0 " kGenericRGBSpace " >> /ExtGState <<");
+    for (i = 0; i < map->numGStates; ++i)
+    {
+	int n = sprintf(entry, "\n/G%u << /CA ", (unsigned)i);
+	n += FormatShortestFloat(entry + n, map->gstates[i].stroke);
+	n += sprintf(entry + n, " /ca ");
+	n += FormatShortestFloat(entry + n, map->gstates[i].fill);
+	sprintf(entry + n, " >>");
+	PutPDFString(w, entry);
+    }
+    PutPDFString(w, " >>");
+    if (map->numForms > 0)
+    {
+	PutPDFString(w, " /XObject <<");
+	for (i = 0; i < map->numForms; ++i)
+	{
+	    sprintf(entry, "\n/X%016llx %u 0 R", (unsigned long long)map->forms[i].hash, (unsigned)map->forms[i].objNum);
+	    PutPDFString(w, entry);
+	}
+	PutPDFString(w, " >>");
+    }
+    PutPDFString(w, " >>\nendobj\n");
+}
+
+// Compressed here, if it isn't yet. Its bounding box is that of the first copy, rounded out
+// by a point to take in the others.
+static void PutForm(PDFWriter* w, PDFForm* form)
+{
+    char    entries[kPDFMaxItemSize];
+    int	    n = sprintf(entries, "/Type /XObject /Subtype /Form /BBox [");
+
+    if ((form->packed.bytes == NULL) && ((w->err = CompressForm(form)) != noErr))
+	return;
+    n += FormatShortestFloat(entries + n, CGRectGetMinX(form->bbox));	entries[n++] = ' ';
+    n += FormatShortestFloat(entries + n, CGRectGetMinY(form->bbox));	entries[n++] = ' ';
+    n += FormatShortestFloat(entries + n, CGRectGetMaxX(form->bbox));	entries[n++] = ' ';
+    n += FormatShortestFloat(entries + n, CGRectGetMaxY(form->bbox));
+    sprintf(entries + n, "] /Resources %d 0 R ", kResourcesObj);
+    PutPDFStream(w, form->objNum, entries, form->packed.bytes, form->packed.length, true);
+    FreeBuffer(&form->packed);
+}
+
+static void PutPage(PDFWriter* w, const PDFExportMap* map, UInt32 pageNumber, const PDFBuffer* contents)
+{
+    char header[kPDFMaxItemSize];
+
+    BeginPDFObject(w, map->pages[pageNumber - 1].objNum);
+    sprintf(header, "<< /Type /Page /Parent %d 0 R /Resources %d 0 R /Contents ", kPagesObj, kResourcesObj);
+    PutPDFString(w, header);
+    PutPDFBytes(w, contents->bytes, contents->length);
+    PutPDFString(w, " >>\nendobj\n");
+}
+
+static void PutMap(PDFWriter* w, const PDFExportMap* map)
+{
+    PDFBuffer text = { NULL, 0, 0, false };
+
+    AppendMapText(&text, map);
+    if (text.failed)
+	w->err = memFullErr;
+    else
+	PutPDFStream(w, kMapObj, "", text.bytes, text.length, false);
+    FreeBuffer(&text);
+}
+
+// A cross-reference subsection for each run of consecutive object numbers written, then
+// the trailer; prevXref is the offset of the previous section, or 0.
+static void PutXrefAndTrailer(PDFWriter* w, const PDFExportMap* map, SInt64 prevXref)
+{
+    SInt64  xrefOffset = w->position + w->used;
+    char    line[kPDFMaxItemSize];
+    UInt32  first, last, i;
+
+    PutPDFString(w, "xref\n");
+    for (first = (prevXref == 0) ? 0 : 1; first < map->size; first = last)
+    {
+	if ((first > 0) && (w->offsets[first] == 0))
+	{
+	    last = first + 1;
+	    continue;
+	}
+	for (last = first + 1; (last < map->size) && (w->offsets[last] != 0); ++last)
+	    ;
+	sprintf(line, "%u %u\n", (unsigned)first, (unsigned)(last - first));
+	PutPDFString(w, line);
+	for (i = first; i < last; ++i)
+	{
+	    if (i == 0)
+		PutPDFString(w, "0000000000 65535 f \n");
+	    else
+	    {
+		sprintf(line, "%010lld 00000 n \n", (long long)w->offsets[i]);
+		PutPDFString(w, line);
+	    }
+	}
+    }
+    sprintf(line, "trailer\n<< /Size %u /Root %d 0 R /Info %d 0 R /CSkExportMap %d 0 R", (unsigned)map->size, kCatalogObj, kInfoObj, kMapObj);
+    PutPDFString(w, line);
+    if (prevXref != 0)
+    {
+	sprintf(line, " /Prev %lld", (long long)prevXref);
+	PutPDFString(w, line);
+    }
+    sprintf(line, " >>\nstartxref\n%lld\n%%%%EOF\n", (long long)xrefOffset);
+    PutPDFString(w, line);
+}
+
+// /Title as UTF-16 with a byte order mark, the one text string encoding that takes any title.
+static void PutInfo(PDFWriter* w, CFStringRef title)
+{
+    char    hex[8];
+    CFIndex length = (title != NULL) ? CFStringGetLength(title) : 0, i;
+
+    BeginPDFObject(w, kInfoObj);
+    PutPDFString(w, "<< /Creator (CarbonSketch)");
+    if (length > 0)
+    {
+	PutPDFString(w, " /Title <FEFF");
+	for (i = 0; i < length; ++i)
+	{
+	    sprintf(hex, "%04X", (unsigned)CFStringGetCharacterAtIndex(title, i));
+	    PutPDFString(w, hex);
+	}
+	PutPDFString(w, ">");
+    }
+    PutPDFString(w, " >>\nendobj\n");
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+static OSStatus WholePDF(PDFWriter* w, PDFExportMap* map, CFStringRef title, CSkPDFUpdateStats* stats)
+{
+    PDFBuffer	contents = { NULL, 0, 0, false };
+    char	line[kPDFMaxItemSize];
+    UInt32	i;
+    int		n;
+    CSK_TRACE_SPAN("WholePDF");
+
+    PutPDFString(w, "%PDF-1.4\n%\342\343\317\323\n");
+    BeginPDFObject(w, kCatalogObj);
+    sprintf(line, "<< /Type /Catalog /Pages %d 0 R >>\nendobj\n", kPagesObj);
+    PutPDFString(w, line);
+    BeginPDFObject(w, kPagesObj);
+    n = sprintf(line, "<< /Type /Pages /Count %u /MediaBox [0 0 ", (unsigned)map->numPages);
+    n += FormatShortestFloat(line + n, map->tiling.tileSize.width);
+    line[n++] = ' ';
+    n += FormatShortestFloat(line + n, map->tiling.tileSize.height);
+    sprintf(line + n, "] /Kids [");
+    PutPDFString(w, line);
+    for (i = 0; i < map->numPages; ++i)
+    {
+	sprintf(line, "%s%u 0 R", (i == 0) ? "" : " ", (unsigned)map->pages[i].objNum);
+	PutPDFString(w, line);
+    }
+    PutPDFString(w, "] >>\nendobj\n");
+    PutInfo(w, title);
+    PutResources(w, map);
+    PutPDFStream(w, kTailObj, "", "Q\n", 2, false);
+
+    for (i = 0; (i < map->numSegments) && (w->err == noErr); ++i)
+    {
+	PDFSegment* seg = &map->segments[i];
+
+	if ((seg->packed.bytes == NULL) && ((w->err = CompressSegment(seg)) != noErr))
+	    break;
+	PutPDFStream(w, seg->objNum, "", seg->packed.bytes, seg->packed.length, true);
+	FreeBuffer(&seg->packed);
+	stats->segmentsWritten++;
+    }
+    for (i = 0; (i < map->numForms) && (w->err == noErr); ++i)
+	PutForm(w, &map->forms[i]);
+    for (i = 0; (i < map->numPages) && (w->err == noErr); ++i)
+    {
+	CGRect	tile = CSkPageTilingGetTile(&map->tiling, i + 1);
+	CGRect	visibleRect = CGRectIntersection(tile, map->tiling.docRect);
+
+	// The head: into the tile's coordinates, clipped to the document
+	n = sprintf(line, "q 1 0 0 1 ");
+	n += FormatShortestFloat(line + n, -tile.origin.x);	line[n++] = ' ';
+	n += FormatShortestFloat(line + n, -tile.origin.y);
+	n += sprintf(line + n, " cm ");
+	n += FormatShortestFloat(line + n, visibleRect.origin.x);	line[n++] = ' ';
+	n += FormatShortestFloat(line + n, visibleRect.origin.y);	line[n++] = ' ';
+	n += FormatShortestFloat(line + n, visibleRect.size.width);	line[n++] = ' ';
+	n += FormatShortestFloat(line + n, visibleRect.size.height);
+	n += sprintf(line + n, " re W n\n");
+	contents.length = 0;
+	AppendBytes(&contents, line, n);
+	if (contents.failed)
+	    w->err = memFullErr;
+	PutPDFStream(w, map->pages[i].objNum + 1, "", contents.bytes, contents.length, false);
+
+	contents.length = 0;
+	AppendPageContents(&contents, map, i + 1);
+	map->pages[i].hash = HashBytes(kHashSeed, contents.bytes, contents.length);
+	if (contents.failed)
+	    w->err = memFullErr;
+	PutPage(w, map, i + 1, &contents);
+	stats->pagesWritten++;
+    }
+    PutMap(w, map);
+    PutXrefAndTrailer(w, map, 0);
+    FreeBuffer(&contents);
+    return w->err;
+}
+
+// Appends the segments that changed, the new forms, the pages whose /Contents changed, the
+// resources if there are new ExtGStates or forms, and the map; a segment that took the place
+// of an old one gets its object number. The old forms stay, used or not.
+static OSStatus AppendPDFUpdate(PDFWriter* w, PDFExportMap* map, const PDFExportMap* old, CSkPDFUpdateStats* stats)
+{
+    PDFBuffer	contents = { NULL, 0, 0, false };
+    UInt32	i;
+    CSK_TRACE_SPAN("AppendPDFUpdate");
+
+    if ((map->numGStates > old->numGStates) || (map->numForms > old->numForms))
+	PutResources(w, map);
+    for (i = 0; (i < map->numSegments) && (w->err == noErr); ++i)
+    {
+	PDFSegment* seg = &map->segments[i];
+
+	if (seg->packed.bytes != NULL)
+	{
+	    PutPDFStream(w, seg->objNum, "", seg->packed.bytes, seg->packed.length, true);
+	    FreeBuffer(&seg->packed);
+	    stats->segmentsWritten++;
+	}
+    }
+    for (i = old->numForms; (i < map->numForms) && (w->err == noErr); ++i)
+	PutForm(w, &map->forms[i]);
+    for (i = 0; (i < map->numPages) && (w->err == noErr); ++i)
+    {
+	contents.length = 0;
+	AppendPageContents(&contents, map, i + 1);
+	map->pages[i].hash = HashBytes(kHashSeed, contents.bytes, contents.length);
+	if (contents.failed)
+	    w->err = memFullErr;
+	else if (map->pages[i].hash != old->pages[i].hash)
+	{
+	    PutPage(w, map, i + 1, &contents);
+	    stats->pagesWritten++;
+	}
+    }
+    PutMap(w, map);
+    PutXrefAndTrailer(w, map, old->xrefOffset);
+    FreeBuffer(&contents);
+    return w->err;
+}
+
+// Whether the pages of map, and their heads, are still those of old.
+static Boolean SamePages(const PDFExportMap* old, const PDFExportMap* map)
+{
+    const CSkPageTiling*    a = &old->tiling;
+    const CSkPageTiling*    b = &map->tiling;
+
+    return CGRectEqualToRect(a->docRect, b->docRect) && (a->tileSize.width == b->tileSize.width)
+	    && (a->tileSize.height == b->tileSize.height) && (a->overlap == b->overlap)
+	    && (a->cols == b->cols) && (a->rows == b->rows);
+}
+
+//--------------------------------------------------------------------------------------
+// Segments are compressed only once it's clear they are going to be written. The whole file
+// goes to a new file next to path that is renamed over it, like CSkReplaceFileContents does;
+// an update that fails is cut off again, so that path is the old file either way.
+OSStatus CSkUpdatePDFDocument(DocStoragePtr docStP, const char* path, CFStringRef title, UInt32 options, CSkPDFUpdateStats* outStats)
+{
+    PDFExportMap	old, map;
+    PDFWriter		w;
+    FormTable		forms;
+    CSkPDFUpdateStats	stats;
+    char		tempPath[PATH_MAX];
+    struct stat		sb;
+    Boolean		incremental = false;
+    SInt64		rawTotal = 0, rawChanged = 0, appended = 0, freshSize = 0;
+    UInt32		i, n;
+    CSK_TRACE_SPAN("CSkUpdatePDFDocument");
+
+    memset(&old, 0, sizeof(old));
+    memset(&map, 0, sizeof(map));
+    memset(&w, 0, sizeof(w));
+    memset(&forms, 0, sizeof(forms));
+    memset(&stats, 0, sizeof(stats));
+    w.fd = -1;
+
+    if (((docStP->pdfDocument != NULL) && docStP->pdfIsUnlocked) || (docStP->cgImgSrc != NULL) || docStP->shouldDrawGrabbers)
+    {
+	CFURLRef url = CFURLCreateFromFileSystemRepresentation(kCFAllocatorDefault, (const UInt8*)path, strlen(path), false);
+
+	require_action(url != NULL, Done, w.err = memFullErr);
+	w.err = CSkWritePDFDocument(docStP, url, title, kCSkPageDrawOptimized, NULL);
+	CFRelease(url);
+	goto Done;
+    }
+    w.err = CSkGetPageTiling(docStP, &map.tiling);
+    require_noerr(w.err, Done);
+    MaterializeAllObjects(docStP);
+
+    if (!(options & kCSkPDFRewrite) && (ReadExportMap(path, &old) == noErr) && SamePages(&old, &map))
+    {
+	incremental = true;
+	for (i = 0; i < old.numGStates; ++i)
+	    (void)GetGStateIndex(&map, old.gstates[i]);
+	require_action(map.numGStates == old.numGStates, Done, w.err = memFullErr);
+	for (i = 0; i < old.numForms; ++i)
+	{
+	    PDFForm* form = AddForm(&map);
+
+	    require_action(form != NULL, Done, w.err = memFullErr);
+	    form->objNum = old.forms[i].objNum;
+	    form->hash = old.forms[i].hash;
+	    form->rawLength = old.forms[i].rawLength;
+	    form->length = old.forms[i].length;
+	}
+    }
+    if (!(options & kCSkPDFNoForms))
+    {
+	w.err = CollectForms(docStP, &map, &forms);
+	require_noerr(w.err, Done);
+    }
+    w.err = BuildSegments(docStP, incremental ? &old : NULL, &forms, &map);
+    require_noerr(w.err, Done);
+
+    // Number the objects, and see how much changed
+    map.numPages = CSkPageTilingGetCount(&map.tiling);
+    map.pages = (PDFPage*)calloc(map.numPages, sizeof(PDFPage));
+    require_action(map.pages != NULL, Done, w.err = memFullErr);
+    map.size = incremental ? old.size : kFirstPageObj + 2 * map.numPages;
+    for (i = 0; i < map.numPages; ++i)
+	map.pages[i].objNum = incremental ? old.pages[i].objNum : kFirstPageObj + 2 * i;
+    for (i = 0; i < map.numSegments; ++i)
+    {
+	PDFSegment*	    seg = &map.segments[i];
+	const PDFSegment*   was = (incremental && (seg->old >= 0)) ? &old.segments[seg->old] : NULL;
+
+	rawTotal += seg->rawLength;
+	if ((was != NULL) && (was->hash == seg->hash) && (was->rawLength == seg->rawLength))
+	{
+	    seg->objNum = was->objNum;
+	    seg->length = was->length;
+	}
+	else
+	{
+	    seg->objNum = (was != NULL) ? was->objNum : map.size++;
+	    seg->length = 0;	// to be written
+	    rawChanged += seg->rawLength;
+	}
+    }
+    for (i = 0; i < map.numForms; ++i)
+    {
+	PDFForm* form = &map.forms[i];
+
+	if (form->count == 0)
+	    continue;
+	rawTotal += form->rawLength;
+	if (form->objNum == 0)
+	{
+	    form->objNum = map.size++;
+	    rawChanged += form->rawLength;
+	}
+	stats.numForms++;
+	stats.formPlacements += form->count;
+    }
+    if (incremental && (rawChanged * 100 > rawTotal * kMaxUpdatePercent))
+	incremental = false;
+    for (i = 0; incremental && (i < map.numSegments); ++i)
+    {
+	PDFSegment* seg = &map.segments[i];
+
+	if (seg->length == 0)
+	{
+	    w.err = CompressSegment(seg);
+	    require_noerr(w.err, Done);
+	    appended += seg->length;
+	}
+	freshSize += seg->length;
+    }
+    for (i = 0; incremental && (i < map.numForms); ++i)
+    {
+	PDFForm* form = &map.forms[i];
+
+	if (i >= old.numForms)
+	{
+	    w.err = CompressForm(form);
+	    require_noerr(w.err, Done);
+	    appended += form->length;
+	}
+	if (form->count > 0)
+	    freshSize += form->length;
+    }
+    if (incremental && (old.fileSize + appended > kMaxFileGrowth * (freshSize + kPageSizeEstimate * map.numPages)))
+	incremental = false;
+    if (incremental)
+    {
+	for (i = 0; i < map.numSegments; ++i)
+	    FreeBuffer(&map.segments[i].content);    // already in the file, or compressed
+	for (i = 0; i < map.numForms; ++i)
+	    FreeBuffer(&map.forms[i].content);
+    }
+    else
+    {
+	map.size = kFirstPageObj + 2 * map.numPages;
+	for (i = 0; i < map.numPages; ++i)
+	    map.pages[i].objNum = kFirstPageObj + 2 * i;
+	for (i = 0; i < map.numSegments; ++i)
+	    map.segments[i].objNum = map.size++;
+	for (i = 0, n = 0; i < map.numForms; ++i)    // only those used this time
+	{
+	    if (map.forms[i].count == 0)
+	    {
+		FreeBuffer(&map.forms[i].content);
+		FreeBuffer(&map.forms[i].packed);
+		continue;
+	    }
+	    map.forms[n] = map.forms[i];
+	    map.forms[n++].objNum = map.size++;
+	}
+	map.numForms = n;
+    }
+
+    // Write it
+    w.buffer = (char*)malloc(kPDFBufferSize);
+    w.offsets = (SInt64*)calloc(map.size, sizeof(SInt64));
+    require_action((w.buffer != NULL) && (w.offsets != NULL), Done, w.err = memFullErr);
+    if (!incremental)
+	require_action(snprintf(tempPath, sizeof(tempPath), "%s.saving", path) < (int)sizeof(tempPath), Done, w.err = bdNamErr);
+    w.fd = incremental ? open(path, O_WRONLY | O_APPEND)
+		       : open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, (stat(path, &sb) == 0) ? (sb.st_mode & 0777) : 0644);
+    require_action(w.fd >= 0, Done, w.err = (errno == ENOENT) ? dirNFErr : ioErr);
+    w.position = incremental ? old.fileSize : 0;
+    if (incremental)
+	AppendPDFUpdate(&w, &map, &old, &stats);
+    else
+	WholePDF(&w, &map, title, &stats);
+    FlushPDF(&w);
+    if ((w.err == noErr) && (fcntl(w.fd, F_FULLFSYNC) != 0) && (fsync(w.fd) != 0))
+	w.err = ioErr;
+    stats.bytesWritten = w.position - (incremental ? old.fileSize : 0);
+
+Done:
+    if ((w.fd >= 0) && incremental && (w.err != noErr))
+	(void)ftruncate(w.fd, old.fileSize);	// drop what got appended
+    if ((w.fd >= 0) && (close(w.fd) != 0) && (w.err == noErr))
+	w.err = ioErr;
+    if ((w.fd >= 0) && !incremental)
+    {
+	if ((w.err == noErr) && (rename(tempPath, path) != 0))
+	    w.err = ioErr;
+	if (w.err != noErr)
+	    unlink(tempPath);
+    }
+    if (w.err != noErr)
+	fprintf(stderr, "CSkUpdatePDFDocument: can't write %s (%d)\n", path, (int)w.err);
+    stats.incremental = incremental;
+    stats.numSegments = map.numSegments;
+    if (outStats != NULL)
+	*outStats = stats;
+    free(w.buffer);
+    free(w.offsets);
+    FreeFormTable(&forms);
+    FreeExportMap(&old);
+    FreeExportMap(&map);
+    return w.err;
+}
@@ -0,0 +1,92 @@
+/*
+    File:       CSkPDFUpdate.h
+        
+    Contains:	Incremental PDF export: appends updates to a PDF written before.
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#ifndef __CSKPDFUPDATE__
+#define __CSKPDFUPDATE__
+
+#include <Carbon/Carbon.h>
+#include "CSkDocStorage.h"
+
+// PDF export that can bring a PDF it wrote before up to date by appending an incremental update
+// (PDF 1.4, section 3.4.5): new versions of the objects that changed, a cross-reference section
+// for them, and a trailer that points back to the previous one. Readers see only the latest
+// version of each object.
+// The page is written as content streams ("segments") of up to 256 objects each, back to front,
+// which every page whose tile they touch lists in its /Contents. A map in the file (the
+// /CSkExportMap entry of the trailer) records the segments: for each, a hash of its first
+// object and of its content. On the next export, segments start again at the same objects where
+// they still exist, so an edit only changes the segments it falls into; those, the pages that
+// list them and the map are all that's appended.
+// The whole file is written again when there is no map (or the pages are laid out differently),
+// when more than half of the content changed, or when the replaced objects would make the file
+// more than twice the size of a fresh one. A document with a background picture or PDF, or
+// that shows its selection, is written by CSkWritePDFDocument instead, every time.
+// Objects are drawn as DrawThePage draws them, in the generic RGB space (as CalRGB); like
+// CSkWritePDFDocument, the page leaves out the grid, and invisible and off-page objects (see
+// CSkPageDrawerCreate). Copies of a shape, objects with the same style and the same path but
+// for a translation, are drawn from one form XObject that each of them places with a "cm";
+// only shapes with more than a few path operators are worth it.
+
+enum {	// CSkUpdatePDFDocument options
+    kCSkPDFUpdate	= 0,	// append to the file if it has a map
+    kCSkPDFRewrite	= 1,	// always write the whole file
+    kCSkPDFNoForms	= 2	// every object draws its own path
+};
+
+struct CSkPDFUpdateStats
+{
+    Boolean	incremental;	    // appended to the file, rather than writing it again
+    UInt32	numSegments;
+    UInt32	segmentsWritten;
+    UInt32	pagesWritten;
+    SInt64	bytesWritten;
+    UInt32	numForms;	    // used by the objects
+    UInt32	formPlacements;
+};
+typedef struct CSkPDFUpdateStats CSkPDFUpdateStats;
+
+// Writes the document to the PDF file at path, titled title; outStats may be NULL.
+extern OSStatus	CSkUpdatePDFDocument(DocStoragePtr docStP, const char* path, CFStringRef title, UInt32 options, CSkPDFUpdateStats* outStats);
+
+#endif
@@ -0,0 +1,405 @@
+/*
+    File:       CSkPasteboard.c
+        
+    Contains:	Promised pasteboard flavors of the document page, drawn when asked for
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#include "CSkPasteboard.h"
+#include "CSkObjects.h"
+#include "CSkFileFormat.h"
+#include "CSkTrace.h"
+
+// The PDF of a page is collected in chunks of kPasteboardChunkSize, the first of which is
+// allocated up front, and copied into a CFData of the final size once.
+
+enum {
+    kPasteboardChunkSize    = 256 * 1024
+};
+
+struct CSkChunkedData
+{
+    UInt8**	chunks;
+    UInt32	numChunks, maxChunks;
+    size_t	length;
+};
+typedef struct CSkChunkedData CSkChunkedData;
+
+// What Copy saw: the selected objects, or all of them (with the fields of DocStorage that
+// DrawPageBackground looks at) if none were selected.
+struct CSkPromisedCopy
+{
+    DocStorage	    page;
+    CSkObjectPtr*   objects;	    // a snapshot
+    UInt32	    numObjects;
+    CGRect	    pdfRect;	    // in document coordinates
+    Boolean	    hasSelection;   // then the page isn't drawn, and the objects flavor is promised too
+};
+typedef struct CSkPromisedCopy CSkPromisedCopy;
+
+static CSkPromisedCopy*	sPromisedCopy = NULL;	// also the PasteboardItemID of its item
+static PasteboardRef	sPromisePasteboard = NULL;
+
+//--------------------------------------------------------------------------------------
+static Boolean AddChunk(CSkChunkedData* data)
+{
+    if (data->numChunks == data->maxChunks)
+    {
+	UInt32	maxChunks = (data->maxChunks > 0) ? 2 * data->maxChunks : 8;
+	UInt8** chunks = (UInt8**)realloc(data->chunks, maxChunks * sizeof(UInt8*));
+	if (chunks == NULL)
+	    return false;
+	data->chunks = chunks;
+	data->maxChunks = maxChunks;
+    }
+    data->chunks[data->numChunks] = (UInt8*)malloc(kPasteboardChunkSize);
+    if (data->chunks[data->numChunks] == NULL)
+	return false;
+    data->numChunks += 1;
+    return true;
+}
+
+static size_t ChunkedDataPutBytes(void* info, const void* buffer, size_t count)
+{
+    CSkChunkedData* data = (CSkChunkedData*)info;
+    const UInt8*    src = (const UInt8*)buffer;
+    size_t	    left = count;
+    
+    while (left > 0)
+    {
+	size_t offset = data->length % kPasteboardChunkSize;
+	size_t n = kPasteboardChunkSize - offset;
+	
+	if ((data->length == data->numChunks * (size_t)kPasteboardChunkSize) && !AddChunk(data))
+	    return count - left;	// tells CG we're out of memory
+	if (n > left)
+	    n = left;
+	memcpy(data->chunks[data->length / kPasteboardChunkSize] + offset, src, n);
+	data->length += n;
+	src += n;
+	left -= n;
+    }
+    return count;
+}
+
+static void ReleaseChunkedData(CSkChunkedData* data)
+{
+    UInt32 i;
+    
+    for (i = 0; i < data->numChunks; ++i)
+	free(data->chunks[i]);
+    free(data->chunks);
+}
+
+// The bytes, in one block; NULL if out of memory
+static CFDataRef CopyChunkedDataAsCFData(const CSkChunkedData* data)
+{
+    UInt8*	bytes = (UInt8*)malloc(data->length + 1);
+    CFDataRef	cfData = NULL;
+    size_t	offset;
+    UInt32	i;
+    
+    if (bytes != NULL)
+    {
+	for (i = 0, offset = 0; offset < data->length; ++i, offset += kPasteboardChunkSize)
+	{
+	    size_t n = data->length - offset;
+	    memcpy(bytes + offset, data->chunks[i], (n < kPasteboardChunkSize) ? n : kPasteboardChunkSize);
+	}
+	cfData = CFDataCreateWithBytesNoCopy(kCFAllocatorDefault, bytes, data->length, kCFAllocatorMalloc);
+	if (cfData == NULL)
+	    free(bytes);
+    }
+    return cfData;
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+static void ReleasePromisedCopy(CSkPromisedCopy* promise)
+{
+    if (promise != NULL)
+    {
+	if (promise->page.pdfDocument != NULL)
+	    CGPDFDocumentRelease(promise->page.pdfDocument);
+	if (promise->page.cgImgSrc != NULL)
+	    CFRelease(promise->page.cgImgSrc);
+	ReleaseDrawObjSnapshot(promise->objects, promise->numObjects);
+	free(promise);
+    }
+}
+
+// Note that we don't include a pdf background if it is password-protected. The selection
+// may change after Copy, so grabbers aren't drawn.
+static CSkPromisedCopy* CreatePromisedCopy(DocStoragePtr docStP)
+{
+    CSkPromisedCopy* promise = (CSkPromisedCopy*)calloc(1, sizeof(CSkPromisedCopy));
+    UInt32	     i;
+    
+    if (promise != NULL)
+    {
+	promise->objects = CreateSelectedDrawObjSnapshot(&docStP->objList, &promise->numObjects);
+	promise->hasSelection = (promise->numObjects > 0);
+	if (promise->hasSelection)
+	{
+	    promise->pdfRect = CGRectNull;
+	    for (i = 0; i < promise->numObjects; ++i)
+		promise->pdfRect = CGRectUnion(promise->pdfRect, GetDrawObjRenderBounds(promise->objects[i], false));
+	    promise->pdfRect = CGRectIntegral(promise->pdfRect);
+	    return promise;
+	}
+	MaterializeObjectsInRect(docStP, docStP->pageRect);
+	promise->objects = CreateDrawObjSnapshot(&docStP->objList, &promise->numObjects);
+	promise->pdfRect = docStP->pageRect;
+	promise->page.pageRect = docStP->pageRect;
+	promise->page.gridWidth = docStP->gridWidth;
+	promise->page.shouldDrawGrid = docStP->shouldDrawGrid;
+	promise->page.indexOrPageNo = docStP->indexOrPageNo;
+	if ((docStP->pdfDocument != NULL) && !docStP->pdfIsProtected)
+	{
+	    promise->page.pdfDocument = CGPDFDocumentRetain(docStP->pdfDocument);
+	    promise->page.pdfIsUnlocked = true;
+	}
+	else if (docStP->cgImgSrc != NULL)
+	{
+	    promise->page.cgImgSrc = (CGImageSourceRef)CFRetain(docStP->cgImgSrc);
+	}
+    }
+    return promise;
+}
+
+static CFDataRef CreatePDFDataForPromisedCopy(CSkPromisedCopy* promise)
+{
+    CGDataConsumerCallbacks callbacks = { ChunkedDataPutBytes, NULL };
+    CSkChunkedData	    data = { NULL, 0, 0, 0 };
+    CGDataConsumerRef	    consumer = NULL;
+    CGContextRef	    pdfContext = NULL;
+    CFDataRef		    pdfData = NULL;
+    CGRect		    mediaBox = CGRectMake(0, 0, promise->pdfRect.size.width, promise->pdfRect.size.height);
+    CSK_TRACE_SPAN("CreatePDFDataForPromisedCopy");
+    
+    require(AddChunk(&data), CantAllocate);
+    consumer = CGDataConsumerCreate(&data, &callbacks);
+    require(consumer != NULL, CantAllocate);
+    pdfContext = CGPDFContextCreate(consumer, &mediaBox, NULL);
+    require(pdfContext != NULL, CantAllocate);
+    
+    CGContextBeginPage(pdfContext, &mediaBox);
+    CGContextTranslateCTM(pdfContext, -promise->pdfRect.origin.x, -promise->pdfRect.origin.y);
+    if (!promise->hasSelection)
+	DrawPageBackground(pdfContext, &promise->page);
+    RenderDrawObjSnapshot(pdfContext, promise->objects, promise->numObjects, false);
+    CGContextEndPage(pdfContext);
+    CGContextRelease(pdfContext);   // this writes out the rest of the pdf
+    
+    pdfData = CopyChunkedDataAsCFData(&data);
+    
+CantAllocate:
+    if (pdfData == NULL)
+	fprintf(stderr, "CreatePDFDataForPromisedCopy: can't allocate (%lu bytes so far)\n", (unsigned long)data.length);
+    CGDataConsumerRelease(consumer);
+    ReleaseChunkedData(&data);
+    return pdfData;
+}
+
+//--------------------------------------------------------------------------------------
+// Called by the pasteboard when somebody wants a flavor we promised
+static OSStatus PromiseKeeper(PasteboardRef pasteboard, PasteboardItemID item, CFStringRef flavorType, void* context)
+{
+#pragma unused(context)
+    OSStatus	err;
+    CFDataRef	flavorData;
+    
+    if ((sPromisedCopy == NULL) || (item != (PasteboardItemID)sPromisedCopy))
+	return badPasteboardItemErr;
+    
+    if (CFStringCompare(flavorType, kUTTypePDF, 0) == kCFCompareEqualTo)
+	flavorData = CreatePDFDataForPromisedCopy(sPromisedCopy);
+    else if (sPromisedCopy->hasSelection && (CFStringCompare(flavorType, kCSkObjectsFlavorType, 0) == kCFCompareEqualTo))
+	flavorData = CSkCreateBinaryDocumentDataFromObjects(sPromisedCopy->objects, sPromisedCopy->numObjects);
+    else
+	return badPasteboardFlavorErr;
+    require_action(flavorData != NULL, CantCreateFlavor, err = memFullErr);
+    
+    err = PasteboardPutItemFlavor(pasteboard, item, flavorType, flavorData, kPasteboardFlavorNoFlags);
+    CFRelease(flavorData);
+    
+CantCreateFlavor:
+    return err;
+}
+
+//--------------------------------------------------------------------------------------
+// The objects flavor goes first, as the one we'd rather paste.
+OSStatus CSkPasteboardPromiseCopy(PasteboardRef pasteboard, DocStoragePtr docStP)
+{
+    OSStatus	err;
+    
+    // We need to clear the pasteboard of it's current contents so that this application can
+    // own it and add it's own data.
+    err = PasteboardClear(pasteboard);
+    require_noerr(err, PasteboardClear_FAILED);
+    ReleasePromisedCopy(sPromisedCopy);
+    sPromisedCopy = NULL;
+    
+    if (sPromisePasteboard != pasteboard)
+    {
+	err = PasteboardSetPromiseKeeper(pasteboard, PromiseKeeper, NULL);
+	require_noerr(err, PasteboardSetPromiseKeeper_FAILED);
+	sPromisePasteboard = pasteboard;
+    }
+    
+    sPromisedCopy = CreatePromisedCopy(docStP);
+    require_action(sPromisedCopy != NULL, CreatePromisedCopy_FAILED, err = memFullErr);
+    if (sPromisedCopy->hasSelection)
+    {
+	err = PasteboardPutItemFlavor(pasteboard, (PasteboardItemID)sPromisedCopy, kCSkObjectsFlavorType, kPasteboardPromisedData, kPasteboardFlavorNoFlags);
+	require_noerr(err, PasteboardPutItemFlavor_FAILED);
+    }
+    err = PasteboardPutItemFlavor(pasteboard, (PasteboardItemID)sPromisedCopy, kUTTypePDF, kPasteboardPromisedData, kPasteboardFlavorNoFlags);
+    require_noerr(err, PasteboardPutItemFlavor_FAILED);
+    return noErr;
+    
+PasteboardPutItemFlavor_FAILED:
+    ReleasePromisedCopy(sPromisedCopy);
+    sPromisedCopy = NULL;
+CreatePromisedCopy_FAILED:
+PasteboardSetPromiseKeeper_FAILED:
+PasteboardClear_FAILED:
+    return err;
+}
+
+//--------------------------------------------------------------------------------------
+// Other applications can't ask us for the data once we're gone, so hand it over now.
+void CSkPasteboardResolvePromises(void)
+{
+    if (sPromisedCopy != NULL)
+    {
+	if ((PasteboardSynchronize(sPromisePasteboard) & kPasteboardClientIsOwner) != 0)
+	    PasteboardResolvePromises(sPromisePasteboard);
+	ReleasePromisedCopy(sPromisedCopy);
+	sPromisedCopy = NULL;
+    }
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+// Looks for flavorType in the items on the pasteboard, front to back.
+Boolean CSkPasteboardCopyFlavorData(PasteboardRef pasteboard, CFStringRef flavorType, CFDataRef* outData)
+{
+    ItemCount		itemCount;
+    UInt32		itemIndex;
+    
+    if (pasteboard == NULL)
+	return false;
+    (void)PasteboardSynchronize(pasteboard);
+    if (PasteboardGetItemCount(pasteboard, &itemCount) != noErr)
+	return false;
+    for (itemIndex = 1; itemIndex <= itemCount; ++itemIndex)
+    {
+	PasteboardItemID	itemID;
+	PasteboardFlavorFlags	flags;
+	
+	if (PasteboardGetItemIdentifier(pasteboard, itemIndex, &itemID) != noErr)
+	    continue;
+	if (PasteboardGetItemFlavorFlags(pasteboard, itemID, flavorType, &flags) != noErr)
+	    continue;	    // no such flavor
+	if (outData == NULL)
+	    return true;
+	if (PasteboardCopyItemFlavorData(pasteboard, itemID, flavorType, outData) == noErr)
+	    return true;
+    }
+    return false;
+}
+
+//--------------------------------------------------------------------------------------
+// Objects flavor data of the selected objects of objList, as Copy promises it.
+CFDataRef CSkCreateObjectsFlavorData(const DrawObjList* objList)
+{
+    CFDataRef	    data = NULL;
+    UInt32	    numObjects;
+    CSkObjectPtr*   objects = CreateSelectedDrawObjSnapshot(objList, &numObjects);
+    
+    if (objects != NULL)
+    {
+	data = CSkCreateBinaryDocumentDataFromObjects(objects, numObjects);
+	ReleaseDrawObjSnapshot(objects, numObjects);
+    }
+    return data;
+}
+
+// PDF flavor data of the selected objects, or of the page if none are selected.
+CFDataRef CSkCreatePDFFlavorData(DocStoragePtr docStP)
+{
+    CSkPromisedCopy* promise = CreatePromisedCopy(docStP);
+    CFDataRef	     data = NULL;
+    
+    if (promise != NULL)
+    {
+	data = CreatePDFDataForPromisedCopy(promise);
+	ReleasePromisedCopy(promise);
+    }
+    return data;
+}
+
+//--------------------------------------------------------------------------------------
+// The objects are decoded with the document's style table, then moved in front of the
+// document's objects in one go, selected instead of what was.
+OSStatus CSkPasteObjectsFlavorData(DocStoragePtr docStP, CFDataRef data)
+{
+    DrawObjList	    pasted = { NULL, NULL, NULL };
+    CSkObjectPtr    obj;
+    OSStatus	    err = memFullErr;
+    CSK_TRACE_SPAN("CSkPasteObjectsFlavorData");
+    
+    pasted.styles = CSkObjListGetStyles(&docStP->objList);
+    require(pasted.styles != NULL, CantPaste);
+    err = CSkDecodeBinaryDocument(CFDataGetBytePtr(data), CFDataGetLength(data), &pasted, MPProcessorsScheduled(), NULL);
+    require_noerr(err, CantPaste);
+    
+    for (obj = pasted.firstItem; obj != NULL; obj = CSkObjectGetNext(obj))
+    {
+	CSkObjectSetID(obj, 0);	    // new objects, as far as the file is concerned
+	SetDrawObjSelectState(obj, true);
+    }
+    CSkObjListSetSelectState(&docStP->objList, false);
+    MoveDrawObjListToFront(&docStP->objList, &pasted);
+    
+CantPaste:
+    return err;
+}
@@ -0,0 +1,70 @@
+/*
+    File:       CSkPasteboard.h
+        
+    Contains:	Interface to copying the document page to the pasteboard
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#ifndef __CSKPASTEBOARD__
+#define __CSKPASTEBOARD__
+
+#include <Carbon/Carbon.h>
+#include "CSkDocStorage.h"
+
+// Copy takes a snapshot of the selected objects, or of the whole page (objects and background)
+// if none are selected, and promises its flavors on the pasteboard; a flavor is made only when
+// some application asks for it. The selected objects go on it as kCSkObjectsFlavorType, a
+// binary document of just those objects and their styles (see CSkFileFormat.h), and as PDF.
+// A later Copy replaces the promise. Call CSkPasteboardResolvePromises before quitting.
+
+#define kCSkObjectsFlavorType	CFSTR("com.apple.CarbonSketch.objects")
+
+OSStatus    CSkPasteboardPromiseCopy(PasteboardRef pasteboard, DocStoragePtr docStP);
+void	    CSkPasteboardResolvePromises(void);
+
+// outData may be NULL, to find out whether there is such a flavor.
+Boolean	    CSkPasteboardCopyFlavorData(PasteboardRef pasteboard, CFStringRef flavorType, CFDataRef* outData);
+
+// What Copy puts on the pasteboard, made right away; and Paste of the objects flavor.
+CFDataRef   CSkCreateObjectsFlavorData(const DrawObjList* objList);
+CFDataRef   CSkCreatePDFFlavorData(DocStoragePtr docStP);
+OSStatus    CSkPasteObjectsFlavorData(DocStoragePtr docStP, CFDataRef data);
+
+#endif
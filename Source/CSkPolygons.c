@@ -0,0 +1,831 @@
+/*
+    File:       CSkPolygons.c
+        
+    Contains:	Packed point storage of free polygons, plain or compact
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#include "CSkPolygons.h"
+#include <libkern/OSAtomic.h>
+#if CSK_COMPACT_GEOMETRY
+#include <Accelerate/Accelerate.h>
+#endif
+
+#define kPolygonPointsIncrement	32	/* add room for so many points at a time */
+
+enum {
+    kDecodeChunkSize	= 256,	    // points decoded at a time for drawing and copying out
+    kDeltaBlockSize	= 64,	    // quantized points per anchor; divides kDecodeChunkSize
+    kMaxGridValue	= 8388607   // 2^23 - 1: up to here, grid coordinates are exact in a float
+};
+
+// The points of a free polygon, see the kCSkPolygon verbs in CSkShapes.h.
+// Bounds are kept as extreme points, stored like the points themselves, so that
+// moving a vertex can compare against them exactly.
+// A move only adds to translation, which the points and bounds leave out until the next
+// edit bakes it in (see CSkPolygonOffset); the derived path leaves it out as well, so that it
+// survives moves, and is drawn translated.
+// Copies share the arrays, counted in arrayRefs, until one of them changes a point
+// (see OwnArrays); moving a copy that a snapshot shares costs no more than moving any other.
+// A quantized polygon (only with CSK_COMPACT_GEOMETRY) keeps the first point of each
+// block of kDeltaBlockSize points in anchors, and each point as a step on the grid
+// from the point before in deltas (0 for the anchor itself). A polygon whose
+// points do not fit is widened to float32 points, and stays that way.
+struct CSkPolygon
+{
+    CSkStoredPoint*	points;		// NULL while the polygon is quantized
+#if CSK_COMPACT_GEOMETRY
+    CSkStoredPoint*	anchors;	// quantized: one per block, on the grid
+    SInt16*		deltas;		// quantized: x, y for each point, in grid steps
+#endif
+    UInt8*		verbs;		// one per point
+    UInt32		count;
+    UInt32		capacity;
+    CSkStoredPoint	minPt;		// of all points, kept up to date
+    CSkStoredPoint	maxPt;
+    CGPoint		translation;	// moved by this much since the points were last changed
+    int32_t*		arrayRefs;	// polygons sharing the arrays, this one included
+    CGMutablePathRef	path;		// built from the points on demand, NULL after a change
+};
+
+#if CSK_COMPACT_GEOMETRY
+#define IsQuantized(poly)	((poly)->points == NULL)
+#else
+#define IsQuantized(poly)	false
+#endif
+
+//--------------------------------------------------------
+static CGPoint LoadPoint(CSkStoredPoint p)
+{
+    return CGPointMake(p.x, p.y);
+}
+
+static CSkStoredPoint StorePoint(CGPoint pt)
+{
+    CSkStoredPoint p;
+    p.x = pt.x;
+    p.y = pt.y;
+    return p;
+}
+
+//--------------------------------------------------------
+static void ExtendBounds(CSkPolygon* poly, CSkStoredPoint p)
+{
+    if (p.x < poly->minPt.x)	poly->minPt.x = p.x;
+    if (p.x > poly->maxPt.x)	poly->maxPt.x = p.x;
+    if (p.y < poly->minPt.y)	poly->minPt.y = p.y;
+    if (p.y > poly->maxPt.y)	poly->maxPt.y = p.y;
+}
+
+//--------------------------------------------------------
+// The derived path is dropped whenever a point changes.
+static void InvalidatePath(CSkPolygon* poly)
+{
+    if (poly->path != NULL)
+    {
+	CGPathRelease(poly->path);
+	poly->path = NULL;
+    }
+}
+
+
+#pragma mark -
+#if CSK_COMPACT_GEOMETRY
+//--------------------------------------------------------
+// Float32 to CGFloat, for decoded x, y pairs
+static void ConvertFloats(const float* xy, CGPoint* outPoints, UInt32 count)
+{
+#if CGFLOAT_IS_DOUBLE
+    vDSP_vspdp((float*)xy, 1, (double*)outPoints, 1, 2 * count);
+#else
+    memcpy(outPoints, xy, count * sizeof(CGPoint));
+#endif
+}
+
+//--------------------------------------------------------
+// False if v is too far out to be represented exactly on the grid.
+static Boolean ToGrid(float v, SInt32* outGrid)
+{
+    float g = roundf(v / kCSkPolygonQuantum);
+    if (!(fabsf(g) <= kMaxGridValue))	// also catches NaN
+	return false;
+    *outGrid = (SInt32)g;
+    return true;
+}
+
+static float FromGrid(SInt32 g)
+{
+    return g * kCSkPolygonQuantum;	    // exact: kCSkPolygonQuantum is a power of 2
+}
+
+//--------------------------------------------------------
+// O(kDeltaBlockSize): sums the steps from the block's anchor.
+static CSkStoredPoint GetQuantizedPoint(const CSkPolygon* poly, UInt32 index)
+{
+    UInt32		first = index - index % kDeltaBlockSize;
+    CSkStoredPoint	anchor = poly->anchors[first / kDeltaBlockSize];
+    SInt32		sx = 0, sy = 0;
+    UInt32		i;
+    CSkStoredPoint	p;
+    
+    for (i = first + 1; i <= index; ++i)
+    {
+	sx += poly->deltas[2 * i];
+	sy += poly->deltas[2 * i + 1];
+    }
+    p.x = anchor.x + FromGrid(sx);
+    p.y = anchor.y + FromGrid(sy);
+    return p;
+}
+
+//--------------------------------------------------------
+// Per block: steps to float, running sum scaled to the grid, plus the anchor. All of this is exact,
+// so that the result is the same as GetQuantizedPoint's.
+static void DecodeQuantizedPoints(const CSkPolygon* poly, UInt32 first, UInt32 count, CGPoint* outPoints)
+{
+    const float	quantum = kCSkPolygonQuantum;
+    UInt32	end = first + count;
+    UInt32	block = first - first % kDeltaBlockSize;
+    float	steps[kDeltaBlockSize], sums[kDeltaBlockSize], xy[2 * kDeltaBlockSize];
+    
+    for ( ; block < end; block += kDeltaBlockSize)
+    {
+	const CSkStoredPoint*	anchor = poly->anchors + block / kDeltaBlockSize;
+	const SInt16*		deltas = poly->deltas + 2 * block;
+	UInt32			from = (first > block) ? first : block;
+	UInt32			n = ((end < block + kDeltaBlockSize) ? end : block + kDeltaBlockSize) - block;
+	
+	vDSP_vflt16((short*)deltas, 2, steps, 1, n);
+	vDSP_vrsum(steps, 1, (float*)&quantum, sums, 1, n);
+	vDSP_vsadd(sums, 1, (float*)&anchor->x, xy, 2, n);
+	vDSP_vflt16((short*)deltas + 1, 2, steps, 1, n);
+	vDSP_vrsum(steps, 1, (float*)&quantum, sums, 1, n);
+	vDSP_vsadd(sums, 1, (float*)&anchor->y, xy + 1, 2, n);
+	ConvertFloats(xy + 2 * (from - block), outPoints + (from - first), block + n - from);
+    }
+}
+
+//--------------------------------------------------------
+// Gives up the grid: from here on, the polygon keeps float32 points.
+static Boolean WidenPolygon(CSkPolygon* poly)
+{
+    CSkStoredPoint* points = (CSkStoredPoint*)malloc((poly->capacity > 0 ? poly->capacity : 1) * sizeof(CSkStoredPoint));
+    CGPoint	    chunk[kDecodeChunkSize];
+    UInt32	    i, k, n;
+    
+    if (points == NULL)
+	return false;
+    for (i = 0; i < poly->count; i += n)
+    {
+	n = (poly->count - i < kDecodeChunkSize) ? poly->count - i : kDecodeChunkSize;
+	DecodeQuantizedPoints(poly, i, n, chunk);
+	for (k = 0; k < n; ++k)
+	    points[i + k] = StorePoint(chunk[k]);
+    }
+    free(poly->anchors);
+    free(poly->deltas);
+    poly->anchors = NULL;
+    poly->deltas = NULL;
+    poly->points = points;
+    return true;
+}
+
+//--------------------------------------------------------
+// False if the point does not fit on the grid; the polygon must be widened then.
+static Boolean AppendQuantizedPoint(CSkPolygon* poly, CGPoint pt, CSkStoredPoint* outStored)
+{
+    UInt32  index = poly->count;
+    SInt32  gx, gy, stepX, stepY;
+    
+    if (!ToGrid(pt.x, &gx) || !ToGrid(pt.y, &gy))
+	return false;
+    if (index % kDeltaBlockSize == 0)
+    {
+	stepX = stepY = 0;
+	poly->anchors[index / kDeltaBlockSize].x = FromGrid(gx);
+	poly->anchors[index / kDeltaBlockSize].y = FromGrid(gy);
+    }
+    else
+    {
+	CSkStoredPoint prev = GetQuantizedPoint(poly, index - 1);
+	stepX = gx - (SInt32)(prev.x / kCSkPolygonQuantum);
+	stepY = gy - (SInt32)(prev.y / kCSkPolygonQuantum);
+	if ((stepX < -32767) || (stepX > 32767) || (stepY < -32767) || (stepY > 32767))
+	    return false;
+    }
+    poly->deltas[2 * index] = stepX;
+    poly->deltas[2 * index + 1] = stepY;
+    outStored->x = FromGrid(gx);
+    outStored->y = FromGrid(gy);
+    return true;
+}
+
+//--------------------------------------------------------
+// Changes the steps to point index and to the one after it; the other points stay where they are.
+static Boolean MoveQuantizedPoint(CSkPolygon* poly, UInt32 index, CGPoint pt, CSkStoredPoint* outStored)
+{
+    CSkStoredPoint  old = GetQuantizedPoint(poly, index);
+    Boolean	    hasNext = (index + 1 < poly->count) && ((index + 1) % kDeltaBlockSize != 0);
+    SInt32	    gx, gy, dx, dy, stepX, stepY, nextX = 0, nextY = 0;
+    
+    if (!ToGrid(pt.x, &gx) || !ToGrid(pt.y, &gy))
+	return false;
+    dx = gx - (SInt32)(old.x / kCSkPolygonQuantum);
+    dy = gy - (SInt32)(old.y / kCSkPolygonQuantum);
+    stepX = poly->deltas[2 * index] + dx;
+    stepY = poly->deltas[2 * index + 1] + dy;
+    if (index % kDeltaBlockSize == 0)
+	stepX = stepY = 0;
+    if (hasNext)
+    {
+	nextX = poly->deltas[2 * index + 2] - dx;
+	nextY = poly->deltas[2 * index + 3] - dy;
+    }
+    if (   (stepX < -32767) || (stepX > 32767) || (stepY < -32767) || (stepY > 32767)
+	|| (nextX < -32767) || (nextX > 32767) || (nextY < -32767) || (nextY > 32767))
+	return false;
+	
+    if (index % kDeltaBlockSize == 0)
+    {
+	poly->anchors[index / kDeltaBlockSize].x = FromGrid(gx);
+	poly->anchors[index / kDeltaBlockSize].y = FromGrid(gy);
+    }
+    poly->deltas[2 * index] = stepX;
+    poly->deltas[2 * index + 1] = stepY;
+    if (hasNext)
+    {
+	poly->deltas[2 * index + 2] = nextX;
+	poly->deltas[2 * index + 3] = nextY;
+    }
+    outStored->x = FromGrid(gx);
+    outStored->y = FromGrid(gy);
+    return true;
+}
+
+//--------------------------------------------------------
+// Moves the anchors by whole grid steps; false if the polygon would leave the grid.
+static Boolean OffsetQuantizedPolygon(CSkPolygon* poly, CGFloat dx, CGFloat dy)
+{
+    SInt32  gx, gy, minX, minY, maxX, maxY;
+    UInt32  b;
+    
+    if (!ToGrid(dx, &gx) || !ToGrid(dy, &gy))
+	return false;
+    if (   !ToGrid(poly->minPt.x + FromGrid(gx), &minX) || !ToGrid(poly->maxPt.x + FromGrid(gx), &maxX)
+	|| !ToGrid(poly->minPt.y + FromGrid(gy), &minY) || !ToGrid(poly->maxPt.y + FromGrid(gy), &maxY))
+	return false;
+    for (b = 0; b * kDeltaBlockSize < poly->count; ++b)
+    {
+	poly->anchors[b].x += FromGrid(gx);
+	poly->anchors[b].y += FromGrid(gy);
+    }
+    poly->minPt.x = FromGrid(minX);
+    poly->minPt.y = FromGrid(minY);
+    poly->maxPt.x = FromGrid(maxX);
+    poly->maxPt.y = FromGrid(maxY);
+    return true;
+}
+#endif	// CSK_COMPACT_GEOMETRY
+
+
+#pragma mark -
+//--------------------------------------------------------
+CSkPolygonPtr CSkPolygonCreate(void)
+{
+    CSkPolygon* poly = (CSkPolygon*)calloc(1, sizeof(CSkPolygon));
+    
+    if (poly != NULL)
+    {
+	poly->arrayRefs = (int32_t*)malloc(sizeof(int32_t));
+	if (poly->arrayRefs == NULL)
+	{
+	    free(poly);
+	    return NULL;
+	}
+	*poly->arrayRefs = 1;
+    }
+    return poly;
+}
+
+//--------------------------------------------------------
+static void FreeArrays(CSkPolygon* poly)
+{
+    free(poly->points);
+#if CSK_COMPACT_GEOMETRY
+    free(poly->anchors);
+    free(poly->deltas);
+#endif
+    free(poly->verbs);
+}
+
+//--------------------------------------------------------
+void CSkPolygonRelease(CSkPolygonPtr poly)
+{
+    if (poly != NULL)
+    {
+	InvalidatePath(poly);
+	if (OSAtomicDecrement32(poly->arrayRefs) == 0)
+	{
+	    FreeArrays(poly);
+	    free(poly->arrayRefs);
+	}
+	free(poly);
+    }
+}
+
+//--------------------------------------------------------
+// The arrays and a derived path are only read until one of the polygons sharing them changes
+// a point, so the copy shares both: it costs the same whatever the number of points.
+CSkPolygonPtr CSkPolygonCreateCopy(const CSkPolygon* poly)
+{
+    CSkPolygon* newPoly = (CSkPolygon*)malloc(sizeof(CSkPolygon));
+    
+    if (newPoly == NULL)
+    {
+	fprintf(stderr, "CSkPolygonCreateCopy: can't allocate a polygon\n");
+	return NULL;
+    }
+    *newPoly = *poly;
+    OSAtomicIncrement32(newPoly->arrayRefs);
+    if (newPoly->path != NULL)
+	CGPathRetain(newPoly->path);
+    return newPoly;
+}
+
+//--------------------------------------------------------
+// Before a point changes: if other polygons share the arrays, give poly its own copies of them.
+// The others go on reading theirs, possibly on another thread, so the shared arrays are left alone.
+static Boolean OwnArrays(CSkPolygon* poly)
+{
+    CSkPolygon	copy = *poly;
+    UInt32	count = poly->count;
+    
+    if (*poly->arrayRefs == 1)
+	return true;
+    copy.capacity = count;
+    copy.points = NULL;
+#if CSK_COMPACT_GEOMETRY
+    copy.anchors = NULL;
+    copy.deltas = NULL;
+#endif
+    copy.verbs = NULL;
+    copy.arrayRefs = (int32_t*)malloc(sizeof(int32_t));
+    require(copy.arrayRefs != NULL, CantAllocate);
+    if (count > 0)
+    {
+	copy.verbs = (UInt8*)malloc(count);
+	require(copy.verbs != NULL, CantAllocate);
+	memcpy(copy.verbs, poly->verbs, count);
+    }
+#if CSK_COMPACT_GEOMETRY
+    if (IsQuantized(poly))
+    {
+	UInt32 numBlocks = (count + kDeltaBlockSize - 1) / kDeltaBlockSize;
+	if (count > 0)
+	{
+	    copy.anchors = (CSkStoredPoint*)malloc(numBlocks * sizeof(CSkStoredPoint));
+	    copy.deltas = (SInt16*)malloc(2 * count * sizeof(SInt16));
+	    require((copy.anchors != NULL) && (copy.deltas != NULL), CantAllocate);
+	    memcpy(copy.anchors, poly->anchors, numBlocks * sizeof(CSkStoredPoint));
+	    memcpy(copy.deltas, poly->deltas, 2 * count * sizeof(SInt16));
+	}
+    }
+    else
+#endif
+    {
+	copy.points = (CSkStoredPoint*)malloc((count > 0 ? count : 1) * sizeof(CSkStoredPoint));
+	require(copy.points != NULL, CantAllocate);
+	memcpy(copy.points, poly->points, count * sizeof(CSkStoredPoint));
+    }
+    *copy.arrayRefs = 1;
+    if (OSAtomicDecrement32(poly->arrayRefs) == 0)
+    {
+	// the others let go in the meantime
+	FreeArrays(poly);
+	free(poly->arrayRefs);
+    }
+    *poly = copy;
+    return true;
+    
+CantAllocate:
+    fprintf(stderr, "OwnArrays: can't allocate %lu points\n", (unsigned long)count);
+    FreeArrays(&copy);
+    free(copy.arrayRefs);
+    return false;
+}
+
+//--------------------------------------------------------
+// What the polygon takes up in memory, not counting a derived path
+ByteCount CSkPolygonGetStorageSize(const CSkPolygon* poly)
+{
+    ByteCount size = sizeof(CSkPolygon) + poly->capacity;    // verbs
+    
+#if CSK_COMPACT_GEOMETRY
+    if (IsQuantized(poly))
+	return size + poly->capacity * 2 * sizeof(SInt16) 
+		    + (poly->capacity + kDeltaBlockSize - 1) / kDeltaBlockSize * sizeof(CSkStoredPoint);
+#endif
+    return size + poly->capacity * sizeof(CSkStoredPoint);
+}
+
+//--------------------------------------------------------
+UInt32 CSkPolygonGetCount(const CSkPolygon* poly)
+{
+    return poly->count;
+}
+
+//--------------------------------------------------------
+CGRect CSkPolygonGetBounds(const CSkPolygon* poly)
+{
+    if (poly->count == 0)
+	return CGRectNull;
+    return CGRectMake(poly->minPt.x + poly->translation.x, poly->minPt.y + poly->translation.y, 
+			poly->maxPt.x - poly->minPt.x, poly->maxPt.y - poly->minPt.y);
+}
+
+//--------------------------------------------------------
+CGPoint CSkPolygonGetPoint(const CSkPolygon* poly, UInt32 index)
+{
+    CGPoint pt;
+    
+#if CSK_COMPACT_GEOMETRY
+    if (IsQuantized(poly))
+	pt = LoadPoint(GetQuantizedPoint(poly, index));
+    else
+#endif
+	pt = LoadPoint(poly->points[index]);
+    return CGPointMake(pt.x + poly->translation.x, pt.y + poly->translation.y);
+}
+
+//--------------------------------------------------------
+// The stored points, without the translation
+static void DecodePoints(const CSkPolygon* poly, UInt32 first, UInt32 count, CGPoint* outPoints, UInt8* outVerbs)
+{
+    if (outVerbs != NULL)
+	memcpy(outVerbs, poly->verbs + first, count);
+    if (outPoints == NULL)
+	return;
+#if CSK_COMPACT_GEOMETRY
+    if (IsQuantized(poly))
+	DecodeQuantizedPoints(poly, first, count, outPoints);
+    else
+	ConvertFloats((const float*)(poly->points + first), outPoints, count);
+#else
+    memcpy(outPoints, poly->points + first, count * sizeof(CGPoint));
+#endif
+}
+
+//--------------------------------------------------------
+// Copies out count points from first on; outPoints or outVerbs may be NULL.
+void CSkPolygonGetPoints(const CSkPolygon* poly, UInt32 first, UInt32 count, CGPoint* outPoints, UInt8* outVerbs)
+{
+    UInt32 i;
+    
+    if ((first > poly->count) || (count > poly->count - first))
+	return;
+    DecodePoints(poly, first, count, outPoints, outVerbs);
+    if ((outPoints != NULL) && ((poly->translation.x != 0) || (poly->translation.y != 0)))
+    {
+	for (i = 0; i < count; ++i)
+	{
+	    outPoints[i].x += poly->translation.x;
+	    outPoints[i].y += poly->translation.y;
+	}
+    }
+}
+
+
+#pragma mark -
+//--------------------------------------------------------
+// Moves the points by the translation, before they are changed: O(number of points),
+// or of anchors for a quantized polygon. The derived path has to be built again.
+// False if a quantized polygon had to be widened and couldn't be; it keeps its translation.
+static Boolean BakeTranslation(CSkPolygon* poly)
+{
+    CGFloat dx = poly->translation.x;
+    CGFloat dy = poly->translation.y;
+    UInt32  i;
+    
+    if ((dx == 0) && (dy == 0))
+	return true;
+#if CSK_COMPACT_GEOMETRY
+    if (IsQuantized(poly) && !OffsetQuantizedPolygon(poly, dx, dy) && !WidenPolygon(poly))
+	return false;
+    if (!IsQuantized(poly))
+#endif
+    {
+	for (i = 0; i < poly->count; ++i)
+	{
+	    poly->points[i].x += dx;
+	    poly->points[i].y += dy;
+	}
+	poly->minPt.x += dx;
+	poly->minPt.y += dy;
+	poly->maxPt.x += dx;
+	poly->maxPt.y += dy;
+    }
+    poly->translation = CGPointZero;
+    InvalidatePath(poly);
+    return true;
+}
+
+//--------------------------------------------------------------------
+// Grows the arrays geometrically, so that numPoints more fit.
+static Boolean GrowPolygon(CSkPolygon* poly, UInt32 numPoints)
+{
+    UInt32  capacity;
+    UInt8*  verbs;
+    
+    if (poly->count + numPoints <= poly->capacity)
+	return true;
+    capacity = 2 * poly->capacity + kPolygonPointsIncrement;
+    if (capacity < poly->count + numPoints)
+	capacity = poly->count + numPoints;
+	
+#if CSK_COMPACT_GEOMETRY
+    if (IsQuantized(poly))
+    {
+	UInt32		numBlocks = (capacity + kDeltaBlockSize - 1) / kDeltaBlockSize;
+	SInt16*		deltas = (SInt16*)realloc(poly->deltas, 2 * capacity * sizeof(SInt16));
+	CSkStoredPoint*	anchors;
+	
+	if (deltas == NULL)
+	    return false;
+	poly->deltas = deltas;
+	anchors = (CSkStoredPoint*)realloc(poly->anchors, numBlocks * sizeof(CSkStoredPoint));
+	if (anchors == NULL)
+	    return false;
+	poly->anchors = anchors;
+    }
+    else
+#endif
+    {
+	CSkStoredPoint* points = (CSkStoredPoint*)realloc(poly->points, capacity * sizeof(CSkStoredPoint));
+	if (points == NULL)
+	    return false;
+	poly->points = points;
+    }
+    verbs = (UInt8*)realloc(poly->verbs, capacity);
+    if (verbs == NULL)
+	return false;
+    poly->verbs = verbs;
+    poly->capacity = capacity;
+    return true;
+}
+
+//--------------------------------------------------------------------
+Boolean CSkPolygonAppend(CSkPolygonPtr poly, const CGPoint* pts, const UInt8* verbs, UInt32 numPoints)
+{
+    UInt32 i;
+    
+    if (!OwnArrays(poly) || !BakeTranslation(poly) || !GrowPolygon(poly, numPoints))
+	return false;
+    
+    for (i = 0; i < numPoints; ++i)
+    {
+	CSkStoredPoint p;
+#if CSK_COMPACT_GEOMETRY
+	if (!IsQuantized(poly) || !AppendQuantizedPoint(poly, pts[i], &p))
+	{
+	    if (IsQuantized(poly) && !WidenPolygon(poly))
+		return false;
+	    p = StorePoint(pts[i]);
+	    poly->points[poly->count] = p;
+	}
+#else
+	p = StorePoint(pts[i]);
+	poly->points[poly->count] = p;
+#endif
+	if (poly->count == 0)
+	    poly->minPt = poly->maxPt = p;
+	poly->verbs[poly->count] = verbs[i];
+	poly->count += 1;
+	ExtendBounds(poly, p);
+    }
+    InvalidatePath(poly);
+    return true;
+}
+
+//--------------------------------------------------------------------
+void CSkPolygonCloseSubpath(CSkPolygonPtr poly)
+{
+    if ((poly->count > 0) && OwnArrays(poly))
+    {
+	poly->verbs[poly->count - 1] |= kCSkPolygonClose;
+	InvalidatePath(poly);
+    }
+}
+
+//--------------------------------------------------------
+// Recomputes the bounds from all points
+static void RescanBounds(CSkPolygon* poly)
+{
+    CGPoint chunk[kDecodeChunkSize];
+    UInt32  i, k, n;
+    
+    for (i = 0; i < poly->count; i += n)
+    {
+	n = (poly->count - i < kDecodeChunkSize) ? poly->count - i : kDecodeChunkSize;
+	DecodePoints(poly, i, n, chunk, NULL);
+	if (i == 0)
+	    poly->minPt = poly->maxPt = StorePoint(chunk[0]);
+	for (k = 0; k < n; ++k)
+	    ExtendBounds(poly, StorePoint(chunk[k]));
+    }
+}
+
+//--------------------------------------------------------
+// Dragging a vertex costs O(1), unless it is an extreme point moving inwards:
+// only then do the bounds have to be recomputed from all points.
+void CSkPolygonMovePoint(CSkPolygonPtr poly, UInt32 index, CGPoint pt)
+{
+    CSkStoredPoint old, p;
+    
+    if ((index >= poly->count) || !OwnArrays(poly) || !BakeTranslation(poly))
+	return;
+#if CSK_COMPACT_GEOMETRY
+    if (IsQuantized(poly))
+    {
+	old = GetQuantizedPoint(poly, index);
+	if (!MoveQuantizedPoint(poly, index, pt, &p))
+	{
+	    if (!WidenPolygon(poly))
+		return;
+	    p = StorePoint(pt);
+	    poly->points[index] = p;
+	}
+    }
+    else
+#endif
+    {
+	old = poly->points[index];
+	p = StorePoint(pt);
+	poly->points[index] = p;
+    }
+    
+    if (   ((old.x == poly->minPt.x) && (p.x > old.x)) || ((old.x == poly->maxPt.x) && (p.x < old.x))
+	|| ((old.y == poly->minPt.y) && (p.y > old.y)) || ((old.y == poly->maxPt.y) && (p.y < old.y)))
+	RescanBounds(poly);
+    else
+	ExtendBounds(poly, p);
+    InvalidatePath(poly);
+}
+
+//--------------------------------------------------------
+// O(1), even with the arrays shared: the translation goes into the points when they are next
+// changed (see BakeTranslation), which is also when a copy gets arrays of its own.
+// A quantized polygon moves in whole grid steps, as it would if its anchors were moved.
+void CSkPolygonOffset(CSkPolygonPtr poly, float dx, float dy)
+{
+#if CSK_COMPACT_GEOMETRY
+    SInt32 gx, gy;
+    
+    if (IsQuantized(poly) && ToGrid(dx, &gx) && ToGrid(dy, &gy))
+    {
+	dx = FromGrid(gx);
+	dy = FromGrid(gy);
+    }
+#endif
+    poly->translation.x += dx;
+    poly->translation.y += dy;
+}
+
+
+#pragma mark -
+//------------------------------------------------------------------------------
+// Walks the path elements of the polygon, decoding kDecodeChunkSize points at a time;
+// a chunk ends before an element that would not fit into it completely.
+typedef void (*PolygonElementProc)(void* target, int verb, const CGPoint* pts, Boolean close);
+
+static void ApplyPolygon(const CSkPolygon* poly, void* target, PolygonElementProc proc)
+{
+    CGPoint chunk[kDecodeChunkSize];
+    UInt8   verbs[kDecodeChunkSize];
+    UInt32  first, n, i;
+    
+    for (first = 0; first < poly->count; first += i)
+    {
+	n = (poly->count - first < kDecodeChunkSize) ? poly->count - first : kDecodeChunkSize;
+	DecodePoints(poly, first, n, chunk, verbs);
+	for (i = 0; i < n; )
+	{
+	    int	    verb = verbs[i] & kCSkPolygonVerbMask;
+	    UInt32  numPoints = (verb == kCSkPolygonQuadTo) ? 2 : (verb == kCSkPolygonCurveTo) ? 3 : 1;
+	    
+	    if ((i + numPoints > n) && (first + n < poly->count))
+		break;				// continues in the next chunk
+	    if (i + numPoints > n)
+		numPoints = n - i;		// can't happen: CSkShapeAddPolygonElement adds whole elements
+	    if (verb != kCSkPolygonContinuation)
+		(*proc)(target, verb, chunk + i, (verbs[i + numPoints - 1] & kCSkPolygonClose) != 0);
+	    i += numPoints;
+	}
+    }
+}
+
+//------------------------------------------------------------------------------
+static void AddElementToPath(void* target, int verb, const CGPoint* pts, Boolean close)
+{
+    CGMutablePathRef path = (CGMutablePathRef)target;
+    
+    switch (verb)
+    {
+	case kCSkPolygonMoveTo:	    CGPathMoveToPoint(path, NULL, pts[0].x, pts[0].y);					    break;
+	case kCSkPolygonLineTo:	    CGPathAddLineToPoint(path, NULL, pts[0].x, pts[0].y);				    break;
+	case kCSkPolygonQuadTo:	    CGPathAddQuadCurveToPoint(path, NULL, pts[0].x, pts[0].y, pts[1].x, pts[1].y);	    break;
+	case kCSkPolygonCurveTo:    
+	    CGPathAddCurveToPoint(path, NULL, pts[0].x, pts[0].y, pts[1].x, pts[1].y, pts[2].x, pts[2].y);		    break;
+    }
+    if (close)
+	CGPathCloseSubpath(path);
+}
+
+//------------------------------------------------------------------------------
+// The path belongs to poly, and is only valid until poly is changed. It leaves out the
+// translation of a polygon that has been moved since; CSkPolygonAddToContext applies it.
+CGPathRef CSkPolygonGetPath(const CSkPolygon* poly)
+{
+    if (poly->path == NULL)
+    {
+	CGMutablePathRef path = CGPathCreateMutable();
+	ApplyPolygon(poly, path, AddElementToPath);
+	((CSkPolygon*)poly)->path = path;
+    }
+    return poly->path;
+}
+
+#if CSK_COMPACT_GEOMETRY
+//------------------------------------------------------------------------------
+static void AddElementToContext(void* target, int verb, const CGPoint* pts, Boolean close)
+{
+    CGContextRef ctx = (CGContextRef)target;
+    
+    switch (verb)
+    {
+	case kCSkPolygonMoveTo:	    CGContextMoveToPoint(ctx, pts[0].x, pts[0].y);					    break;
+	case kCSkPolygonLineTo:	    CGContextAddLineToPoint(ctx, pts[0].x, pts[0].y);					    break;
+	case kCSkPolygonQuadTo:	    CGContextAddQuadCurveToPoint(ctx, pts[0].x, pts[0].y, pts[1].x, pts[1].y);		    break;
+	case kCSkPolygonCurveTo:    
+	    CGContextAddCurveToPoint(ctx, pts[0].x, pts[0].y, pts[1].x, pts[1].y, pts[2].x, pts[2].y);		    break;
+    }
+    if (close)
+	CGContextClosePath(ctx);
+}
+#endif
+
+//------------------------------------------------------------------------------
+// For drawing and hit-testing. Compact polygons are decoded straight into the context, so that
+// they don't keep a path of CGFloats around; the others add their (cached) path. Either is
+// added under a CTM translated by the polygon's translation: the context keeps the path in
+// device space, so the CTM can be put back right after.
+void CSkPolygonAddToContext(const CSkPolygon* poly, CGContextRef ctx)
+{
+    Boolean translated = (poly->translation.x != 0) || (poly->translation.y != 0);
+    
+    if (translated)
+	CGContextTranslateCTM(ctx, poly->translation.x, poly->translation.y);
+#if CSK_COMPACT_GEOMETRY
+    ApplyPolygon(poly, ctx, AddElementToContext);
+#else
+    CGContextAddPath(ctx, CSkPolygonGetPath(poly));
+#endif
+    if (translated)
+	CGContextTranslateCTM(ctx, -poly->translation.x, -poly->translation.y);
+}
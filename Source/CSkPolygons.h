@@ -0,0 +1,87 @@
+/*
+    File:       CSkPolygons.h
+        
+    Contains:	Interface to the point storage of free polygons
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#ifndef __CSKPOLYGONS__
+#define __CSKPOLYGONS__
+
+#include <Carbon/Carbon.h>
+#include "CSkShapes.h"	// CSK_COMPACT_GEOMETRY, kCSkPolygon verbs
+
+// The point storage of free polygons, for CSkShapes.c. Points are kept in one packed
+// array with a verb for each point; with CSK_COMPACT_GEOMETRY, as 16-bit steps on a grid
+// of kCSkPolygonQuantum (see CSkShapes.h). Everything that reads points gets them decoded
+// to CGPoints; everything that changes a point does it in place. A move is only recorded,
+// and applied to the points with the next change (see CSkPolygonOffset).
+
+typedef struct CSkPolygon CSkPolygon, *CSkPolygonPtr;  // struct CSkPolygon defined in CSkPolygons.c
+
+// How the other shapes store their coordinates
+#if CSK_COMPACT_GEOMETRY
+typedef struct { float x; float y; }			    CSkStoredPoint;
+typedef struct { float width; float height; }		    CSkStoredSize;
+typedef struct { CSkStoredPoint origin; CSkStoredSize size; } CSkStoredRect;
+#else
+typedef CGPoint	    CSkStoredPoint;
+typedef CGRect	    CSkStoredRect;
+#endif
+
+CSkPolygonPtr	CSkPolygonCreate(void);
+CSkPolygonPtr	CSkPolygonCreateCopy(const CSkPolygon* poly);
+void		CSkPolygonRelease(CSkPolygonPtr poly);
+ByteCount	CSkPolygonGetStorageSize(const CSkPolygon* poly);
+
+UInt32		CSkPolygonGetCount(const CSkPolygon* poly);
+CGRect		CSkPolygonGetBounds(const CSkPolygon* poly);
+CGPoint		CSkPolygonGetPoint(const CSkPolygon* poly, UInt32 index);
+void		CSkPolygonGetPoints(const CSkPolygon* poly, UInt32 first, UInt32 count, CGPoint* outPoints, UInt8* outVerbs);
+
+Boolean		CSkPolygonAppend(CSkPolygonPtr poly, const CGPoint* pts, const UInt8* verbs, UInt32 numPoints);
+void		CSkPolygonCloseSubpath(CSkPolygonPtr poly);
+void		CSkPolygonMovePoint(CSkPolygonPtr poly, UInt32 index, CGPoint pt);
+void		CSkPolygonOffset(CSkPolygonPtr poly, float dx, float dy);
+
+CGPathRef	CSkPolygonGetPath(const CSkPolygon* poly);
+void		CSkPolygonAddToContext(const CSkPolygon* poly, CGContextRef ctx);
+
+#endif
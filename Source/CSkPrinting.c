@@ -47,23 +47,10 @@
 #include "CSkWindow.h"
 // also includes "CSkDocStorage.h"
 // also includes "CSkObjects.h"
+#include "CSkTrace.h"
 
 #include "NavServicesHandling.h"
 
-//-----------------------------------------------------------------------------------------------------------------------
-static OSStatus MyCreatePageFormat(PMPrintSession printSession, PMPageFormat *pageFormat)
-{
-    OSStatus status = PMCreatePageFormat(pageFormat);
-	
-    //  Note that PMPageFormat is not session-specific, but calling
-    //  PMSessionDefaultPageFormat assigns values specific to the printer
-    //  associated with the current printing session.
-    if ((status == noErr) && (*pageFormat != kPMNoPageFormat))
-	status = PMSessionDefaultPageFormat(printSession, *pageFormat);
-	
-    return status;
-}
-
 //-----------------------------------------------------------------------------------------------------------------------
 // (Borrowed from /Developer/Examples/Printing/App/)
 static OSStatus DoPageSetupDialog(PMPrintSession printSession, PMPageFormat* pageFormat, CFDataRef* flattenedPageFormat)
@@ -72,7 +59,7 @@ static OSStatus DoPageSetupDialog(PMPrintSession printSession, PMPageFormat* pag
     
     if (*pageFormat == kPMNoPageFormat)    // Set up a valid PageFormat object
     {
-	MyCreatePageFormat(printSession, pageFormat);
+	CSkCreateDefaultPageFormat(printSession, pageFormat);
     }
     else
     {
@@ -97,13 +84,13 @@ static OSStatus DoPageSetupDialog(PMPrintSession printSession, PMPageFormat* pag
 } // DoPageSetupDialog
 
 //-----------------------------------------------------------------------------------------------------------------------
-static OSStatus	DetermineNumberOfPagesInDoc(PMPageFormat pageFormat, UInt32* numPages)
+static OSStatus	DetermineNumberOfPagesInDoc(DocStoragePtr docStP, UInt32* numPages)
 {
-    PMRect	pageRect;
-    OSStatus	status  = PMGetAdjustedPageRect(pageFormat, &pageRect);
+    CSkPageTiling   tiling;
+    OSStatus	    status = CSkGetPageTiling(docStP, &tiling);
     check(status == noErr);
 
-    *numPages = 1;  // will do better some time in the future ...
+    *numPages = (status == noErr) ? CSkPageTilingGetCount(&tiling) : 1;
 
     return status;
     
@@ -114,6 +101,8 @@ static OSStatus DoPrintLoop(DocStoragePtr docStP, PMPrintSession printSession, P
 {
     OSStatus        status = noErr, tempErr;
     CGContextRef    printingCtx;
+    CSkPageTiling   tiling;
+    CSkPageDrawerPtr drawer = NULL;
     UInt32          realNumberOfPagesinDoc,
                     pageNumber,
                     firstPage,
@@ -136,7 +125,8 @@ static OSStatus DoPrintLoop(DocStoragePtr docStP, PMPrintSession printSession, P
     //	Check that the selected page range does not exceed the actual number of pages in the document.
     if (status == noErr)
     {
-        status = DetermineNumberOfPagesInDoc(pageFormat, &realNumberOfPagesinDoc);
+        status = CSkGetPageTiling(docStP, &tiling);
+        realNumberOfPagesinDoc = (status == noErr) ? CSkPageTilingGetCount(&tiling) : 1;
         if (realNumberOfPagesinDoc < lastPage)
             lastPage = realNumberOfPagesinDoc;
     }
@@ -153,6 +143,14 @@ static OSStatus DoPrintLoop(DocStoragePtr docStP, PMPrintSession printSession, P
     //	manager handles this.  So we just iterate through the document from the
     //	first page to be printed, to the last.
     
+    // Only the objects on the pages to print are looked at, once for each page they are on.
+    if (status == noErr)
+    {
+        drawer = CSkPageDrawerCreate(docStP, &tiling, firstPage, lastPage, kCSkPageDrawAll);
+        if (drawer == NULL)
+            status = memFullErr;
+    }
+    
     if (status == noErr)
     {
 		// Now, tell the printing system that we promise never to use any Quickdraw calls:
@@ -175,7 +173,7 @@ static OSStatus DoPrintLoop(DocStoragePtr docStP, PMPrintSession printSession, P
                     check(status == noErr);
                     if (status == noErr) 
                     {
-			DrawThePage(printingCtx, docStP);
+			CSkPageDrawerDrawPage(drawer, printingCtx, pageNumber);
                     }
                                     
                     tempErr = PMSessionEndPage(printSession);
@@ -191,6 +189,7 @@ static OSStatus DoPrintLoop(DocStoragePtr docStP, PMPrintSession printSession, P
                 status = tempErr;
         }
     }
+    CSkPageDrawerRelease(drawer);
             
     //	Only report a printing error once we have completed the print loop. This ensures
     //	that every PMBeginXXX call that returns no error is followed by a matching PMEndXXX
@@ -208,7 +207,7 @@ static OSStatus DoPrintLoop(DocStoragePtr docStP, PMPrintSession printSession, P
 
 //-----------------------------------------------------------------------------------------------------------------------
 // (Borrowed from /Developer/Examples/Printing/App/)
-static OSStatus DoPrintDialog(PMPrintSession printSession, PMPageFormat pageFormat, PMPrintSettings* printSettings)
+static OSStatus DoPrintDialog(DocStoragePtr docStP, PMPrintSession printSession, PMPageFormat pageFormat, PMPrintSettings* printSettings)
 {
     OSStatus	status = noErr;
     Boolean     accepted;
@@ -244,7 +243,7 @@ static OSStatus DoPrintDialog(PMPrintSession printSession, PMPageFormat pageForm
 
     // Calculate the number of pages required to print the entire document.
     if (status == noErr)
-        status = DetermineNumberOfPagesInDoc(pageFormat, &realNumberOfPagesinDoc);
+        status = DetermineNumberOfPagesInDoc(docStP, &realNumberOfPagesinDoc);
 
     // Set a valid page range before displaying the Print dialog
     if (status == noErr)
@@ -281,10 +280,10 @@ void ProcessPrintCommand(DocStoragePtr docStP, UInt32 commandID)
 	{
 	    if (docStP->pageFormat == NULL)
 	    {
-		err = MyCreatePageFormat(printSession, &docStP->pageFormat);
+		err = CSkCreateDefaultPageFormat(printSession, &docStP->pageFormat);
 	    }
 
-	    if (DoPrintDialog(printSession, docStP->pageFormat, &docStP->printSettings) == noErr)
+	    if (DoPrintDialog(docStP, printSession, docStP->pageFormat, &docStP->printSettings) == noErr)
 	    {
 		DoPrintLoop(docStP, printSession, docStP->pageFormat, docStP->printSettings);
 	    }
@@ -46,5 +46,6 @@
 
 #include "CskWindow.h"
 #include "CskDocStorage.h"
+#include "CSkPDFExport.h"
 
 extern void ProcessPrintCommand(DocStoragePtr, UInt32 commandID);
@@ -0,0 +1,621 @@
+/*
+    File:       CSkRasterExport.c
+        
+    Contains:	Renders the page in bands on several threads and streams them to a PNG or TIFF file
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+#include <pthread.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "CSkRasterExport.h"
+#include "CSkObjects.h"
+#include "CSkShapes.h"
+#include "CSkSpatialIndex.h"
+#include "CSkUtils.h"
+#include "CSkTrace.h"
+
+// The page is drawn in bands of whole pixel rows, kRasterBandBytes of RGBX pixels each, into
+// numSlots buffers that the bands take turns with: band b goes into slot b % numSlots, once
+// band b - numSlots has been written. The calling thread writes the bands in order.
+
+enum {
+    kRasterBandBytes	= 4 * 1024 * 1024,
+    kMaxRasterThreads	= 8,
+    kPNGChunkSize	= 64 * 1024,	    // compressed data per IDAT chunk
+    kTIFFHeaderSize	= 8,
+    kTIFFNumTags	= 13,
+    kNoBand		= 0xFFFFFFFF
+};
+
+struct RasterSlot
+{
+    UInt8*	pixels;
+    UInt32	band;	    // the band the pixels are done for; kNoBand before the first one
+};
+typedef struct RasterSlot RasterSlot;
+
+struct RasterWriter
+{
+    FILE*	file;
+    int		format;
+    UInt32	width, height, rowsPerBand, numBands;
+    float	dpi;
+    UInt8*	row;	    // one row, as written
+    UInt8*	out;	    // kPNGChunkSize of deflated data
+    z_stream	zs;
+    Boolean	zsInited;
+};
+typedef struct RasterWriter RasterWriter;
+
+struct RasterJob
+{
+    DocStoragePtr	docStP;
+    CGRect		docRect;
+    float		scale;	    // pixels per point
+    UInt32		width, height, rowsPerBand, numBands;
+    size_t		rowBytes;
+    CGColorSpaceRef	colorSpace;
+    CSkObjectPtr*	objects;    // snapshot of docStP->objList
+    UInt32		numObjects;
+    CSkSpatialIndexPtr	index;	    // not thread-safe: used with lock held
+    
+    pthread_mutex_t	lock;
+    pthread_cond_t	changed;    // a band was taken, drawn or written, or the job failed
+    pthread_mutex_t	backgroundLock;
+    UInt32		nextBand, numWritten;
+    UInt32		numSlots;
+    RasterSlot*		slots;
+    OSStatus		err;	    // set (with lock held) by the first thread that fails
+};
+typedef struct RasterJob RasterJob;
+
+//--------------------------------------------------------------------------------------
+static void PutBE32(UInt8* p, UInt32 v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void PutLE16(UInt8* p, UInt16 v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void PutLE32(UInt8* p, UInt32 v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+//--------------------------------------------------------------------------------------
+static void FailRasterJob(RasterJob* job, OSStatus err)
+{
+    pthread_mutex_lock(&job->lock);
+    if (job->err == noErr)
+	job->err = err;
+    pthread_cond_broadcast(&job->changed);
+    pthread_mutex_unlock(&job->lock);
+}
+
+//--------------------------------------------------------------------------------------
+// Rows are counted from the top of the page; the last band may have fewer of them.
+static UInt32 GetBandRows(const RasterJob* job, UInt32 band)
+{
+    UInt32 firstRow = band * job->rowsPerBand;
+    return (job->height - firstRow < job->rowsPerBand) ? job->height - firstRow : job->rowsPerBand;
+}
+
+// In document coordinates
+static CGRect GetBandRect(const RasterJob* job, UInt32 band)
+{
+    UInt32 bottomRow = band * job->rowsPerBand + GetBandRows(job, band);
+    return CGRectMake(CGRectGetMinX(job->docRect), CGRectGetMaxY(job->docRect) - bottomRow / job->scale,
+		      job->width / job->scale, GetBandRows(job, band) / job->scale);
+}
+
+//--------------------------------------------------------------------------------------
+// The background PDF or image isn't drawn into two bands at the same time.
+static Boolean DrawRasterBand(RasterJob* job, UInt8* pixels, UInt32 band, const UInt32* found, UInt32 count)
+{
+    UInt32	    numRows = GetBandRows(job, band);
+    CGRect	    bandRect = GetBandRect(job, band);
+    Boolean	    hasBackground = (job->docStP->pdfDocument != NULL) || (job->docStP->cgImgSrc != NULL);
+    CGContextRef    ctx;
+    
+    memset(pixels, 0xFF, numRows * job->rowBytes);
+    ctx = CGBitmapContextCreate(pixels, job->width, numRows, 8, job->rowBytes, job->colorSpace, kCGImageAlphaNoneSkipLast);
+    if (ctx == NULL)
+	return false;
+    CGContextScaleCTM(ctx, job->scale, job->scale);
+    CGContextTranslateCTM(ctx, -bandRect.origin.x, -bandRect.origin.y);
+    CGContextClipToRect(ctx, bandRect);
+    if (hasBackground)
+	pthread_mutex_lock(&job->backgroundLock);
+    DrawPageBackground(ctx, job->docStP);
+    if (hasBackground)
+	pthread_mutex_unlock(&job->backgroundLock);
+    RenderDrawObjsAtIndices(ctx, job->objects, found, count, false);
+    CGContextRelease(ctx);
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+static void* RasterWorker(void* arg)
+{
+    RasterJob*	job = (RasterJob*)arg;
+    UInt32*	found = (UInt32*)malloc((job->numObjects + 1) * sizeof(UInt32));
+    UInt32	band, count;
+    
+    if (found == NULL)
+    {
+	FailRasterJob(job, memFullErr);
+	return NULL;
+    }
+    pthread_mutex_lock(&job->lock);
+    for (;;)
+    {
+	while ((job->err == noErr) && (job->nextBand < job->numBands) && (job->nextBand >= job->numWritten + job->numSlots))
+	    pthread_cond_wait(&job->changed, &job->lock);
+	if ((job->err != noErr) || (job->nextBand >= job->numBands))
+	    break;
+	band = job->nextBand++;
+	count = CSkSpatialIndexFindInRect(job->index, GetBandRect(job, band), found);
+	pthread_mutex_unlock(&job->lock);
+	
+	if (!DrawRasterBand(job, job->slots[band % job->numSlots].pixels, band, found, count))
+	{
+	    FailRasterJob(job, memFullErr);
+	    pthread_mutex_lock(&job->lock);
+	    break;
+	}
+	pthread_mutex_lock(&job->lock);
+	job->slots[band % job->numSlots].band = band;
+	pthread_cond_broadcast(&job->changed);
+    }
+    pthread_mutex_unlock(&job->lock);
+    free(found);
+    return NULL;
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+static Boolean WritePNGChunk(FILE* file, const char* type, const UInt8* data, UInt32 length)
+{
+    UInt8   header[8], trailer[4];
+    uLong   crc = crc32(crc32(0, Z_NULL, 0), (const Bytef*)type, 4);
+    
+    if (length > 0)
+	crc = crc32(crc, data, length);
+    PutBE32(header, length);
+    memcpy(header + 4, type, 4);
+    PutBE32(trailer, (UInt32)crc);
+    return (fwrite(header, 1, 8, file) == 8) && ((length == 0) || (fwrite(data, 1, length, file) == length)) 
+	    && (fwrite(trailer, 1, 4, file) == 4);
+}
+
+//--------------------------------------------------------------------------------------
+// Writes out what deflate has made so far; all of it with flush == Z_FINISH.
+static Boolean DeflatePNGData(RasterWriter* w, int flush)
+{
+    int	zerr;
+    
+    do {
+	zerr = deflate(&w->zs, flush);
+	if ((zerr != Z_OK) && (zerr != Z_STREAM_END) && (zerr != Z_BUF_ERROR))
+	    return false;
+	if ((w->zs.avail_out == 0) || ((flush == Z_FINISH) && (w->zs.avail_out < kPNGChunkSize)))
+	{
+	    if (!WritePNGChunk(w->file, "IDAT", w->out, kPNGChunkSize - w->zs.avail_out))
+		return false;
+	    w->zs.next_out = w->out;
+	    w->zs.avail_out = kPNGChunkSize;
+	}
+    } while ((w->zs.avail_in > 0) || ((flush == Z_FINISH) && (zerr != Z_STREAM_END)));
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Fast compression with the Sub filter on every row, which does well enough on drawings
+// (long runs of one color) without looking back at the previous row.
+static Boolean BeginPNG(RasterWriter* w)
+{
+    static const UInt8	signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    UInt8		ihdr[13], phys[9];
+    UInt32		pixelsPerMeter = (UInt32)(w->dpi / 0.0254 + 0.5);
+    
+    PutBE32(ihdr, w->width);
+    PutBE32(ihdr + 4, w->height);
+    ihdr[8] = 8;	    // bits per sample
+    ihdr[9] = 2;	    // RGB
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    PutBE32(phys, pixelsPerMeter);
+    PutBE32(phys + 4, pixelsPerMeter);
+    phys[8] = 1;	    // meters
+    
+    w->out = (UInt8*)malloc(kPNGChunkSize);
+    if ((w->out == NULL) || (deflateInit(&w->zs, Z_BEST_SPEED) != Z_OK))
+	return false;
+    w->zsInited = true;
+    w->zs.next_out = w->out;
+    w->zs.avail_out = kPNGChunkSize;
+    return (fwrite(signature, 1, 8, w->file) == 8) && WritePNGChunk(w->file, "IHDR", ihdr, 13) 
+	    && WritePNGChunk(w->file, "pHYs", phys, 9);
+}
+
+static Boolean WritePNGRow(RasterWriter* w, const UInt8* rgbx)
+{
+    UInt8*  p = w->row;
+    UInt8   prev[3] = { 0, 0, 0 };
+    UInt32  x;
+    
+    *p++ = 1;		    // Sub
+    for (x = 0; x < w->width; ++x, rgbx += 4, p += 3)
+    {
+	p[0] = rgbx[0] - prev[0];
+	p[1] = rgbx[1] - prev[1];
+	p[2] = rgbx[2] - prev[2];
+	prev[0] = rgbx[0];
+	prev[1] = rgbx[1];
+	prev[2] = rgbx[2];
+    }
+    w->zs.next_in = w->row;
+    w->zs.avail_in = 1 + 3 * w->width;
+    return DeflatePNGData(w, Z_NO_FLUSH);
+}
+
+static Boolean EndPNG(RasterWriter* w)
+{
+    return DeflatePNGData(w, Z_FINISH) && WritePNGChunk(w->file, "IEND", NULL, 0);
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+static UInt64 TIFFPixelBytes(const RasterWriter* w)
+{
+    return (UInt64)w->width * w->height * 3;
+}
+
+// Where the IFD goes: after the strips, on a word boundary.
+static UInt64 TIFFDirectoryOffset(const RasterWriter* w)
+{
+    return (kTIFFHeaderSize + TIFFPixelBytes(w) + 1) & ~(UInt64)1;
+}
+
+static UInt64 TIFFFileSize(const RasterWriter* w)
+{
+    UInt64 extra = 6 + 2 * 8 + ((w->numBands > 1) ? 2 * 4 * w->numBands : 0);   // BitsPerSample, resolutions, strips
+    return TIFFDirectoryOffset(w) + 2 + 12 * kTIFFNumTags + 4 + extra;
+}
+
+// An uncompressed strip of rowsPerBand rows for every band, before the IFD, which is
+// written once the size of the strips is known.
+static Boolean BeginTIFF(RasterWriter* w)
+{
+    UInt8 header[kTIFFHeaderSize] = { 'I', 'I', 42, 0 };
+    
+    PutLE32(header + 4, (UInt32)TIFFDirectoryOffset(w));
+    return fwrite(header, 1, kTIFFHeaderSize, w->file) == kTIFFHeaderSize;
+}
+
+static Boolean WriteTIFFRow(RasterWriter* w, const UInt8* rgbx)
+{
+    UInt8*  p = w->row;
+    UInt32  x;
+    
+    for (x = 0; x < w->width; ++x, rgbx += 4, p += 3)
+    {
+	p[0] = rgbx[0];
+	p[1] = rgbx[1];
+	p[2] = rgbx[2];
+    }
+    return fwrite(w->row, 3, w->width, w->file) == w->width;
+}
+
+static UInt8* PutTIFFEntry(UInt8* p, UInt16 tag, UInt16 type, UInt32 count, UInt32 value)
+{
+    PutLE16(p, tag);
+    PutLE16(p + 2, type);
+    PutLE32(p + 4, count);
+    if ((type == 3) && (count == 1))	// SHORT, left-justified
+    {
+	PutLE16(p + 8, (UInt16)value);
+	PutLE16(p + 10, 0);
+    }
+    else
+	PutLE32(p + 8, value);
+    return p + 12;
+}
+
+static Boolean EndTIFF(RasterWriter* w)
+{
+    UInt32  dirOffset = (UInt32)TIFFDirectoryOffset(w);
+    UInt32  extraOffset = dirOffset + 2 + 12 * kTIFFNumTags + 4;
+    UInt32  dirSize = (UInt32)(TIFFFileSize(w) - dirOffset);
+    UInt32  stripBytes = w->rowsPerBand * w->width * 3;
+    UInt32  resolution = (UInt32)(w->dpi * 100 + 0.5);
+    UInt32  band;
+    UInt8*  dir = (UInt8*)calloc(1, dirSize + 1);
+    UInt8*  p;
+    UInt8*  extra;
+    Boolean ok;
+    
+    if (dir == NULL)
+	return false;
+    p = dir;
+    PutLE16(p, kTIFFNumTags);
+    p += 2;
+    p = PutTIFFEntry(p, 256, 4, 1, w->width);			// ImageWidth
+    p = PutTIFFEntry(p, 257, 4, 1, w->height);			// ImageLength
+    p = PutTIFFEntry(p, 258, 3, 3, extraOffset);		// BitsPerSample
+    p = PutTIFFEntry(p, 259, 3, 1, 1);				// Compression: none
+    p = PutTIFFEntry(p, 262, 3, 1, 2);				// PhotometricInterpretation: RGB
+    p = PutTIFFEntry(p, 273, 4, w->numBands, (w->numBands > 1) ? extraOffset + 22 : kTIFFHeaderSize);	    // StripOffsets
+    p = PutTIFFEntry(p, 277, 3, 1, 3);				// SamplesPerPixel
+    p = PutTIFFEntry(p, 278, 4, 1, w->rowsPerBand);		// RowsPerStrip
+    p = PutTIFFEntry(p, 279, 4, w->numBands, (w->numBands > 1) ? extraOffset + 22 + 4 * w->numBands : (UInt32)TIFFPixelBytes(w));    // StripByteCounts
+    p = PutTIFFEntry(p, 282, 5, 1, extraOffset + 6);		// XResolution
+    p = PutTIFFEntry(p, 283, 5, 1, extraOffset + 14);		// YResolution
+    p = PutTIFFEntry(p, 284, 3, 1, 1);				// PlanarConfiguration: chunky
+    p = PutTIFFEntry(p, 296, 3, 1, 2);				// ResolutionUnit: inch
+    PutLE32(p, 0);						// no next IFD
+    
+    extra = dir + (extraOffset - dirOffset);
+    PutLE16(extra, 8);
+    PutLE16(extra + 2, 8);
+    PutLE16(extra + 4, 8);
+    PutLE32(extra + 6, resolution);
+    PutLE32(extra + 10, 100);
+    PutLE32(extra + 14, resolution);
+    PutLE32(extra + 18, 100);
+    if (w->numBands > 1)
+    {
+	for (band = 0; band < w->numBands; ++band)
+	{
+	    UInt32 rows = (band + 1 < w->numBands) ? w->rowsPerBand : w->height - band * w->rowsPerBand;
+	    PutLE32(extra + 22 + 4 * band, kTIFFHeaderSize + band * stripBytes);
+	    PutLE32(extra + 22 + 4 * (w->numBands + band), rows * w->width * 3);
+	}
+    }
+    
+    // the pad byte before the IFD goes out with it
+    if ((kTIFFHeaderSize + TIFFPixelBytes(w)) & 1)
+	ok = (fwrite(dir + dirSize, 1, 1, w->file) == 1) && (fwrite(dir, 1, dirSize, w->file) == dirSize);
+    else
+	ok = fwrite(dir, 1, dirSize, w->file) == dirSize;
+    free(dir);
+    return ok;
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+static Boolean WriteRasterBand(RasterWriter* w, const UInt8* pixels, UInt32 numRows, size_t rowBytes)
+{
+    UInt32 y;
+    
+    for (y = 0; y < numRows; ++y, pixels += rowBytes)
+    {
+	if (!((w->format == kCSkRasterPNG) ? WritePNGRow(w, pixels) : WriteTIFFRow(w, pixels)))
+	    return false;
+    }
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// The objects of a mapped document are all materialized first.
+OSStatus CSkExportRaster(DocStoragePtr docStP, const char* path, int format, float dpi, 
+			    int numThreads, CSkRasterStats* outStats)
+{
+    RasterJob		job;
+    RasterWriter	w;
+    pthread_t		threads[kMaxRasterThreads];
+    int			numStarted = 0;
+    UInt32		band, i;
+    CFAbsoluteTime	startTime = CFAbsoluteTimeGetCurrent();
+    Boolean		locksInited = false, ok;
+    OSStatus		err = paramErr;
+    CSK_TRACE_SPAN("CSkExportRaster");
+    
+    memset(&job, 0, sizeof(job));
+    memset(&w, 0, sizeof(w));
+    require((format == kCSkRasterPNG) || (format == kCSkRasterTIFF), BadParameter);
+    require((dpi > 0) && !CGRectIsEmpty(docStP->pageRect), BadParameter);
+    
+    job.docStP = docStP;
+    job.docRect = docStP->pageRect;
+    job.scale = dpi / 72;
+    job.width = (UInt32)ceil(CGRectGetWidth(job.docRect) * job.scale);
+    job.height = (UInt32)ceil(CGRectGetHeight(job.docRect) * job.scale);
+    require((job.width > 0) && (job.height > 0) && (job.width <= 0x7FFFFFFF / 4) && (job.height <= 0x7FFFFFFF), BadParameter);
+    job.rowBytes = (size_t)job.width * 4;
+    job.rowsPerBand = kRasterBandBytes / job.rowBytes;
+    if (job.rowsPerBand == 0)
+	job.rowsPerBand = 1;
+    if (job.rowsPerBand > job.height)
+	job.rowsPerBand = job.height;
+    job.numBands = (job.height + job.rowsPerBand - 1) / job.rowsPerBand;
+    
+    w.format = format;
+    w.width = job.width;
+    w.height = job.height;
+    w.rowsPerBand = job.rowsPerBand;
+    w.numBands = job.numBands;
+    w.dpi = dpi;
+    err = fsDataTooBigErr;
+    require((format != kCSkRasterTIFF) || (TIFFFileSize(&w) <= 0xFFFFFFFF), BadParameter);
+    
+    if (numThreads <= 0)
+	numThreads = MPProcessorsScheduled();
+    if (numThreads > kMaxRasterThreads)
+	numThreads = kMaxRasterThreads;
+    if ((UInt32)numThreads > job.numBands)
+	numThreads = job.numBands;
+    if (numThreads < 1)
+	numThreads = 1;
+    job.numSlots = 2 * numThreads;
+    if (job.numSlots > job.numBands)
+	job.numSlots = job.numBands;
+    
+    err = memFullErr;
+    job.slots = (RasterSlot*)calloc(job.numSlots, sizeof(RasterSlot));
+    w.row = (UInt8*)malloc(1 + 3 * (size_t)job.width);
+    require((job.slots != NULL) && (w.row != NULL), CantAllocate);
+    for (i = 0; i < job.numSlots; ++i)
+    {
+	job.slots[i].band = kNoBand;
+	job.slots[i].pixels = (UInt8*)malloc(job.rowsPerBand * job.rowBytes);
+	require(job.slots[i].pixels != NULL, CantAllocate);
+    }
+    
+    MaterializeObjectsInRect(docStP, job.docRect);
+    job.objects = CreateDrawObjSnapshot(&docStP->objList, &job.numObjects);
+    job.index = CSkSpatialIndexCreate(job.objects, job.numObjects, false);
+    require(job.index != NULL, CantAllocate);
+    job.colorSpace = GetGenericRGBColorSpace();
+#if !CSK_COMPACT_GEOMETRY
+    // Polygons build their cached path when they are first drawn; not while the bands are.
+    for (i = 0; i < job.numObjects; ++i)
+	CSkShapeGetPath(CSkObjectGetShape(job.objects[i]));
+#endif
+    
+    require_noerr(pthread_mutex_init(&job.lock, NULL), CantAllocate);
+    pthread_mutex_init(&job.backgroundLock, NULL);
+    pthread_cond_init(&job.changed, NULL);
+    locksInited = true;
+    
+    err = ioErr;
+    w.file = fopen(path, "wb");
+    require(w.file != NULL, CantOpen);
+    setvbuf(w.file, NULL, _IOFBF, 256 * 1024);
+    ok = (format == kCSkRasterPNG) ? BeginPNG(&w) : BeginTIFF(&w);
+    require(ok, CantWrite);
+    
+    for (numStarted = 0; numStarted < numThreads; ++numStarted)
+    {
+	if (pthread_create(&threads[numStarted], NULL, RasterWorker, &job) != 0)
+	    break;
+    }
+    require_action(numStarted > 0, CantWrite, err = memFullErr);
+    
+    for (band = 0; (band < job.numBands) && ok; ++band)
+    {
+	RasterSlot* slot = &job.slots[band % job.numSlots];
+	
+	pthread_mutex_lock(&job.lock);
+	while ((slot->band != band) && (job.err == noErr))
+	    pthread_cond_wait(&job.changed, &job.lock);
+	ok = (job.err == noErr);
+	pthread_mutex_unlock(&job.lock);
+	
+	if (ok && !WriteRasterBand(&w, slot->pixels, GetBandRows(&job, band), job.rowBytes))
+	{
+	    FailRasterJob(&job, ioErr);
+	    ok = false;
+	}
+	pthread_mutex_lock(&job.lock);
+	job.numWritten = band + 1;
+	pthread_cond_broadcast(&job.changed);
+	pthread_mutex_unlock(&job.lock);
+    }
+    while (numStarted > 0)
+	pthread_join(threads[--numStarted], NULL);
+    err = job.err;
+    require_noerr(err, CantWrite);
+    
+    err = ioErr;
+    ok = (format == kCSkRasterPNG) ? EndPNG(&w) : EndTIFF(&w);
+    require(ok, CantWrite);
+    require(fclose(w.file) == 0, CantClose);
+    w.file = NULL;
+    err = noErr;
+    
+    if (outStats != NULL)
+    {
+	outStats->width = job.width;
+	outStats->height = job.height;
+	outStats->rowsPerBand = job.rowsPerBand;
+	outStats->numBands = job.numBands;
+	outStats->numThreads = numThreads;
+	outStats->bufferBytes = job.numSlots * job.rowsPerBand * job.rowBytes;
+	outStats->seconds = CFAbsoluteTimeGetCurrent() - startTime;
+	outStats->megapixelsPerSecond = (outStats->seconds > 0) ? (double)job.width * job.height / 1e6 / outStats->seconds : 0;
+    }
+    goto Done;
+    
+CantWrite:
+    fclose(w.file);
+    w.file = NULL;
+CantClose:
+    unlink(path);
+CantOpen:
+    fprintf(stderr, "CSkExportRaster: can't write %s (%d)\n", path, (int)err);
+    goto Done;
+    
+CantAllocate:
+BadParameter:
+    fprintf(stderr, "CSkExportRaster: can't export %s (%d)\n", path, (int)err);
+    
+Done:
+    if (w.zsInited)
+	deflateEnd(&w.zs);
+    free(w.out);
+    free(w.row);
+    if (locksInited)
+    {
+	pthread_cond_destroy(&job.changed);
+	pthread_mutex_destroy(&job.backgroundLock);
+	pthread_mutex_destroy(&job.lock);
+    }
+    if (job.index != NULL)
+	CSkSpatialIndexRelease(job.index);
+    if (job.objects != NULL)
+	ReleaseDrawObjSnapshot(job.objects, job.numObjects);
+    if (job.slots != NULL)
+    {
+	for (i = 0; i < job.numSlots; ++i)
+	    free(job.slots[i].pixels);
+	free(job.slots);
+    }
+    return err;
+}
@@ -0,0 +1,423 @@
+/*
+    File:       CSkSVGExport.c
+        
+    Contains:	Streams the document page to a file descriptor as SVG
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include "CSkSVGExport.h"
+#include "CSkConstants.h"
+#include "CSkMappedDoc.h"
+#include "CSkObjects.h"
+#include "CSkShapes.h"
+#include "CSkTrace.h"
+#include "CSkUtils.h"
+
+enum {
+    kSVGBufferSize	= 64 * 1024,
+    kSVGMaxItemSize	= 512,		// an element without its path data, or a style rule
+    kSVGPolygonChunk	= 64		// points read at a time
+};
+
+struct SVGWriter
+{
+    int		fd;
+    char*	buffer;
+    size_t	used;
+    OSStatus	err;	    // of the first write that failed
+    CGFloat	minX, maxY; // of the page; y goes down in SVG
+    CSkStylePtr* styles;    // those with a rule written, held so that their IDs stay theirs
+    UInt32	numStyles;
+    UInt32	stylesCapacity;
+    UInt8*	hasRule;    // one bit per style ID
+    UInt32	hasRuleSize;
+};
+typedef struct SVGWriter SVGWriter;
+
+//--------------------------------------------------------------------------------------
+static void FlushSVG(SVGWriter* w)
+{
+    const char*	p = w->buffer;
+    size_t	left = w->used;
+    
+    while ((left > 0) && (w->err == noErr))
+    {
+	ssize_t n = write(w->fd, p, left);
+	if (n > 0)
+	{
+	    p += n;
+	    left -= n;
+	}
+	else if ((n < 0) && (errno != EINTR))
+	    w->err = (errno == ENOSPC) ? dskFulErr : ioErr;
+    }
+    w->used = 0;
+}
+
+// Makes room for kSVGMaxItemSize more bytes.
+static char* ReserveSVG(SVGWriter* w)
+{
+    if (w->used > kSVGBufferSize - kSVGMaxItemSize)
+	FlushSVG(w);
+    return w->buffer + w->used;
+}
+
+static void PutSVGString(SVGWriter* w, const char* s)
+{
+    size_t length = strlen(s);
+    
+    if (w->used + length > kSVGBufferSize)
+	FlushSVG(w);
+    memcpy(w->buffer + w->used, s, length);
+    w->used += length;
+}
+
+//--------------------------------------------------------------------------------------
+// name="v", with a leading space
+static int FormatSVGAttribute(char* p, const char* name, double v)
+{
+    int n = sprintf(p, " %s=\"", name);
+    
+    n += FormatShortestFloat(p + n, v);
+    p[n++] = '"';
+    p[n] = '\0';
+    return n;
+}
+
+// x and y of a point on the page, with a leading separator
+static int FormatSVGPoint(SVGWriter* w, char* p, char separator, CGPoint pt)
+{
+    int n = 0;
+    
+    p[n++] = separator;
+    n += FormatShortestFloat(p + n, pt.x - w->minX);
+    p[n++] = ' ';
+    n += FormatShortestFloat(p + n, w->maxY - pt.y);
+    return n;
+}
+
+static void FormatSVGColor(char* p, const CGrgba* c)
+{
+    sprintf(p, "#%02x%02x%02x", (int)lrintf(c->r * 255), (int)lrintf(c->g * 255), (int)lrintf(c->b * 255));
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+// The attributes as RenderCSkObject sets them: fill and stroke, butt caps and miter joins
+// by default, dashes as long as the gaps, both lineWidth + 4, with a phase of 1.
+static void PutSVGStyleRule(SVGWriter* w, const CSkStyle* style)
+{
+    static const char*	caps[] = { "butt", "round", "square" };
+    static const char*	joins[] = { "miter", "round", "bevel" };
+    const CSkObjectAttributes* attr = CSkStyleGetAttributes(style);
+    char*		p = ReserveSVG(w);
+    char		fill[8], stroke[8], width[32];
+    int			n;
+    
+    FormatSVGColor(fill, &attr->fillColor);
+    FormatSVGColor(stroke, &attr->strokeColor);
+    FormatShortestFloat(width, attr->lineWidth);
+    n = sprintf(p, ".s%u{fill:%s;stroke:%s;stroke-width:%s", (unsigned)CSkStyleGetID(style), fill, stroke, width);
+    if (attr->fillColor.a < 1)
+	n += sprintf(p + n, ";fill-opacity:%.3g", attr->fillColor.a);
+    if (attr->strokeColor.a < 1)
+	n += sprintf(p + n, ";stroke-opacity:%.3g", attr->strokeColor.a);
+    if ((attr->lineCap > kCGLineCapButt) && (attr->lineCap <= kCGLineCapSquare))
+	n += sprintf(p + n, ";stroke-linecap:%s", caps[attr->lineCap]);
+    if ((attr->lineJoin > kCGLineJoinMiter) && (attr->lineJoin <= kCGLineJoinBevel))
+	n += sprintf(p + n, ";stroke-linejoin:%s", joins[attr->lineJoin]);
+    if (attr->lineStyle == kStyleDashed)
+    {
+	FormatShortestFloat(width, attr->lineWidth + 4);
+	n += sprintf(p + n, ";stroke-dasharray:%s;stroke-dashoffset:1", width);
+    }
+    n += sprintf(p + n, "}\n");
+    w->used += n;
+}
+
+static Boolean HasSVGStyleRule(const SVGWriter* w, const CSkStyle* style)
+{
+    UInt32 styleID = CSkStyleGetID(style);
+    
+    return (styleID / 8 < w->hasRuleSize) && ((w->hasRule[styleID / 8] >> (styleID % 8)) & 1);
+}
+
+// Takes over a reference to style, whose rule has been written.
+static Boolean HoldSVGStyle(SVGWriter* w, CSkStylePtr style)
+{
+    UInt32 styleID = CSkStyleGetID(style);
+    
+    if (w->numStyles == w->stylesCapacity)
+    {
+	UInt32	    capacity = 2 * w->stylesCapacity + 16;
+	CSkStylePtr* styles = (CSkStylePtr*)realloc(w->styles, capacity * sizeof(CSkStylePtr));
+	
+	if (styles == NULL)
+	    goto CantAllocate;
+	w->styles = styles;
+	w->stylesCapacity = capacity;
+    }
+    if (styleID / 8 >= w->hasRuleSize)
+    {
+	UInt32	size = 2 * (styleID / 8) + 16;
+	UInt8*	hasRule = (UInt8*)realloc(w->hasRule, size);
+	
+	if (hasRule == NULL)
+	    goto CantAllocate;
+	memset(hasRule + w->hasRuleSize, 0, size - w->hasRuleSize);
+	w->hasRule = hasRule;
+	w->hasRuleSize = size;
+    }
+    w->styles[w->numStyles++] = style;
+    w->hasRule[styleID / 8] |= 1 << (styleID % 8);
+    return true;
+    
+CantAllocate:
+    CSkStyleRelease(style);
+    return false;
+}
+
+// All the styles of the table, whether or not the page uses them; there are few.
+static Boolean PutSVGStyles(SVGWriter* w, CSkStyleTablePtr table)
+{
+    UInt32	    maxCount = CSkStyleTableGetCount(table), count, i;
+    CSkStylePtr*    styles = (CSkStylePtr*)malloc((maxCount + 1) * sizeof(CSkStylePtr));
+    Boolean	    ok = true;
+    
+    if (styles == NULL)
+	return false;
+    count = CSkStyleTableCopyStyles(table, styles, maxCount);
+    PutSVGString(w, "<style type=\"text/css\"><![CDATA[\n");
+    for (i = 0; i < count; ++i)
+    {
+	PutSVGStyleRule(w, styles[i]);
+	if (!HoldSVGStyle(w, styles[i]))
+	    ok = false;
+    }
+    PutSVGString(w, "]]></style>\n");
+    free(styles);
+    return ok;
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+// Polygons go out kSVGPolygonChunk points at a time; a curve's control points follow its verb.
+static void PutSVGPolygon(SVGWriter* w, const CSkShape* sh, unsigned styleID)
+{
+    UInt32	count = CSkShapeGetPolygonCount(sh), first, n, i;
+    CGPoint	pts[kSVGPolygonChunk];
+    UInt8	verbs[kSVGPolygonChunk];
+    char*	p;
+    
+    if (count == 0)
+	return;
+    p = ReserveSVG(w);
+    w->used += sprintf(p, "<path class=\"s%u\" d=\"", styleID);
+    for (first = 0; first < count; first += n)
+    {
+	n = (count - first < kSVGPolygonChunk) ? count - first : kSVGPolygonChunk;
+	CSkShapeGetPolygonPoints(sh, first, n, pts, verbs);
+	for (i = 0; i < n; ++i)
+	{
+	    char separator = ' ';
+	    
+	    switch (verbs[i] & kCSkPolygonVerbMask)
+	    {
+		case kCSkPolygonMoveTo:	    separator = 'M';	break;
+		case kCSkPolygonLineTo:	    separator = 'L';	break;
+		case kCSkPolygonQuadTo:	    separator = 'Q';	break;
+		case kCSkPolygonCurveTo:    separator = 'C';	break;
+	    }
+	    p = ReserveSVG(w);
+	    w->used += FormatSVGPoint(w, p, separator, pts[i]);
+	    if (verbs[i] & kCSkPolygonClose)
+		w->buffer[w->used++] = 'Z';
+	}
+    }
+    PutSVGString(w, "\"/>\n");
+}
+
+static void PutSVGObject(SVGWriter* w, const CSkObject* obj)
+{
+    CSkShapePtr	sh = CSkObjectGetShape(obj);
+    unsigned	styleID = CSkStyleGetID(CSkObjectGetStyle(obj));
+    CGRect	r = CSkShapeGetBounds(sh);
+    CGPoint	pts[4], radii;
+    char*	p;
+    int		n;
+    
+    if (CSkShapeGetType(sh) == kFreePolygon)
+    {
+	PutSVGPolygon(w, sh, styleID);
+	return;
+    }
+    CSkShapeGetPoints(sh, pts);
+    p = ReserveSVG(w);
+    switch (CSkShapeGetType(sh))
+    {
+	case kLineShape:	    // stroked only
+	    n = sprintf(p, "<line class=\"s%u\"", styleID);
+	    n += FormatSVGAttribute(p + n, "x1", pts[0].x - w->minX);
+	    n += FormatSVGAttribute(p + n, "y1", w->maxY - pts[0].y);
+	    n += FormatSVGAttribute(p + n, "x2", pts[1].x - w->minX);
+	    n += FormatSVGAttribute(p + n, "y2", w->maxY - pts[1].y);
+	    break;
+	case kQuadBezier:	    // filled and stroked, but not closed
+	    n = sprintf(p, "<path class=\"s%u\" d=\"", styleID);
+	    n += FormatSVGPoint(w, p + n, 'M', pts[0]);
+	    n += FormatSVGPoint(w, p + n, 'Q', pts[1]);
+	    n += FormatSVGPoint(w, p + n, ' ', pts[2]);
+	    p[n++] = '"';
+	    break;
+	case kCubicBezier:
+	    n = sprintf(p, "<path class=\"s%u\" d=\"", styleID);
+	    n += FormatSVGPoint(w, p + n, 'M', pts[0]);
+	    n += FormatSVGPoint(w, p + n, 'C', pts[1]);
+	    n += FormatSVGPoint(w, p + n, ' ', pts[2]);
+	    n += FormatSVGPoint(w, p + n, ' ', pts[3]);
+	    p[n++] = '"';
+	    break;
+	case kRectShape:
+	case kRRectShape:	    // like DrawRRect, SVG keeps the radii within half the size
+	    n = sprintf(p, "<rect class=\"s%u\"", styleID);
+	    n += FormatSVGAttribute(p + n, "x", CGRectGetMinX(r) - w->minX);
+	    n += FormatSVGAttribute(p + n, "y", w->maxY - CGRectGetMaxY(r));
+	    n += FormatSVGAttribute(p + n, "width", CGRectGetWidth(r));
+	    n += FormatSVGAttribute(p + n, "height", CGRectGetHeight(r));
+	    radii = CSkShapeGetRRectRadii(sh);
+	    if ((CSkShapeGetType(sh) == kRRectShape) && (radii.x > 0) && (radii.y > 0))
+	    {
+		n += FormatSVGAttribute(p + n, "rx", radii.x);
+		n += FormatSVGAttribute(p + n, "ry", radii.y);
+	    }
+	    break;
+	case kOvalShape:
+	    n = sprintf(p, "<ellipse class=\"s%u\"", styleID);
+	    n += FormatSVGAttribute(p + n, "cx", CGRectGetMidX(r) - w->minX);
+	    n += FormatSVGAttribute(p + n, "cy", w->maxY - CGRectGetMidY(r));
+	    n += FormatSVGAttribute(p + n, "rx", 0.5 * CGRectGetWidth(r));
+	    n += FormatSVGAttribute(p + n, "ry", 0.5 * CGRectGetHeight(r));
+	    break;
+	default:
+	    return;
+    }
+    n += sprintf(p + n, "/>\n");
+    w->used += n;
+}
+
+// An object of a mapped document that was never materialized may have a style that wasn't
+// in the table when the rules were written: its rule goes in a style element of its own,
+// which applies to the whole file all the same.
+static Boolean PutSVGObjectProc(void* refCon, const CSkObject* obj)
+{
+    SVGWriter*	w = (SVGWriter*)refCon;
+    CSkStylePtr	style = CSkObjectGetStyle(obj);
+    
+    if (!HasSVGStyleRule(w, style))
+    {
+	PutSVGString(w, "<style type=\"text/css\"><![CDATA[\n");
+	PutSVGStyleRule(w, style);
+	PutSVGString(w, "]]></style>\n");
+	if (!HoldSVGStyle(w, CSkStyleRetain(style)) && (w->err == noErr))
+	    w->err = memFullErr;
+    }
+    PutSVGObject(w, obj);
+    return (w->err == noErr);
+}
+
+#pragma mark -
+//--------------------------------------------------------------------------------------
+// The records of a mapped document are read one at a time, and left where they are.
+OSStatus CSkWriteSVG(DocStoragePtr docStP, int fd)
+{
+    SVGWriter	    w;
+    CGRect	    page = docStP->pageRect;
+    CSkObjectPtr    obj;
+    char*	    p;
+    int		    n;
+    UInt32	    i;
+    CSK_TRACE_SPAN("CSkWriteSVG");
+    
+    memset(&w, 0, sizeof(w));
+    w.fd = fd;
+    w.minX = CGRectGetMinX(page);
+    w.maxY = CGRectGetMaxY(page);
+    w.buffer = (char*)malloc(kSVGBufferSize);
+    require_action(w.buffer != NULL, CantAllocate, w.err = memFullErr);
+    
+    p = ReserveSVG(&w);
+    n = sprintf(p, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		   "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\" width=\"");
+    n += FormatShortestFloat(p + n, CGRectGetWidth(page));
+    n += sprintf(p + n, "pt\" height=\"");
+    n += FormatShortestFloat(p + n, CGRectGetHeight(page));
+    n += sprintf(p + n, "pt\" viewBox=\"0 0 ");
+    n += FormatShortestFloat(p + n, CGRectGetWidth(page));
+    p[n++] = ' ';
+    n += FormatShortestFloat(p + n, CGRectGetHeight(page));
+    n += sprintf(p + n, "\" stroke-miterlimit=\"10\">\n");
+    w.used += n;
+    require_action(PutSVGStyles(&w, CSkObjListGetStyles(&docStP->objList)), CantAllocate, w.err = memFullErr);
+    
+    if (docStP->mappedDoc != NULL)
+	CSkMappedDocWalkBackToFront(docStP->mappedDoc, &docStP->objList, PutSVGObjectProc, &w);
+    else
+    {
+	for (obj = docStP->objList.lastItem; (obj != NULL) && PutSVGObjectProc(&w, obj); obj = CSkObjectGetPrev(obj))
+	    ;
+    }
+    PutSVGString(&w, "</svg>\n");
+    FlushSVG(&w);
+    if (w.err != noErr)
+	fprintf(stderr, "CSkWriteSVG: can't write (%d)\n", (int)w.err);
+    goto Done;
+    
+CantAllocate:
+    fprintf(stderr, "CSkWriteSVG: out of memory\n");
+Done:
+    for (i = 0; i < w.numStyles; ++i)
+	CSkStyleRelease(w.styles[i]);
+    free(w.styles);
+    free(w.hasRule);
+    free(w.buffer);
+    return w.err;
+}
@@ -46,18 +46,21 @@
 
 
 #include "CSkShapes.h"
+#include "CSkPolygons.h"
 #include "CSkConstants.h"
 #include "CSkUtils.h"
 
 // The information about a CSkObject's geometric shape has been factored out into this separate file,
 // for good coding practice, and to make room for future extensions.
-// As it stands, CSkShapes are fixed-size allocations; but this might change in the future.
+// As it stands, CSkShapes are fixed-size allocations, except for the points of free polygons
+// (see CSkPolygons.c). Coordinates are stored as CSkStoredPoint and CSkStoredRect, which are
+// float32 with CSK_COMPACT_GEOMETRY (see CSkShapes.h).
 
 struct CSkRRect 
 {
-    CGRect  bounds;
-    float   rX;
-    float   rY;
+    CSkStoredRect   bounds;
+    float	    rX;
+    float	    rY;
 };
 typedef struct CSkRRect CSkRRect;
 
@@ -65,19 +68,48 @@ struct CSkShape
 {
     int		shapeType;
     union   {
-	CGPoint			points[4];	// for lines, quadratic or cubic splines
-        CGRect			bounds;		// for rects, ovals (and RRects)
+	CSkStoredPoint		points[4];	// for lines, quadratic or cubic splines
+        CSkStoredRect		bounds;		// for rects, ovals (and RRects)
         CSkRRect		rrect;
-	CGMutablePathRef	path;		// for freePolygon and general paths
+	CSkPolygonPtr		polygon;	// for freePolygon
     } u;
 };
 
+//------------------------------------------------------------------------------
+static CGPoint LoadPoint(CSkStoredPoint p)
+{
+    return CGPointMake(p.x, p.y);
+}
+
+static CSkStoredPoint StorePoint(CGPoint pt)
+{
+    CSkStoredPoint p;
+    p.x = pt.x;
+    p.y = pt.y;
+    return p;
+}
+
+static CGRect LoadRect(CSkStoredRect r)
+{
+    return CGRectMake(r.origin.x, r.origin.y, r.size.width, r.size.height);
+}
+
+static CSkStoredRect StoreRect(CGRect rect)
+{
+    CSkStoredRect r;
+    r.origin.x = rect.origin.x;
+    r.origin.y = rect.origin.y;
+    r.size.width = rect.size.width;
+    r.size.height = rect.size.height;
+    return r;
+}
+
 #if 0
 //------------------------------------------------------------------------------
 static void CSkShapeSetRect(CSkShape* sh, CGRect rect)
 {
     sh->shapeType = kRectShape;
-    sh->u.bounds = rect;
+    sh->u.bounds = StoreRect(rect);
 }
 #endif
 
@@ -85,7 +117,7 @@ static void CSkShapeSetRect(CSkShape* sh, CGRect rect)
 static void CSkShapeSetRRect(CSkShape* sh, CGRect rect, float rX, float rY)
 {
     sh->shapeType = kRRectShape;
-    sh->u.rrect.bounds = rect;
+    sh->u.rrect.bounds = StoreRect(rect);
     sh->u.rrect.rX = rX;
     sh->u.rrect.rY = rY;
 }
@@ -104,17 +136,28 @@ CSkShapePtr CSkShapeCreate(int shapeType)
 }
 
 //--------------------------------------------------------
-static bool CSkShapeUsesPath(const CSkShape* sh)
+static bool CSkShapeUsesPolygon(const CSkShape* sh)
 {
     int shapeType = CSkShapeGetType(sh);
-    return (shapeType == kFreePolygon);    // for now, that's the only case where the sh->u.path is being used
+    return (shapeType == kFreePolygon);    // for now, that's the only case where the sh->u.polygon is being used
+}
+
+//--------------------------------------------------------
+// Independent copy of sh; a polygon shares its points until either polygon changes them.
+CSkShapePtr CSkShapeCreateCopy(const CSkShape* sh)
+{
+    CSkShapePtr newSh = (CSkShapePtr)calloc(sizeof(CSkShape), 1);
+    memcpy(newSh, sh, sizeof(CSkShape));
+    if (CSkShapeUsesPolygon(newSh) && (newSh->u.polygon != NULL))
+	newSh->u.polygon = CSkPolygonCreateCopy(sh->u.polygon);
+    return newSh;
 }
 
 //-------------------------------------------------------- Deallocate
 void CSkShapeRelease(CSkShape* sh)
 {
-    if (CSkShapeUsesPath(sh))
-	CGPathRelease(sh->u.path);
+    if (CSkShapeUsesPolygon(sh))
+	CSkPolygonRelease(sh->u.polygon);
     free(sh);
 }
 
@@ -125,11 +168,28 @@ ByteCount CSkShapeSize(void)
     return sizeof(CSkShape);
 }
 
+//--------------------------------------------------------
+// Including the points of a polygon
+ByteCount CSkShapeGetStorageSize(const CSkShape* sh)
+{
+    ByteCount size = sizeof(CSkShape);
+    if (CSkShapeUsesPolygon(sh) && (sh->u.polygon != NULL))
+	size += CSkPolygonGetStorageSize(sh->u.polygon);
+    return size;
+}
+
 //-------------------------------------------------------- The expected accessors
 
-CGPoint* CSkShapeGetPoints(CSkShapePtr sh)
+// Copies out the points of a line or curve; returns how many there are.
+int CSkShapeGetPoints(const CSkShape* sh, CGPoint outPoints[4])
 {
-    return sh->u.points;
+    int i, numPoints = 0;
+    
+    if ((sh->shapeType == kLineShape) || (sh->shapeType == kQuadBezier) || (sh->shapeType == kCubicBezier))
+	numPoints = sh->shapeType + 1;	    // uses special values of shapeType enums!
+    for (i = 0; i < numPoints; ++i)
+	outPoints[i] = LoadPoint(sh->u.points[i]);
+    return numPoints;
 }
 
 //--------------------------------------------------------------------
@@ -137,7 +197,7 @@ void CSkShapeSetPointAtIndex(CSkShape* sh, CGPoint pt, int index)
 {
     if ((index >= 0) && (index < 4))
     {
-	sh->u.points[index] = pt;
+	sh->u.points[index] = StorePoint(pt);
 //	fprintf(stderr, "points[%d] = (%g, %g)\n", index, pt.x, pt.y);
     }
     else
@@ -157,7 +217,7 @@ void CSkShapeSetType(CSkShapePtr sh, int shapeType)
 }
 
 //------------------------------------------------------------------------------
-static CGRect MakeBoundsFromPoints(CGPoint* pts, int pointCount)
+static CGRect MakeBoundsFromPoints(const CSkStoredPoint* pts, int pointCount)
 {
     float xmin = 1e10;
     float xmax = -1e10;
@@ -166,7 +226,7 @@ static CGRect MakeBoundsFromPoints(CGPoint* pts, int pointCount)
     int i = 0;
     while (i < pointCount)
     {
-	CGPoint pt = pts[i];
+	CGPoint pt = LoadPoint(pts[i]);
 	if (pt.x < xmin)	xmin = pt.x;
 	if (pt.x > xmax)	xmax = pt.x;
 	if (pt.y < ymin)	ymin = pt.y;
@@ -187,9 +247,11 @@ CGRect CSkShapeGetBounds(CSkShape* sh)
 	case kQuadBezier:   bounds = MakeBoundsFromPoints(sh->u.points, 3);	break;
 	case kCubicBezier:  bounds = MakeBoundsFromPoints(sh->u.points, 4);	break;
         case kRectShape:
-        case kOvalShape:    bounds = sh->u.bounds;				break;
-        case kRRectShape:   bounds = sh->u.rrect.bounds;			break;
-	default:	    bounds = CGPathGetBoundingBox(sh->u.path);		break;
+        case kOvalShape:    bounds = LoadRect(sh->u.bounds);			break;
+        case kRRectShape:   bounds = LoadRect(sh->u.rrect.bounds);		break;
+	default:	    
+	    bounds = (sh->u.polygon != NULL) ? CSkPolygonGetBounds(sh->u.polygon) : CGRectNull;
+	    break;
     }
     return bounds;
 }
@@ -201,14 +263,43 @@ CGPoint CSkShapeGetRRectRadii(const CSkShape* sh)
 }
 
 //------------------------------------------------------------------------------
-CGMutablePathRef CSkShapeGetPath(const CSkShape* sh)
+void CSkShapeSetRRectRadii(CSkShape* sh, float rX, float rY)
 {
-    CGMutablePathRef path = NULL;
-    
-    if (CSkShapeUsesPath(sh))
-	path = sh->u.path;
-	    
-    return path;
+    sh->u.rrect.rX = rX;
+    sh->u.rrect.rY = rY;
+}
+
+//------------------------------------------------------------------------------
+// The path belongs to sh, and is only valid until sh is changed; see CSkPolygonGetPath.
+CGPathRef CSkShapeGetPath(const CSkShape* sh)
+{
+    if (!CSkShapeUsesPolygon(sh) || (sh->u.polygon == NULL))
+	return NULL;
+    return CSkPolygonGetPath(sh->u.polygon);
+}
+
+//------------------------------------------------------------------------------
+// For drawing a polygon; see CSkPolygonAddToContext.
+void CSkShapeAddPolygonToContext(const CSkShape* sh, CGContextRef ctx)
+{
+    if (CSkShapeUsesPolygon(sh) && (sh->u.polygon != NULL))
+	CSkPolygonAddToContext(sh->u.polygon, ctx);
+}
+
+//------------------------------------------------------------------------------
+UInt32 CSkShapeGetPolygonCount(const CSkShape* sh)
+{
+    if (!CSkShapeUsesPolygon(sh) || (sh->u.polygon == NULL))
+	return 0;
+    return CSkPolygonGetCount(sh->u.polygon);
+}
+
+//------------------------------------------------------------------------------
+// Copies out count points and their verbs, from first on; outPoints or outVerbs may be NULL.
+void CSkShapeGetPolygonPoints(const CSkShape* sh, UInt32 first, UInt32 count, CGPoint* outPoints, UInt8* outVerbs)
+{
+    if (CSkShapeUsesPolygon(sh) && (sh->u.polygon != NULL))
+	CSkPolygonGetPoints(sh->u.polygon, first, count, outPoints, outVerbs);
 }
 
 //------------------------------------------------------------------------------
@@ -217,9 +308,9 @@ void CSkShapeSetBounds(CSkShape* sh, CGRect rect)
     if ((sh->shapeType >= kRectShape) && (sh->shapeType <= kRRectShape))
     {
         if (sh->shapeType != kRRectShape)
-            sh->u.bounds = rect;
+            sh->u.bounds = StoreRect(rect);
         else
-	    sh->u.rrect.bounds = rect;
+	    sh->u.rrect.bounds = StoreRect(rect);
     }
     else
     {
@@ -227,14 +318,6 @@ void CSkShapeSetBounds(CSkShape* sh, CGRect rect)
     }
 }
 
-//------------------------------------------------------------------------------
-static void CSkShapeSetPath(CSkShape* sh, CGMutablePathRef path)
-{
-    if (sh->u.path != NULL)
-	CGPathRelease(sh->u.path);
-    sh->u.path = (CGMutablePathRef) CGPathRetain(path);
-}
-
 //--------------------------------------------------------------
 // (Cannot think of any non-redundant comment ...)
 void CSkShapeOffset(CSkShape* sh, float offsetX, float offsetY)
@@ -248,10 +331,8 @@ void CSkShapeOffset(CSkShape* sh, float offsetX, float offsetY)
             int i;
 	    for (i = 0; i < 4; ++i)
 	    {
-		CGPoint p = sh->u.points[i];
-		p.x += offsetX;
-		p.y += offsetY;
-		sh->u.points[i] = p;
+		sh->u.points[i].x += offsetX;
+		sh->u.points[i].y += offsetY;
 	    }
         }
         break;
@@ -267,12 +348,9 @@ void CSkShapeOffset(CSkShape* sh, float offsetX, float offsetY)
         break;
 		
 	case kFreePolygon:
-	{	
-	    CGMutablePathRef newPath = CopyPathWithOffset(sh->u.path, offsetX, offsetY);
-	    CGPathRelease(sh->u.path);
-	    sh->u.path = newPath;
-	}
-	break;
+	    if (sh->u.polygon != NULL)
+		CSkPolygonOffset(sh->u.polygon, offsetX, offsetY);
+	    break;
     }
 }
 
@@ -336,30 +414,17 @@ Boolean NextGrabberRect(CSkShape* sh, int* ioGrabber, CGRect* grabRect)
         *grabRect   = CGRectOffset(grabR, bounds.origin.x + xD[grNum] * halfWidth,
                                           bounds.origin.y + yD[grNum] * halfHeight );
     }
-    else // control points of path
+    else // control points of the polygon
     {
-	// For now, only polygons ...
-	static CGPoint* sPtArray = NULL;
-	static int		sNumPoints = 0;
+	CGPoint pt;
 	
-	if (grNum == 0)	// first request: allocate array of positions
+	if ((sh->u.polygon == NULL) || ((UInt32)grNum >= CSkPolygonGetCount(sh->u.polygon)))
 	{
-	    // Run through path to extract control points
-	    sPtArray = ExtractControlPoints(CSkShapeGetPath(sh), &sNumPoints);
-	}
-	
-	if (grNum > sNumPoints - 1)	// this was the last one - time to deallocate
-	{
-	    free(sPtArray);
-	    sPtArray = NULL;
-	    sNumPoints = 0;
 	    *ioGrabber = 0;
 	    return false;
 	}
-	else 
-	{
-	    *grabRect = CGRectOffset( grabR, sPtArray[grNum].x, sPtArray[grNum].y );
-	}
+	pt = CSkPolygonGetPoint(sh->u.polygon, grNum);
+	*grabRect = CGRectOffset( grabR, pt.x, pt.y );
     }
 	
     *ioGrabber = grNum + 1;
@@ -390,7 +455,7 @@ void CSkShapeResize(CSkShape* sh, int* grabberNum, CGPoint newPt)
     if ((shapeType == kLineShape) || (shapeType == kQuadBezier) || (shapeType == kCubicBezier))
     {
 	if (*grabberNum <= shapeType + 1)   // uses special values of shapeType enums!
-	sh->u.points[*grabberNum - 1] = newPt;
+	sh->u.points[*grabberNum - 1] = StorePoint(newPt);
     }
     else if (shapeType == kRectShape || shapeType == kOvalShape || shapeType == kRRectShape)
     {
@@ -479,16 +544,61 @@ void CSkShapeResize(CSkShape* sh, int* grabberNum, CGPoint newPt)
         }
         CSkShapeSetBounds(sh, CGRectStandardize(bounds));
     }
-    else	// need to rebuild the path with the <*grabberNum> control point replaced
+    else	// replace the <*grabberNum> control point (1-based) in place
     {
-	CGMutablePathRef newPath = CreateResizedPath(sh->u.path, *grabberNum, newPt);
-	CGPathRelease(sh->u.path);
-	sh->u.path = newPath;
+	CSkPolygonPtr poly = sh->u.polygon;
+	if ((poly != NULL) && (*grabberNum >= 1) && ((UInt32)*grabberNum <= CSkPolygonGetCount(poly)))
+	    CSkPolygonMovePoint(poly, *grabberNum - 1, newPt);
     }
 	
 }	// CSkShapeResize
 
 
+//--------------------------------------------------------------------
+// Adds one path element: 1 point for kCSkPolygonMoveTo and kCSkPolygonLineTo,
+// 2 for kCSkPolygonQuadTo, 3 for kCSkPolygonCurveTo. A polygon starts with a moveTo;
+// if the first element is something else, its first point is also made the start.
+Boolean CSkShapeAddPolygonElement(CSkShape* sh, int verb, const CGPoint* pts)
+{
+    const UInt8 verbs[3] = { verb, kCSkPolygonContinuation, kCSkPolygonContinuation };
+    const UInt8 moveTo = kCSkPolygonMoveTo;
+    UInt32	numPoints;
+    
+    if (sh->shapeType != kFreePolygon)
+    {
+	fprintf(stderr, "CSkShapeAddPolygonElement: wrong shapeType\n");
+	return false;
+    }
+    switch (verb)
+    {
+	case kCSkPolygonMoveTo:
+	case kCSkPolygonLineTo:	    numPoints = 1;  break;
+	case kCSkPolygonQuadTo:	    numPoints = 2;  break;
+	case kCSkPolygonCurveTo:    numPoints = 3;  break;
+	default:		    return false;
+    }
+    
+    if (sh->u.polygon == NULL)
+    {
+	sh->u.polygon = CSkPolygonCreate();
+	if (sh->u.polygon == NULL)
+	    return false;
+    }
+    if ((CSkPolygonGetCount(sh->u.polygon) == 0) && (verb != kCSkPolygonMoveTo))
+    {
+	if (!CSkPolygonAppend(sh->u.polygon, pts, &moveTo, 1))
+	    return false;
+    }
+    return CSkPolygonAppend(sh->u.polygon, pts, verbs, numPoints);
+}
+
+//--------------------------------------------------------------------
+void CSkShapeClosePolygonSubpath(CSkShape* sh)
+{
+    if (CSkShapeUsesPolygon(sh) && (sh->u.polygon != NULL))
+	CSkPolygonCloseSubpath(sh->u.polygon);
+}
+
 //--------------------------------------------------------------------
 void CSkShapeAddPolygonPoint(CSkShape* sh, CGPoint pt)
 {
@@ -499,21 +609,121 @@ void CSkShapeAddPolygonPoint(CSkShape* sh, CGPoint pt)
 	return;
     }
     
-    if (sh->u.path == NULL)
-    {
-	sh->u.path = CGPathCreateMutable();
-    }
+    if (!CSkShapeAddPolygonElement(sh, (CSkShapeGetPolygonCount(sh) == 0) ? kCSkPolygonMoveTo : kCSkPolygonLineTo, &pt))
+	fprintf(stderr, "CSkShapeAddPolygonPoint: can't allocate\n");
+}
 
-    if (CGPathIsEmpty(sh->u.path))
+
+//------------------------------------------------------------------------------
+// We represent a polygon as array of path elements, where each path element is a
+// dictionary with a kPathElementType key and up to three points; a closed subpath
+// gets an element of its own.
+static void AddPolygonToDict(CFMutableDictionaryRef objDict, const CSkShape* sh)
+{
+    CFMutableArrayRef	array = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
+    UInt32		i, count = CSkShapeGetPolygonCount(sh);
+    CGPoint*		points = (CGPoint*)malloc((count > 0 ? count : 1) * sizeof(CGPoint));
+    UInt8*		verbs = (UInt8*)malloc(count > 0 ? count : 1);
+    
+    if ((points == NULL) || (verbs == NULL))
     {
-	CGPathMoveToPoint(sh->u.path, NULL, pt.x, pt.y);
+	fprintf(stderr, "AddPolygonToDict: can't allocate %lu points\n", (unsigned long)count);
+	count = 0;
     }
     else
+	CSkShapeGetPolygonPoints(sh, 0, count, points, verbs);
+	
+    for (i = 0; i < count; ++i)
     {
-	CGPathAddLineToPoint(sh->u.path, NULL, pt.x, pt.y);
+	CFMutableDictionaryRef	elemDict = CFDictionaryCreateMutable(kCFAllocatorDefault, 7, 
+					    &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+	int			verb = verbs[i] & kCSkPolygonVerbMask;
+	const CGPoint*		pts = points + i;
+	
+	AddIntegerToDict(elemDict, kPathElementType, verb);
+	switch (verb)
+	{
+	    case kCSkPolygonCurveTo:
+		AddFloatToDict(elemDict, kX2, pts[2].x);
+		AddFloatToDict(elemDict, kY2, pts[2].y);
+		i += 1;
+	    // fall through
+	    
+	    case kCSkPolygonQuadTo:
+		AddFloatToDict(elemDict, kX1, pts[1].x);
+		AddFloatToDict(elemDict, kY1, pts[1].y);
+		i += 1;
+	    // fall through
+	    
+	    default:
+		AddFloatToDict(elemDict, kX0, pts[0].x);
+		AddFloatToDict(elemDict, kY0, pts[0].y);
+	    break;
+	}
+	CFArrayAppendValue(array, elemDict);
+	CFRelease(elemDict);
+	
+	if (verbs[i] & kCSkPolygonClose)
+	{
+	    elemDict = CFDictionaryCreateMutable(kCFAllocatorDefault, 1, 
+					    &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+	    AddIntegerToDict(elemDict, kPathElementType, kCGPathElementCloseSubpath);
+	    CFArrayAppendValue(array, elemDict);
+	    CFRelease(elemDict);
+	}
     }
+    CFDictionaryAddValue(objDict, kPath, array);
+    CFRelease(array);
+    free(points);
+    free(verbs);
 }
 
+//------------------------------------------------------------------------------
+static void AddPolygonFromDict(CSkShape* sh, CFDictionaryRef objDict)
+{
+    CFArrayRef	array = CFDictionaryGetValue(objDict, kPath);
+    CFIndex	count = (array != NULL) ? CFArrayGetCount(array) : 0;
+    CFIndex	i;
+
+    for (i = 0; i < count; ++i)
+    {
+	CFDictionaryRef pathElem = (CFDictionaryRef)CFArrayGetValueAtIndex(array, i);
+	int		elemType = GetIntegerFromDict(pathElem, kPathElementType);
+	CGPoint		pts[3];
+
+	if (elemType == kCGPathElementCloseSubpath)
+	{
+	    CSkShapeClosePolygonSubpath(sh);
+	    continue;
+	}
+	switch (elemType)
+	{
+	    case kCGPathElementAddCurveToPoint:
+		pts[2].x = GetFloatFromDict(pathElem, kX2);
+		pts[2].y = GetFloatFromDict(pathElem, kY2);
+	    // fall through
+	    
+	    case kCGPathElementAddQuadCurveToPoint:
+		pts[1].x = GetFloatFromDict(pathElem, kX1);
+		pts[1].y = GetFloatFromDict(pathElem, kY1);
+	    // fall through
+	    
+	    case kCGPathElementMoveToPoint:
+	    case kCGPathElementAddLineToPoint:
+		pts[0].x = GetFloatFromDict(pathElem, kX0);
+		pts[0].y = GetFloatFromDict(pathElem, kY0);
+	    break;
+	    
+	    default:
+	    continue;
+	}
+	if (!CSkShapeAddPolygonElement(sh, elemType, pts))
+	{
+	    fprintf(stderr, "AddPolygonFromDict: can't allocate\n");
+	    break;
+	}
+    }
+}
 
 //------------------------------------------------------------------------------
 void AddCSkShapeToDict(CSkShape* sh, CFMutableDictionaryRef objDict)
@@ -559,7 +769,7 @@ void AddCSkShapeToDict(CSkShape* sh, CFMutableDictionaryRef objDict)
 	    break;
 	    	    
 	case kFreePolygon:
-	    CFDictionaryAddValue(objDict, kPath, sh->u.path);
+	    AddPolygonToDict(objDict, sh);
 	    break;
     }
 }
@@ -606,10 +816,7 @@ CSkShape* CreateCSkShapeFromDict(CFDictionaryRef objDict)
 	break;
 		
 	case kFreePolygon:
-	{
-	    CGMutablePathRef path = (CGMutablePathRef)CFDictionaryGetValue(objDict, kPath);
-	    CSkShapeSetPath(sh, path);
-	}
+	    AddPolygonFromDict(sh, objDict);
 	break;
     }
     return sh;
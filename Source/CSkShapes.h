@@ -49,15 +49,48 @@
 
 typedef struct CSkShape CSkShape, *CSkShapePtr;
 
+// With CSK_COMPACT_GEOMETRY non-zero, shapes keep their coordinates as float32 instead of
+// CGFloat, and free polygons their vertices as 16-bit steps on a grid of kCSkPolygonQuantum,
+// starting over from an absolute point every 64 vertices. Coordinates are decoded to CGFloat
+// (polygons with vDSP) whenever they are drawn, hit-tested or read. Precision:
+//  - float32 keeps 24 significant bits: below 8192 pt, a coordinate is off by at most 1/4096 pt.
+//  - A quantized vertex is within kCSkPolygonQuantum / 2 (1/64 pt) of where it was put, and
+//    a quantized polygon moves in whole grid steps. Steps are exact; errors don't add up.
+//  - A polygon with two consecutive vertices more than 1023 pt apart, or a vertex farther out
+//    than 262143 pt, falls back to float32 vertices for good.
+// Documents are written with float32 coordinates either way.
+#ifndef CSK_COMPACT_GEOMETRY
+#define CSK_COMPACT_GEOMETRY 0
+#endif
+
+#define kCSkPolygonQuantum  (1.0f / 32)
+
+// Free polygons keep their points in one packed array, with a verb for each point that
+// says how it continues the path (see CSkPolygons.h). Vertices are edited in place, and a
+// move is kept as a translation until the next edit; the CGPath returned by CSkShapeGetPath
+// is built from the untranslated points when it is first asked for.
+enum {
+    kCSkPolygonMoveTo	    = kCGPathElementMoveToPoint,
+    kCSkPolygonLineTo	    = kCGPathElementAddLineToPoint,
+    kCSkPolygonQuadTo	    = kCGPathElementAddQuadCurveToPoint,    // control point, then end point
+    kCSkPolygonCurveTo	    = kCGPathElementAddCurveToPoint,	    // two control points, then end point
+    kCSkPolygonContinuation = 0x7F,	// the 2nd or 3rd point of a curve element
+    kCSkPolygonVerbMask	    = 0x7F,
+    kCSkPolygonClose	    = 0x80	// flag on the last point of a closed subpath
+};
+
 ByteCount   CSkShapeSize(void);
+ByteCount   CSkShapeGetStorageSize(const CSkShape* sh);
 CSkShapePtr CSkShapeCreate(int shapeType);
+CSkShapePtr CSkShapeCreateCopy(const CSkShape* sh);
 void        CSkShapeRelease(CSkShape* sh);
 
 void	    CSkShapeSetType(CSkShapePtr sh, int shapeType);
 int         CSkShapeGetType(const CSkShape* sh);
-CGPoint*    CSkShapeGetPoints(CSkShapePtr sh);
+int	    CSkShapeGetPoints(const CSkShape* sh, CGPoint outPoints[4]);
 CGPoint     CSkShapeGetRRectRadii(const CSkShape* sh);
-CGMutablePathRef CSkShapeGetPath(const CSkShape* sh);
+CGPathRef   CSkShapeGetPath(const CSkShape* sh);
+void	    CSkShapeSetRRectRadii(CSkShape* sh, float rX, float rY);
 CGRect      CSkShapeGetBounds(CSkShape* sh);
 void        CSkShapeSetBounds(CSkShape* sh, CGRect rect);
 
@@ -68,6 +101,11 @@ Boolean	    NextGrabberRect(CSkShape* sh, int* ioGrabber, CGRect* grabRect);
 
 void	    CSkShapeSetPointAtIndex(CSkShape* sh, CGPoint pt, int index);
 void	    CSkShapeAddPolygonPoint(CSkShape* sh, CGPoint pt);
+Boolean	    CSkShapeAddPolygonElement(CSkShape* sh, int verb, const CGPoint* pts);
+void	    CSkShapeClosePolygonSubpath(CSkShape* sh);
+UInt32	    CSkShapeGetPolygonCount(const CSkShape* sh);
+void	    CSkShapeGetPolygonPoints(const CSkShape* sh, UInt32 first, UInt32 count, CGPoint* outPoints, UInt8* outVerbs);
+void	    CSkShapeAddPolygonToContext(const CSkShape* sh, CGContextRef ctx);
 
 void	    AddCSkShapeToDict(CSkShape* sh, CFMutableDictionaryRef objDict);
 CSkShapePtr CreateCSkShapeFromDict(CFDictionaryRef objDict);
@@ -0,0 +1,295 @@
+/*
+    File:       CSkSnapping.c
+        
+    Contains:	Hashed object edges, for snapping to other objects and to the grid
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#include "CSkSnapping.h"
+
+// Each axis is an open-addressing table from a quantized coordinate to the number of edges
+// there, with the first edge's exact value so that a snap lands on it. A slot whose count has
+// gone back to 0 keeps its key until the table is rebuilt, so removal doesn't break probe chains.
+
+enum {
+    kSnapMinSlots   = 64,
+    kSnapEmptyKey   = (SInt32)0x80000000,
+    kSnapMaxKey	    = 0x3FFFFFFF
+};
+
+struct SnapSlot
+{
+    SInt32	key;	    // kSnapEmptyKey if never used
+    UInt32	count;
+    float	value;
+};
+typedef struct SnapSlot SnapSlot;
+
+struct SnapAxis
+{
+    SnapSlot*	slots;
+    UInt32	numSlots;   // a power of 2
+    UInt32	shift;	    // 32 - log2(numSlots)
+    UInt32	numUsed;    // slots with a key, counted or not
+    UInt32	numKeys;    // slots with a count
+};
+typedef struct SnapAxis SnapAxis;
+
+struct CSkSnapIndex
+{
+    SnapAxis	x;
+    SnapAxis	y;
+};
+
+//--------------------------------------------------------------------------------------
+static SInt32 SnapKey(double v)
+{
+    double k = floor(v * kCSkSnapResolution + 0.5);
+    
+    if (!(k > -kSnapMaxKey))	    // (also catches NaNs)
+	return -kSnapMaxKey;
+    return (k < kSnapMaxKey) ? (SInt32)k : kSnapMaxKey;
+}
+
+static UInt32 FindSlot(const SnapAxis* axis, SInt32 key)
+{
+    UInt32 i = ((UInt32)key * 2654435761U) >> axis->shift;
+    
+    while ((axis->slots[i].key != key) && (axis->slots[i].key != kSnapEmptyKey))
+	i = (i + 1) & (axis->numSlots - 1);
+    return i;
+}
+
+//--------------------------------------------------------------------------------------
+// Rebuilds the table with room for twice the keys it has, leaving out the uncounted ones.
+static Boolean RehashAxis(SnapAxis* axis)
+{
+    SnapSlot*	oldSlots = axis->slots;
+    UInt32	oldNumSlots = axis->numSlots;
+    UInt32	numSlots = kSnapMinSlots, shift = 26, i;
+    
+    while (numSlots < 4 * (axis->numKeys + 1))
+    {
+	numSlots *= 2;
+	shift -= 1;
+    }
+    axis->slots = (SnapSlot*)malloc(numSlots * sizeof(SnapSlot));
+    if (axis->slots == NULL)
+    {
+	axis->slots = oldSlots;
+	return false;
+    }
+    for (i = 0; i < numSlots; ++i)
+    {
+	axis->slots[i].key = kSnapEmptyKey;
+	axis->slots[i].count = 0;
+    }
+    axis->numSlots = numSlots;
+    axis->shift = shift;
+    axis->numUsed = 0;
+    for (i = 0; i < oldNumSlots; ++i)
+    {
+	if (oldSlots[i].count > 0)
+	{
+	    axis->slots[FindSlot(axis, oldSlots[i].key)] = oldSlots[i];
+	    axis->numUsed += 1;
+	}
+    }
+    free(oldSlots);
+    return true;
+}
+
+static void AddValue(SnapAxis* axis, float v)
+{
+    SInt32  key = SnapKey(v);
+    UInt32  i;
+    
+    if (4 * (axis->numUsed + 1) > 3 * axis->numSlots)
+    {
+	if (!RehashAxis(axis) && (axis->numUsed + 1 >= axis->numSlots))
+	    return;	    // full; the edge can't be snapped to
+    }
+    i = FindSlot(axis, key);
+    if (axis->slots[i].key == kSnapEmptyKey)
+    {
+	axis->slots[i].key = key;
+	axis->slots[i].count = 0;
+	axis->numUsed += 1;
+    }
+    if (axis->slots[i].count++ == 0)
+    {
+	axis->slots[i].value = v;
+	axis->numKeys += 1;
+    }
+}
+
+static void RemoveValue(SnapAxis* axis, float v)
+{
+    UInt32 i = FindSlot(axis, SnapKey(v));
+    
+    if (axis->slots[i].count > 0)
+    {
+	axis->slots[i].count -= 1;
+	if (axis->slots[i].count == 0)
+	    axis->numKeys -= 1;
+    }
+}
+
+//--------------------------------------------------------------------------------------
+CSkSnapIndexPtr CSkSnapIndexCreate(void)
+{
+    CSkSnapIndex* index = (CSkSnapIndex*)calloc(1, sizeof(CSkSnapIndex));
+    
+    require(index != NULL, CantAllocate);
+    require(RehashAxis(&index->x) && RehashAxis(&index->y), CantAllocate);
+    return index;
+    
+CantAllocate:
+    fprintf(stderr, "CSkSnapIndexCreate: can't allocate\n");
+    CSkSnapIndexRelease(index);
+    return NULL;
+}
+
+void CSkSnapIndexRelease(CSkSnapIndexPtr index)
+{
+    if (index != NULL)
+    {
+	free(index->x.slots);
+	free(index->y.slots);
+	free(index);
+    }
+}
+
+//--------------------------------------------------------------------------------------
+void CSkSnapIndexAddRect(CSkSnapIndexPtr index, CGRect r)
+{
+    if (CGRectIsNull(r))
+	return;
+    AddValue(&index->x, CGRectGetMinX(r));
+    AddValue(&index->x, CGRectGetMidX(r));
+    AddValue(&index->x, CGRectGetMaxX(r));
+    AddValue(&index->y, CGRectGetMinY(r));
+    AddValue(&index->y, CGRectGetMidY(r));
+    AddValue(&index->y, CGRectGetMaxY(r));
+}
+
+void CSkSnapIndexRemoveRect(CSkSnapIndexPtr index, CGRect r)
+{
+    if (CGRectIsNull(r))
+	return;
+    RemoveValue(&index->x, CGRectGetMinX(r));
+    RemoveValue(&index->x, CGRectGetMidX(r));
+    RemoveValue(&index->x, CGRectGetMaxX(r));
+    RemoveValue(&index->y, CGRectGetMinY(r));
+    RemoveValue(&index->y, CGRectGetMidY(r));
+    RemoveValue(&index->y, CGRectGetMaxY(r));
+}
+
+//--------------------------------------------------------------------------------------
+// The nearest snap for the edges v[0..2] along one axis, as the distance to move them.
+// Each edge looks at the keys within tolerance, nearest first, and stops at the first it finds.
+static float SnapAxisValues(const SnapAxis* axis, const float v[3], float tolerance, float gridWidth, Boolean* outHasGuide, float* outGuide)
+{
+    SInt32  range = (SInt32)ceilf(tolerance * kCSkSnapResolution);
+    float   best = tolerance, delta = 0;
+    int	    e;
+    
+    *outHasGuide = false;
+    *outGuide = 0;
+    for (e = 0; e < 3; ++e)
+    {
+	SInt32	key = SnapKey(v[e]);
+	SInt32	d;
+	
+	for (d = 0; (axis != NULL) && (d <= 2 * range); ++d)
+	{
+	    SInt32 k = (d & 1) ? key - (d + 1) / 2 : key + d / 2;	// key, key + 1, key - 1, key + 2, ...
+	    UInt32 i = FindSlot(axis, k);
+	    
+	    if (axis->slots[i].count > 0)
+	    {
+		float to = axis->slots[i].value;
+		if (fabsf(to - v[e]) <= best)
+		{
+		    best = fabsf(to - v[e]);
+		    delta = to - v[e];
+		    *outHasGuide = true;
+		    *outGuide = to;
+		}
+		break;
+	    }
+	}
+    }
+    if (gridWidth > 0)
+    {
+	for (e = 0; e < 3; ++e)
+	{
+	    float to = 0.5 + gridWidth * floorf((v[e] - 0.5) / gridWidth + 0.5);
+	    if (fabsf(to - v[e]) < best)
+	    {
+		best = fabsf(to - v[e]);
+		delta = to - v[e];
+		*outHasGuide = false;
+	    }
+	}
+    }
+    return delta;
+}
+
+//--------------------------------------------------------------------------------------
+CGSize CSkSnapIndexSnapRect(CSkSnapIndexPtr index, CGRect r, float tolerance, float gridWidth, CSkSnapGuides* outGuides)
+{
+    CSkSnapGuides   guides;
+    float	    vx[3], vy[3];
+    CGSize	    d;
+    
+    r = CGRectStandardize(r);
+    vx[0] = CGRectGetMinX(r);
+    vx[1] = CGRectGetMidX(r);
+    vx[2] = CGRectGetMaxX(r);
+    vy[0] = CGRectGetMinY(r);
+    vy[1] = CGRectGetMidY(r);
+    vy[2] = CGRectGetMaxY(r);
+    d.width = SnapAxisValues((index != NULL) ? &index->x : NULL, vx, tolerance, gridWidth, &guides.hasX, &guides.x);
+    d.height = SnapAxisValues((index != NULL) ? &index->y : NULL, vy, tolerance, gridWidth, &guides.hasY, &guides.y);
+    if (outGuides != NULL)
+	*outGuides = guides;
+    return d;
+}
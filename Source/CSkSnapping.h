@@ -0,0 +1,81 @@
+/*
+    File:       CSkSnapping.h
+        
+    Contains:	Interface to the snap index of object edges
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#ifndef __CSKSNAPPING__
+#define __CSKSNAPPING__
+
+#include <Carbon/Carbon.h>
+
+// A snap index holds the left, center and right x and the bottom, middle and top y of a set of
+// rects (for a list, the shape bounds of its objects; see CSkObjListGetSnapIndex), hashed by
+// their value in steps of 1 / kCSkSnapResolution. Adding or removing a rect takes a few hash
+// operations, so the index is kept up to date as objects come, go and move; and finding the
+// nearest edge within a tolerance probes a fixed number of slots however many rects there are.
+
+enum { kCSkSnapResolution = 8 };    // edges less than 1/8 apart count as one
+
+typedef struct CSkSnapIndex CSkSnapIndex, *CSkSnapIndexPtr;  // struct CSkSnapIndex defined in CSkSnapping.c
+
+struct CSkSnapGuides	// the edges a rect was snapped to, to show as alignment guides
+{
+    Boolean	hasX;	    // a vertical guide at x
+    Boolean	hasY;	    // a horizontal guide at y
+    float	x;
+    float	y;
+};
+typedef struct CSkSnapGuides CSkSnapGuides;
+
+CSkSnapIndexPtr	CSkSnapIndexCreate(void);
+void		CSkSnapIndexRelease(CSkSnapIndexPtr index);
+void		CSkSnapIndexAddRect(CSkSnapIndexPtr index, CGRect r);
+void		CSkSnapIndexRemoveRect(CSkSnapIndexPtr index, CGRect r);	// r as it was added
+
+// How far to move r so that one of its edges or its center lines up with an edge or center in
+// the index, or else with a grid line (at 0.5 + k * gridWidth, where DrawDocumentBackgroundGrid
+// draws them; no grid if gridWidth is 0). The nearest within tolerance wins, the index before
+// the grid. A point snaps as an empty rect. index may be NULL; so may outGuides, which gets the
+// index edges snapped to.
+CGSize		CSkSnapIndexSnapRect(CSkSnapIndexPtr index, CGRect r, float tolerance, float gridWidth, CSkSnapGuides* outGuides);
+
+#endif
@@ -0,0 +1,242 @@
+/*
+    File:       CSkSpatialIndex.c
+        
+    Contains:	Uniform grid index of object bounds, for finding the objects in a rect
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#include "CSkSpatialIndex.h"
+
+// The grid is laid out like the GRID chunk of a binary document (see CSkFileFormat.c):
+// cells over the union of the object bounds with about kIndexObjectsPerCell objects each,
+// plus an overflow cell, at index cols * rows, for objects that span too many cells.
+// An object is listed in every cell it overlaps, so a lookup marks the objects it has seen.
+
+enum {
+    kIndexObjectsPerCell    = 8,
+    kIndexMaxColsRows	    = 4096,
+    kIndexMaxCellsPerObject = 64    // bigger objects go to the overflow cell
+};
+
+struct CSkSpatialIndex
+{
+    UInt32	numObjects;
+    CGRect*	bounds;		// render bounds, by object
+    float	originX, originY;
+    float	cellWidth, cellHeight;
+    UInt32	cols, rows;
+    UInt32*	cellStarts;	// cols * rows + 2 entries: cell k lists cellIndices[cellStarts[k] .. cellStarts[k + 1] - 1]
+    UInt32*	cellIndices;
+    UInt32*	marks;		// by object: the last lookup that saw it
+    UInt32	stamp;		// the current lookup
+};
+
+//--------------------------------------------------------------------------------------
+static void MakeGrid(CSkSpatialIndex* index, CGRect allBounds)
+{
+    double  numCells = (index->numObjects + kIndexObjectsPerCell - 1) / kIndexObjectsPerCell;
+    double  aspect;
+    
+    if (CGRectIsNull(allBounds) || (CGRectGetWidth(allBounds) <= 0) || (CGRectGetHeight(allBounds) <= 0))
+	allBounds = CGRectMake(0, 0, 1, 1);
+    aspect = CGRectGetWidth(allBounds) / CGRectGetHeight(allBounds);
+    
+    index->cols = (UInt32)sqrt(numCells * aspect);
+    index->cols = (index->cols < 1) ? 1 : (index->cols > kIndexMaxColsRows) ? kIndexMaxColsRows : index->cols;
+    index->rows = (UInt32)(numCells / index->cols);
+    index->rows = (index->rows < 1) ? 1 : (index->rows > kIndexMaxColsRows) ? kIndexMaxColsRows : index->rows;
+    index->originX = CGRectGetMinX(allBounds);
+    index->originY = CGRectGetMinY(allBounds);
+    index->cellWidth = CGRectGetWidth(allBounds) / index->cols;
+    index->cellHeight = CGRectGetHeight(allBounds) / index->rows;
+}
+
+//--------------------------------------------------------------------------------------
+// The range of cells r overlaps, [*c0..*c1] x [*r0..*r1]. Returns false if r is outside the grid.
+static Boolean GetCells(const CSkSpatialIndex* index, CGRect r, UInt32* c0, UInt32* c1, UInt32* r0, UInt32* r1)
+{
+    double x0 = (CGRectGetMinX(r) - index->originX) / index->cellWidth;
+    double x1 = (CGRectGetMaxX(r) - index->originX) / index->cellWidth;
+    double y0 = (CGRectGetMinY(r) - index->originY) / index->cellHeight;
+    double y1 = (CGRectGetMaxY(r) - index->originY) / index->cellHeight;
+    
+    if (CGRectIsNull(r) || !(x1 >= 0) || !(y1 >= 0) || !(x0 < index->cols) || !(y0 < index->rows))
+	return false;	    // (also catches NaNs)
+	
+    *c0 = (x0 > 0) ? (UInt32)x0 : 0;
+    *r0 = (y0 > 0) ? (UInt32)y0 : 0;
+    *c1 = (x1 < index->cols - 1) ? (UInt32)x1 : index->cols - 1;
+    *r1 = (y1 < index->rows - 1) ? (UInt32)y1 : index->rows - 1;
+    return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Counts (outIndices == NULL) or lists object i in one cell; while listing,
+// cellCounts holds the next free slot of each cell.
+static void AddToCell(UInt32 cell, UInt32 i, UInt32* cellCounts, UInt32* outIndices)
+{
+    if (outIndices == NULL)
+	cellCounts[cell] += 1;
+    else
+	outIndices[cellCounts[cell]++] = i;
+}
+
+static void AddToCells(const CSkSpatialIndex* index, UInt32 i, UInt32* cellCounts, UInt32* outIndices)
+{
+    UInt32 c0, c1, r0, r1, c, row;
+    
+    if (!GetCells(index, index->bounds[i], &c0, &c1, &r0, &r1) || ((c1 - c0 + 1) * (r1 - r0 + 1) > kIndexMaxCellsPerObject))
+    {
+	AddToCell(index->cols * index->rows, i, cellCounts, outIndices);	// the overflow cell
+	return;
+    }
+    for (row = r0; row <= r1; ++row)
+    {
+	for (c = c0; c <= c1; ++c)
+	    AddToCell(row * index->cols + c, i, cellCounts, outIndices);
+    }
+}
+
+//--------------------------------------------------------------------------------------
+CSkSpatialIndexPtr CSkSpatialIndexCreate(const CSkObjectPtr* objects, UInt32 numObjects, Boolean drawSelection)
+{
+    CSkSpatialIndex*	index = (CSkSpatialIndex*)calloc(1, sizeof(CSkSpatialIndex));
+    CGRect		allBounds = CGRectNull;
+    UInt32*		cellCounts = NULL;
+    UInt32		numCells, numIndices = 0, i;
+    
+    require(index != NULL, CantAllocate);
+    index->numObjects = numObjects;
+    index->bounds = (CGRect*)malloc((numObjects + 1) * sizeof(CGRect));
+    index->marks = (UInt32*)calloc(numObjects + 1, sizeof(UInt32));
+    require((index->bounds != NULL) && (index->marks != NULL), CantAllocate);
+    for (i = 0; i < numObjects; ++i)
+    {
+	index->bounds[i] = GetDrawObjRenderBounds(objects[i], drawSelection);
+	allBounds = CGRectUnion(allBounds, index->bounds[i]);
+    }
+    MakeGrid(index, allBounds);
+    
+    // count, then list the objects of each cell
+    numCells = index->cols * index->rows + 1;
+    cellCounts = (UInt32*)calloc(numCells + 1, sizeof(UInt32));
+    index->cellStarts = (UInt32*)malloc((numCells + 1) * sizeof(UInt32));
+    require((cellCounts != NULL) && (index->cellStarts != NULL), CantAllocate);
+    for (i = 0; i < numObjects; ++i)
+	AddToCells(index, i, cellCounts, NULL);
+    for (i = 0; i < numCells; ++i)
+    {
+	index->cellStarts[i] = numIndices;
+	numIndices += cellCounts[i];
+	cellCounts[i] = index->cellStarts[i];
+    }
+    index->cellStarts[numCells] = numIndices;
+    index->cellIndices = (UInt32*)malloc((numIndices + 1) * sizeof(UInt32));
+    require(index->cellIndices != NULL, CantAllocate);
+    for (i = 0; i < numObjects; ++i)
+	AddToCells(index, i, cellCounts, index->cellIndices);
+	
+    free(cellCounts);
+    return index;
+    
+CantAllocate:
+    fprintf(stderr, "CSkSpatialIndexCreate: can't allocate for %lu objects\n", (unsigned long)numObjects);
+    free(cellCounts);
+    CSkSpatialIndexRelease(index);
+    return NULL;
+}
+
+//--------------------------------------------------------------------------------------
+void CSkSpatialIndexRelease(CSkSpatialIndexPtr index)
+{
+    if (index != NULL)
+    {
+	free(index->bounds);
+	free(index->cellStarts);
+	free(index->cellIndices);
+	free(index->marks);
+	free(index);
+    }
+}
+
+//--------------------------------------------------------------------------------------
+static int CompareIndices(const void* a, const void* b)
+{
+    UInt32 i = *(const UInt32*)a, k = *(const UInt32*)b;
+    return (i < k) ? -1 : (i > k) ? 1 : 0;
+}
+
+static UInt32 FindInCell(CSkSpatialIndex* index, UInt32 cell, CGRect r, UInt32* outIndices, UInt32 count)
+{
+    UInt32 k;
+    
+    for (k = index->cellStarts[cell]; k < index->cellStarts[cell + 1]; ++k)
+    {
+	UInt32 i = index->cellIndices[k];
+	if (index->marks[i] == index->stamp)
+	    continue;	    // seen in another cell
+	index->marks[i] = index->stamp;
+	if (CGRectIntersectsRect(index->bounds[i], r))
+	    outIndices[count++] = i;
+    }
+    return count;
+}
+
+UInt32 CSkSpatialIndexFindInRect(CSkSpatialIndexPtr index, CGRect r, UInt32* outIndices)
+{
+    UInt32 count, c0, c1, r0, r1, c, row;
+    
+    if (++index->stamp == 0)	// wrapped around: start over
+    {
+	memset(index->marks, 0, index->numObjects * sizeof(UInt32));
+	index->stamp = 1;
+    }
+    count = FindInCell(index, index->cols * index->rows, r, outIndices, 0);
+    if (GetCells(index, r, &c0, &c1, &r0, &r1))
+    {
+	for (row = r0; row <= r1; ++row)
+	{
+	    for (c = c0; c <= c1; ++c)
+		count = FindInCell(index, row * index->cols + c, r, outIndices, count);
+	}
+    }
+    qsort(outIndices, count, sizeof(UInt32), CompareIndices);
+    return count;
+}
@@ -0,0 +1,65 @@
+/*
+    File:       CSkSpatialIndex.h
+        
+    Contains:	Interface to the spatial index of objects
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#ifndef __CSKSPATIALINDEX__
+#define __CSKSPATIALINDEX__
+
+#include <Carbon/Carbon.h>
+#include "CSkObjects.h"
+
+// A spatial index finds the objects whose render bounds intersect a rect without looking at
+// all of them. It is a uniform grid over an array of objects, usually a snapshot of a list
+// (see CreateDrawObjSnapshot), and refers to the objects by their position in that array;
+// the array and the objects' geometry must not change while the index is used.
+
+typedef struct CSkSpatialIndex CSkSpatialIndex, *CSkSpatialIndexPtr;  // struct CSkSpatialIndex defined in CSkSpatialIndex.c
+
+CSkSpatialIndexPtr  CSkSpatialIndexCreate(const CSkObjectPtr* objects, UInt32 numObjects, Boolean drawSelection);
+void		    CSkSpatialIndexRelease(CSkSpatialIndexPtr index);
+
+// Fills outIndices (room for numObjects) with the positions of the objects in r, in ascending
+// order, i.e. front to back for a snapshot; returns how many there are.
+UInt32		    CSkSpatialIndexFindInRect(CSkSpatialIndexPtr index, CGRect r, UInt32* outIndices);
+
+#endif
@@ -0,0 +1,334 @@
+/*
+    File:       CSkStyles.c
+        
+    Contains:	Interned, reference counted drawing attributes shared by CSkObjects
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#include <pthread.h>
+#include <libkern/OSAtomic.h>
+#include "CSkStyles.h"
+
+struct CSkStyle {
+    CSkObjectAttributes	attr;
+    UInt32		hash;
+    UInt32		styleID;
+    int32_t		refCount;
+    CSkStyleTablePtr	table;
+    CSkStylePtr		nextInBucket;
+};
+
+struct CSkStyleTable {
+    pthread_mutex_t	lock;
+    CSkStylePtr*	buckets;
+    UInt32		numBuckets;	// a power of 2
+    UInt32		count;
+    UInt32		nextID;
+    UInt32*		freeIDs;	// of released styles
+    UInt32		numFreeIDs;
+    UInt32		freeIDCapacity;
+    Boolean		released;	// by its owner; goes when its last style does
+};
+
+enum {
+    kInitialBuckets	= 64,
+    kFNVPrime		= 16777619
+};
+
+
+//-------------------------------------------------------------------------------------------
+// FNV-1a, a field at a time. Attributes that compare equal hash the same (but for 0.0 and -0.0).
+static UInt32 HashFloat(UInt32 h, CGFloat f)
+{
+    float   v = f;
+    UInt32  bits;
+    
+    memcpy(&bits, &v, sizeof(bits));
+    return (h ^ bits) * kFNVPrime;
+}
+
+static UInt32 HashColor(UInt32 h, const CGrgba* c)
+{
+    return HashFloat(HashFloat(HashFloat(HashFloat(h, c->r), c->g), c->b), c->a);
+}
+
+static UInt32 HashAttributes(const CSkObjectAttributes* attr)
+{
+    UInt32 h = 2166136261U;
+    
+    h = HashFloat(h, attr->lineWidth);
+    h = (h ^ (UInt32)attr->lineCap) * kFNVPrime;
+    h = (h ^ (UInt32)attr->lineJoin) * kFNVPrime;
+    h = (h ^ (UInt32)attr->lineStyle) * kFNVPrime;
+    h = HashColor(h, &attr->strokeColor);
+    return HashColor(h, &attr->fillColor);
+}
+
+static Boolean EqualColors(const CGrgba* a, const CGrgba* b)
+{
+    return (a->r == b->r) && (a->g == b->g) && (a->b == b->b) && (a->a == b->a);
+}
+
+static Boolean EqualAttributes(const CSkObjectAttributes* a, const CSkObjectAttributes* b)
+{
+    return (a->lineWidth == b->lineWidth) && (a->lineCap == b->lineCap) && (a->lineJoin == b->lineJoin)
+	    && (a->lineStyle == b->lineStyle) && EqualColors(&a->strokeColor, &b->strokeColor)
+	    && EqualColors(&a->fillColor, &b->fillColor);
+}
+
+
+#pragma mark -
+//-------------------------------------------------------------------------------------------
+CSkStyleTablePtr CSkStyleTableCreate(void)
+{
+    CSkStyleTablePtr table = (CSkStyleTablePtr)calloc(1, sizeof(CSkStyleTable));
+    
+    require(table != NULL, CantAllocate);
+    table->numBuckets = kInitialBuckets;
+    table->buckets = (CSkStylePtr*)calloc(table->numBuckets, sizeof(CSkStylePtr));
+    require(table->buckets != NULL, CantAllocate);
+    require_noerr(pthread_mutex_init(&table->lock, NULL), CantAllocate);
+    return table;
+    
+CantAllocate:
+    if (table != NULL)
+	free(table->buckets);
+    free(table);
+    return NULL;
+}
+
+static void DisposeStyleTable(CSkStyleTablePtr table)
+{
+    pthread_mutex_destroy(&table->lock);
+    free(table->buckets);
+    free(table->freeIDs);
+    free(table);
+}
+
+//-------------------------------------------------------------------------------------------
+// Objects may still hold on to styles (an autosave snapshot, say); the table stays around
+// until they let go.
+void CSkStyleTableRelease(CSkStyleTablePtr table)
+{
+    Boolean isEmpty;
+    
+    if (table == NULL)
+	return;
+    pthread_mutex_lock(&table->lock);
+    table->released = true;
+    isEmpty = (table->count == 0);
+    pthread_mutex_unlock(&table->lock);
+    if (isEmpty)
+	DisposeStyleTable(table);
+}
+
+UInt32 CSkStyleTableGetCount(CSkStyleTablePtr table)
+{
+    UInt32 count;
+    
+    pthread_mutex_lock(&table->lock);
+    count = table->count;
+    pthread_mutex_unlock(&table->lock);
+    return count;
+}
+
+//-------------------------------------------------------------------------------------------
+// Called with the lock held. If there's no memory for more buckets, the chains get longer.
+static void GrowBuckets(CSkStyleTablePtr table)
+{
+    UInt32	    numBuckets = 2 * table->numBuckets;
+    CSkStylePtr*    buckets = (CSkStylePtr*)calloc(numBuckets, sizeof(CSkStylePtr));
+    UInt32	    i;
+    
+    if (buckets == NULL)
+	return;
+    for (i = 0; i < table->numBuckets; ++i)
+    {
+	CSkStylePtr style = table->buckets[i];
+	while (style != NULL)
+	{
+	    CSkStylePtr next = style->nextInBucket;
+	    style->nextInBucket = buckets[style->hash & (numBuckets - 1)];
+	    buckets[style->hash & (numBuckets - 1)] = style;
+	    style = next;
+	}
+    }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->numBuckets = numBuckets;
+}
+
+//-------------------------------------------------------------------------------------------
+CSkStylePtr CSkStyleTableIntern(CSkStyleTablePtr table, const CSkObjectAttributes* attr)
+{
+    UInt32	hash = HashAttributes(attr);
+    CSkStylePtr	style;
+    
+    pthread_mutex_lock(&table->lock);
+    for (style = table->buckets[hash & (table->numBuckets - 1)]; style != NULL; style = style->nextInBucket)
+    {
+	if ((style->hash == hash) && EqualAttributes(&style->attr, attr))
+	{
+	    OSAtomicIncrement32(&style->refCount);
+	    goto Done;
+	}
+    }
+    
+    style = (CSkStylePtr)malloc(sizeof(CSkStyle));
+    if (style != NULL)
+    {
+	if (table->count >= 2 * table->numBuckets)
+	    GrowBuckets(table);
+	style->attr = *attr;
+	style->hash = hash;
+	style->styleID = (table->numFreeIDs > 0) ? table->freeIDs[--table->numFreeIDs] : table->nextID++;
+	style->refCount = 1;
+	style->table = table;
+	style->nextInBucket = table->buckets[hash & (table->numBuckets - 1)];
+	table->buckets[hash & (table->numBuckets - 1)] = style;
+	table->count += 1;
+    }
+    else
+	fprintf(stderr, "CSkStyleTableIntern: out of memory\n");
+    
+Done:
+    pthread_mutex_unlock(&table->lock);
+    return style;
+}
+
+//-------------------------------------------------------------------------------------------
+static int CompareStyleIDs(const void* a, const void* b)
+{
+    UInt32 idA = (*(const CSkStylePtr*)a)->styleID;
+    UInt32 idB = (*(const CSkStylePtr*)b)->styleID;
+    return (idA < idB) ? -1 : (idA > idB) ? 1 : 0;
+}
+
+// Every style in the table has a reference while the lock is held; see CSkStyleRelease.
+UInt32 CSkStyleTableCopyStyles(CSkStyleTablePtr table, CSkStylePtr* outStyles, UInt32 maxCount)
+{
+    UInt32	count = 0, i;
+    CSkStylePtr	style;
+    
+    pthread_mutex_lock(&table->lock);
+    for (i = 0; (i < table->numBuckets) && (count < maxCount); ++i)
+    {
+	for (style = table->buckets[i]; (style != NULL) && (count < maxCount); style = style->nextInBucket)
+	{
+	    OSAtomicIncrement32(&style->refCount);
+	    outStyles[count++] = style;
+	}
+    }
+    pthread_mutex_unlock(&table->lock);
+    qsort(outStyles, count, sizeof(CSkStylePtr), CompareStyleIDs);
+    return count;
+}
+
+//-------------------------------------------------------------------------------------------
+// Called with the lock held, for a style nobody uses any more.
+static void RemoveStyle(CSkStyleTablePtr table, CSkStylePtr style)
+{
+    CSkStylePtr* link = &table->buckets[style->hash & (table->numBuckets - 1)];
+    
+    while (*link != style)
+	link = &(*link)->nextInBucket;
+    *link = style->nextInBucket;
+    table->count -= 1;
+    
+    if (table->numFreeIDs == table->freeIDCapacity)
+    {
+	UInt32	capacity = (table->freeIDCapacity > 0) ? 2 * table->freeIDCapacity : kInitialBuckets;
+	UInt32*	freeIDs = (UInt32*)realloc(table->freeIDs, capacity * sizeof(UInt32));
+	
+	if (freeIDs == NULL)
+	    return;				// that ID isn't used again
+	table->freeIDs = freeIDs;
+	table->freeIDCapacity = capacity;
+    }
+    table->freeIDs[table->numFreeIDs++] = style->styleID;
+}
+
+//-------------------------------------------------------------------------------------------
+CSkStylePtr CSkStyleRetain(CSkStylePtr style)
+{
+    OSAtomicIncrement32(&style->refCount);
+    return style;
+}
+
+// Only the last release takes the lock: CSkStyleTableIntern may be handing out the style again.
+void CSkStyleRelease(CSkStylePtr style)
+{
+    CSkStyleTablePtr	table = style->table;
+    Boolean		disposeTable = false;
+    int32_t		count;
+    
+    while ((count = style->refCount) > 1)
+    {
+	if (OSAtomicCompareAndSwap32(count, count - 1, &style->refCount))
+	    return;
+    }
+    
+    pthread_mutex_lock(&table->lock);
+    if (OSAtomicDecrement32(&style->refCount) == 0)
+    {
+	RemoveStyle(table, style);
+	disposeTable = table->released && (table->count == 0);
+	free(style);
+    }
+    pthread_mutex_unlock(&table->lock);
+    if (disposeTable)
+	DisposeStyleTable(table);
+}
+
+//-------------------------------------------------------------------------------------------
+const CSkObjectAttributes* CSkStyleGetAttributes(const CSkStyle* style)
+{
+    return &style->attr;
+}
+
+CSkStyleTablePtr CSkStyleGetTable(const CSkStyle* style)
+{
+    return style->table;
+}
+
+UInt32 CSkStyleGetID(const CSkStyle* style)
+{
+    return style->styleID;
+}
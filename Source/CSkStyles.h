@@ -0,0 +1,94 @@
+/*
+    File:       CSkStyles.h
+        
+    Contains:	Interned, reference counted drawing attributes shared by CSkObjects
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#ifndef __CSKSTYLES__
+#define __CSKSTYLES__
+
+#include <Carbon/Carbon.h>
+#include <ApplicationServices/ApplicationServices.h>
+#include "CSkUtils.h"
+
+
+struct CSkObjectAttributes  // as set in ToolPalette
+{
+    float           lineWidth;
+    CGLineCap       lineCap;
+    CGLineJoin      lineJoin;
+    int             lineStyle;
+    CGrgba          strokeColor;
+    CGrgba          fillColor;
+};
+typedef struct CSkObjectAttributes CSkObjectAttributes;
+
+
+// A drawing uses only a handful of distinct attribute sets, so objects don't carry their
+// own: they share a CSkStyle from their document's CSkStyleTable (see DrawObjList).
+// A style never changes; an object that gets other attributes gets another style.
+// Styles are reference counted; a style that no object uses any more leaves the table.
+// Interning and releasing are thread safe (objects are decoded and autosaved on threads).
+typedef struct CSkStyle CSkStyle, *CSkStylePtr;
+typedef struct CSkStyleTable CSkStyleTable, *CSkStyleTablePtr;
+
+CSkStyleTablePtr CSkStyleTableCreate(void);
+void		CSkStyleTableRelease(CSkStyleTablePtr table);	// the owner's reference
+UInt32		CSkStyleTableGetCount(CSkStyleTablePtr table);
+
+// Returns the table's style with these attributes, retained; adds it if there is none.
+// NULL if we're out of memory.
+CSkStylePtr	CSkStyleTableIntern(CSkStyleTablePtr table, const CSkObjectAttributes* attr);
+
+// Fills outStyles with up to maxCount of the table's styles, retained and in ID order;
+// returns how many there are. The caller releases them.
+UInt32		CSkStyleTableCopyStyles(CSkStyleTablePtr table, CSkStylePtr* outStyles, UInt32 maxCount);
+
+CSkStylePtr	CSkStyleRetain(CSkStylePtr style);
+void		CSkStyleRelease(CSkStylePtr style);
+const CSkObjectAttributes* CSkStyleGetAttributes(const CSkStyle* style);
+CSkStyleTablePtr CSkStyleGetTable(const CSkStyle* style);
+
+// Small and unique among the table's styles in use, for sorting, batching or numbering them;
+// the ID of a released style is given to the next new one.
+UInt32		CSkStyleGetID(const CSkStyle* style);
+
+#endif
@@ -0,0 +1,226 @@
+/*
+    File:       CSkTrace.c
+        
+    Contains:	Per-thread trace span recording, and Chrome trace-event JSON output
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+#include "CSkTrace.h"
+
+#if CSK_TRACING
+
+#include <pthread.h>
+#include <unistd.h>
+#include <limits.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <libkern/OSAtomic.h>
+
+// Every thread that records a span gets its own ring buffer, so recording needs no lock:
+// the owning thread is the only writer. It fills in a slot, then (after a memory barrier)
+// bumps the "written" count. A reader trusts a slot only if the count shows that the writer
+// can't have come around to it again while it was being copied.
+// Buffers are kept after their thread exits, so its spans can still be dumped.
+
+enum {
+    kTraceEventsPerThread	= 16384		// must be a power of 2
+};
+
+struct CSkTraceEvent {
+    const char*	name;
+    UInt64	start;
+    UInt64	end;
+};
+typedef struct CSkTraceEvent CSkTraceEvent;
+
+struct CSkTraceBuffer {
+    struct CSkTraceBuffer*  next;
+    mach_port_t		    threadID;
+    Boolean		    isMainThread;
+    volatile UInt32	    written;		// total count; the next slot is (written & (kTraceEventsPerThread - 1))
+    CSkTraceEvent	    events[kTraceEventsPerThread];
+};
+typedef struct CSkTraceBuffer CSkTraceBuffer;
+
+static pthread_once_t		    sTraceOnce	    = PTHREAD_ONCE_INIT;
+static pthread_key_t		    sBufferKey;
+static pthread_mutex_t		    sListMutex	    = PTHREAD_MUTEX_INITIALIZER;   // only guards sBufferList
+static CSkTraceBuffer*		    sBufferList	    = NULL;
+static mach_timebase_info_data_t    sTimebase;
+static UInt64			    sOrigin;				    // timestamps are relative to this
+
+
+//-------------------------------------------------------------------------------
+static void InitTracing(void)
+{
+    mach_timebase_info(&sTimebase);
+    sOrigin = mach_absolute_time();
+    pthread_key_create(&sBufferKey, NULL);  // no destructor: buffers outlive their threads
+}
+
+//-------------------------------------------------------------------------------
+// Called once per thread, on its first span.
+static CSkTraceBuffer* NewTraceBuffer(void)
+{
+    CSkTraceBuffer* buf = (CSkTraceBuffer*)calloc(1, sizeof(CSkTraceBuffer));
+    if (buf == NULL)
+	return NULL;
+
+    buf->threadID = pthread_mach_thread_np(pthread_self());
+    buf->isMainThread = (pthread_main_np() != 0);
+    pthread_setspecific(sBufferKey, buf);
+    
+    pthread_mutex_lock(&sListMutex);
+    buf->next = sBufferList;
+    sBufferList = buf;
+    pthread_mutex_unlock(&sListMutex);
+    return buf;
+}
+
+//-------------------------------------------------------------------------------
+CSkTraceSpan CSkTraceBeginSpan(const char* name)
+{
+    CSkTraceSpan span;
+
+    pthread_once(&sTraceOnce, InitTracing);
+    span.name = name;
+    span.start = mach_absolute_time();
+    return span;
+}
+
+//-------------------------------------------------------------------------------
+void CSkTraceEndSpan(CSkTraceSpan* span)
+{
+    UInt64	    end = mach_absolute_time();
+    CSkTraceBuffer* buf = (CSkTraceBuffer*)pthread_getspecific(sBufferKey);
+    
+    if (buf == NULL)
+    {
+	buf = NewTraceBuffer();
+	if (buf == NULL)
+	    return;
+    }
+    
+    UInt32	    n = buf->written;
+    CSkTraceEvent*  e = &buf->events[n & (kTraceEventsPerThread - 1)];
+    e->name  = span->name;
+    e->start = span->start;
+    e->end   = end;
+    OSMemoryBarrier();	    // the event must be complete before it becomes visible
+    buf->written = n + 1;
+}
+
+//-------------------------------------------------------------------------------
+static double TicksToMicroseconds(UInt64 ticks)
+{
+    return (double)ticks * sTimebase.numer / sTimebase.denom / 1000.0;
+}
+
+//-------------------------------------------------------------------------------
+static void WriteBufferEvents(FILE* fp, CSkTraceBuffer* buf, int pid, Boolean* ioFirst)
+{
+    UInt32 written = buf->written;
+    UInt32 i = (written > kTraceEventsPerThread) ? written - kTraceEventsPerThread : 0;
+
+    OSMemoryBarrier();
+    fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+		(*ioFirst ? "" : ","), pid, (unsigned)buf->threadID, (buf->isMainThread ? "main" : "worker"));
+    *ioFirst = false;
+
+    for ( ; i != written; ++i)
+    {
+	CSkTraceEvent e = buf->events[i & (kTraceEventsPerThread - 1)];
+	OSMemoryBarrier();
+	if (buf->written - i >= kTraceEventsPerThread)	// overwritten while we were copying it
+	    continue;
+	
+	// span names are literals without quotes or backslashes, so they need no escaping
+	fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"CarbonSketch\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+		    e.name, pid, (unsigned)buf->threadID, 
+		    TicksToMicroseconds(e.start - sOrigin), TicksToMicroseconds(e.end - e.start));
+    }
+}
+
+//-------------------------------------------------------------------------------
+// Write the spans recorded so far as Chrome trace-event JSON, which can be loaded
+// into chrome://tracing or Perfetto. Recording continues while this runs.
+OSStatus CSkTraceWriteChromeTrace(const char* path)
+{
+    FILE*	    fp = fopen(path, "w");
+    Boolean	    first = true;
+    int		    pid = getpid();
+    CSkTraceBuffer* buf;
+
+    if (fp == NULL)
+    {
+	fprintf(stderr, "CSkTraceWriteChromeTrace: can't open %s\n", path);
+	return ioErr;
+    }
+    pthread_once(&sTraceOnce, InitTracing);
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    pthread_mutex_lock(&sListMutex);
+    for (buf = sBufferList; buf != NULL; buf = buf->next)
+	WriteBufferEvents(fp, buf, pid, &first);
+    pthread_mutex_unlock(&sListMutex);
+    fprintf(fp, "\n]}\n");
+    
+    return (fclose(fp) == 0 ? noErr : ioErr);
+}
+
+//-------------------------------------------------------------------------------
+// Dump to $CSK_TRACE_FILE, or to /tmp/CarbonSketch-<pid>.trace.json.
+OSStatus CSkTraceDump(void)
+{
+    char	path[PATH_MAX];
+    const char*	envPath = getenv("CSK_TRACE_FILE");
+    OSStatus	err;
+
+    if (envPath != NULL)
+	strlcpy(path, envPath, sizeof(path));
+    else
+	snprintf(path, sizeof(path), "/tmp/CarbonSketch-%d.trace.json", (int)getpid());
+
+    err = CSkTraceWriteChromeTrace(path);
+    if (err == noErr)
+	fprintf(stderr, "Trace written to %s\n", path);
+    return err;
+}
+
+#endif	// CSK_TRACING
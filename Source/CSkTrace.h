@@ -0,0 +1,88 @@
+/*
+    File:       CSkTrace.h
+        
+    Contains:	Lightweight trace spans for CarbonSketch hot paths
+
+    Disclaimer:	IMPORTANT:  This Apple software is supplied to you by Apple Computer, Inc.
+                ("Apple") in consideration of your agreement to the following terms, and your
+                use, installation, modification or redistribution of this Apple software
+                constitutes acceptance of these terms.  If you do not agree with these terms,
+                please do not use, install, modify or redistribute this Apple software.
+
+                In consideration of your agreement to abide by the following terms, and subject
+                to these terms, Apple grants you a personal, non-exclusive license, under Apples
+                copyrights in this original Apple software (the "Apple Software"), to use,
+                reproduce, modify and redistribute the Apple Software, with or without
+                modifications, in source and/or binary forms; provided that if you redistribute
+                the Apple Software in its entirety and without modifications, you must retain
+                this notice and the following text and disclaimers in all such redistributions of
+                the Apple Software.  Neither the name, trademarks, service marks or logos of
+                Apple Computer, Inc. may be used to endorse or promote products derived from the
+                Apple Software without specific prior written permission from Apple.  Except as
+                expressly stated in this notice, no other rights or licenses, express or implied,
+                are granted by Apple herein, including but not limited to any patent rights that
+                may be infringed by your derivative works or by other works in which the Apple
+                Software may be incorporated.
+
+                The Apple Software is provided by Apple on an "AS IS" basis.  APPLE MAKES NO
+                WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION THE IMPLIED
+                WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+                PURPOSE, REGARDING THE APPLE SOFTWARE OR ITS USE AND OPERATION ALONE OR IN
+                COMBINATION WITH YOUR PRODUCTS.
+
+                IN NO EVENT SHALL APPLE BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR
+                CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+                GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+                ARISING IN ANY WAY OUT OF THE USE, REPRODUCTION, MODIFICATION AND/OR DISTRIBUTION
+                OF THE APPLE SOFTWARE, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT
+                (INCLUDING NEGLIGENCE), STRICT LIABILITY OR OTHERWISE, EVEN IF APPLE HAS BEEN
+                ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+    Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
+*/
+
+
+#ifndef __CSKTRACE__
+#define __CSKTRACE__
+
+#include <Carbon/Carbon.h>
+
+// Trace spans are compiled in only when CSK_TRACING is non-zero (the Development
+// configuration sets it). Otherwise CSK_TRACE_SPAN expands to nothing.
+//
+// Usage, at the top of a function body:
+//	CSK_TRACE_SPAN("DrawThePage");
+// The span ends automatically when the enclosing block is left, including early returns.
+
+#ifndef CSK_TRACING
+#define CSK_TRACING 0
+#endif
+
+enum {
+    kCmdDumpTrace		= 'Trce'	// "Save Trace" menu command, added at startup in trace builds
+};
+
+#if CSK_TRACING
+
+struct CSkTraceSpan {
+    const char*	name;		// must be a string literal: only the pointer is recorded
+    UInt64	start;		// mach_absolute_time() units
+};
+typedef struct CSkTraceSpan CSkTraceSpan;
+
+CSkTraceSpan	CSkTraceBeginSpan(const char* name);
+void		CSkTraceEndSpan(CSkTraceSpan* span);
+
+OSStatus	CSkTraceWriteChromeTrace(const char* path);
+OSStatus	CSkTraceDump(void);
+
+#define CSK_TRACE_SPAN(name) \
+    CSkTraceSpan cskTraceSpan __attribute__((cleanup(CSkTraceEndSpan), unused)) = CSkTraceBeginSpan(name)
+
+#else
+
+#define CSK_TRACE_SPAN(name)
+
+#endif	// CSK_TRACING
+
+#endif
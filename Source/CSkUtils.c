@@ -41,6 +41,11 @@
     Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
 */
 
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "CSkUtils.h"
 #include "CSkConstants.h"
 
@@ -251,6 +256,41 @@ PasteboardRef GetPasteboard(void)
 }
 
 
+//------------------------------------------------------------------------------
+// A data provider for the bytes of the file at path, mapped rather than read: pages come in
+// from the file as they are touched, and the VM system can drop them again, as they are
+// never dirty. Used for PDF files, which can be hundreds of megabytes of scanned pages of
+// which only one is drawn. Returns NULL if the file can't be mapped.
+static void ReleaseMappedFile(void* info, const void* data, size_t size)
+{
+#pragma unused(info)
+    munmap((void*)data, size);
+}
+
+CGDataProviderRef CreateMappedFileDataProvider(const char* path)
+{
+    CGDataProviderRef	provider = NULL;
+    struct stat		sb;
+    void*		base;
+    int			fd = open(path, O_RDONLY);
+    
+    if (fd < 0)
+	return NULL;
+    if ((fstat(fd, &sb) == 0) && (sb.st_size > 0) && ((UInt64)sb.st_size <= SIZE_MAX))
+    {
+	base = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base != MAP_FAILED)
+	{
+	    provider = CGDataProviderCreateWithData(NULL, base, (size_t)sb.st_size, ReleaseMappedFile);
+	    if (provider == NULL)
+		munmap(base, (size_t)sb.st_size);
+	}
+    }
+    close(fd);			// the mapping keeps the file
+    return provider;
+}
+
+
 
 //------------------------------------------------------------------------------
 void AddIntegerToDict(CFMutableDictionaryRef objDict, CFStringRef key, int value)
@@ -318,326 +358,69 @@ void GetRGBAColorFromDict(CFDictionaryRef theDict, CFStringRef key, CGrgba* colo
     color->a = GetFloatFromDict(colorDict, kKeyAlpha);
 }
 
-/*
-//-------------------------------------------------------------- AddPathToDict
-// We represent a path as array of path-elements, where each path element is
-// a dictionary with a kPathElementType key and up to three points.
-static void MyAddToArrayApplier(void *info, const CGPathElement *element)
-{
-    CFMutableArrayRef array = (CFMutableArrayRef)info;
-    CFMutableDictionaryRef pathElementDict = CFDictionaryCreateMutable(kCFAllocatorDefault, 4, 
-					&kCFTypeDictionaryKeyCallBacks, 
-					&kCFTypeDictionaryValueCallBacks);
-    CGPoint p0, p1, p2;
-    
-    AddIntegerToDict(pathElementDict, kPathElementType, element->type);
-
-    switch (element->type)
-    {
-	case kCGPathElementMoveToPoint:
-	case kCGPathElementAddLineToPoint:
-	    p0 = element->points[0];
-	    AddFloatToDict(pathElementDict, kX0, p0.x);
-	    AddFloatToDict(pathElementDict, kY0, p0.y);
-	// fall through
-	
-	case kCGPathElementAddQuadCurveToPoint:
-	    p1 = element->points[1];
-	    AddFloatToDict(pathElementDict, kX1, p1.x);
-	    AddFloatToDict(pathElementDict, kY1, p1.y);
-	// fall through
-	
-	case kCGPathElementAddCurveToPoint:
-	    p2 = element->points[2];
-	    AddFloatToDict(pathElementDict, kX2, p2.x);
-	    AddFloatToDict(pathElementDict, kY2, p2.y);
-	break;
-	
-	case kCGPathElementCloseSubpath:    // nothing to do
-	break;
-    }
-    CFArrayAppendValue(array, pathElementDict);
-    CFRelease(pathElementDict);
-}
-    
-void AddPathToDict(CFMutableDictionaryRef theDict, CGPathRef path)
-{
-    CFMutableArrayRef array = CFArrayCreateMutable(kCFAllocatorDefault, 0, &kCFTypeArrayCallBacks);
-    CGPathApply(path, array, MyAddToArrayApplier);
-    CFDictionaryAddValue(theDict, kPath, path);
-    CFRelease(array);
-}
-*/
-
-/*
 //------------------------------------------------------------------------------
-CGMutablePathRef GetPathFromDict(CFDictionaryRef theDict)
+// The fewest decimals (up to 6) that give back v as a float32, for the text formats we export
+// (SVG, PDF); "%.9g" always does. Returns the length written to p, which needs 32 bytes.
+int FormatShortestFloat(char* p, double v)
 {
-    CGMutablePathRef path = CGPathCreateMutable();
-    CFArrayRef array = CFDictionaryGetValue(theDict, kPath);
-    CFIndex count = CFArrayGetCount(array);
-    CGPoint p0, p1, p2;
-    CFIndex i;
-
-    for (i = 0; i < count; ++i)
-    {
-	CFDictionaryRef pathElem = (CFDictionaryRef)CFArrayGetValueAtIndex(array, i);
-	int elemType = GetIntegerFromDict(pathElem, kPathElementType);
-
-	if (elemType == kCGPathElementCloseSubpath)
-	{
-	    CGPathCloseSubpath(path);
-	    continue;
-	}
-	
-	p0.x = GetFloatFromDict(pathElem, kX0);
-	p0.y = GetFloatFromDict(pathElem, kY0);
-
-	switch (elemType)
-	{
-	    case kCGPathElementMoveToPoint:
-		CGPathMoveToPoint(path, NULL, p0.x, p0.y);
-		break;
-		
-	    case kCGPathElementAddLineToPoint:
-		CGPathAddLineToPoint(path, NULL, p0.x, p0.y);
-		break;
-
-	    case kCGPathElementAddQuadCurveToPoint:
-		p1.x = GetFloatFromDict(pathElem, kX1);
-		p1.y = GetFloatFromDict(pathElem, kY1);
-		CGPathAddQuadCurveToPoint(path, NULL, p0.x, p0.y, p1.x, p1.y);
-		break;
-	    
-	    case kCGPathElementAddCurveToPoint:
-		p1.x = GetFloatFromDict(pathElem, kX1);
-		p1.y = GetFloatFromDict(pathElem, kY1);
-		p2.x = GetFloatFromDict(pathElem, kX2);
-		p2.y = GetFloatFromDict(pathElem, kY2);
-		CGPathAddCurveToPoint(path, NULL, p0.x, p0.y, p1.x, p1.y, p2.x, p2.y);
-	}
-    }
+    const int	kMaxDecimals = 6;
+    float	f = (float)v;
+    double	scale = 1;
+    long long	scaled = 0, unit = 1;
+    int		decimals, n;
     
-    return path;
-}
-*/
-
-
-// More path utilities
-
-//--------------------------------------------------------------
-struct PathOffsetStruct {
-    CGMutablePathRef newPath;
-    float	dx;
-    float	dy;
-};
-typedef struct PathOffsetStruct PathOffsetStruct;
-
-//------------------------------------------------------------------------------
-static void MyOffsetApplier(void *info, const CGPathElement *element)
-{
-    PathOffsetStruct* myStruct = (PathOffsetStruct*)info;
-    CGPoint pt, c1, c2;
-    
-    switch (element->type)
-    {
-	case kCGPathElementMoveToPoint:
-	    pt = element->points[0];
-	    pt.x += myStruct->dx;
-	    pt.y += myStruct->dy;
-	    CGPathMoveToPoint(myStruct->newPath, NULL, pt.x, pt.y);
-	break;
-	
-	case kCGPathElementAddLineToPoint:
-	    pt = element->points[0];
-	    pt.x += myStruct->dx;
-	    pt.y += myStruct->dy;
-	    CGPathAddLineToPoint(myStruct->newPath, NULL, pt.x, pt.y);
-	break;
-	
-	case kCGPathElementAddQuadCurveToPoint:
-	    c1 = element->points[0];
-	    pt = element->points[1];
-	    c1.x += myStruct->dx;
-	    c1.y += myStruct->dy;
-	    pt.x += myStruct->dx;
-	    pt.y += myStruct->dy;
-	    CGPathAddQuadCurveToPoint(myStruct->newPath, NULL, c1.x, c1.y, pt.x, pt.y);
-	break;
-	
-	case kCGPathElementAddCurveToPoint:
-	    c1 = element->points[0];
-	    c2 = element->points[1];
-	    pt = element->points[2];
-	    c1.x += myStruct->dx;
-	    c1.y += myStruct->dy;
-	    c2.x += myStruct->dx;
-	    c2.y += myStruct->dy;
-	    pt.x += myStruct->dx;
-	    pt.y += myStruct->dy;
-	    CGPathAddCurveToPoint(myStruct->newPath, NULL, c1.x, c1.y, c2.x, c2.y, pt.x, pt.y);
-	break;
-	
-	case kCGPathElementCloseSubpath:
-	break;
-    }
-}
-
-
-CGMutablePathRef CopyPathWithOffset(CGPathRef path, float dx, float dy)
-{
-    PathOffsetStruct info;
-    info.newPath = CGPathCreateMutable();
-    info.dx = dx;
-    info.dy = dy;
-    CGPathApply(path, &info, MyOffsetApplier);
-    return info.newPath;
-}
-
-
-
-//------------------------------------------------------------------------------
-#define kNumPointsIncrement	32	/* add room for so many points at a time */
-struct PointExtractStruct {
-    CGPoint* ptArray;
-    ItemCount	numPoints;
-    ItemCount	capacity;
-};
-typedef struct PointExtractStruct PointExtractStruct;
-
-static void 
-AddPoints(PointExtractStruct* myStruct, ItemCount numPoints, CGPoint* points)
-{
-    if (myStruct->numPoints + numPoints > myStruct->capacity)
-    {
-	myStruct->ptArray = realloc(myStruct->ptArray, myStruct->capacity + kNumPointsIncrement);
-	// Error handling ... !!!
-	myStruct->capacity += kNumPointsIncrement;
-    }
-    while (numPoints-- > 0)
+    if (!(fabsf(f) < 1e9f))
+	return sprintf(p, "%.9g", f);
+    for (decimals = 0; decimals <= kMaxDecimals; ++decimals, scale *= 10, unit *= 10)
     {
-	myStruct->ptArray[myStruct->numPoints++] = *points++;
+	scaled = llround(f * scale);
+	if ((float)(scaled / scale) == f)
+	    break;
     }
+    if (decimals > kMaxDecimals)
+	return sprintf(p, "%.9g", f);
+    if (scaled == 0)
+	return sprintf(p, "0");
+    n = sprintf(p, "%s%lld", (scaled < 0) ? "-" : "", llabs(scaled) / unit);
+    if (decimals > 0)
+	n += sprintf(p + n, ".%0*lld", decimals, llabs(scaled) % unit);
+    return n;
 }
 
 //------------------------------------------------------------------------------
-static void MyPointExtractApplier(void *info, const CGPathElement *element)
+void CSkFramePacerReset(CSkFramePacer* pacer)
 {
-    PointExtractStruct* myStruct = (PointExtractStruct*)info;
-    switch (element->type)
-    {
-	case kCGPathElementMoveToPoint:
-	    AddPoints(myStruct, 1, element->points);
-	break;
-	
-	case kCGPathElementAddLineToPoint:
-	    AddPoints(myStruct, 1, element->points);
-	break;
-	
-	case kCGPathElementAddQuadCurveToPoint:
-	    AddPoints(myStruct, 2, element->points);
-	break;
-	
-	case kCGPathElementAddCurveToPoint:
-	    AddPoints(myStruct, 3, element->points);
-	break;
-	
-	case kCGPathElementCloseSubpath:
-	break;
-    }
+    pacer->pending = false;
+    pacer->rendered = 0;
+    pacer->dropped = 0;
 }
 
-//------------------------------------------------------------------------------
-CGPoint* ExtractControlPoints(CGMutablePathRef path, int* outNumPoints)
+// A new state to show; the one still pending, if any, will never be drawn.
+void CSkFramePacerPost(CSkFramePacer* pacer)
 {
-	PointExtractStruct info;
-	info.ptArray = (CGPoint*)malloc(sizeof(CGPoint) * kNumPointsIncrement);
-	info.numPoints = 0;
-	info.capacity = kNumPointsIncrement;
-	CGPathApply(path, &info, MyPointExtractApplier);
-	*outNumPoints = info.numPoints;
-	return info.ptArray;
+    if (pacer->pending)
+	pacer->dropped += 1;
+    pacer->pending = true;
 }
 
-//------------------------------------------------------------------------------
-struct ResizePathStruct {
-	CGMutablePathRef newPath;
-	int		indexOfNewPt;
-	int		currentPtIndex;
-	CGPoint		newPt;
-};
-typedef struct ResizePathStruct ResizePathStruct;
-
-static void MyResizePathApplier(void *info, const CGPathElement *element)
+// Called once per display frame: true if there is a state to draw.
+Boolean CSkFramePacerTakeFrame(CSkFramePacer* pacer)
 {
-    ResizePathStruct* myStruct = (ResizePathStruct*)info;
-    CGPoint pt, c1, c2;
-    
-    switch (element->type)
-    {
-	case kCGPathElementMoveToPoint:
-	    pt = element->points[0];
-	    myStruct->currentPtIndex += 1;
-	    if (myStruct->indexOfNewPt == myStruct->currentPtIndex)
-	    {
-		pt = myStruct->newPt;
-	    }
-	    CGPathMoveToPoint(myStruct->newPath, NULL, pt.x, pt.y);
-	break;
-	
-	case kCGPathElementAddLineToPoint:
-	    pt = element->points[0];
-	    myStruct->currentPtIndex += 1;
-	    if (myStruct->indexOfNewPt == myStruct->currentPtIndex)
-	    {
-		pt = myStruct->newPt;
-	    }
-	    CGPathAddLineToPoint(myStruct->newPath, NULL, pt.x, pt.y);
-	break;
-	
-	case kCGPathElementAddQuadCurveToPoint:
-	    c1 = element->points[0];
-	    pt = element->points[1];
-	    myStruct->currentPtIndex += 2;
-	    if (myStruct->indexOfNewPt == myStruct->currentPtIndex - 1)
-		c1 = myStruct->newPt;
-	    else if (myStruct->indexOfNewPt == myStruct->currentPtIndex)
-		pt = myStruct->newPt;
-	    CGPathAddQuadCurveToPoint(myStruct->newPath, NULL, c1.x, c1.y, pt.x, pt.y);
-	break;
-	
-	case kCGPathElementAddCurveToPoint:
-	    c1 = element->points[0];
-	    c1 = element->points[1];
-	    pt = element->points[2];
-	    myStruct->currentPtIndex += 3;
-	    if (myStruct->indexOfNewPt == myStruct->currentPtIndex - 2)
-		c1 = myStruct->newPt;
-	    else if (myStruct->indexOfNewPt == myStruct->currentPtIndex - 1)
-		c2 = myStruct->newPt;
-	    else if (myStruct->indexOfNewPt == myStruct->currentPtIndex)
-		pt = myStruct->newPt;
-	    CGPathAddCurveToPoint(myStruct->newPath, NULL, c1.x, c1.y, c2.x, c2.y, pt.x, pt.y);
-	break;
-	
-	case kCGPathElementCloseSubpath:
-	break;
-    }
+    if (!pacer->pending)
+	return false;
+    pacer->pending = false;
+    pacer->rendered += 1;
+    return true;
 }
 
-CGMutablePathRef 
-CreateResizedPath(CGMutablePathRef oldPath, int ctlPointIndex, CGPoint newPt)
+// Tracking is over; a state still pending is superseded by the end result.
+void CSkFramePacerFinish(CSkFramePacer* pacer)
 {
-    ResizePathStruct info;
-    info.newPath = CGPathCreateMutable();
-    info.indexOfNewPt = ctlPointIndex;
-    info.newPt = newPt;
-    info.currentPtIndex = 0;	// control points are 1-based
-    CGPathApply(oldPath, &info, MyResizePathApplier);
-    return info.newPath;
+    if (pacer->pending)
+	pacer->dropped += 1;
+    pacer->pending = false;
 }
 
-
 //------------------------------------
 /*
 void ShowPoint(char* msg, CGPoint pt)
@@ -68,6 +68,8 @@ CGColorSpaceRef GetGenericRGBColorSpace(void);
 
 PasteboardRef   GetPasteboard(void);
 
+CGDataProviderRef CreateMappedFileDataProvider(const char* path);
+
 void AddFloatToDict(CFMutableDictionaryRef objDict, CFStringRef key, float value);
 float GetFloatFromDict(CFDictionaryRef theDict, CFStringRef key);
 
@@ -77,15 +79,21 @@ int GetIntegerFromDict(CFDictionaryRef theDict, CFStringRef key);
 void AddRGBAColorToDict(CFMutableDictionaryRef objDict, CFStringRef key, CGrgba* color);
 void GetRGBAColorFromDict(CFDictionaryRef theDict, CFStringRef key, CGrgba* color);
 
-// Path utilities
-CGMutablePathRef CopyPathWithOffset(CGPathRef path, float dx, float dy);
-CGPoint* ExtractControlPoints(CGMutablePathRef path, int* outNumPoints);
+int FormatShortestFloat(char* p, double v);
 
-CGMutablePathRef 
-CreateResizedPath(CGMutablePathRef oldPath, int ctlPointIndex, CGPoint newPt);
+// Tracking feedback is drawn at most once per display frame: each new tracking state is
+// posted, and a timer that fires once a frame draws the latest one (see DoMouseTracking).
+struct CSkFramePacer {
+    Boolean	pending;	// a posted state has not been drawn yet
+    UInt32	rendered;	// frames drawn since the last reset
+    UInt32	dropped;	// states that a later one replaced before they were drawn
+};
+typedef struct CSkFramePacer CSkFramePacer;
 
-void AddPathToDict(CFMutableDictionaryRef theDict, CGPathRef path);
-CGMutablePathRef GetPathFromDict(CFDictionaryRef theDict);
+void	CSkFramePacerReset(CSkFramePacer* pacer);
+void	CSkFramePacerPost(CSkFramePacer* pacer);
+Boolean	CSkFramePacerTakeFrame(CSkFramePacer* pacer);
+void	CSkFramePacerFinish(CSkFramePacer* pacer);
 
 //------------------------------------
 // void ShowPoint(char* msg, CGPoint pt);
@@ -41,6 +41,7 @@
     Copyright  2004-2005 Apple Computer, Inc., All Rights Reserved
 */
 
+#include <limits.h>
 #include "CSkWindow.h"
 #include "CSkDocStorage.h"
 #include "CSkDocumentView.h"
@@ -52,6 +53,11 @@
 #include "NavServicesHandling.h"
 #include "CSkDocumentView.h"
 #include "CSkPDFPasswordEntry.h"
+#include "CSkTrace.h"
+#include "CSkDocReader.h"
+#include "CSkFileFormat.h"
+#include "CSkAutosave.h"
+#include "CSkPasteboard.h"
 
 
 //-----------------------------------------------------------------------------------------------------------------------
@@ -115,67 +121,6 @@ CreateNewWindowFAILED:
 /////////////////////////////// Support for Copy/Paste of PDF Data /////////////////////////////////
 //--------------------------------------------------------------------------------------------------
 
-// To create PDF data for the Pasteboard, we need to set up a CFDataConsumer that collects data in a CFMutableDataRef.
-// Here are the two required callbacks:
-
-static size_t MyCFDataPutBytes(void* info, const void* buffer, size_t count)
-{
-	CFDataAppendBytes((CFMutableDataRef)info, buffer, count);
-	return count;
-}
-
-static void MyCFDataRelease(void* info)
-{
-	CFRelease((CFMutableDataRef)info);
-}
-
-//--------------------------------------------------------------------------------------------------
-// Add the windows contents to the Pasteboard as PDF.  This function assumes that the pasteboard is
-// not NULL. Also, note that we don't include a pdf background if it is password-protected.
-static OSStatus 
-AddWindowContentToPasteboardAsPDF( PasteboardRef pasteboard, DocStorage* docStP)
-{
-    OSStatus		err		= noErr;
-    CFDataRef		pdfData		= CFDataCreateMutable( kCFAllocatorDefault, 0);
-    CGContextRef	pdfContext;
-    CGDataConsumerRef	consumer;
-    CGDataConsumerCallbacks cfDataCallbacks = { MyCFDataPutBytes, MyCFDataRelease };
-    
-    // We need to clear the pasteboard of it's current contents so that this application can
-    // own it and add it's own data.
-    err = PasteboardClear( pasteboard );
-    require_noerr( err, PasteboardClear_FAILED );
-
-    consumer = CGDataConsumerCreate((void*)pdfData, &cfDataCallbacks);
-    
-    // For now (and for demo purposes), just put the whole window drawing as pdf data
-    // on the paste board, regardless of what is selected in the window.
-    pdfContext = CGPDFContextCreate(consumer, &docStP->pageRect, NULL);
-    require(pdfContext != NULL, CGPDFContextCreate_FAILED);
-    
-    CGContextBeginPage(pdfContext, &docStP->pageRect);
-    // Note that we never get here with pdfIsProtected = true && pdfIsUnlocked = false!
-    if (docStP->pdfIsProtected)
-	    docStP->pdfIsUnlocked = false;	// pretend it's not unlocked, so it doesn't get drawn
-    DrawThePage(pdfContext, docStP);
-    if (docStP->pdfIsProtected)
-	    docStP->pdfIsUnlocked = true;	
-    CGContextEndPage(pdfContext);
-    CGContextRelease(pdfContext);   // this finalizes the pdfData
-    
-    err = PasteboardPutItemFlavor( pasteboard, (PasteboardItemID)1,
-					    CFSTR("com.adobe.pdf"), pdfData, 0 );
-    require_noerr( err, PasteboardPutItemFlavor_FAILED );
-    
-CGPDFContextCreate_FAILED:
-PasteboardPutItemFlavor_FAILED:
-    CGDataConsumerRelease(consumer);	// this also releases the pdfData, via MyCFDataRelease
-
-PasteboardClear_FAILED:
-    return err;
-}   // AddWindowContentToPasteboardAsPDF
-
-//--------------------------------------------------------------------------------------------------
 // Check whether the pasteboard contains pdf data. 
 // If so, return the CFDataRef in the pdfData parameter, if it's not NULL.
 static Boolean PasteboardContainsPDF(PasteboardRef inPasteboard, CFDataRef* pdfData)
@@ -273,10 +218,11 @@ PasteboardGetItemCount_FAILED:
 
 
 //--------------------------------------------------------------------------------------------------
-// We keep the pasted-in pdf data separately from the CSkObject list.
-// A new "Open PDF ..." or "Paste" replaces any previous pdf data.
+// We keep the pdf background separately from the CSkObject list.
+// A new "Open PDF ..." or "Paste" replaces any previous pdf background.
 // If the PDF is password protected, try to unlock it via a password entry dialog.
-void AttachPDFToWindow(WindowRef w, CFDataRef pdfData)
+// pdfData holds the bytes of a pasted-in pdf; it is NULL for a pdf file, which provider maps.
+static void AttachPDFProviderToWindow(WindowRef w, CGDataProviderRef provider, CFDataRef pdfData)
 {
     DocStorage*	docStP = GetWindowDocStoragePtr(w);
     if (docStP != NULL)
@@ -286,10 +232,8 @@ void AttachPDFToWindow(WindowRef w, CFDataRef pdfData)
 	if (docStP->pdfDocument != NULL)
 		CGPDFDocumentRelease(docStP->pdfDocument);
 		
-	docStP->pdfData = CFRetain(pdfData);
-	CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, CFDataGetBytePtr(pdfData), CFDataGetLength(pdfData), NULL);
+	docStP->pdfData = (pdfData != NULL) ? CFRetain(pdfData) : NULL;
 	docStP->pdfDocument = CGPDFDocumentCreateWithProvider(provider);
-	CFRelease(provider);	// we created it
 	
 	// Now check whether the pdf is password protected, and if so, try to unlock it
 	docStP->pdfIsProtected  = false; // by default (when CGPDFDocumentIsEncrypted() returns false)
@@ -303,7 +247,34 @@ void AttachPDFToWindow(WindowRef w, CFDataRef pdfData)
 	
 	docStP->indexOrPageNo = 1;
     }
-}	// AttachPDFToWindow
+}	// AttachPDFProviderToWindow
+
+//--------------------------------------------------------------------------------------------------
+void AttachPDFToWindow(WindowRef w, CFDataRef pdfData)
+{
+    CGDataProviderRef provider = CGDataProviderCreateWithData(NULL, CFDataGetBytePtr(pdfData), CFDataGetLength(pdfData), NULL);
+    AttachPDFProviderToWindow(w, provider, pdfData);
+    CFRelease(provider);	// we created it
+}
+
+//--------------------------------------------------------------------------------------------------
+// A pdf file isn't read into memory; CG reads the pages it draws straight from the mapped file.
+static OSStatus AttachPDFFileToWindow(WindowRef w, CFURLRef url)
+{
+    UInt8		path[PATH_MAX];
+    CGDataProviderRef	provider = NULL;
+    
+    if (CFURLGetFileSystemRepresentation(url, true, path, sizeof(path)))
+	provider = CreateMappedFileDataProvider((char*)path);
+    if (provider == NULL)
+    {
+	fprintf(stderr, "AttachPDFFileToWindow: can't map %s\n", (char*)path);
+	return ioErr;
+    }
+    AttachPDFProviderToWindow(w, provider, NULL);
+    CFRelease(provider);	// docStP->pdfDocument holds on to it
+    return noErr;
+}
 
 
 //-------------------------------------------------------
@@ -331,12 +302,36 @@ static void AttachCGImageSourceToWindow(WindowRef w, CGImageSourceRef imgSrc)
     }
 }
 
+//-------------------------------------------------------
+// Reading a large document can take a while: spin the cursor once it has taken
+// longer than a moment, and let command-period or escape cancel.
+struct OpenProgress {
+    EventTime	startTime;
+    UInt32	cursorStep;
+};
+typedef struct OpenProgress OpenProgress;
+
+static Boolean OpenProgressProc(void* refCon, SInt64 bytesRead, SInt64 totalBytes)
+{
+#pragma unused(bytesRead, totalBytes)
+    OpenProgress* progress = (OpenProgress*)refCon;
+    EventTime now = GetCurrentEventTime();
+    
+    if (progress->startTime == 0)
+	progress->startTime = now;
+    else if (now - progress->startTime > 0.5)
+	SetAnimatedThemeCursor(kThemeSpinningCursor, progress->cursorStep++);
+	
+    return !CheckEventQueueForUserCancel();
+}
+
 //-------------------------------------------------------
 static OSStatus OpenFileForWindow(WindowRef w, FSRef* fsRef)
 {
     CFURLRef		url = CFURLCreateFromFSRef(NULL, fsRef);
     LSItemInfoRecord    info;
     OSStatus		err;
+    CSK_TRACE_SPAN("OpenFileForWindow");
     
     err = LSCopyItemInfoForURL( url, kLSRequestExtension | kLSRequestTypeCreator, &info );
     
@@ -345,32 +340,21 @@ static OSStatus OpenFileForWindow(WindowRef w, FSRef* fsRef)
 	// If a pdf document, attach it to window
 	if (CFStringCompare(info.extension, kUTTypePDF, 0) == kCFCompareEqualTo)
 	{
-	    CFDataRef data;
-	    if (!CFURLCreateDataAndPropertiesFromResource(NULL, url, &data, NULL, NULL, &err))
-	    {
-		fprintf(stderr, "CFURLCreateDataAndPropertiesFromResource returned %d\n", (int)err);
-		return err;
-	    }
-	    AttachPDFToWindow(w, data);
+	    err = AttachPDFFileToWindow(w, url);
 	}
 	else if (CFStringCompare(info.extension, CFSTR("CSk "), 0) == kCFCompareEqualTo)
 	{
-	    CFStringRef fileName = CFURLCopyLastPathComponent(url);
-	    SetWindowTitleWithCFString(w, fileName);
-	    CFRelease(fileName);
-
-	    CFReadStreamRef readStream = CFReadStreamCreateWithFile(kCFAllocatorDefault, url);
-	    CFStringRef errorString = NULL;
-	    /* Boolean success = */ CFReadStreamOpen(readStream);
-	    CFPropertyListFormat format;
-	    CFPropertyListRef propList = CFPropertyListCreateFromStream(kCFAllocatorDefault, readStream, 0, 
-			    kCFPropertyListMutableContainers, &format, &errorString);
-	    CFReadStreamClose(readStream);
-	    if (errorString != NULL)
-		CFRelease(errorString);
-	    SetObjectListFromPropertyList(GetWindowDocStoragePtr(w), propList);
-	    CFRelease(propList);
-	    HIWindowSetProxyFSRef(w, fsRef);
+	    // binary or legacy XML property list; CSkReadDocumentFromURL tells them apart
+	    OpenProgress progress = { 0, 0 };
+	    err = CSkReadDocumentFromURL(GetWindowDocStoragePtr(w), url, OpenProgressProc, &progress);
+	    SetThemeCursor(kThemeArrowCursor);
+	    if (err == noErr)
+	    {
+		CFStringRef fileName = CFURLCopyLastPathComponent(url);
+		SetWindowTitleWithCFString(w, fileName);
+		CFRelease(fileName);
+		HIWindowSetProxyFSRef(w, fsRef);
+	    }
 	}
 	else	// pass it to ImageIO. If ImageIO cannot deal with it, imgSrc is NULL.
 	{
@@ -436,7 +420,7 @@ CantGetCount:
 // pasteboard's avalibility and if their is anything to paste.
 static void DoCommandUpdateStatus(EventRef inEvent, WindowRef window, DocStorage* docStP)
 {
-#pragma unused(inEvent, window, docStP)		// for now
+#pragma unused(inEvent, window)		// for now
     MenuRef	    menu;
     MenuItemIndex   unused;
     PasteboardRef   pasteBoardRef;
@@ -451,12 +435,22 @@ static void DoCommandUpdateStatus(EventRef inEvent, WindowRef window, DocStorage
     else
 	DisableMenuCommand(menu, kHICommandCopy);
     
-    // For now, enable "Paste" only if we have a pastebord and their is a pdf on the pasteboard
+    // Enable "Paste" only if we have a pastebord and their are objects or a pdf on the pasteboard
     GetIndMenuItemWithCommandID(NULL, kHICommandPaste, 1, &menu, &unused);
-    if ( pasteBoardRef != NULL && PasteboardContainsPDF(pasteBoardRef, NULL) )
+    if ( pasteBoardRef != NULL && (CSkPasteboardCopyFlavorData(pasteBoardRef, kCSkObjectsFlavorType, NULL) 
+				    || PasteboardContainsPDF(pasteBoardRef, NULL)) )
 	EnableMenuCommand(menu, kHICommandPaste);
     else
 	DisableMenuCommand(menu, kHICommandPaste);
+	
+    // "Compact Document" rewrites the document's file, so it needs one
+    if (GetIndMenuItemWithCommandID(NULL, kCmdCompactDocument, 1, &menu, &unused) == noErr)
+    {
+	if (docStP->fileURL != NULL)
+	    EnableMenuCommand(menu, kCmdCompactDocument);
+	else
+	    DisableMenuCommand(menu, kCmdCompactDocument);
+    }
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -489,17 +483,22 @@ static OSStatus DoCommandProcess(EventRef inEvent, WindowRef window, DocStorage*
     switch (command.commandID)
     {
 	case kHICommandCopy:
-	// for now, only demonstrate how to put the current document content as 'pdf' on the clip board
+	// the selected objects, or the whole page if none are selected (see CSkPasteboard.h)
 	{
-	    err = AddWindowContentToPasteboardAsPDF( GetPasteboard(), docStP);
+	    err = CSkPasteboardPromiseCopy( GetPasteboard(), docStP);
 	}
 	break;
 
 	case kHICommandPaste:
-	// demonstrate how to paste in a 'pdf' from the clip board
+	// objects copied from a CarbonSketch document, or else a 'pdf' from the clip board as background
 	{
-	    CFDataRef pdfData;
-	    if ( PasteboardContainsPDF(GetPasteboard(), &pdfData) )
+	    CFDataRef objectsData, pdfData;
+	    if ( CSkPasteboardCopyFlavorData(GetPasteboard(), kCSkObjectsFlavorType, &objectsData) )
+	    {
+		(void)CSkPasteObjectsFlavorData(docStP, objectsData);
+		CFRelease(objectsData);
+	    }
+	    else if ( PasteboardContainsPDF(GetPasteboard(), &pdfData) )
 	    {
 		AttachPDFToWindow(window, pdfData); // this will retain the pdfData in docStP
 		CFRelease(pdfData);
@@ -513,8 +512,18 @@ static OSStatus DoCommandProcess(EventRef inEvent, WindowRef window, DocStorage*
 	break;
 
         case kHICommandSave:
-//	    (void)SaveTheDocument(window, docStP);
-//	    err = noErr;
+	    // only the changes since the last save go to the file; Save As for a new document,
+	    // or one read from an XML file (see CSkReadDocumentFromURL)
+	    if (docStP->fileURL == NULL)
+		(void)SaveAsCSkDocument(window, docStP);
+	    else
+		(void)CSkSaveDocumentChanges(docStP);
+	    err = noErr;
+	break;
+	
+        case kCmdCompactDocument:
+	    (void)CSkCompactDocument(docStP);
+	    err = noErr;
 	break;
 	
         case kHICommandSaveAs:
@@ -545,12 +554,23 @@ static OSStatus DoCommandProcess(EventRef inEvent, WindowRef window, DocStorage*
 	    err = noErr;
 	    break;
 			
+        case kCmdUpdatePDF:
+	    (void)UpdatePDFDocument(window, docStP);
+	    err = noErr;
+	    break;
+			
+        case kCmdWriteSVG:
+	    (void)SaveAsSVGDocument(window, docStP);
+	    err = noErr;
+	    break;
+			
         case kHICommandClear:       
 	    RemoveSelectedDrawObjs(&docStP->objList); 
 	    err = noErr;
 	    break;
         
 	case kHICommandSelectAll:
+	    MaterializeAllObjects(docStP);
 	    CSkObjListSetSelectState(&docStP->objList, true);
 	    err = noErr;
 	    break;
@@ -561,21 +581,25 @@ static OSStatus DoCommandProcess(EventRef inEvent, WindowRef window, DocStorage*
 	    break;
         
         case kCmdMoveForward:
+	    MaterializeAllObjects(docStP);	// reordering needs the objects in between
 	    MoveObjectForward(&docStP->objList);
 	    err = noErr;
 	    break;
 
         case kCmdMoveToFront:
+	    MaterializeAllObjects(docStP);
 	    MoveObjectToFront(&docStP->objList);
 	    err = noErr;
 	    break;
         
         case kCmdMoveBackward:
+	    MaterializeAllObjects(docStP);
 	    MoveObjectBackward(&docStP->objList);
 	    err = noErr;
 	    break;
         
         case kCmdMoveToBack:
+	    MaterializeAllObjects(docStP);
 	    MoveObjectToBack(&docStP->objList);
 	    err = noErr;
 	    break;
@@ -883,6 +907,7 @@ WindowRef NewCSkWindow(IBNibRef theNibRef, WindowRef toolPalette)
 
     DocStorage*  docStP = CreateDocumentStorage(window, toolPalette);
     SetWindowProperty(window, kCSkSignature, kCSkPerWindowStorage, sizeof(DocStorage*), &docStP);
+    docStP->autosave = CSkAutosaveCreate(docStP, kCSkDefaultAutosaveInterval);
     
     // Create a scroll view in the window with our DocumentView as the scrollable canvas view
     HIViewRef contentView;
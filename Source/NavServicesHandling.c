@@ -42,9 +42,17 @@
 */
 
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
 #include "NavServicesHandling.h"
 #include "CSkDocStorage.h"
 #include "CSkWindow.h"
+#include "CSkTrace.h"
+#include "CSkFileFormat.h"
+#include "CSkPrinting.h"
+#include "CSkSVGExport.h"
+#include "CSkPDFUpdate.h"
 
 #define	kFileCreatorPDF			'prvw'
 #define kFileTypePDF			'PDF '
@@ -52,14 +60,19 @@
 #define	kFileCreatorCSk			'CSk '
 #define kFileTypeCSk			'CSk '
 
+#define	kFileCreatorSVG			kUnknownType
+#define kFileTypeSVG			'SVG '
+
 #define kFileTypePDFCFStr		CFSTR("%@.pdf")		// our format string for making the save as file name
 #define kFileTypeCSkCFStr		CFSTR("%@.csk")
+#define kFileTypeSVGCFStr		CFSTR("%@.svg")
 
 
 struct OurNavDialogData {
     bool	    isOpenDialog;
     bool	    userCanceled;
-    bool	    savePDF;
+    OSType	    fileType;	    // what to save: kFileTypeCSk, kFileTypePDF or kFileTypeSVG
+    OSType	    fileCreator;
     NavDialogRef    dialogRef;
     void*	    userDataP;
 };
@@ -67,81 +80,60 @@ typedef struct OurNavDialogData OurNavDialogData;
 
 
 //-----------------------------------------------------------------------------------------------------------------------
-static OSStatus MakePDFDocument(DocStoragePtr docStP, CFURLRef url)	
+// One PDF page per printed sheet, see CSkPDFExport.h. The file is written so that Update PDF
+// can append what changed to it later (CSkPDFUpdate.h); options is kCSkPDFUpdate or kCSkPDFRewrite.
+static OSStatus MakePDFDocument(DocStoragePtr docStP, CFURLRef url, UInt32 options)	
 {
-    OSStatus                err         = -1;   // generic error code: watch console output!
-    CFMutableDictionaryRef  dict        = CFDictionaryCreateMutable( kCFAllocatorDefault, 0,
-                                                                    &kCFTypeDictionaryKeyCallBacks, 
-                                                                    &kCFTypeDictionaryValueCallBacks); 
-    if (dict != NULL) 
-    {
-        CGContextRef    ctx         = CGPDFContextCreateWithURL(url, &docStP->pageRect, dict);
-        CFStringRef     stringRef;    // Add some producer information to our PDF file
-        
-        CopyWindowTitleAsCFString(docStP->ownerWindow, &stringRef);
-	CFDictionaryAddValue(dict, CFSTR("Title"), stringRef);
+    CFStringRef stringRef = NULL;    // Add some producer information to our PDF file
+    UInt8	path[PATH_MAX];
+    OSStatus	err;
+    CSK_TRACE_SPAN("MakePDFDocument");
+
+    if (!CFURLGetFileSystemRepresentation(url, true, path, sizeof(path)))
+	return fnfErr;
+    CopyWindowTitleAsCFString(docStP->ownerWindow, &stringRef);
+    err = CSkUpdatePDFDocument(docStP, (const char*)path, stringRef, options, NULL);
+    if (stringRef != NULL)
 	CFRelease(stringRef);
-	CFDictionaryAddValue(dict, CFSTR("Creator"), CFSTR("CarbonSketch"));
-
-        if (ctx != NULL)
-        {
-	    CGContextBeginPage(ctx, &docStP->pageRect);
-	    docStP->shouldDrawGrid = false;
-	    DrawThePage(ctx, docStP);
-	    docStP->shouldDrawGrid = true;
-	    CGContextEndPage(ctx);
-	    CGContextRelease(ctx);
-            err = noErr;
-        }
-	CFRelease(dict);
-    }
-    else 
+    if ((err == noErr) && (docStP->pdfURL != url))
     {
-        fprintf(stderr, "CFDictionaryCreateMutable FAILED\n");
+	if (docStP->pdfURL != NULL)
+	    CFRelease(docStP->pdfURL);
+	docStP->pdfURL = (CFURLRef)CFRetain(url);
     }
-    
     return err;
 }   // MakePDFDocument
 
 
 //-----------------------------------------------------------------------------------------------------------------------
-static OSStatus MakeCSkDocument(DocStoragePtr docStP, CFURLRef url)	
+// Written straight into the file that DoFSRefSave created; see CSkSVGExport.h.
+static OSStatus MakeSVGDocument(DocStoragePtr docStP, CFURLRef url)
 {
-    OSStatus err = noErr;   // generic error code: watch console output!
+    UInt8	path[PATH_MAX];
+    int		fd;
+    OSStatus	err;
+    CSK_TRACE_SPAN("MakeSVGDocument");
+
+    if (!CFURLGetFileSystemRepresentation(url, true, path, sizeof(path)))
+	return fnfErr;
+    fd = open((const char*)path, O_WRONLY | O_TRUNC);
+    if (fd < 0)
+	return ioErr;
+    err = CSkWriteSVG(docStP, fd);
+    if ((close(fd) != 0) && (err == noErr))
+	err = ioErr;
+    return err;
+}   // MakeSVGDocument
 
-    CFWriteStreamRef stream = CFWriteStreamCreateWithFile(kCFAllocatorDefault, url); 
-    (void)CFWriteStreamOpen(stream);
 
-    CFStreamStatus status = CFWriteStreamGetStatus(stream);
-    if (status != kCFStreamStatusOpen)
-    {
-	fprintf(stderr, "CFWriteStreamOpen: status = %d\n", (int)status);
-	return -1;
-    }
-    
-    CFPropertyListRef docPList = CSkCreatePropertyList(docStP);
+//-----------------------------------------------------------------------------------------------------------------------
+// New documents are saved in the binary format (see CSkFileFormat.h); XML property list
+// documents from earlier versions can still be opened.
+static OSStatus MakeCSkDocument(DocStoragePtr docStP, CFURLRef url)	
+{
+    CSK_TRACE_SPAN("MakeCSkDocument");
 
-    if (CFWriteStreamCanAcceptBytes(stream))
-    {
-	CFStringRef errorString = NULL;  
-	CFPropertyListWriteToStream(docPList, stream, kCFPropertyListXMLFormat_v1_0, &errorString);  
-	if (errorString != NULL) 
-	{  
-	    fprintf(stderr, "CFPropertyListWriteToStream failed\n");
-	    err = -2;  // watch console output!
-	}
-    }
-    else
-    {
-	fprintf(stderr, "CFWriteStreamCanAcceptBytes() returned FALSE\n");
-    }
-    
-    CFWriteStreamClose(stream);  
-    CFRelease(stream);      
-    
-    CFRelease(docPList);
-    
-    return err;
+    return CSkWriteDocumentToURL(docStP, url, kCSkFormatBinary);
 }   // MakeCSkDocument
 
 
@@ -188,8 +180,8 @@ static OSStatus DoFSRefSave(const OurNavDialogData* dialogDataP, NavReplyRecord*
     
     memset(&fileInfo, 0, sizeof(FInfo));
     
-    fileInfo.fdType = (dialogDataP->savePDF ? kFileTypePDF : kFileTypeCSk);
-    fileInfo.fdCreator = (dialogDataP->savePDF ? kFileCreatorPDF : kFileCreatorCSk);
+    fileInfo.fdType = dialogDataP->fileType;
+    fileInfo.fdCreator = dialogDataP->fileCreator;
     
     memcpy(&catalogInfo.finderInfo, &fileInfo, sizeof(FInfo));
 
@@ -212,11 +204,15 @@ static OSStatus DoFSRefSave(const OurNavDialogData* dialogDataP, NavReplyRecord*
 	return -1;
     }
 
-    if (dialogDataP->savePDF )
+    if (dialogDataP->fileType == kFileTypePDF)
     {
 	// delete the file we just made for making the FSRef
 	FSDeleteObject(&newFSRef);
-	err = MakePDFDocument((DocStoragePtr)dialogDataP->userDataP, saveURL);
+	err = MakePDFDocument((DocStoragePtr)dialogDataP->userDataP, saveURL, kCSkPDFRewrite);
+    }
+    else if (dialogDataP->fileType == kFileTypeSVG)
+    {
+	err = MakeSVGDocument((DocStoragePtr)dialogDataP->userDataP, saveURL);
     }
     else
     {
@@ -325,7 +321,8 @@ static pascal void NavEventProc( NavEventCallbackMessage callBackSelector, NavCB
 
 //-----------------------------------------------------------------------------------------------------------------------
 // this code originates from the NavServices sample code in the CarbonLib SDK
-OSStatus SaveAsPDFDocument (WindowRef w, void* ourDataP)
+// Saves what fileType says once the user has picked a file name (see DoFSRefSave).
+static OSStatus RunSaveDialog(WindowRef w, void* ourDataP, OSType fileType, OSType fileCreator, CFStringRef nameFormat)
 {
     OSStatus 			err = noErr;
     static NavEventUPP          gNavEventProc = NULL;		// event proc for our Nav Dialogs 
@@ -345,7 +342,7 @@ OSStatus SaveAsPDFDocument (WindowRef w, void* ourDataP)
 	CFStringRef         tempString;
         
 	CopyWindowTitleAsCFString(w, &tempString);
-        dialogOptions.saveFileName = CFStringCreateWithFormat(kCFAllocatorDefault, NULL, kFileTypePDFCFStr, tempString);
+        dialogOptions.saveFileName = CFStringCreateWithFormat(kCFAllocatorDefault, NULL, nameFormat, tempString);
 	CFRelease(tempString);
 	
 	// make the dialog modal to our parent doc, AKA sheets
@@ -357,9 +354,10 @@ OSStatus SaveAsPDFDocument (WindowRef w, void* ourDataP)
         {
 	    dialogDataP->dialogRef  = NULL;
 	    dialogDataP->userDataP  = ourDataP;
-            dialogDataP->savePDF = true;
+            dialogDataP->fileType = fileType;
+            dialogDataP->fileCreator = fileCreator;
 	    
-	    err = NavCreatePutFileDialog(&dialogOptions, kFileTypePDF, kFileCreatorPDF,
+	    err = NavCreatePutFileDialog(&dialogOptions, fileType, fileCreator,
 						    gNavEventProc, dialogDataP,
 						    &dialogDataP->dialogRef);
 	    if ((err == noErr) && (dialogDataP->dialogRef != NULL))
@@ -382,68 +380,34 @@ OSStatus SaveAsPDFDocument (WindowRef w, void* ourDataP)
 	    CFRelease( dialogOptions.saveFileName );
     }
     return err;
-}   // SaveAsPDFDocument
+}   // RunSaveDialog
 
 
 //-----------------------------------------------------------------------------------------------------------------------
-OSStatus SaveAsCSkDocument (WindowRef w, void* ourDataP)
+OSStatus SaveAsPDFDocument (WindowRef w, void* ourDataP)
 {
-    OSStatus 			err = noErr;
-    static NavEventUPP          gNavEventProc = NULL;		// event proc for our Nav Dialogs 
-    NavDialogCreationOptions	dialogOptions;
+    return RunSaveDialog(w, ourDataP, kFileTypePDF, kFileCreatorPDF, kFileTypePDFCFStr);
+}
 
-    if (gNavEventProc == NULL)
-    {
-        gNavEventProc = NewNavEventUPP(NavEventProc);
-        if (!gNavEventProc)
-            return memFullErr;
-    }
+// Brings the PDF last exported up to date, without asking where; the first time, it's Save As PDF.
+OSStatus UpdatePDFDocument (WindowRef w, void* ourDataP)
+{
+    DocStoragePtr docStP = (DocStoragePtr)ourDataP;
 
-    err = NavGetDefaultDialogCreationOptions( &dialogOptions );
-    if (err == noErr )
-    {
-	OurNavDialogData*  dialogDataP = NULL;
-	CFStringRef         tempString;
-        
-	CopyWindowTitleAsCFString(w, &tempString);
-        dialogOptions.saveFileName = CFStringCreateWithFormat(kCFAllocatorDefault, NULL, kFileTypeCSkCFStr, tempString);
-	CFRelease(tempString);
-	
-	// make the dialog modal to our parent doc, AKA sheets
-        dialogOptions.parentWindow = w;
-	dialogOptions.modality = kWindowModalityWindowModal;
-	
-	dialogDataP = (OurNavDialogData*)malloc(sizeof(OurNavDialogData));
-	if (dialogDataP)
-        {
-	    dialogDataP->dialogRef  = NULL;
-	    dialogDataP->userDataP  = ourDataP;
-            dialogDataP->savePDF = false;
+    if (docStP->pdfURL == NULL)
+	return SaveAsPDFDocument(w, ourDataP);
+    return MakePDFDocument(docStP, docStP->pdfURL, kCSkPDFUpdate);
+}
 
-	    err = NavCreatePutFileDialog(&dialogOptions, kFileTypeCSk, kFileCreatorCSk,
-						    gNavEventProc, dialogDataP,
-						    &dialogDataP->dialogRef);
-	    if ((err == noErr) && (dialogDataP->dialogRef != NULL))
-	    {
-		err = NavDialogRun( dialogDataP->dialogRef );
-		if (err != noErr)
-		{
-                    fprintf(stderr, "NavDialogRun returned error %d\n", (int)err);
-		}
-	    }
-            else
-            {
-                fprintf(stderr, "NavCreatePutFileDialog returned error %d\n", (int)err);
-            }
-	}
-        else
-	    err = memFullErr;
-       	
-     	if ( dialogOptions.saveFileName != NULL )
-	    CFRelease( dialogOptions.saveFileName );
-    }
-    return err;
-}   // SaveAsCSkDocument
+OSStatus SaveAsSVGDocument (WindowRef w, void* ourDataP)
+{
+    return RunSaveDialog(w, ourDataP, kFileTypeSVG, kFileCreatorSVG, kFileTypeSVGCFStr);
+}
+
+OSStatus SaveAsCSkDocument (WindowRef w, void* ourDataP)
+{
+    return RunSaveDialog(w, ourDataP, kFileTypeCSk, kFileCreatorCSk, kFileTypeCSkCFStr);
+}
 
 
 //-------------------------------------------------------
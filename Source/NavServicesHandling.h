@@ -46,4 +46,6 @@
 
 OSStatus OpenAFile( void );
 OSStatus SaveAsPDFDocument(WindowRef w, void* ourDataP);
+OSStatus UpdatePDFDocument(WindowRef w, void* ourDataP);
+OSStatus SaveAsSVGDocument(WindowRef w, void* ourDataP);
 OSStatus SaveAsCSkDocument(WindowRef w, void* ourDataP);
@@ -46,6 +46,8 @@
 #include "CSkWindow.h"
 #include "CSkToolPalette.h"
 #include "CSkConstants.h"
+#include "CSkTrace.h"
+#include "CSkPasteboard.h"
 
 // Keep our nibRef around as global (CreateNibReference is expensive)
 IBNibRef    gOurNibRef;
@@ -78,6 +80,11 @@ static	pascal	OSStatus AppEventHandlerProc( EventHandlerCallRef inCallRef, Event
 			case kHICommandOpen:
 				err = OpenAFile();
 			break;
+#if CSK_TRACING
+			case kCmdDumpTrace:
+				err = CSkTraceDump();
+			break;
+#endif
         }
     }
     return err;
@@ -109,6 +116,19 @@ CantGetDocList:
 } // DoOpenDocument
 
 
+#if CSK_TRACING
+//-----------------------------------------------
+// Trace builds get a "Save Trace" item at the end of the File menu.
+static void AddTraceMenuItem(void)
+{
+    MenuRef	    fileMenu;
+    MenuItemIndex   openItem;
+    
+    if (GetIndMenuItemWithCommandID(NULL, kHICommandOpen, 1, &fileMenu, &openItem) == noErr)
+	AppendMenuItemTextWithCFString(fileMenu, CFSTR("Save Trace"), 0, kCmdDumpTrace, NULL);
+}
+#endif
+
 //-----------------------------------------------
 static Boolean SystemVersionRequired(int version)
 {
@@ -141,6 +161,9 @@ int main()
 
     err = SetMenuBarFromNib( gOurNibRef, CFSTR("MenuBar") );
     require_noerr( err, SetMenuBarFromNib_FAILED );
+#if CSK_TRACING
+    AddTraceMenuItem();
+#endif
 
     AEInstallEventHandler(kCoreEventClass, kAEOpenApplication, DoOpenApp, 0, false);
     AEInstallEventHandler(kCoreEventClass, kAEOpenDocuments, DoOpenDocuments, 0, false);
@@ -151,6 +174,11 @@ int main()
                                     sApplicationEvents, 0, NULL );
 
     RunApplicationEventLoop();
+    CSkPasteboardResolvePromises();
+#if CSK_TRACING
+    if (getenv("CSK_TRACE_FILE") != NULL)	// also dump on quit when a trace file was asked for
+	CSkTraceDump();
+#endif
 
 SetMenuBarFromNib_FAILED:
     DisposeNibReference(gOurNibRef);